@@ -1,21 +1,27 @@
 #include <filesystem>
 #include <iostream>
 #include <fstream>
+#include <map>
 #include <sstream>
 
 #include <hippo/cafe.hpp>
 #include <zip.h>
 
-void read_zip(cafe::class_tree& tree, const std::string_view& path) {
-  int err = 0;
-  zip_t* archive = zip_open(path.data(), ZIP_RDONLY, &err);
+template<typename Callback>
+void read_zip(const std::string_view& path, zip_uint64_t offset, const Callback& callback) {
+  zip_error_t zip_error;
+  zip_error_init(&zip_error);
+  zip_source_t* source = zip_source_file_create(path.data(), offset, -1, &zip_error);
+  zip_t* archive = source ? zip_open_from_source(source, ZIP_RDONLY, &zip_error) : nullptr;
   if (!archive) {
-    zip_error_t zip_error;
-    zip_error_init_with_code(&zip_error, err);
+    if (source) {
+      zip_source_free(source);
+    }
     std::string message = zip_error_strerror(&zip_error);
     zip_error_fini(&zip_error);
-    throw std::runtime_error("Failed to open ZIP archive: " + message);
+    throw std::runtime_error("Failed to open ZIP archive " + std::string(path) + ": " + message);
   }
+  zip_error_fini(&zip_error);
 
   const auto num_entries = zip_get_num_entries(archive, 0);
   for (auto i = 0; i < num_entries; i++) {
@@ -32,15 +38,84 @@ void read_zip(cafe::class_tree& tree, const std::string_view& path) {
     zip_fread(file, content.data(), stat.size);
     zip_fclose(file);
 
-    if (std::string(name).find(".class") != std::string::npos) {
-      cafe::class_reader reader;
-      if (const auto res = reader.read(content)) {
-        tree.put(res.value());
+    callback(std::string(name), std::move(content));
+  }
+  zip_close(archive);
+}
+
+std::optional<cafe::class_header> read_header(const std::string& name, std::vector<int8_t>&& content) {
+  cafe::class_reader reader;
+  auto res = reader.read_class_header(cafe::data_reader(std::move(content)));
+  if (!res) {
+    std::cerr << name << ": " << res.error_message() << std::endl;
+    return std::nullopt;
+  }
+  return std::move(res.value());
+}
+
+void read_zip(cafe::class_tree& tree, const std::string_view& path) {
+  read_zip(path, 0, [&tree](const std::string& name, std::vector<int8_t>&& content) {
+    if (name.find(".class") != std::string::npos) {
+      if (const auto header = read_header(name, std::move(content))) {
+        tree.put(header->name, header->super_name, header->interfaces);
+      }
+    }
+  });
+}
+
+// A jmod file is a zip archive behind a 4 byte "JM" header, the classes live under classes/.
+void read_jmods(cafe::class_tree& tree, const std::filesystem::path& directory) {
+  for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+    if (entry.path().extension() != ".jmod") {
+      continue;
+    }
+    read_zip(entry.path().string(), 4, [&tree](const std::string& name, std::vector<int8_t>&& content) {
+      if (name.rfind("classes/", 0) == 0 && name.size() > 6 && name.substr(name.size() - 6) == ".class" &&
+          name.find("module-info.class") == std::string::npos) {
+        if (const auto header = read_header(name, std::move(content))) {
+          tree.put(header->name, header->super_name, header->interfaces);
+        }
+      }
+    });
+  }
+}
+
+// ct.sym stores class files as .sig entries below directories named after the feature releases they belong to, one
+// character per release: 7, 8, 9, A for 10, B for 11 and so on.
+std::map<uint32_t, cafe::class_tree> read_ct_sym(const std::string_view& path) {
+  std::map<uint32_t, cafe::class_tree> trees;
+  read_zip(path, 0, [&trees](const std::string& name, std::vector<int8_t>&& content) {
+    const auto slash = name.find('/');
+    if (slash == std::string::npos || name.size() < 4 || name.substr(name.size() - 4) != ".sig" ||
+        name.find("module-info.sig") != std::string::npos) {
+      return;
+    }
+    const auto header = read_header(name, std::move(content));
+    if (!header) {
+      return;
+    }
+    for (const auto c : name.substr(0, slash)) {
+      uint32_t release;
+      if (c >= '0' && c <= '9') {
+        release = c - '0';
+      } else if (c >= 'A' && c <= 'Z') {
+        release = c - 'A' + 10;
       } else {
-        std::cerr << res.error_message() << std::endl;
+        continue;
       }
+      trees[release].put(header->name, header->super_name, header->interfaces);
     }
+  });
+  return trees;
+}
+
+void write_snapshot(const cafe::class_tree& tree, const std::filesystem::path& directory, uint32_t release) {
+  std::filesystem::create_directories(directory);
+  const auto path = directory / cafe::class_tree_snapshot::release_file_name(release);
+  if (const auto res = cafe::class_tree_snapshot::write(tree, path.string()); !res) {
+    throw std::runtime_error(res.err().message());
   }
+  std::cout << path.string() << ": " << tree.size() << " classes" << std::endl;
 }
 
 void write_gen(cafe::class_tree& tree) {
@@ -127,16 +202,41 @@ void write_gen(cafe::class_tree& tree) {
 }
 
 int main(int argc, char** argv) {
-  if (argc != 2) {
-    std::cerr << "Usage: " << argv[0] << " <path>" << std::endl;
-    return 1;
+  const std::vector<std::string> args(argv + 1, argv + argc);
+  if (args.size() == 1) {
+    cafe::class_tree tree;
+    try {
+      read_zip(tree, args[0]);
+      write_gen(tree);
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+    }
+    return 0;
   }
-  std::string path = argv[1];
-  cafe::class_tree tree;
-  try {
-    read_zip(tree, path);
-    write_gen(tree);
-  } catch (const std::exception& e) {
-    std::cerr << e.what() << std::endl;
+  if (args.size() == 4 && args[0] == "--jmods") {
+    cafe::class_tree tree;
+    try {
+      read_jmods(tree, args[1]);
+      write_snapshot(tree, args[3], static_cast<uint32_t>(std::stoul(args[2])));
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+    return 0;
   }
-}
\ No newline at end of file
+  if (args.size() == 3 && args[0] == "--ct-sym") {
+    try {
+      for (const auto& [release, tree] : read_ct_sym(args[1])) {
+        write_snapshot(tree, args[2], release);
+      }
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  std::cerr << "Usage: " << argv[0] << " <rt.jar>" << std::endl;
+  std::cerr << "       " << argv[0] << " --jmods <jmods directory> <release> <output directory>" << std::endl;
+  std::cerr << "       " << argv[0] << " --ct-sym <ct.sym> <output directory>" << std::endl;
+  return 1;
+}
@@ -41,15 +41,34 @@ private:
   std::unordered_map<basic_block*, std::vector<std::string>> successors_;
   std::unordered_set<label_id> handlers_;
   bool needs_frame_ = false;
+  // Collects every local written by compute_frames() while set, used to check the handler frames of a block.
+  std::vector<std::pair<uint16_t, std::optional<frame_var>>>* stores_ = nullptr;
 
   int32_t max_locals_{};
   int32_t input_max_stack_ = -1;
   int32_t output_max_stack_{};
   int32_t max_stack_{};
-  std::vector<std::optional<frame_var>> input_locals_;
-  std::vector<std::optional<frame_var>> output_locals_;
-  std::deque<std::optional<frame_var>> input_stack_;
-  std::deque<std::optional<frame_var>> output_stack_;
+  // The input and output locals and stacks live in a slab owned by the graph, see basic_block_graph::assign_slots().
+  // Each takes a fixed number of slots and the stacks grow from the bottom, only the heights change while simulating.
+  std::optional<frame_var>* slots_ = nullptr;
+  uint16_t locals_width_{};
+  uint16_t stack_width_{};
+  uint16_t input_height_{};
+  uint16_t output_height_{};
+  // Set when the code needs more slots than the block has, the result is then useless and the slots must be widened.
+  bool overflow_ = false;
+  bool queued_ = false;
+
+  std::optional<frame_var>* input_locals();
+  std::optional<frame_var>* output_locals();
+  std::optional<frame_var>* input_stack();
+  std::optional<frame_var>* output_stack();
+  const std::optional<frame_var>* input_locals() const;
+  const std::optional<frame_var>* output_locals() const;
+  const std::optional<frame_var>* input_stack() const;
+  const std::optional<frame_var>* output_stack() const;
+  void set_input(const std::optional<frame_var>* locals, size_t locals_size, const std::optional<frame_var>* stack,
+                 size_t stack_size);
 };
 
 class CAFE_API frame_compute_result {
@@ -66,11 +85,17 @@ public:
   const std::vector<std::pair<label, frame>>& frames() const;
   uint16_t max_locals() const;
   uint16_t max_stack() const;
+
+  friend class basic_block_graph;
 private:
   std::vector<std::pair<code::const_iterator, label>> inject_labels_;
   std::vector<std::pair<label, frame>> frames_;
   uint16_t max_locals_;
   uint16_t max_stack_;
+  // The index in the code of each injected label and the size of the code. Unlike the iterators they can still be
+  // used after the code was edited, see basic_block_graph::recompute_frames().
+  std::vector<size_t> label_positions_;
+  size_t code_size_ = 0;
 };
 
 class CAFE_API basic_block_graph {
@@ -83,16 +108,52 @@ public:
   basic_block_graph& operator=(basic_block_graph&&) noexcept = default;
 
   frame_compute_result compute_frames(const class_tree& tree, const std::string_view& class_name, const std::vector<std::optional<frame_var>>& start_locals);
-
+  // Recomputes frames after an edit to [first, last) of the code, given the frames computed before the edit and a graph
+  // built from the edited code. For a removal, pass an empty range at the position of the removed instructions. Only
+  // the blocks from the edit onwards are simulated, the state of the other blocks is taken from the previous frames,
+  // including frames placed at injected labels. The labels of the result are the full set to inject, as with
+  // compute_frames(). Frames the edit does not reach are kept as they were, so an edit that only narrows a type can
+  // leave a frame wider than compute_frames() would, which is still valid.
+  frame_compute_result recompute_frames(const class_tree& tree, const std::string_view& class_name,
+                                        const std::vector<std::optional<frame_var>>& start_locals,
+                                        const frame_compute_result& previous, code::const_iterator first,
+                                        code::const_iterator last);
+
+  // Checks existing frames, as decoded by class_reader, against the code instead of computing new ones. Every block
+  // that is a jump or handler target must start at a frame, and the types flowing into a frame must be assignable to
+  // it. The frames are given back as they are, along with the maxes, or nullopt if they do not hold for this code.
+  // Like compute_frames(), this does not check the operands of individual instructions.
+  std::optional<frame_compute_result> verify_frames(const class_tree& tree, const std::string_view& class_name,
+                                                    const std::vector<std::optional<frame_var>>& start_locals,
+                                                    const std::vector<std::pair<label, frame>>& frames);
   void compute_maxes(method& method);
   std::pair<uint16_t, uint16_t> compute_maxes(uint16_t start_locals);
-
+  // Computes max locals and max stack, in that order, in a single scan over the code without building a graph. This
+  // only works for code without exception handlers, subroutines or backward jumps and with few pending forward jumps,
+  // otherwise nullopt is returned and the graph is needed. The result is the same compute_maxes() gives.
+  static std::optional<std::pair<uint16_t, uint16_t>> linear_maxes(const code& code, uint16_t start_locals);
+
+  // Picks the smallest StackMapTable entry that turns the locals of the previous frame into the given local and stack
+  // slots, laid out like the slots of a block, with a long or double taking two. The previous locals are expected
+  // without trailing tops, as returned by basic_block::locals().
+  static frame encode_frame(const std::vector<frame_var>& previous_locals, const std::optional<frame_var>* locals,
+                            size_t locals_size, const std::optional<frame_var>* stack, size_t stack_size);
   static uint16_t get_start_locals(const method& method);
   static std::vector<std::optional<frame_var>> get_start_locals(const std::string_view& class_name, const method& method);
 
   const std::list<basic_block>& blocks() const;
 private:
   std::list<basic_block> blocks_;
+  std::vector<std::optional<frame_var>> slots_;
+
+  // Gives every block the given number of unset local and stack slots for its input and output, and clears the
+  // rest of the per-block state.
+  void assign_slots(uint16_t locals, uint16_t stack);
+  bool overflowed() const;
+  void propagate(const class_tree& tree, const std::string_view& class_name, std::deque<basic_block*>& worklist);
+  frame_compute_result collect_frames(const std::vector<std::optional<frame_var>>& start_locals, uint16_t max_locals,
+                                      uint16_t max_stack,
+                                      const std::unordered_map<const instruction*, label>& known_labels);
 };
 
 }
\ No newline at end of file
@@ -245,6 +245,23 @@ public:
   inner_class& operator=(inner_class&& other) noexcept = default;
 };
 
+class CAFE_API class_header {
+public:
+  uint32_t version{};
+  uint16_t access_flags{};
+  std::string name;
+  std::optional<std::string> super_name;
+  std::vector<std::string> interfaces;
+  class_header() = default;
+  class_header(const std::string_view& name, const std::optional<std::string>& super_name,
+               const std::vector<std::string>& interfaces);
+  ~class_header() = default;
+  class_header(const class_header& other) = default;
+  class_header(class_header&& other) noexcept = default;
+  class_header& operator=(const class_header& other) = default;
+  class_header& operator=(class_header&& other) noexcept = default;
+};
+
 class CAFE_API class_file {
 public:
   uint32_t version{};
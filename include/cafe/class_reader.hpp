@@ -20,11 +20,16 @@ public:
 
   result<class_file> read(data_reader&& reader);
   result<void> read(data_reader&& reader, class_file& file);
+  // Reads only the version, access flags, name, super class and interfaces, stopping before the fields.
+  result<class_header> read_class_header(data_reader&& reader);
 
 private:
   data_reader reader_{{}};
   cp::constant_pool pool_;
   std::vector<size_t> bootstrap_methods_;
+  // Scratch space for tables that are decoded in bulk.
+  std::vector<uint16_t> u16_cache_;
+  std::vector<int32_t> i32_cache_;
   uint32_t class_version_{};
   size_t label_count_ = 0;
 
@@ -33,6 +38,7 @@ private:
   result<void> read_field(class_file& file);
   result<void> read_record(class_file& file);
   result<void> read_header();
+  result<void> read_class_info(class_header& header);
   result<annotation> read_annotation();
   result<type_annotation> read_type_annotation(std::vector<std::pair<size_t, label>>& labels);
   result<element_value> read_element_value();
@@ -1,20 +1,30 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <iterator>
 #include <memory>
 #include <optional>
+#include <shared_mutex>
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "apidef.hpp"
 #include "class_file.hpp"
+#include "result.hpp"
 
 namespace cafe {
 
 struct CAFE_API load_rt_t {};
 inline constexpr load_rt_t load_rt{};
 
+struct CAFE_API concurrent_t {};
+inline constexpr concurrent_t concurrent{};
+
 class CAFE_API class_tree {
 public:
   class node {
@@ -22,24 +32,167 @@ public:
     std::string name;
     node* super_class;
     std::vector<node*> interfaces;
+    // Direct subclasses and the classes and interfaces that directly implement or extend this interface. They are
+    // kept in sync by put() and, like iteration, must not be read while a concurrent tree is being filled.
+    std::vector<node*> subclasses;
+    std::vector<node*> implementors;
     explicit node(const std::string_view& name);
     node(const std::string_view& name, node* super_class, const std::vector<node*>& interfaces);
     ~node() = default;
-    node(const node&) = default;
-    node(node&&) noexcept = default;
-    node& operator=(const node&) = default;
-    node& operator=(node&&) noexcept = default;
+    node(const node& other);
+    node(node&& other) noexcept;
+    node& operator=(const node& other);
+    node& operator=(node&& other) noexcept;
+
+    // True once a put() for this class has published its super class and interfaces. Nodes that are only
+    // referenced by other classes stay unresolved placeholders.
+    bool resolved() const;
+
+    friend class class_tree;
+  private:
+    static constexpr uint8_t placeholder = 0;
+    static constexpr uint8_t publishing = 1;
+    static constexpr uint8_t published = 2;
+    std::atomic<uint8_t> state_{placeholder};
   };
   using map_type = std::unordered_map<std::string, std::unique_ptr<node>>;
-  
-  class_tree() = default;
+
+private:
+  // An open addressing table of published nodes that get() probes without taking a lock. It is only written under the
+  // shard lock, and a table that fills up is replaced by a larger copy while the old one stays alive for readers.
+  struct published_index {
+    explicit published_index(size_t capacity);
+    std::unique_ptr<std::atomic<node*>[]> slots;
+    size_t capacity;
+    size_t count = 0;
+  };
+  struct shard {
+    map_type map;
+    std::unordered_set<std::string> missing;
+    // Classes some thread is asking the resolver about. Other threads wait for its answer instead of asking again.
+    std::unordered_set<std::string> pending;
+    // Notified when a resolver answer arrives or a node of the shard is published.
+    std::condition_variable_any resolved;
+    std::atomic<published_index*> index{nullptr};
+    std::vector<std::unique_ptr<published_index>> indices;
+    mutable std::shared_mutex mutex;
+  };
+
+public:
+  template<typename Shard, typename MapIterator>
+  class basic_iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = map_type::value_type;
+    using difference_type = std::ptrdiff_t;
+    using reference = decltype(*std::declval<MapIterator>());
+    using pointer = decltype(std::declval<MapIterator>().operator->());
+
+    basic_iterator() = default;
+    basic_iterator(Shard* shard, Shard* last, MapIterator it) : shard_(shard), last_(last), it_(it) {
+      skip_empty();
+    }
+
+    reference operator*() const {
+      return *it_;
+    }
+    pointer operator->() const {
+      return it_.operator->();
+    }
+    basic_iterator& operator++() {
+      ++it_;
+      skip_empty();
+      return *this;
+    }
+    basic_iterator operator++(int) {
+      auto copy = *this;
+      ++*this;
+      return copy;
+    }
+    bool operator==(const basic_iterator& other) const {
+      return shard_ == other.shard_ && (shard_ == last_ || it_ == other.it_);
+    }
+    bool operator!=(const basic_iterator& other) const {
+      return !(*this == other);
+    }
+
+  private:
+    Shard* shard_{};
+    Shard* last_{};
+    MapIterator it_{};
+
+    void skip_empty() {
+      while (shard_ != last_ && it_ == shard_->map.end()) {
+        ++shard_;
+        if (shard_ != last_) {
+          it_ = shard_->map.begin();
+        }
+      }
+    }
+  };
+  using iterator = basic_iterator<shard, map_type::iterator>;
+  using const_iterator = basic_iterator<const shard, map_type::const_iterator>;
+  class CAFE_API subtype_iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = node*;
+    using difference_type = std::ptrdiff_t;
+    using reference = node* const&;
+    using pointer = node* const*;
+
+    subtype_iterator() = default;
+    subtype_iterator(const class_tree* tree, const node* root);
+
+    reference operator*() const;
+    pointer operator->() const;
+    subtype_iterator& operator++();
+    subtype_iterator operator++(int);
+    bool operator==(const subtype_iterator& other) const;
+    bool operator!=(const subtype_iterator& other) const;
+
+  private:
+    const class_tree* tree_{};
+    std::vector<node*> stack_;
+    std::unordered_set<const node*> visited_;
+
+    void push_children(const node* n);
+  };
+  class CAFE_API subtype_range {
+  public:
+    subtype_range(const class_tree* tree, const node* root);
+    subtype_iterator begin() const;
+    subtype_iterator end() const;
+
+  private:
+    const class_tree* tree_;
+    const node* root_;
+  };
+  // Returns the header of a class that was not put into the tree, or nullopt if the class is unknown.
+  using resolver = std::function<std::optional<class_header>(const std::string& name)>;
+
+  class_tree();
   class_tree(load_rt_t);
+  // A concurrent tree spreads its classes over independently locked shards so that put() and get() may be called
+  // from many threads at once. A published node never changes, so the first put() of a class wins and later puts of
+  // the same class are ignored. Looking up a published class takes no lock, and a put() or lookup that meets a class
+  // another thread is publishing or resolving waits until it is done.
+  class_tree(concurrent_t);
+  class_tree(load_rt_t, concurrent_t);
+  // An overlay tree only stores its own classes. Lookups of anything else fall through to the shared base, which must
+  // not be modified while overlays are in use. Classes put into the overlay shadow the base classes of the same name.
+  explicit class_tree(std::shared_ptr<const class_tree> base);
+  class_tree(std::shared_ptr<const class_tree> base, concurrent_t);
   ~class_tree() = default;
   class_tree(const class_tree&) = delete;
+  // A tree that was moved from has no shards left, it may only be destroyed or assigned to.
   class_tree(class_tree&&) noexcept = default;
   class_tree& operator=(const class_tree&) = delete;
   class_tree& operator=(class_tree&&) noexcept = default;
 
+  // In a tree that is not concurrent, the super class and interfaces of the returned node may be set directly and
+  // lookups follow them, but subclasses and implementors are only kept in sync by put(). A resolver still replaces the
+  // edges of a node that was never put, and an overlay only sees its own nodes once they were put. Nodes of a
+  // concurrent tree must only be changed through put().
   node* get_or_create(const std::string& name);
   void put(const std::string& name, const std::optional<std::string>& super_name, const std::vector<std::string>& interfaces);
   void put(const class_file& file);
@@ -51,17 +204,55 @@ public:
   }
   node* get(const std::string& name) const;
   bool is_assignable_from(const std::string& from, const std::string& to) const;
+  std::string common_super_class(const std::string& first, const std::string& second) const;
+  // Every class that is assignable to the given class, excluding the class itself, each visited once.
+  subtype_range subtypes(const std::string& name) const;
+  bool concurrent() const;
+  // Whether lookups may run on several threads at once. A tree that resolves classes on demand fills itself on lookups,
+  // so this only fails if the tree or one of its bases has a resolver without being concurrent.
+  bool concurrent_lookups() const;
+  const std::shared_ptr<const class_tree>& base() const;
+  // The resolver is called once per class on a lookup miss and for classes that are only referenced by others. The
+  // answer is cached in the tree, unknown classes are remembered as well. It must be set before the tree is queried and
+  // it must be thread safe if the tree is concurrent.
+  void set_resolver(resolver res);
+  // Creates a tree that resolves the JDK classes of one feature release from a snapshot written by hippocafe_gen. The
+  // snapshot is mapped and only the classes that are looked up and their super classes and interfaces are read from it.
+  // The tree is concurrent, so it can be shared by class writers on several threads.
+  static result<class_tree> load_release(const std::string& directory, uint32_t release);
+  // Resolves classes from <directory>/<name>.class, reading only the class header.
+  static resolver directory_resolver(const std::vector<std::string>& directories);
+  // Size and iteration only cover the classes of this tree, not those of its base.
   size_t size() const;
-  map_type::const_iterator begin() const;
-  map_type::const_iterator end() const;
-  map_type::iterator begin();
-  map_type::iterator end();
+  // Iteration is not synchronized, it must not overlap with concurrent calls to put().
+  const_iterator begin() const;
+  const_iterator end() const;
+  iterator begin();
+  iterator end();
   bool empty() const;
 
 private:
-  map_type tree_;
+  std::unique_ptr<shard[]> shards_;
+  size_t shard_count_ = 1;
+  bool concurrent_ = false;
+  resolver resolver_;
+  std::shared_ptr<const class_tree> base_;
 
+  size_t hash_of(const std::string& name) const;
+  shard& shard_of(const std::string& name) const;
+  node* find(const std::string& name) const;
+  node* find_published(const std::string& name) const;
+  void add_published(node* n) const;
+  node* insert(const std::string& name) const;
+  void children_of(const std::string& name, std::vector<node*>& children) const;
+  void wait_published(const node* n) const;
+  void publish(node* n, const std::optional<std::string>& super_name, const std::vector<std::string>& interfaces) const;
+  node* resolve(const std::string& name, node* existing) const;
+  void link(node* n) const;
+  void unlink(node* n) const;
+  node* super_of(const node* n) const;
+  const std::vector<node*>* interfaces_of(const node* n) const;
   bool is_primitive(const std::string_view& name) const;
 };
 
-}
\ No newline at end of file
+}
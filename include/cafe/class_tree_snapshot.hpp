@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "apidef.hpp"
+#include "class_tree.hpp"
+#include "result.hpp"
+
+namespace cafe {
+
+// A read-only class hierarchy stored in a single binary file. The file holds a string table, one fixed size record per
+// class with the index of its super class and a range of interface indices, and a hash table over the names, all in
+// big endian. Opening a snapshot maps the file and answers queries in place, so the same file can be shared by many
+// processes without rebuilding anything. Only the header is checked on opening. A record is checked when it is read,
+// fields that are out of range read as missing, and hierarchy walks visit each class once, so a damaged file gives
+// wrong answers but is never read out of bounds or walked forever.
+class CAFE_API class_tree_snapshot {
+public:
+  static constexpr uint32_t format_version = 1;
+  static constexpr uint32_t no_class = 0xffffffff;
+
+  class_tree_snapshot() = default;
+  ~class_tree_snapshot();
+  class_tree_snapshot(const class_tree_snapshot&) = delete;
+  class_tree_snapshot(class_tree_snapshot&& other) noexcept;
+  class_tree_snapshot& operator=(const class_tree_snapshot&) = delete;
+  class_tree_snapshot& operator=(class_tree_snapshot&& other) noexcept;
+
+  static std::vector<int8_t> serialize(const class_tree& tree);
+  static result<void> write(const class_tree& tree, const std::string& path);
+  static result<class_tree_snapshot> open(const std::string& path);
+  static result<class_tree_snapshot> from_bytes(std::vector<int8_t>&& data);
+  // The file name hippocafe_gen uses for the JDK hierarchy of a feature release.
+  static std::string release_file_name(uint32_t release);
+  // Feeds classes from the snapshot into a class_tree on demand, see class_tree::set_resolver().
+  static class_tree::resolver resolver(std::shared_ptr<const class_tree_snapshot> snapshot);
+
+  size_t size() const;
+  uint32_t find(const std::string_view& name) const;
+  std::string_view name(uint32_t index) const;
+  uint32_t super_class(uint32_t index) const;
+  uint32_t interface_count(uint32_t index) const;
+  uint32_t interface(uint32_t index, uint32_t i) const;
+  bool resolved(uint32_t index) const;
+  // Whether the super classes and interfaces reachable from the class lead back to one of them. Only reads the records
+  // of those classes.
+  bool has_cyclic_ancestors(uint32_t index) const;
+  bool is_assignable_from(const std::string_view& from, const std::string_view& to) const;
+  std::string common_super_class(const std::string_view& first, const std::string_view& second) const;
+
+private:
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  void* mapping_ = nullptr;
+  std::vector<int8_t> buffer_;
+  uint32_t class_count_ = 0;
+  uint32_t bucket_count_ = 0;
+  uint32_t strings_offset_ = 0;
+  uint32_t strings_size_ = 0;
+  uint32_t interface_total_ = 0;
+  uint32_t classes_offset_ = 0;
+  uint32_t interfaces_offset_ = 0;
+  uint32_t buckets_offset_ = 0;
+
+  result<void> load();
+  void release();
+  uint32_t read_u32(size_t offset) const;
+  uint32_t record(uint32_t index, uint32_t field) const;
+  bool is_class_assignable(uint32_t from, uint32_t to) const;
+};
+
+}
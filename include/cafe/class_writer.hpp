@@ -1,5 +1,8 @@
 #pragma once
 
+#include <ostream>
+#include <unordered_map>
+
 #include "class_reader.hpp"
 #include "data_writer.hpp"
 #include "class_tree.hpp"
@@ -8,12 +11,24 @@ namespace cafe {
 
 inline constexpr uint8_t compute_maxes = 1;
 inline constexpr uint8_t compute_frames = 2;
+// Computes maxes and frames of all methods of a class on several threads before the methods are encoded. Encoding stays
+// sequential, so the output is the same as without the flag. With a class tree that resolves classes on demand without
+// being concurrent the methods are analyzed on one thread.
+inline constexpr uint8_t parallel_methods = 4;
+// Writes the class twice. The second pass puts the most loaded string, class, int and float constants into the first
+// 255 pool slots so that they can use ldc instead of ldc_w, followed by all UTF8 entries in sorted order, which
+// compresses better.
+inline constexpr uint8_t optimize_pool = 8;
+// Keeps the frames a method was read with when a quick check against its code shows they still hold, and only computes
+// frames for the methods where they do not. Needs a class tree, like computing frames does.
+inline constexpr uint8_t reuse_frames = 16;
 
 class CAFE_API class_writer {
 public:
   class_writer() = default;
   explicit class_writer(uint8_t flags);
   explicit class_writer(const class_tree& tree);
+  class_writer(const class_tree& tree, uint8_t flags);
   ~class_writer() = default;
   class_writer(const class_writer&) = delete;
   class_writer(class_writer&&) = default;
@@ -21,17 +36,28 @@ public:
   class_writer& operator=(class_writer&&) = delete;
 
   std::vector<int8_t> write(const class_file& file);
+  // Replaces the contents of out with the class, reusing its capacity.
+  void write(const class_file& file, std::vector<int8_t>& out);
+  result<void> write(const class_file& file, std::ostream& out);
+  // Writes the class to a file descriptor with a single writev call where possible.
+  result<void> write(const class_file& file, int fd);
 
 private:
   uint8_t flags_{};
   const class_tree* tree_{};
+  std::vector<int8_t> head_;
   cp::constant_pool pool_;
+  cp::constant_pool pool_seed_;
+  std::unordered_map<uint16_t, uint32_t> ldc_counts_;
   std::vector<std::pair<uint16_t, std::vector<uint16_t>>> bsm_buffer_;
-  std::vector<int8_t> attributes_;
+  // Everything after the interfaces. Attribute lengths and counts are reserved and patched in place, so the body is
+  // written without temporary buffers.
+  std::vector<int8_t> body_;
   uint16_t attributes_count_ = 0;
-  std::vector<int8_t> fields_;
-  std::vector<int8_t> methods_;
 
+  void prepare(const class_file& file);
+  void write_class(const class_file& file);
+  void layout_pool();
   void write_source_file(const std::string_view& source_file);
   void write_enclosing_method(const std::string_view& owner, const std::optional<std::pair<std::string, std::string>>& method);
   void write_source_debug_extension(const std::string_view& debug_extension);
@@ -44,11 +70,30 @@ private:
   void write_nest_members(const std::vector<std::string>& members);
   void write_record(const std::vector<record_component>& components);
   void write_permitted_subclasses(const std::vector<std::string>& subclasses);
-  void write_annotations(const std::vector<annotation>& annotations, bool visible);
-  void write_type_annotations(const std::vector<type_annotation>& annotations, bool visible);
+  // These write the attributes of whichever lists are not empty and return how many they wrote.
+  uint16_t write_annotation_attributes(databuf& buf, const std::vector<annotation>& visible,
+                                       const std::vector<annotation>& invisible);
+  uint16_t write_type_annotation_attributes(databuf& buf, const std::vector<type_annotation>& visible,
+                                            const std::vector<type_annotation>& invisible,
+                                            const std::vector<std::pair<size_t, label>>& labels);
+  uint16_t write_attributes(databuf& buf, const std::vector<attribute>& attributes);
   void write_fields(const std::vector<field>& fields);
+  struct code_analysis {
+    uint16_t max_stack{};
+    uint16_t max_locals{};
+    std::vector<std::pair<label, frame>> frames;
+    std::vector<std::pair<code::const_iterator, label>> labels;
+  };
+
+  // One per method, only set while write_methods runs or between the two passes of optimize_pool.
+  std::vector<code_analysis> analyses_;
+
   void write_methods(const class_file& file, const std::vector<method>& methods, bool oak);
-  std::vector<int8_t> write_code(const class_file& file, const method& method, const code& code, bool oak);
+  code_analysis analyze_code(const class_file& file, const method& method, const code& code) const;
+  std::vector<code_analysis> analyze_methods(const class_file& file, const std::vector<method>& methods) const;
+  static bool has_code(const method& method);
+  static size_t estimate_body_size(const class_file& file);
+  void write_code(databuf& buf, const code& code, bool oak, const code_analysis& analysis);
 
   uint16_t get_class(const std::string_view& name);
   uint16_t get_field_ref(const std::string_view& owner, const std::string_view& name,
@@ -75,9 +120,9 @@ private:
   uint16_t get_package(const std::string_view& name);
   uint16_t get_value(const value& val);
   uint16_t get_bsm(const method_handle& handle, const std::vector<value>& args);
-  std::vector<int8_t> get_annotations(const std::vector<annotation>& annos);
-  void get_element_value(data_writer& buf, const element_value& value);
-  std::vector<int8_t> get_type_annotations(const std::vector<type_annotation>& annos,
-                                          const std::vector<std::pair<size_t, label>>& labels);
+  void get_annotations(databuf& buf, const std::vector<annotation>& annos);
+  void get_element_value(databuf& buf, const element_value& value);
+  void get_type_annotations(databuf& buf, const std::vector<type_annotation>& annos,
+                            const std::vector<std::pair<size_t, label>>& labels);
 };
 } // namespace cafe
@@ -31,6 +31,10 @@ public:
   result<float> read_f32();
   result<double> read_f64();
   result<std::string> read_utf();
+  // Read count big endian values into out, checking once up front that the input holds all of them. The byte swapping
+  // loops are left simple enough for the compiler to vectorize.
+  [[nodiscard]] bool read_u16s(std::vector<uint16_t>& out, size_t count);
+  [[nodiscard]] bool read_i32s(std::vector<int32_t>& out, size_t count);
 
   result<std::vector<int8_t>> bytes(size_t start, size_t end);
 
@@ -1,12 +1,15 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <string_view>
 #include <vector>
 
+#include "apidef.hpp"
+
 namespace cafe {
 
-class data_writer {
+class CAFE_API data_writer {
 public:
   data_writer() = default;
   ~data_writer() = default;
@@ -26,7 +29,15 @@ public:
   static void write_f32(std::vector<int8_t>& buffer, float value);
   static void write_f64(std::vector<int8_t>& buffer, double value);
   static void write_utf(std::vector<int8_t>& buffer, const std::string_view& value);
-
+  // Writes count values with a single resize of the buffer.
+  static void write_u16s(std::vector<int8_t>& buffer, const uint16_t* values, size_t count);
+  // Reserve a zeroed slot and return its offset so that a count or length can be patched in once it is known.
+  static size_t reserve_u16(std::vector<int8_t>& buffer);
+  static size_t reserve_u32(std::vector<int8_t>& buffer);
+  static void patch_u16(std::vector<int8_t>& buffer, size_t offset, uint16_t value);
+  static void patch_u32(std::vector<int8_t>& buffer, size_t offset, uint32_t value);
+  // Fills a slot reserved with reserve_u32() with the number of bytes written after it.
+  static void patch_length(std::vector<int8_t>& buffer, size_t offset);
 
   void write_i8(int8_t value);
   void write_u8(uint8_t value);
@@ -39,6 +50,16 @@ public:
   void write_f32(float value);
   void write_f64(double value);
   void write_utf(const std::string_view& value);
+  void write_u16s(const uint16_t* values, size_t count);
+  // Makes room for at least capacity bytes in total, so a writer that knows roughly how much it will write grows the
+  // buffer once.
+  void reserve(size_t capacity);
+  size_t reserve_u16();
+  size_t reserve_u32();
+  void patch_u16(size_t offset, uint16_t value);
+  void patch_u32(size_t offset, uint32_t value);
+  void patch_length(size_t offset);
+  size_t size() const;
 
   template<typename Iterator>
   void write_all(const Iterator& data) {
@@ -52,7 +73,7 @@ private:
   std::vector<int8_t> buffer_;
 };
 
-class databuf {
+class CAFE_API databuf {
 public:
   explicit databuf(std::vector<int8_t>& buffer);
   ~databuf() = default;
@@ -72,6 +93,14 @@ public:
   void write_f32(float value);
   void write_f64(double value);
   void write_utf(const std::string_view& value);
+  void write_u16s(const uint16_t* values, size_t count);
+  void reserve(size_t capacity);
+  size_t reserve_u16();
+  size_t reserve_u32();
+  void patch_u16(size_t offset, uint16_t value);
+  void patch_u32(size_t offset, uint32_t value);
+  void patch_length(size_t offset);
+  size_t size() const;
 
   template<typename Iterator>
   void write_all(const Iterator& data) {
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "analysis.hpp"
+
+namespace cafe {
+
+// A fixed size set of small integers packed into 64 bit words. The sets combined by one analysis all have the same
+// size.
+class CAFE_API bit_vector {
+public:
+  bit_vector() = default;
+  explicit bit_vector(size_t size);
+  ~bit_vector() = default;
+  bit_vector(const bit_vector&) = default;
+  bit_vector(bit_vector&&) noexcept = default;
+  bit_vector& operator=(const bit_vector&) = default;
+  bit_vector& operator=(bit_vector&&) noexcept = default;
+
+  size_t size() const;
+  bool test(size_t index) const;
+  void set(size_t index);
+  void reset(size_t index);
+  void set_all();
+  void reset_all();
+  bool any() const;
+  size_t count() const;
+  // Both return whether a bit changed.
+  bool union_with(const bit_vector& other);
+  bool intersect_with(const bit_vector& other);
+  void subtract(const bit_vector& other);
+  bool intersects(const bit_vector& other) const;
+
+  // Calls the function with the index of every set bit, in increasing order.
+  template<typename Function>
+  void for_each(Function&& function) const {
+    for (size_t i = 0; i < words_.size(); i++) {
+      auto index = i * 64;
+      for (auto word = words_[i]; word != 0; word >>= 1) {
+        if ((word & 1) != 0) {
+          function(index);
+        }
+        index++;
+      }
+    }
+  }
+
+  bool operator==(const bit_vector& other) const;
+  bool operator!=(const bit_vector& other) const;
+
+  std::string to_string() const;
+private:
+  size_t size_{};
+  std::vector<uint64_t> words_;
+};
+
+// Numbers the blocks of a graph densely: the blocks reachable from the first block come first, in reverse postorder,
+// followed by the unreachable ones in graph order. Exception handler edges are edges like any other.
+class CAFE_API block_order {
+public:
+  class CAFE_API edge {
+  public:
+    size_t block;
+    bool handler;
+  };
+
+  explicit block_order(const basic_block_graph& graph);
+  ~block_order() = default;
+  block_order(const block_order&) = default;
+  block_order(block_order&&) noexcept = default;
+  block_order& operator=(const block_order&) = default;
+  block_order& operator=(block_order&&) noexcept = default;
+
+  size_t size() const;
+  // The number of reachable blocks, their ids are the ones below it.
+  size_t reachable() const;
+  size_t id(const basic_block& block) const;
+  const basic_block& block(size_t id) const;
+  const std::vector<edge>& successors(size_t id) const;
+  const std::vector<edge>& predecessors(size_t id) const;
+private:
+  std::vector<const basic_block*> blocks_;
+  std::unordered_map<const basic_block*, size_t> ids_;
+  std::vector<std::vector<edge>> successors_;
+  std::vector<std::vector<edge>> predecessors_;
+  size_t reachable_{};
+};
+
+enum class flow_direction {
+  forward,
+  backward
+};
+
+// A may analysis keeps the facts that hold on any incoming path, a must analysis those that hold on all of them.
+enum class flow_meet {
+  any,
+  all
+};
+
+// What a block does to the facts passing through it in the direction of the analysis, out = gen | (in & ~kill).
+// Because an exception can leave a block at any instruction, the handlers of a block see its input plus thrown in a
+// forward may analysis, its input minus kill in a forward must analysis and the handler input is met into the block
+// input in a backward analysis.
+class CAFE_API block_effect {
+public:
+  bit_vector gen;
+  bit_vector kill;
+  bit_vector thrown;
+};
+
+class CAFE_API dataflow_result {
+public:
+  dataflow_result(std::vector<bit_vector>&& in, std::vector<bit_vector>&& out);
+  ~dataflow_result() = default;
+  dataflow_result(const dataflow_result&) = default;
+  dataflow_result(dataflow_result&&) noexcept = default;
+  dataflow_result& operator=(const dataflow_result&) = default;
+  dataflow_result& operator=(dataflow_result&&) noexcept = default;
+
+  // The facts at the start and at the end of a block in code order, whichever way the analysis runs. Unreachable
+  // blocks are not analyzed and have no facts.
+  const bit_vector& in(size_t block) const;
+  const bit_vector& out(size_t block) const;
+private:
+  std::vector<bit_vector> in_;
+  std::vector<bit_vector> out_;
+};
+
+// Solves a bit vector analysis over the reachable blocks, sweeping them in reverse postorder for forward analyses and
+// in postorder for backward ones until nothing changes. An analysis provides:
+//   static constexpr flow_direction direction and flow_meet meet
+//   size_t size() const, the number of facts
+//   void boundary(bit_vector& facts) const, the facts entering the method, or leaving it for a backward analysis
+//   void effect(const basic_block& block, block_effect& effect) const, the sets are sized and empty when called
+template<typename Analysis>
+dataflow_result solve_dataflow(const block_order& order, const Analysis& analysis) {
+  constexpr auto forward = Analysis::direction == flow_direction::forward;
+  constexpr auto may = Analysis::meet == flow_meet::any;
+  const auto size = analysis.size();
+  const auto count = order.reachable();
+  std::vector<bit_vector> in(order.size(), bit_vector(size));
+  std::vector<bit_vector> out(order.size(), bit_vector(size));
+  std::vector<block_effect> effects(count);
+  for (size_t id = 0; id < count; id++) {
+    auto& effect = effects[id];
+    effect.gen = bit_vector(size);
+    effect.kill = bit_vector(size);
+    effect.thrown = bit_vector(size);
+    analysis.effect(order.block(id), effect);
+    if constexpr (!may) {
+      in[id].set_all();
+      out[id].set_all();
+    }
+  }
+  bit_vector boundary(size);
+  analysis.boundary(boundary);
+
+  // Meets the facts of one edge into the facts of a block, the first edge replaces them.
+  const auto meet = [](bit_vector& facts, const bit_vector& edge, bool& first) {
+    if (first) {
+      facts = edge;
+      first = false;
+    } else if constexpr (may) {
+      facts.union_with(edge);
+    } else {
+      facts.intersect_with(edge);
+    }
+  };
+  std::vector<bool> pending(count, true);
+  std::vector<bool> visited(count);
+  bit_vector facts(size);
+  bit_vector thrown(size);
+  auto changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 0; i < count; i++) {
+      const auto id = forward ? i : count - 1 - i;
+      if (!pending[id]) {
+        continue;
+      }
+      pending[id] = false;
+      const auto& effect = effects[id];
+      auto first = true;
+      if constexpr (forward) {
+        if (id == 0) {
+          meet(facts, boundary, first);
+        }
+        for (const auto& pred : order.predecessors(id)) {
+          if (pred.block >= count) {
+            continue;
+          }
+          if (!pred.handler) {
+            meet(facts, out[pred.block], first);
+            continue;
+          }
+          thrown = in[pred.block];
+          if constexpr (may) {
+            thrown.union_with(effects[pred.block].thrown);
+          } else {
+            thrown.subtract(effects[pred.block].kill);
+          }
+          meet(facts, thrown, first);
+        }
+        if (first) {
+          facts.reset_all();
+        }
+        if (visited[id] && facts == in[id]) {
+          continue;
+        }
+        in[id] = facts;
+        facts.subtract(effect.kill);
+        facts.union_with(effect.gen);
+        out[id] = facts;
+      } else {
+        for (const auto& succ : order.successors(id)) {
+          if (!succ.handler) {
+            meet(facts, in[succ.block], first);
+          }
+        }
+        if (first) {
+          facts = boundary;
+        }
+        const auto out_changed = facts != out[id];
+        if (out_changed) {
+          out[id] = facts;
+        }
+        facts.subtract(effect.kill);
+        facts.union_with(effect.gen);
+        for (const auto& succ : order.successors(id)) {
+          if (succ.handler) {
+            if constexpr (may) {
+              facts.union_with(in[succ.block]);
+            } else {
+              facts.intersect_with(in[succ.block]);
+            }
+          }
+        }
+        if (visited[id] && !out_changed && facts == in[id]) {
+          continue;
+        }
+        in[id] = facts;
+      }
+      visited[id] = true;
+      changed = true;
+      for (const auto& next : forward ? order.successors(id) : order.predecessors(id)) {
+        if (next.block < count) {
+          pending[next.block] = true;
+        }
+      }
+    }
+  }
+  for (size_t id = count; id < order.size(); id++) {
+    in[id] = bit_vector();
+    out[id] = bit_vector();
+  }
+  return {std::move(in), std::move(out)};
+}
+
+// The local variable slots that may be read before they are written again, a long or double uses both of its slots.
+// Short forms such as iload_0 count like their long forms, accesses beyond max_locals are ignored.
+class CAFE_API liveness {
+public:
+  static constexpr flow_direction direction = flow_direction::backward;
+  static constexpr flow_meet meet = flow_meet::any;
+
+  explicit liveness(uint16_t max_locals);
+  ~liveness() = default;
+  liveness(const liveness&) = default;
+  liveness(liveness&&) noexcept = default;
+  liveness& operator=(const liveness&) = default;
+  liveness& operator=(liveness&&) noexcept = default;
+
+  size_t size() const;
+  void boundary(bit_vector& facts) const;
+  void effect(const basic_block& block, block_effect& effect) const;
+private:
+  uint16_t max_locals_;
+};
+
+// The writes to local variables that may reach a point without being overwritten. The parameters of the method are
+// definitions made on entry and come first, one per slot, followed by the stores and iinc instructions in code order.
+// Short forms such as istore_1 are stores like their long forms.
+class CAFE_API reaching_definitions {
+public:
+  static constexpr flow_direction direction = flow_direction::forward;
+  static constexpr flow_meet meet = flow_meet::any;
+
+  class CAFE_API definition {
+  public:
+    // The end of the code for a parameter.
+    code::const_iterator insn;
+    uint16_t index;
+    uint16_t size;
+  };
+
+  reaching_definitions(const code& code, uint16_t start_locals);
+  ~reaching_definitions() = default;
+  reaching_definitions(const reaching_definitions&) = default;
+  reaching_definitions(reaching_definitions&&) noexcept = default;
+  reaching_definitions& operator=(const reaching_definitions&) = default;
+  reaching_definitions& operator=(reaching_definitions&&) noexcept = default;
+
+  size_t size() const;
+  void boundary(bit_vector& facts) const;
+  void effect(const basic_block& block, block_effect& effect) const;
+
+  const std::vector<definition>& definitions() const;
+  // The definition made by a store or iinc instruction of the code.
+  std::optional<size_t> definition_of(const instruction& insn) const;
+  // Every definition that writes the given slot.
+  const bit_vector& definitions_of(uint16_t index) const;
+private:
+  std::vector<definition> definitions_;
+  std::unordered_map<const instruction*, size_t> by_insn_;
+  std::vector<bit_vector> by_slot_;
+  bit_vector none_;
+  uint16_t start_locals_;
+};
+
+}
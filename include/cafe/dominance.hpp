@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "dataflow.hpp"
+
+namespace cafe {
+
+// The dominator tree of the reachable blocks of a block_order, computed with the iterative algorithm of Cooper, Harvey
+// and Kennedy over the reverse postorder ids. Handler edges are edges like any other. Unreachable blocks are not in
+// the tree, they dominate nothing and are dominated by nothing.
+class CAFE_API dominator_tree {
+public:
+  static constexpr size_t none = SIZE_MAX;
+
+  explicit dominator_tree(const block_order& order);
+  ~dominator_tree() = default;
+  dominator_tree(const dominator_tree&) = default;
+  dominator_tree(dominator_tree&&) noexcept = default;
+  dominator_tree& operator=(const dominator_tree&) = default;
+  dominator_tree& operator=(dominator_tree&&) noexcept = default;
+
+  // The immediate dominator of a block, none for the first block.
+  size_t idom(size_t block) const;
+  const std::vector<size_t>& children(size_t block) const;
+  // Whether every path from the first block to second goes through first. A block dominates itself.
+  bool dominates(size_t first, size_t second) const;
+  // The blocks where the dominance of a block ends: those it does not strictly dominate but that have a predecessor
+  // it dominates. These are where an SSA value defined in the block needs a phi.
+  const std::vector<size_t>& frontier(size_t block) const;
+private:
+  std::vector<size_t> idoms_;
+  std::vector<std::vector<size_t>> children_;
+  std::vector<std::vector<size_t>> frontiers_;
+  // Entry and exit times of a walk over the tree, a block dominates the blocks whose interval is inside its own.
+  std::vector<size_t> enter_;
+  std::vector<size_t> exit_;
+};
+
+// The natural loops of the reachable blocks. A loop is found from every edge to a block that dominates its source, the
+// loops of edges to the same header are merged. Cycles that are entered at more than one block are not natural loops
+// and are not reported.
+class CAFE_API loop_forest {
+public:
+  static constexpr size_t none = SIZE_MAX;
+
+  class CAFE_API loop {
+  public:
+    size_t header;
+    // The innermost loop this one is nested in, none for an outermost loop.
+    size_t parent;
+    // 1 for an outermost loop.
+    size_t depth;
+    // The blocks of the loop including those of nested loops, in increasing order.
+    std::vector<size_t> blocks;
+    // The sources of the edges back to the header.
+    std::vector<size_t> latches;
+  };
+
+  loop_forest(const block_order& order, const dominator_tree& dominators);
+  ~loop_forest() = default;
+  loop_forest(const loop_forest&) = default;
+  loop_forest(loop_forest&&) noexcept = default;
+  loop_forest& operator=(const loop_forest&) = default;
+  loop_forest& operator=(loop_forest&&) noexcept = default;
+
+  // The loops in order of their headers, so an outer loop comes before the loops nested in it.
+  const std::vector<loop>& loops() const;
+  // The innermost loop a block is in, or none.
+  size_t loop_of(size_t block) const;
+  // The number of loops a block is in.
+  size_t depth(size_t block) const;
+private:
+  std::vector<loop> loops_;
+  std::vector<size_t> block_loops_;
+};
+
+}
@@ -258,6 +258,8 @@ CAFE_API int16_t opcode(const instruction& insn);
 CAFE_API int16_t opcode(instruction&& insn);
 CAFE_API std::string to_string(const instruction& insn);
 CAFE_API std::string to_string(instruction&& insn);
+// The long form of a load or store with its index built into the opcode, such as iload_0, or nullopt for other opcodes.
+CAFE_API std::optional<var_insn> expand_var_insn(uint8_t opcode);
 
 class CAFE_API tcb {
 public:
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "class_file.hpp"
+#include "result.hpp"
+
+namespace cafe {
+
+// The computational types of the JVM. A long or double is a single value like any other.
+enum class ssa_type : uint8_t {
+  int_,
+  long_,
+  float_,
+  double_,
+  reference
+};
+
+// Values are numbered densely across a whole ssa_code and are defined exactly once, by a parameter, a phi, the
+// exception of a handler block or an instruction.
+using ssa_value = uint32_t;
+
+class CAFE_API ssa_insn {
+public:
+  static constexpr ssa_value none = UINT32_MAX;
+
+  // An instruction of the code with its stack operands made explicit. Loads, stores, stack manipulation, iinc and
+  // gotos have no counterpart: values are referred to directly, an iinc becomes an iadd of a constant and control
+  // flow is given by the successors of the block. The labels of branches and switches are those of the lifted code,
+  // only the order of the successors matters.
+  instruction operation;
+  // The values the instruction pops, in the order they were pushed.
+  std::vector<ssa_value> operands;
+  ssa_value result = none;
+  // The source line of the instruction, 0 if unknown.
+  uint16_t line{};
+  ssa_insn(instruction operation, std::vector<ssa_value> operands, ssa_value result, uint16_t line);
+  ~ssa_insn() = default;
+  ssa_insn(const ssa_insn&) = default;
+  ssa_insn(ssa_insn&&) noexcept = default;
+  ssa_insn& operator=(const ssa_insn&) = default;
+  ssa_insn& operator=(ssa_insn&&) noexcept = default;
+
+  std::string to_string() const;
+};
+
+class CAFE_API ssa_phi {
+public:
+  ssa_value result;
+  // One operand for every predecessor of the block, in the same order.
+  std::vector<ssa_value> operands;
+};
+
+class CAFE_API ssa_edge {
+public:
+  size_t block;
+  // Set for the edge from a protected block to its handler. Such an edge carries the values at the start of the
+  // protected block: blocks in a protected range end after every store, so a local never changes before the last
+  // instruction of one.
+  bool handler;
+};
+
+class CAFE_API ssa_handler {
+public:
+  size_t block;
+  std::optional<std::string> type;
+};
+
+class CAFE_API ssa_block {
+public:
+  std::vector<ssa_phi> phis;
+  // The caught exception for a handler block, which is entered with it as the only stack entry.
+  ssa_value exception = ssa_insn::none;
+  std::vector<ssa_insn> insns;
+  // Where control goes after the last instruction. A conditional branch has its target followed by the fall through
+  // block, a switch its default followed by its targets in order, a return or athrow has none.
+  std::vector<size_t> successors;
+  // The handlers covering the block, in the order they are tried.
+  std::vector<ssa_handler> handlers;
+  std::vector<ssa_edge> predecessors;
+};
+
+// A method body as a graph of blocks of instructions over SSA values, with phis for the locals and stack entries that
+// meet at a block. Block 0 is empty, it only defines the parameters and falls through to the first block of the code.
+class CAFE_API ssa_code {
+public:
+  std::vector<ssa_block> blocks;
+  std::vector<ssa_type> types;
+  // The receiver, unless the method is static, followed by the parameters.
+  std::vector<ssa_value> parameters;
+  ssa_code() = default;
+  ~ssa_code() = default;
+  ssa_code(const ssa_code&) = default;
+  ssa_code(ssa_code&&) noexcept = default;
+  ssa_code& operator=(const ssa_code&) = default;
+  ssa_code& operator=(ssa_code&&) noexcept = default;
+
+  ssa_value add_value(ssa_type type);
+  std::string to_string() const;
+};
+
+// Lifts the body of a method into SSA form. Only the reachable code is lifted, phis are only placed where a value
+// that is used later meets another, and the exception handler edges are explicit. Local variable tables, type
+// annotations and frames are not carried over. Fails for subroutines, for a handler that is also jumped to and for code
+// that reads a local or stack entry that is not set on every path to it.
+CAFE_API result<ssa_code> lift_ssa(const method& method);
+
+// Replaces the body of a method with code for an SSA form of it. Values consumed right where they are produced stay on
+// the stack, all others are stored to locals, which are then shared by compact_locals(). Phi copies are made on the
+// edges into a block, through a new block where the edge leaves a branch or switch, and once at the start of a
+// handler from the locals every protected block sets on entry. The maxes are computed and the frames are left empty.
+CAFE_API void emit_ssa(const ssa_code& ssa, method& method);
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "class_file.hpp"
+
+namespace cafe {
+
+// Renumbers the local variables of a method so that locals which are never live at the same time share a slot, which
+// lowers max_locals and shrinks the frames computed for the method. The parameters keep their slots, the two slots of
+// a long or double stay together and a local is never moved onto a slot whose LocalVariableTable or type annotation
+// range overlaps its own, so the debug information stays accurate. Short forms such as istore_1 become the long form
+// of their new slot. Code that cannot be reached keeps its slots and no other local is moved onto them. The existing
+// frames are dropped since they describe the old slots. Methods with subroutines or that read a local before writing it
+// are left as they are and false is returned.
+CAFE_API bool compact_locals(method& method);
+
+// The rewrites of peephole(), which can be combined.
+// Drops nop, a constant, load or dup that is popped right away and swap pairs.
+inline constexpr uint8_t peephole_stack = 1;
+// Drops stores to locals that are never read again and a store followed by the only read of the value, which then
+// stays on the stack. Turns a load, add of a constant and store back to the same int local into iinc.
+inline constexpr uint8_t peephole_locals = 2;
+// Drops jumps to the next instruction and the unreachable instructions after a goto, return, athrow or switch.
+inline constexpr uint8_t peephole_jumps = 4;
+// Folds conditional branches on constants into a goto or nothing.
+inline constexpr uint8_t peephole_branches = 8;
+// Drops casts to java/lang/Object, casts of null and a cast repeated right after itself.
+inline constexpr uint8_t peephole_casts = 16;
+inline constexpr uint8_t peephole_all = 31;
+
+// Rewrites short instruction sequences of a method into shorter equivalent ones until none of the given rules applies.
+// A pattern never spans a jump target, handler or try-catch boundary, so labels, try-catch blocks, line numbers and
+// local variable ranges stay valid. Stores to slots with LocalVariableTable or type annotation entries are kept, and an
+// instruction with a type annotation is never removed. Try-catch blocks left without instructions are removed along
+// with their annotations. The maxes stay an upper bound and the existing frames are dropped when the code changes.
+// The locals rules are skipped for methods with subroutines. Returns whether the code changed.
+CAFE_API bool peephole(method& method, uint8_t rules = peephole_all);
+
+// Removes the instructions that cannot run: those outside the blocks reachable from the start of the method, where a
+// handler is reachable when a reachable block is protected by it. Labels stay, so a range that ends or starts in the
+// removed code now ends or starts where it was cut. Try-catch blocks and LocalVariableTable or type annotation ranges
+// left without instructions are removed, and so are the line numbers, frames and instruction annotations that were
+// placed at removed instructions. Methods with subroutines are left as they are. Returns whether the code changed.
+CAFE_API bool remove_unreachable(method& method);
+
+// Cuts down the jumps a method takes and the goto_w the class writer has to widen them to. Jumps to a goto are pointed
+// at where the goto leads, a conditional branch over a goto becomes the opposite branch to its target, and a block that
+// is only entered by a goto is moved right after it so that the goto can go. A goto_w that fits in 16 bits turns back
+// into goto. Offsets are estimated from the largest encoding of each instruction, a goto counting as goto_w unless it
+// fits even then: a jump is never redirected out of the reach of a conditional branch or a goto that fits now, and a
+// new layout is dropped if it needs more goto_w or splits a try-catch block. LocalVariableTable and type annotation
+// ranges are rebuilt to cover the same instructions, line numbers are kept per instruction and the existing frames are
+// dropped. Gotos that nothing jumps to any more are left for remove_unreachable(). Methods with subroutines are left as
+// they are. Returns whether the code changed.
+CAFE_API bool optimize_branches(method& method);
+
+}
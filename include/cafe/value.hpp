@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <variant>
@@ -55,6 +56,27 @@ private:
   type_kind kind_;
 };
 
+// A method or field descriptor split into its parameter types and its return type, which for a field descriptor is the
+// field type. Parsed descriptors are cached per thread, so that the analysis does not parse the same descriptor for
+// every instruction that refers to it.
+class CAFE_API descriptor {
+public:
+  std::vector<type> parameter_types;
+  type return_type;
+  // The number of local slots or stack entries the parameters take, longs and doubles count twice.
+  uint16_t parameter_size{};
+  explicit descriptor(const std::string_view& desc);
+  ~descriptor() = default;
+  descriptor(const descriptor&) = default;
+  descriptor(descriptor&&) = default;
+  descriptor& operator=(const descriptor&) = default;
+  descriptor& operator=(descriptor&&) = default;
+
+  // Returns the parsed descriptor from the cache of the calling thread. The cache drops its entries when it fills up,
+  // a descriptor that is still held stays alive until it is released.
+  static std::shared_ptr<const descriptor> get(const std::string_view& desc);
+};
+
 
 class CAFE_API method_handle {
 public:
@@ -5,10 +5,15 @@
 #include "cafe/class_file.hpp"
 #include "cafe/class_reader.hpp"
 #include "cafe/class_tree.hpp"
+#include "cafe/class_tree_snapshot.hpp"
 #include "cafe/class_writer.hpp"
 #include "cafe/constants.hpp"
+#include "cafe/dataflow.hpp"
+#include "cafe/dominance.hpp"
 #include "cafe/instruction.hpp"
 #include "cafe/label.hpp"
+#include "cafe/ssa.hpp"
+#include "cafe/transform.hpp"
 #include "cafe/value.hpp"
 
 namespace cafe {
@@ -10,310 +10,439 @@
 #include "cafe/constants.hpp"
 
 namespace cafe {
-basic_block::basic_block(const code& code) : code_(code) {
+namespace {
+// Calls f with each StackMapTable local of the local slots: unset slots become top and the slot after a long or double
+// is folded into it. Returns how many locals there are without the trailing tops.
+template <typename F>
+size_t for_each_frame_local(const std::optional<frame_var>* slots, size_t size, F&& f) {
+  static const frame_var top = top_var();
+  size_t count = 0;
+  size_t used = 0;
+  for (size_t i = 0; i < size; i++) {
+    const auto& local = slots[i];
+    if (!local || std::holds_alternative<top_var>(*local)) {
+      f(top);
+      count++;
+      continue;
+    }
+    if (std::holds_alternative<double_var>(*local) || std::holds_alternative<long_var>(*local)) {
+      i++;
+    }
+    f(*local);
+    used = ++count;
+  }
+  return used;
 }
-void basic_block::compute_maxes() {
-  output_max_stack_ = input_max_stack_;
+// Calls f with each StackMapTable stack entry of the stack slots and returns how many there are.
+template <typename F>
+size_t for_each_frame_stack(const std::optional<frame_var>* slots, size_t size, F&& f) {
+  size_t count = 0;
+  for (size_t i = 0; i < size; i++) {
+    const auto& var = slots[i];
+    if (!var) {
+      continue;
+    }
+    if (std::holds_alternative<double_var>(*var) || std::holds_alternative<long_var>(*var)) {
+      i++;
+    }
+    f(*var);
+    count++;
+  }
+  return count;
+}
+// Converts local slots to StackMapTable locals without the trailing tops, reusing the capacity of locals.
+void frame_locals(const std::optional<frame_var>* slots, size_t size, std::vector<frame_var>& locals) {
+  locals.clear();
+  const auto used = for_each_frame_local(slots, size, [&locals](const frame_var& var) { locals.emplace_back(var); });
+  locals.resize(used, top_var());
+}
+std::vector<frame_var> frame_locals(const std::optional<frame_var>* slots, size_t size) {
+  std::vector<frame_var> locals;
+  locals.reserve(size);
+  frame_locals(slots, size, locals);
+  return locals;
+}
+std::vector<frame_var> frame_stack(const std::optional<frame_var>* slots, size_t size) {
+  std::vector<frame_var> stack;
+  stack.reserve(size);
+  for_each_frame_stack(slots, size, [&stack](const frame_var& var) { stack.emplace_back(var); });
+  return stack;
+}
+// The state a StackMapTable frame describes, in the layout the blocks work with: a long or double takes a second slot
+// holding top, on the stack above it.
+struct frame_state {
+  std::vector<std::optional<frame_var>> locals;
+  std::vector<std::optional<frame_var>> stack;
+};
+bool is_wide(const frame_var& var) {
+  return std::holds_alternative<long_var>(var) || std::holds_alternative<double_var>(var);
+}
+// Decodes relative frames into the full state at each label, or nullopt if a frame does not fit the one before it.
+std::optional<std::unordered_map<label_id, frame_state>> expand_frames(
+    const std::vector<std::optional<frame_var>>& start_locals, const std::vector<std::pair<label, frame>>& frames) {
+  std::unordered_map<label_id, frame_state> states;
+  states.reserve(frames.size());
+  auto locals = frame_locals(start_locals.data(), start_locals.size());
+  for (const auto& [lbl, f] : frames) {
+    std::vector<frame_var> stack;
+    bool valid = true;
+    std::visit(
+        [&](const auto& arg) {
+          using T = std::decay_t<decltype(arg)>;
+          if constexpr (std::is_same_v<T, same_frame>) {
+            if (arg.stack) {
+              stack.emplace_back(*arg.stack);
+            }
+          } else if constexpr (std::is_same_v<T, full_frame>) {
+            locals = arg.locals;
+            stack = arg.stack;
+          } else if constexpr (std::is_same_v<T, chop_frame>) {
+            valid = arg.size <= locals.size();
+            if (valid) {
+              locals.resize(locals.size() - arg.size, top_var());
+            }
+          } else if constexpr (std::is_same_v<T, append_frame>) {
+            locals.insert(locals.end(), arg.locals.begin(), arg.locals.end());
+          }
+        },
+        f);
+    if (!valid) {
+      return std::nullopt;
+    }
+    frame_state state;
+    for (const auto& var : locals) {
+      state.locals.emplace_back(var);
+      if (is_wide(var)) {
+        state.locals.emplace_back(top_var());
+      }
+    }
+    for (const auto& var : stack) {
+      state.stack.emplace_back(var);
+      if (is_wide(var)) {
+        state.stack.emplace_back(top_var());
+      }
+    }
+    if (!states.emplace(lbl.id(), std::move(state)).second) {
+      return std::nullopt;
+    }
+  }
+  return states;
+}
+// The stack height and bounds while walking instructions without tracking types.
+struct max_state {
+  int32_t stack = 0;
+  int32_t max_stack = 0;
+  int32_t max_locals = 0;
+};
+// Applies the stack effect and local accesses of one instruction. Labels have no effect, handler entries are up to the
+// caller.
+void apply_maxes(const instruction& in, max_state& state) {
   const auto check_stack = [&]() {
-    if (output_max_stack_ > max_stack_) {
-      max_stack_ = output_max_stack_;
+    if (state.stack > state.max_stack) {
+      state.max_stack = state.stack;
     }
   };
   const auto check_local = [&](uint16_t index, uint16_t size) {
     index += size;
-    if (index >= max_locals_) {
-      max_locals_ = index;
+    if (index >= state.max_locals) {
+      state.max_locals = index;
     }
   };
   const auto push = [&](uint16_t size) {
-    output_max_stack_ += size;
+    state.stack += size;
     check_stack();
   };
   const auto pop = [&](uint16_t size) {
-    output_max_stack_ -= size;
+    state.stack -= size;
     check_stack();
   };
-  for (const auto& it : instructions_) {
-    const auto& in = *it;
-    std::visit(
-        [&](auto&& arg) {
-          using T = std::decay_t<decltype(arg)>;
-          if constexpr (std::is_same_v<T, insn>) {
-            switch (arg.opcode) {
-              case op::aaload:
-              case op::baload:
-              case op::caload:
-              case op::faload:
-              case op::iaload:
-              case op::saload:
-              case op::areturn:
-              case op::ireturn:
-              case op::freturn:
-              case op::d2f:
-              case op::d2i:
-              case op::fadd:
-              case op::fcmpg:
-              case op::fcmpl:
-              case op::fdiv:
-              case op::fmul:
-              case op::frem:
-              case op::fsub:
-              case op::iadd:
-              case op::iand:
-              case op::idiv:
-              case op::imul:
-              case op::ior:
-              case op::irem:
-              case op::ishl:
-              case op::ishr:
-              case op::isub:
-              case op::iushr:
-              case op::ixor:
-              case op::l2f:
-              case op::l2i:
-              case op::lshl:
-              case op::lshr:
-              case op::lushr:
-              case op::monitorenter:
-              case op::monitorexit:
-              case op::pop:
-              case op::athrow:
-                pop(1);
-                break;
-              case op::aastore:
-              case op::bastore:
-              case op::castore:
-              case op::fastore:
-              case op::iastore:
-              case op::sastore:
-              case op::dcmpg:
-              case op::dcmpl:
-              case op::lcmp:
-                pop(3);
-                break;
-              case op::aconst_null:
-              case op::dup:
-              case op::dup_x1:
-              case op::dup_x2:
-              case op::f2d:
-              case op::f2l:
-              case op::fconst_0:
-              case op::fconst_1:
-              case op::fconst_2:
-              case op::i2d:
-              case op::i2l:
-              case op::iconst_m1:
-              case op::iconst_0:
-              case op::iconst_1:
-              case op::iconst_2:
-              case op::iconst_3:
-              case op::iconst_4:
-              case op::iconst_5:
-                push(1);
-                break;
-              case op::aload_0:
-              case op::aload_1:
-              case op::aload_2:
-              case op::aload_3:
-                push(1);
-                check_local(arg.opcode - op::aload_0, 1);
-                break;
-              case op::lreturn:
-              case op::dreturn:
-              case op::dadd:
-              case op::ddiv:
-              case op::dmul:
-              case op::drem:
-              case op::dsub:
-              case op::ladd:
-              case op::land:
-              case op::ldiv:
-              case op::lmul:
-              case op::lor:
-              case op::lrem:
-              case op::lsub:
-              case op::lxor:
-              case op::pop2:
-                pop(2);
-                break;
-              case op::astore_0:
-              case op::astore_1:
-              case op::astore_2:
-              case op::astore_3:
-                pop(1);
-                check_local(arg.opcode - op::astore_0, 1);
-                break;
-              case op::dastore:
-              case op::lastore:
-                pop(4);
-                break;
-              case op::dconst_0:
-              case op::dconst_1:
-              case op::dup2:
-              case op::dup2_x1:
-              case op::dup2_x2:
-              case op::lconst_0:
-              case op::lconst_1:
-                push(2);
-                break;
-              case op::dload_0:
-              case op::dload_1:
-              case op::dload_2:
-              case op::dload_3:
-                push(2);
-                check_local(arg.opcode - op::dload_0, 2);
-                break;
-              case op::dstore_0:
-              case op::dstore_1:
-              case op::dstore_2:
-              case op::dstore_3:
-                pop(2);
-                check_local(arg.opcode - op::dstore_0, 2);
-                break;
-              case op::fload_0:
-              case op::fload_1:
-              case op::fload_2:
-              case op::fload_3:
-                push(1);
-                check_local(arg.opcode - op::fload_0, 1);
-                break;
-              case op::fstore_0:
-              case op::fstore_1:
-              case op::fstore_2:
-              case op::fstore_3:
-                pop(1);
-                check_local(arg.opcode - op::fstore_0, 1);
-                break;
-              case op::iload_0:
-              case op::iload_1:
-              case op::iload_2:
-              case op::iload_3:
-                push(1);
-                check_local(arg.opcode - op::iload_0, 1);
-                break;
-              case op::istore_0:
-              case op::istore_1:
-              case op::istore_2:
-              case op::istore_3:
-                pop(1);
-                check_local(arg.opcode - op::istore_0, 1);
-                break;
-              case op::lload_0:
-              case op::lload_1:
-              case op::lload_2:
-              case op::lload_3:
-                push(2);
-                check_local(arg.opcode - op::lload_0, 2);
-                break;
-              case op::lstore_0:
-              case op::lstore_1:
-              case op::lstore_2:
-              case op::lstore_3:
-                pop(2);
-                check_local(arg.opcode - op::lstore_0, 2);
-                break;
-              default:
-                break;
-            }
-          } else if constexpr (std::is_same_v<T, var_insn>) {
-            if (arg.is_load()) {
-              push(arg.is_wide() ? 2 : 1);
-            } else if (arg.opcode != op::ret) {
-              pop(arg.is_wide() ? 2 : 1);
-            }
-            check_local(arg.index, arg.is_wide() ? 2 : 1);
-          } else if constexpr (std::is_same_v<T, push_insn>) {
+  std::visit(
+      [&](auto&& arg) {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, insn>) {
+          switch (arg.opcode) {
+            case op::aaload:
+            case op::baload:
+            case op::caload:
+            case op::faload:
+            case op::iaload:
+            case op::saload:
+            case op::areturn:
+            case op::ireturn:
+            case op::freturn:
+            case op::d2f:
+            case op::d2i:
+            case op::fadd:
+            case op::fcmpg:
+            case op::fcmpl:
+            case op::fdiv:
+            case op::fmul:
+            case op::frem:
+            case op::fsub:
+            case op::iadd:
+            case op::iand:
+            case op::idiv:
+            case op::imul:
+            case op::ior:
+            case op::irem:
+            case op::ishl:
+            case op::ishr:
+            case op::isub:
+            case op::iushr:
+            case op::ixor:
+            case op::l2f:
+            case op::l2i:
+            case op::lshl:
+            case op::lshr:
+            case op::lushr:
+            case op::monitorenter:
+            case op::monitorexit:
+            case op::pop:
+            case op::athrow:
+              pop(1);
+              break;
+            case op::aastore:
+            case op::bastore:
+            case op::castore:
+            case op::fastore:
+            case op::iastore:
+            case op::sastore:
+            case op::dcmpg:
+            case op::dcmpl:
+            case op::lcmp:
+              pop(3);
+              break;
+            case op::aconst_null:
+            case op::dup:
+            case op::dup_x1:
+            case op::dup_x2:
+            case op::f2d:
+            case op::f2l:
+            case op::fconst_0:
+            case op::fconst_1:
+            case op::fconst_2:
+            case op::i2d:
+            case op::i2l:
+            case op::iconst_m1:
+            case op::iconst_0:
+            case op::iconst_1:
+            case op::iconst_2:
+            case op::iconst_3:
+            case op::iconst_4:
+            case op::iconst_5:
+              push(1);
+              break;
+            case op::aload_0:
+            case op::aload_1:
+            case op::aload_2:
+            case op::aload_3:
+              push(1);
+              check_local(arg.opcode - op::aload_0, 1);
+              break;
+            case op::lreturn:
+            case op::dreturn:
+            case op::dadd:
+            case op::ddiv:
+            case op::dmul:
+            case op::drem:
+            case op::dsub:
+            case op::ladd:
+            case op::land:
+            case op::ldiv:
+            case op::lmul:
+            case op::lor:
+            case op::lrem:
+            case op::lsub:
+            case op::lxor:
+            case op::pop2:
+              pop(2);
+              break;
+            case op::astore_0:
+            case op::astore_1:
+            case op::astore_2:
+            case op::astore_3:
+              pop(1);
+              check_local(arg.opcode - op::astore_0, 1);
+              break;
+            case op::dastore:
+            case op::lastore:
+              pop(4);
+              break;
+            case op::dconst_0:
+            case op::dconst_1:
+            case op::dup2:
+            case op::dup2_x1:
+            case op::dup2_x2:
+            case op::lconst_0:
+            case op::lconst_1:
+              push(2);
+              break;
+            case op::dload_0:
+            case op::dload_1:
+            case op::dload_2:
+            case op::dload_3:
+              push(2);
+              check_local(arg.opcode - op::dload_0, 2);
+              break;
+            case op::dstore_0:
+            case op::dstore_1:
+            case op::dstore_2:
+            case op::dstore_3:
+              pop(2);
+              check_local(arg.opcode - op::dstore_0, 2);
+              break;
+            case op::fload_0:
+            case op::fload_1:
+            case op::fload_2:
+            case op::fload_3:
+              push(1);
+              check_local(arg.opcode - op::fload_0, 1);
+              break;
+            case op::fstore_0:
+            case op::fstore_1:
+            case op::fstore_2:
+            case op::fstore_3:
+              pop(1);
+              check_local(arg.opcode - op::fstore_0, 1);
+              break;
+            case op::iload_0:
+            case op::iload_1:
+            case op::iload_2:
+            case op::iload_3:
+              push(1);
+              check_local(arg.opcode - op::iload_0, 1);
+              break;
+            case op::istore_0:
+            case op::istore_1:
+            case op::istore_2:
+            case op::istore_3:
+              pop(1);
+              check_local(arg.opcode - op::istore_0, 1);
+              break;
+            case op::lload_0:
+            case op::lload_1:
+            case op::lload_2:
+            case op::lload_3:
+              push(2);
+              check_local(arg.opcode - op::lload_0, 2);
+              break;
+            case op::lstore_0:
+            case op::lstore_1:
+            case op::lstore_2:
+            case op::lstore_3:
+              pop(2);
+              check_local(arg.opcode - op::lstore_0, 2);
+              break;
+            default:
+              break;
+          }
+        } else if constexpr (std::is_same_v<T, var_insn>) {
+          if (arg.is_load()) {
             push(arg.is_wide() ? 2 : 1);
-          } else if constexpr (std::is_same_v<T, field_insn>) {
-            const type type(arg.desc);
-            auto start = output_max_stack_;
-            switch (arg.opcode) {
-              case op::getstatic:
-                push(type.size());
-                break;
-              case op::putstatic:
-                pop(type.size());
-                break;
-              case op::getfield:
-                push(type.size() - 1);
-                break;
-              case op::putfield:
-                pop(type.size() + 1);
-                break;
-              default:
-                break;
-            }
-          } else if constexpr (std::is_same_v<T, branch_insn>) {
-            switch (arg.opcode) {
-              case op::if_acmpeq:
-              case op::if_acmpne:
-              case op::if_icmpeq:
-              case op::if_icmpne:
-              case op::if_icmplt:
-              case op::if_icmpge:
-              case op::if_icmpgt:
-              case op::if_icmple:
-                pop(2);
-                break;
-              case op::ifeq:
-              case op::ifne:
-              case op::iflt:
-              case op::ifge:
-              case op::ifgt:
-              case op::ifle:
-              case op::ifnonnull:
-              case op::ifnull:
-                pop(1);
-                break;
-              case op::jsr:
-              case op::jsr_w:
-                push(1);
-                break;
-              default:
-                break;
-            }
-          } else if constexpr (std::is_same_v<T, iinc_insn>) {
-            check_local(arg.index, 1);
-          } else if constexpr (std::is_same_v<T, invoke_dynamic_insn>) {
-            const type type(arg.desc);
-            auto size = static_cast<int32_t>(type.return_type().size());
-            for (const auto& p : type.parameter_types()) {
-              size -= p.size();
-            }
-            output_max_stack_ += size;
-            check_stack();
-          } else if constexpr (std::is_same_v<T, method_insn>) {
-            const type type(arg.desc);
-            auto start = output_max_stack_;
-            auto size = static_cast<int32_t>(type.return_type().size()) - (arg.opcode != op::invokestatic);
-            for (const auto& p : type.parameter_types()) {
-              size -= p.size();
-            }
-            output_max_stack_ += size;
-            check_stack();
-          } else if constexpr (std::is_same_v<T, lookup_switch_insn>) {
-            pop(1);
-          } else if constexpr (std::is_same_v<T, table_switch_insn>) {
-            pop(1);
-          } else if constexpr (std::is_same_v<T, multi_array_insn>) {
-            pop(arg.dims == 0 ? 0 : arg.dims - 1);
-          } else if constexpr (std::is_same_v<T, type_insn>) {
-            if (arg.opcode == op::new_) {
+          } else if (arg.opcode != op::ret) {
+            pop(arg.is_wide() ? 2 : 1);
+          }
+          check_local(arg.index, arg.is_wide() ? 2 : 1);
+        } else if constexpr (std::is_same_v<T, push_insn>) {
+          push(arg.is_wide() ? 2 : 1);
+        } else if constexpr (std::is_same_v<T, field_insn>) {
+          const auto size = descriptor::get(arg.desc)->return_type.size();
+          switch (arg.opcode) {
+            case op::getstatic:
+              push(size);
+              break;
+            case op::putstatic:
+              pop(size);
+              break;
+            case op::getfield:
+              push(size - 1);
+              break;
+            case op::putfield:
+              pop(size + 1);
+              break;
+            default:
+              break;
+          }
+        } else if constexpr (std::is_same_v<T, branch_insn>) {
+          switch (arg.opcode) {
+            case op::if_acmpeq:
+            case op::if_acmpne:
+            case op::if_icmpeq:
+            case op::if_icmpne:
+            case op::if_icmplt:
+            case op::if_icmpge:
+            case op::if_icmpgt:
+            case op::if_icmple:
+              pop(2);
+              break;
+            case op::ifeq:
+            case op::ifne:
+            case op::iflt:
+            case op::ifge:
+            case op::ifgt:
+            case op::ifle:
+            case op::ifnonnull:
+            case op::ifnull:
+              pop(1);
+              break;
+            case op::jsr:
+            case op::jsr_w:
               push(1);
-            }
-          } else if constexpr (std::is_same_v<T, label>) {
-            if (handlers_.find(arg.id()) != handlers_.end()) {
-              output_max_stack_ = 1;
-              check_stack();
-            }
+              break;
+            default:
+              break;
           }
-        },
-        in);
+        } else if constexpr (std::is_same_v<T, iinc_insn>) {
+          check_local(arg.index, 1);
+        } else if constexpr (std::is_same_v<T, invoke_dynamic_insn>) {
+          const auto desc = descriptor::get(arg.desc);
+          state.stack += static_cast<int32_t>(desc->return_type.size()) - desc->parameter_size;
+          check_stack();
+        } else if constexpr (std::is_same_v<T, method_insn>) {
+          const auto desc = descriptor::get(arg.desc);
+          state.stack += static_cast<int32_t>(desc->return_type.size()) - desc->parameter_size -
+                         (arg.opcode != op::invokestatic);
+          check_stack();
+        } else if constexpr (std::is_same_v<T, lookup_switch_insn>) {
+          pop(1);
+        } else if constexpr (std::is_same_v<T, table_switch_insn>) {
+          pop(1);
+        } else if constexpr (std::is_same_v<T, multi_array_insn>) {
+          pop(arg.dims == 0 ? 0 : arg.dims - 1);
+        } else if constexpr (std::is_same_v<T, type_insn>) {
+          if (arg.opcode == op::new_) {
+            push(1);
+          }
+        }
+      },
+      in);
+}
+}
+basic_block::basic_block(const code& code) : code_(code) {
+}
+void basic_block::compute_maxes() {
+  max_state state{input_max_stack_, max_stack_, max_locals_};
+  for (const auto& it : instructions_) {
+    if (const auto lbl = std::get_if<label>(&*it)) {
+      if (handlers_.find(lbl->id()) != handlers_.end()) {
+        state.stack = 1;
+        state.max_stack = std::max(state.max_stack, 1);
+      }
+      continue;
+    }
+    apply_maxes(*it, state);
   }
+  output_max_stack_ = state.stack;
+  max_stack_ = state.max_stack;
+  max_locals_ = state.max_locals;
 }
 void basic_block::compute_frames(const std::string_view& class_name) {
-  output_locals_ = input_locals_;
-  output_stack_ = input_stack_;
+  static const std::optional<frame_var> unset;
+  auto* const locals = output_locals();
+  auto* const stack = output_stack();
+  std::copy(input_locals(), input_locals() + locals_width_, locals);
+  std::copy(input_stack(), input_stack() + input_height_, stack);
+  output_height_ = input_height_;
   output_max_stack_ = input_max_stack_;
   const auto is_wide = [](const std::optional<frame_var>& var) -> bool {
     return var && (std::holds_alternative<double_var>(*var) || std::holds_alternative<long_var>(*var));
@@ -323,22 +452,28 @@ void basic_block::compute_frames(const std::string_view& class_name) {
     if (output_max_stack_ > max_stack_) {
       max_stack_ = output_max_stack_;
     }
-    output_stack_.emplace_front(var);
+    if (output_height_ == stack_width_) {
+      overflow_ = true;
+      return;
+    }
+    stack[output_height_++] = var;
   };
   const auto pop = [&]() -> std::optional<frame_var> {
     output_max_stack_--;
-    if (output_stack_.empty()) {
+    if (output_height_ == 0) {
       return std::nullopt;
     }
-    const auto var = output_stack_.front();
-    output_stack_.pop_front();
-    return var;
+    return std::move(stack[--output_height_]);
   };
   const auto store = [&](uint16_t index, const std::optional<frame_var>& var) {
-    if (index >= output_locals_.size()) {
-      output_locals_.resize(index + 1);
+    if (index >= locals_width_) {
+      overflow_ = true;
+    } else {
+      locals[index] = var;
+    }
+    if (stores_ != nullptr) {
+      stores_->emplace_back(index, var);
     }
-    output_locals_[index] = var;
     index++;
     if (index > max_locals_) {
       max_locals_ = index;
@@ -348,10 +483,11 @@ void basic_block::compute_frames(const std::string_view& class_name) {
     if (index + 1 > max_locals_) {
       max_locals_ = index + 1;
     }
-    if (index >= output_locals_.size()) {
-      output_locals_.resize(index + 1);
+    if (index >= locals_width_) {
+      overflow_ = true;
+      return unset;
     }
-    return output_locals_[index];
+    return locals[index];
   };
   const auto to_frame_var = [](const type& type) -> frame_var {
     switch (type.kind()) {
@@ -444,6 +580,7 @@ void basic_block::compute_frames(const std::string_view& class_name) {
                 push(float_var());
                 break;
               case op::iconst_m1:
+              case op::iconst_0:
               case op::iconst_1:
               case op::iconst_2:
               case op::iconst_3:
@@ -560,6 +697,7 @@ void basic_block::compute_frames(const std::string_view& class_name) {
                 const auto var2 = pop();
                 push(var1);
                 push(var2);
+                break;
               }
               case op::dconst_0:
               case op::dconst_1:
@@ -784,7 +922,8 @@ void basic_block::compute_frames(const std::string_view& class_name) {
                   } else if constexpr (std::is_same_v<V, method_type>) {
                     push(object_var("java/lang/invoke/MethodType"));
                   } else if constexpr (std::is_same_v<V, dynamic>) {
-                    const type type(varg.desc);
+                    const auto desc = descriptor::get(varg.desc);
+                    const auto& type = desc->return_type;
                     push(to_frame_var(type));
                     if (type.size() == 2) {
                       push(top_var());
@@ -806,8 +945,8 @@ void basic_block::compute_frames(const std::string_view& class_name) {
               push(uninitialized_var(label(id)));
             }
           } else if constexpr (std::is_same_v<T, field_insn>) {
-            const type type(arg.desc);
-            auto start = output_max_stack_;
+            const auto desc = descriptor::get(arg.desc);
+            const auto& type = desc->return_type;
             switch (arg.opcode) {
               case op::getfield:
                 pop();
@@ -869,54 +1008,58 @@ void basic_block::compute_frames(const std::string_view& class_name) {
               max_locals_ = arg.index + 1;
             }
           } else if constexpr (std::is_same_v<T, invoke_dynamic_insn>) {
-            const type type(arg.desc);
-            for (const auto& p : type.parameter_types()) {
+            const auto desc = descriptor::get(arg.desc);
+            for (uint16_t i = 0; i < desc->parameter_size; i++) {
               pop();
-              if (p.size() == 2) {
-                pop();
-              }
             }
-            if (const auto return_type = type.return_type(); return_type.kind() != type_kind::void_) {
+            if (const auto& return_type = desc->return_type; return_type.kind() != type_kind::void_) {
               push(to_frame_var(return_type));
               if (return_type.size() == 2) {
                 push(top_var());
               }
             }
           } else if constexpr (std::is_same_v<T, method_insn>) {
-            const type type(arg.desc);
-            auto start = output_max_stack_;
+            const auto desc = descriptor::get(arg.desc);
+            // The receiver of a constructor may have been copied to locals or deeper into the stack, every copy is
+            // initialized by the call.
+            std::optional<frame_var> receiver;
+            if (arg.opcode == op::invokespecial && arg.name == "<init>" && output_height_ > desc->parameter_size) {
+              receiver = stack[output_height_ - desc->parameter_size - 1];
+            }
             if (arg.opcode != op::invokestatic) {
               pop();
             }
-            for (const auto& p : type.parameter_types()) {
+            for (uint16_t i = 0; i < desc->parameter_size; i++) {
               pop();
-              if (p.size() == 2) {
-                pop();
-              }
             }
-            if (const auto return_type = type.return_type(); return_type.kind() != type_kind::void_) {
+            if (const auto& return_type = desc->return_type; return_type.kind() != type_kind::void_) {
               push(to_frame_var(return_type));
               if (return_type.size() == 2) {
                 push(top_var());
               }
             }
-            if (arg.opcode == op::invokespecial && arg.name == "<init>") {
-              if (!output_stack_.empty() && output_stack_.front()) {
-                if (const auto uninit = std::get_if<uninitialized_var>(&*output_stack_.front())) {
-                  const auto id = uninit->offset.id();
-                  const auto uninit_index = id & 0xFFFFFFFF;
-                  std::string uninit_type =
-                      uninit_index < uninitialized.size() ? uninitialized[uninit_index] : arg.owner;
-                  pop();
-                  push(object_var(uninit_type));
-                  return;
-                }
-              }
-              if (!output_locals_.empty() && output_locals_[0]) {
-                if (std::holds_alternative<uninitialized_this_var>(*output_locals_[0])) {
-                  output_locals_[0] = object_var(class_name);
-                }
+            if (!receiver) {
+              return;
+            }
+            std::optional<frame_var> initialized;
+            if (const auto uninit = std::get_if<uninitialized_var>(&*receiver)) {
+              const auto uninit_index = uninit->offset.id() & 0xFFFFFFFF;
+              initialized = object_var(uninit_index < uninitialized.size() ? uninitialized[uninit_index] : arg.owner);
+            } else if (std::holds_alternative<uninitialized_this_var>(*receiver)) {
+              initialized = object_var(class_name);
+            } else {
+              return;
+            }
+            const auto initialize = [&](std::optional<frame_var>& var) {
+              if (var && *var == *receiver) {
+                var = initialized;
               }
+            };
+            for (uint16_t i = 0; i < output_height_; i++) {
+              initialize(stack[i]);
+            }
+            for (uint16_t i = 0; i < locals_width_; i++) {
+              initialize(locals[i]);
             }
           } else if constexpr (std::is_same_v<T, lookup_switch_insn>) {
             pop();
@@ -930,7 +1073,10 @@ void basic_block::compute_frames(const std::string_view& class_name) {
           } else if constexpr (std::is_same_v<T, label>) {
             if (handlers_.find(arg.id()) != handlers_.end()) {
               output_max_stack_ = 1;
-              output_stack_.resize(1);
+              if (output_height_ > 1) {
+                stack[0] = std::move(stack[output_height_ - 1]);
+              }
+              output_height_ = std::min<uint16_t>(output_height_, 1);
               if (output_max_stack_ > max_stack_) {
                 max_stack_ = output_max_stack_;
               }
@@ -961,26 +1107,16 @@ bool basic_block::merge(const class_tree& tree, const basic_block& other, const
     }
     if (const auto obj1 = std::get_if<object_var>(&*var1)) {
       if (const auto obj2 = std::get_if<object_var>(&*var2)) {
-        if (tree.is_assignable_from(obj1->type, obj2->type)) {
-          return var1;
-        }
-        if (tree.is_assignable_from(obj2->type, obj1->type)) {
-          return var2;
-        }
-        auto node = tree.get(obj1->type);
-        do {
-          if (node != nullptr) {
-            node = node->super_class;
-          }
-        } while (node != nullptr && !tree.is_assignable_from(node->name, obj2->type));
-        return object_var(node == nullptr ? "java/lang/Object" : node->name);
+        return object_var(tree.common_super_class(obj1->type, obj2->type));
       }
     }
     return top_var();
   };
   bool changed = false;
+  auto* const stack = input_stack();
+  auto* const locals = input_locals();
   if (!tcb_types.empty()) {
-    std::optional<frame_var> tcb_type = input_stack_.empty() ? std::nullopt : input_stack_[0];
+    std::optional<frame_var> tcb_type = input_height_ == 0 ? std::nullopt : stack[0];
     for (const auto& type : tcb_types) {
       if (!tcb_type) {
         tcb_type = object_var(type);
@@ -988,33 +1124,32 @@ bool basic_block::merge(const class_tree& tree, const basic_block& other, const
         tcb_type = merge_type(tcb_type, object_var(type));
       }
     }
-    if (input_stack_.size() != 1 || input_stack_[0] != tcb_type) {
-      input_stack_.clear();
-      input_stack_.emplace_back(tcb_type);
+    if (input_height_ != 1 || stack[0] != tcb_type) {
+      stack[0] = std::move(tcb_type);
+      input_height_ = 1;
       input_max_stack_ = 1;
       changed = true;
     }
-  } else if (input_stack_.size() < other.output_stack_.size()) {
-    input_stack_.resize(other.output_stack_.size());
-    changed = true;
-  }
-  if (input_locals_.size() < other.output_locals_.size()) {
-    input_locals_.resize(other.output_locals_.size());
-    changed = true;
-  }
-  if (tcb_types.empty()) {
-    for (size_t i = 0; i < other.output_stack_.size(); i++) {
-      const auto var = merge_type(input_stack_[i], other.output_stack_[i]);
-      if (input_stack_[i] != var) {
-        input_stack_[i] = var;
+  } else {
+    if (input_height_ < other.output_height_) {
+      std::fill(stack + input_height_, stack + other.output_height_, std::nullopt);
+      input_height_ = other.output_height_;
+      changed = true;
+    }
+    const auto* const other_stack = other.output_stack();
+    for (size_t i = 0; i < other.output_height_; i++) {
+      auto var = merge_type(stack[i], other_stack[i]);
+      if (stack[i] != var) {
+        stack[i] = std::move(var);
         changed = true;
       }
     }
   }
-  for (size_t i = 0; i < other.output_locals_.size(); i++) {
-    const auto var = merge_type(input_locals_[i], other.output_locals_[i]);
-    if (input_locals_[i] != var) {
-      input_locals_[i] = var;
+  const auto* const other_locals = other.output_locals();
+  for (size_t i = 0; i < locals_width_; i++) {
+    auto var = merge_type(locals[i], other_locals[i]);
+    if (locals[i] != var) {
+      locals[i] = std::move(var);
       changed = true;
     }
   }
@@ -1047,54 +1182,10 @@ std::string basic_block::to_string(const std::string_view& delim) const {
   return oss.str();
 }
 std::vector<frame_var> basic_block::locals() const {
-  std::vector<frame_var> locals;
-  auto num_local = 0;
-  auto top_trail = 0;
-  for (auto i = 0; i < input_locals_.size(); i++) {
-    auto& local = input_locals_[i];
-    if (!local) {
-      continue;
-    }
-    if (std::holds_alternative<double_var>(*local) || std::holds_alternative<long_var>(*local)) {
-      i += 1;
-    }
-    if (std::holds_alternative<top_var>(*local)) {
-      top_trail++;
-    } else {
-      num_local += top_trail + 1;
-      top_trail = 0;
-    }
-  }
-  locals.reserve(num_local);
-  auto i = 0;
-  while (num_local-- > 0) {
-    auto& local = input_locals_[i];
-    if (!local) {
-      continue;
-    }
-    if (std::holds_alternative<double_var>(*local) || std::holds_alternative<long_var>(*local)) {
-      i += 2;
-    } else {
-      i++;
-    }
-    locals.emplace_back(*local);
-  }
-  return locals;
+  return frame_locals(input_locals(), locals_width_);
 }
 std::vector<frame_var> basic_block::stack() const {
-  std::vector<frame_var> stack;
-  stack.reserve(input_stack_.size());
-  for (auto it = input_stack_.rbegin(); it != input_stack_.rend(); ++it) {
-    const auto& var = *it;
-    if (!var) {
-      continue;
-    }
-    if (std::holds_alternative<double_var>(*var) || std::holds_alternative<long_var>(*var)) {
-      ++it;
-    }
-    stack.emplace_back(*var);
-  }
-  return stack;
+  return frame_stack(input_stack(), input_height_);
 }
 int32_t basic_block::max_locals() const {
   return max_locals_;
@@ -1102,6 +1193,41 @@ int32_t basic_block::max_locals() const {
 int32_t basic_block::max_stack() const {
   return max_stack_;
 }
+std::optional<frame_var>* basic_block::input_locals() {
+  return slots_;
+}
+std::optional<frame_var>* basic_block::output_locals() {
+  return slots_ + locals_width_;
+}
+std::optional<frame_var>* basic_block::input_stack() {
+  return slots_ + 2 * locals_width_;
+}
+std::optional<frame_var>* basic_block::output_stack() {
+  return slots_ + 2 * locals_width_ + stack_width_;
+}
+const std::optional<frame_var>* basic_block::input_locals() const {
+  return slots_;
+}
+const std::optional<frame_var>* basic_block::output_locals() const {
+  return slots_ + locals_width_;
+}
+const std::optional<frame_var>* basic_block::input_stack() const {
+  return slots_ + 2 * locals_width_;
+}
+const std::optional<frame_var>* basic_block::output_stack() const {
+  return slots_ + 2 * locals_width_ + stack_width_;
+}
+void basic_block::set_input(const std::optional<frame_var>* locals, size_t locals_size,
+                            const std::optional<frame_var>* stack, size_t stack_size) {
+  if (locals_size > locals_width_ || stack_size > stack_width_) {
+    overflow_ = true;
+    return;
+  }
+  std::copy(locals, locals + locals_size, input_locals());
+  std::fill(input_locals() + locals_size, input_locals() + locals_width_, std::nullopt);
+  std::copy(stack, stack + stack_size, input_stack());
+  input_height_ = static_cast<uint16_t>(stack_size);
+}
 const std::vector<code::const_iterator>& basic_block::instructions() const {
   return instructions_;
 }
@@ -1193,10 +1319,19 @@ basic_block_graph::basic_block_graph(const code& code) {
     }
     return it->second;
   };
+  // Jump targets are looked up once per edge, a linear search through the code for each would make this quadratic.
+  std::unordered_map<label_id, code::const_iterator> label_map;
+  const auto find_label = [&](const label& lbl) {
+    const auto found = label_map.find(lbl.id());
+    return found == label_map.end() ? code.end() : found->second;
+  };
   bool tcb_flag = false;
   for (auto it = code.begin(); it != code.end(); ++it) {
     auto* in = &*it;
     const auto lbl = std::get_if<label>(in);
+    if (lbl) {
+      label_map.emplace(lbl->id(), it);
+    }
     if (tcb_flag) {
       current = get_block(in);
       tcb_flag = false;
@@ -1222,7 +1357,7 @@ basic_block_graph::basic_block_graph(const code& code) {
     if (const auto branch = std::get_if<branch_insn>(in)) {
       link_next = branch->opcode != op::goto_ && branch->opcode != op::goto_w && branch->opcode != op::jsr &&
                   branch->opcode != op::jsr_w;
-      if (const auto target = code.find_label(branch->target); target != code.end()) {
+      if (const auto target = find_label(branch->target); target != code.end()) {
         auto target_block = get_block(&*target);
         target_block->needs_frame_ = true;
         current->successors_[target_block] = {};
@@ -1230,13 +1365,13 @@ basic_block_graph::basic_block_graph(const code& code) {
     } else if (const auto table_switch = std::get_if<table_switch_insn>(in)) {
       link_next = false;
       for (const auto& branch_target : table_switch->targets) {
-        if (const auto target = code.find_label(branch_target); target != code.end()) {
+        if (const auto target = find_label(branch_target); target != code.end()) {
           auto target_block = get_block(&*target);
           target_block->needs_frame_ = true;
           current->successors_[target_block] = {};
         }
       }
-      if (const auto target = code.find_label(table_switch->default_target); target != code.end()) {
+      if (const auto target = find_label(table_switch->default_target); target != code.end()) {
         auto target_block = get_block(&*target);
         target_block->needs_frame_ = true;
         current->successors_[target_block] = {};
@@ -1244,13 +1379,13 @@ basic_block_graph::basic_block_graph(const code& code) {
     } else if (const auto lookup_switch = std::get_if<lookup_switch_insn>(in)) {
       link_next = false;
       for (const auto& [key, branch_target] : lookup_switch->targets) {
-        if (const auto target = code.find_label(branch_target); target != code.end()) {
+        if (const auto target = find_label(branch_target); target != code.end()) {
           auto target_block = get_block(&*target);
           target_block->needs_frame_ = true;
           current->successors_[target_block] = {};
         }
       }
-      if (const auto target = code.find_label(lookup_switch->default_target); target != code.end()) {
+      if (const auto target = find_label(lookup_switch->default_target); target != code.end()) {
         auto target_block = get_block(&*target);
         target_block->needs_frame_ = true;
         current->successors_[target_block] = {};
@@ -1281,12 +1416,12 @@ basic_block_graph::basic_block_graph(const code& code) {
   }
 
   for (const auto& tcb : code.tcbs) {
-    if (const auto handler = code.find_label(tcb.handler); handler != code.end()) {
+    if (const auto handler = find_label(tcb.handler); handler != code.end()) {
       auto sucessor = get_block(&*handler);
       sucessor->needs_frame_ = true;
       const auto tcb_type = tcb.type ? *tcb.type : "java/lang/Throwable";
       sucessor->handlers_.emplace(tcb.handler.id());
-      for (auto it = code.find_label(tcb.start); it != code.find_label(tcb.end); ++it) {
+      for (auto it = find_label(tcb.start); it != find_label(tcb.end); ++it) {
         auto* in = &*it;
         auto* block = get_block(in);
         auto sit = block->successors_.find(sucessor);
@@ -1325,6 +1460,7 @@ frame_compute_result basic_block_graph::compute_frames(const class_tree& tree, c
     return {max_locals, 0};
   }
   // A single pass is sufficient to find max locals
+  int32_t growth = 1;
   for (auto& block : blocks_) {
     block.max_locals_ = 0;
     block.input_max_stack_ = -1;
@@ -1334,87 +1470,124 @@ frame_compute_result basic_block_graph::compute_frames(const class_tree& tree, c
     if (block.max_locals_ > max_locals) {
       max_locals = block.max_locals_;
     }
-    block.max_locals_ = 0;
-    block.input_max_stack_ = -1;
-    block.output_max_stack_ = 0;
-    block.max_stack_ = 0;
+    growth = std::max(growth, block.max_stack_ + 1);
   }
   std::vector<std::optional<frame_var>> input_locals = start_locals;
   while (input_locals.size() < max_locals) {
     input_locals.emplace_back(top_var());
   }
-  std::deque<basic_block*> worklist;
-  auto* head = &blocks_.front();
-  head->input_max_stack_ = 0;
-  head->max_locals_ = max_locals;
-  head->input_locals_ = std::move(input_locals);
-  worklist.emplace_back(head);
-
+  // Most blocks start with an empty stack, so the most a single block pushes is a good first guess for the stack. It
+  // is widened until no block overflows.
+  auto stack_width = static_cast<uint16_t>(std::min<int32_t>(growth, UINT16_MAX));
+  while (true) {
+    assign_slots(max_locals, stack_width);
+    std::deque<basic_block*> worklist;
+    auto* head = &blocks_.front();
+    head->input_max_stack_ = 0;
+    head->max_locals_ = max_locals;
+    head->set_input(input_locals.data(), input_locals.size(), nullptr, 0);
+    head->queued_ = true;
+    worklist.emplace_back(head);
+    propagate(tree, class_name, worklist);
+    if (!overflowed() || stack_width == UINT16_MAX) {
+      break;
+    }
+    stack_width = static_cast<uint16_t>(std::min<int32_t>(stack_width * 2, UINT16_MAX));
+  }
+  return collect_frames(start_locals, max_locals, 0, {});
+}
+void basic_block_graph::assign_slots(uint16_t locals, uint16_t stack) {
+  const auto width = 2 * (static_cast<size_t>(locals) + stack);
+  slots_.assign(width * blocks_.size(), std::nullopt);
+  auto* slots = slots_.data();
+  for (auto& block : blocks_) {
+    block.slots_ = slots;
+    slots += width;
+    block.locals_width_ = locals;
+    block.stack_width_ = stack;
+    block.input_height_ = 0;
+    block.output_height_ = 0;
+    block.overflow_ = false;
+    block.queued_ = false;
+    block.max_locals_ = 0;
+    block.input_max_stack_ = -1;
+    block.output_max_stack_ = 0;
+    block.max_stack_ = 0;
+  }
+}
+bool basic_block_graph::overflowed() const {
+  return std::any_of(blocks_.begin(), blocks_.end(), [](const basic_block& block) {
+    return block.overflow_;
+  });
+}
+void basic_block_graph::propagate(const class_tree& tree, const std::string_view& class_name,
+                                  std::deque<basic_block*>& worklist) {
   while (!worklist.empty()) {
     auto* current = worklist.front();
     worklist.pop_front();
+    current->queued_ = false;
     current->compute_frames(class_name);
     for (auto& [succ, tcb_type] : current->successors_) {
       if (succ->merge(tree, *current, tcb_type) || (succ->input_max_stack_ < current->output_max_stack_)) {
         succ->max_locals_ = current->max_locals_;
         succ->input_max_stack_ = current->output_max_stack_;
-        if (std::find(worklist.begin(), worklist.end(), succ) == worklist.end()) {
+        if (!succ->queued_) {
+          succ->queued_ = true;
           worklist.emplace_back(succ);
         }
       }
     }
   }
-
+}
+frame_compute_result basic_block_graph::collect_frames(
+    const std::vector<std::optional<frame_var>>& start_locals, uint16_t max_locals, uint16_t max_stack,
+    const std::unordered_map<const instruction*, label>& known_labels) {
   std::vector<std::pair<code::const_iterator, label>> inject_labels;
 
   for (auto& block : blocks_) {
-    for (auto& var : block.input_stack_) {
-      if (!var) {
+    for (auto* var = block.input_stack(); var != block.input_stack() + block.input_height_; ++var) {
+      if (!*var) {
         continue;
       }
-      if (const auto uninit = std::get_if<uninitialized_var>(&*var)) {
+      if (const auto uninit = std::get_if<uninitialized_var>(&**var)) {
         const auto it_index = static_cast<size_t>((uninit->offset.id() >> 32) & 0xFFFFFFFF);
         if (it_index < block.code_.size()) {
           auto it = block.code_.begin();
           std::advance(it, it_index);
           auto maybe_label = it == block.code_.begin() ? it : std::prev(it);
           if (const auto lbl = std::get_if<label>(&*maybe_label)) {
-            var = uninitialized_var(*lbl);
+            *var = uninitialized_var(*lbl);
           } else {
             label l;
             inject_labels.emplace_back(it, l);
-            var = uninitialized_var(l);
+            *var = uninitialized_var(l);
           }
         }
       }
     }
 
-    for (auto& var : block.input_locals_) {
-      if (!var) {
+    for (auto* var = block.input_locals(); var != block.input_locals() + block.locals_width_; ++var) {
+      if (!*var) {
         continue;
       }
-      if (const auto uninit = std::get_if<uninitialized_var>(&*var)) {
+      if (const auto uninit = std::get_if<uninitialized_var>(&**var)) {
         const auto it_index = static_cast<size_t>((uninit->offset.id() >> 32) & 0xFFFFFFFF);
         if (it_index < block.code_.size()) {
           auto it = block.code_.begin();
           std::advance(it, it_index);
           if (const auto lbl = std::get_if<label>(&*it)) {
-            var = uninitialized_var(*lbl);
+            *var = uninitialized_var(*lbl);
           } else {
             label l;
             inject_labels.emplace_back(it, l);
-            var = uninitialized_var(l);
+            *var = uninitialized_var(l);
           }
         }
       }
     }
   }
 
-  std::vector<frame_var> locals;
-  std::vector<frame_var> stack;
-  for (const auto& local : head->locals()) {
-    locals.emplace_back(local);
-  }
+  auto locals = frame_locals(start_locals.data(), start_locals.size());
 
   std::vector<std::pair<label, frame>> frames;
   std::unordered_map<const basic_block*, label> block_labels;
@@ -1425,6 +1598,9 @@ frame_compute_result basic_block_graph::compute_frames(const class_tree& tree, c
       const auto in = block->instructions_.front();
       if (const auto lbl = std::get_if<label>(&*in)) {
         it = block_labels.emplace(block, *lbl).first;
+      } else if (const auto known = known_labels.find(&*in); known != known_labels.end()) {
+        inject_labels.emplace_back(in, known->second);
+        it = block_labels.emplace(block, known->second).first;
       } else {
         label l;
         inject_labels.emplace_back(in, l);
@@ -1438,65 +1614,459 @@ frame_compute_result basic_block_graph::compute_frames(const class_tree& tree, c
     if (!block.needs_frame_) {
       continue;
     }
-    const auto block_locals = block.locals();
-    const auto block_stack = block.stack();
-    bool written = false;
-    if (block_stack.empty()) {
-      if (block_locals.size() > locals.size() && block_locals.size() - locals.size() <= 3) {
-        std::vector<frame_var> append_locals;
-        bool same = true;
-        auto j = 0;
-        for (const auto& local : block_locals) {
-          if (j < locals.size()) {
-            if (local != locals[j]) {
-              same = false;
-              break;
-            }
-          } else {
-            append_locals.emplace_back(local);
+    frames.emplace_back(get_label(&block), encode_frame(locals, block.input_locals(), block.locals_width_,
+                                                        block.input_stack(), block.input_height_));
+    frame_locals(block.input_locals(), block.locals_width_, locals);
+  }
+  for (const auto& b : blocks_) {
+    if (b.max_locals_ > max_locals) {
+      max_locals = b.max_locals_;
+    }
+    if (b.max_stack_ > max_stack) {
+      max_stack = b.max_stack_;
+    }
+  }
+  frame_compute_result result(std::move(inject_labels), std::move(frames), max_locals, max_stack);
+  const auto& code = blocks_.front().code_;
+  result.code_size_ = code.size();
+  if (!result.inject_labels_.empty()) {
+    std::unordered_map<const instruction*, size_t> positions;
+    for (const auto& [it, lbl] : result.inject_labels_) {
+      positions.emplace(&*it, 0);
+    }
+    size_t index = 0;
+    for (const auto& in : code) {
+      if (const auto found = positions.find(&in); found != positions.end()) {
+        found->second = index;
+      }
+      index++;
+    }
+    for (const auto& [it, lbl] : result.inject_labels_) {
+      result.label_positions_.emplace_back(positions[&*it]);
+    }
+  }
+  return result;
+}
+frame_compute_result basic_block_graph::recompute_frames(const class_tree& tree, const std::string_view& class_name,
+                                                         const std::vector<std::optional<frame_var>>& start_locals,
+                                                         const frame_compute_result& previous,
+                                                         code::const_iterator first, code::const_iterator last) {
+  if (blocks_.empty()) {
+    return compute_frames(tree, class_name, start_locals);
+  }
+  // Uninitialized values are tracked by instruction position while simulating, which the labels of the previous
+  // frames do not carry over.
+  const auto expanded = expand_frames(start_locals, previous.frames());
+  if (!expanded) {
+    return compute_frames(tree, class_name, start_locals);
+  }
+  uint16_t max_locals = previous.max_locals();
+  uint16_t max_frame_stack = 0;
+  for (const auto& [id, state] : *expanded) {
+    const auto uninit = [](const std::optional<frame_var>& var) {
+      return var && std::holds_alternative<uninitialized_var>(*var);
+    };
+    if (std::any_of(state.locals.begin(), state.locals.end(), uninit) ||
+        std::any_of(state.stack.begin(), state.stack.end(), uninit)) {
+      return compute_frames(tree, class_name, start_locals);
+    }
+    max_locals = std::max(max_locals, static_cast<uint16_t>(state.locals.size()));
+    max_frame_stack = std::max(max_frame_stack, static_cast<uint16_t>(state.stack.size()));
+  }
+  // The labels of the previous result point into the code before the edit, where removed instructions may be gone, so
+  // they are placed by position. The code before the edit is unchanged and the code after it only moved by how much the
+  // edit grew it. Labels on instructions inside the edit are dropped.
+  const auto& code = blocks_.front().code_;
+  std::unordered_map<const instruction*, label> known_labels;
+  if (!previous.label_positions_.empty()) {
+    const auto edit_start = static_cast<size_t>(std::distance(code.begin(), first));
+    const auto edit_end = edit_start + static_cast<size_t>(std::distance(first, last));
+    const auto growth = static_cast<int64_t>(code.size()) - static_cast<int64_t>(previous.code_size_);
+    const auto previous_edit_end = static_cast<int64_t>(edit_end) - growth;
+    std::unordered_map<size_t, label> by_position;
+    for (size_t i = 0; i < previous.label_positions_.size(); i++) {
+      const auto position = previous.label_positions_[i];
+      if (position < edit_start) {
+        by_position.emplace(position, previous.inject_labels_[i].second);
+      } else if (static_cast<int64_t>(position) >= previous_edit_end) {
+        by_position.emplace(static_cast<size_t>(static_cast<int64_t>(position) + growth),
+                            previous.inject_labels_[i].second);
+      }
+    }
+    size_t index = 0;
+    for (const auto& in : code) {
+      if (const auto found = by_position.find(index); found != by_position.end()) {
+        known_labels.emplace(&in, found->second);
+      }
+      index++;
+    }
+  }
+  const auto find_state = [&](const basic_block& block) -> const frame_state* {
+    for (const auto& it : block.instructions_) {
+      const auto lbl = std::get_if<label>(&*it);
+      if (lbl == nullptr) {
+        break;
+      }
+      if (const auto found = expanded->find(lbl->id()); found != expanded->end()) {
+        return &found->second;
+      }
+    }
+    if (const auto known = known_labels.find(&*block.instructions_.front()); known != known_labels.end()) {
+      if (const auto found = expanded->find(known->second.id()); found != expanded->end()) {
+        return &found->second;
+      }
+    }
+    return nullptr;
+  };
+
+  std::unordered_set<const instruction*> edited;
+  for (auto it = first; it != last; ++it) {
+    edited.emplace(&*it);
+  }
+  if (first == last) {
+    if (first != code.end()) {
+      edited.emplace(&*first);
+    }
+    if (first != code.begin()) {
+      edited.emplace(&*std::prev(first));
+    }
+  }
+
+  // Blocks without a frame are only entered from the block before them, so a change anywhere in such a run affects the
+  // run from the block with the frame that starts it. A block that needs a frame but had none is new and is handled
+  // the same way.
+  int32_t growth = 0;
+  std::vector<basic_block*> order;
+  std::vector<const frame_state*> block_states;
+  std::vector<basic_block*> roots;
+  size_t run_start = 0;
+  const auto falls_into = [&order](size_t i) {
+    return i > 0 && order[i - 1]->successors_.find(order[i]) != order[i - 1]->successors_.end();
+  };
+  for (auto& block : blocks_) {
+    block.max_locals_ = 0;
+    block.input_max_stack_ = -1;
+    block.output_max_stack_ = 0;
+    block.max_stack_ = 0;
+    const auto state = find_state(block);
+    order.emplace_back(&block);
+    block_states.emplace_back(state);
+    if (state != nullptr || !falls_into(order.size() - 1)) {
+      run_start = order.size() - 1;
+    }
+    auto dirty = block.needs_frame_ && state == nullptr;
+    if (std::any_of(block.instructions_.begin(), block.instructions_.end(), [&edited](const auto& it) {
+          return edited.find(&*it) != edited.end();
+        })) {
+      dirty = true;
+      block.compute_maxes();
+      max_locals = std::max(max_locals, static_cast<uint16_t>(block.max_locals_));
+      growth = std::max(growth, block.max_stack_ + 1);
+    }
+    if (dirty && (roots.empty() || roots.back() != order[run_start])) {
+      roots.emplace_back(order[run_start]);
+    }
+  }
+
+  // Only the blocks reachable from a changed run can see a different input. They are simulated from scratch, the
+  // others keep the state of their frame.
+  std::unordered_set<const basic_block*> region(roots.begin(), roots.end());
+  while (!roots.empty()) {
+    const auto* current = roots.back();
+    roots.pop_back();
+    for (const auto& [succ, tcb_types] : current->successors_) {
+      if (region.emplace(succ).second) {
+        roots.emplace_back(succ);
+      }
+    }
+  }
+  const auto leads_into_region = [&region](const basic_block* block) {
+    return std::any_of(block->successors_.begin(), block->successors_.end(), [&region](const auto& succ) {
+      return region.find(succ.first) != region.end();
+    });
+  };
+  // The blocks outside the region that jump or fall into it, and the blocks before them in their run, are simulated
+  // once from their frame to get the output the region starts from. A run that is not entered at all is dead code and
+  // has no output, just like in compute_frames().
+  std::vector<bool> simulate(order.size());
+  for (auto i = order.size(); i-- > 0;) {
+    if (region.find(order[i]) != region.end() || (i > 0 && block_states[i] == nullptr && !falls_into(i))) {
+      continue;
+    }
+    const auto next_needs_input = i + 1 < order.size() && simulate[i + 1] && block_states[i + 1] == nullptr;
+    simulate[i] = next_needs_input || leads_into_region(order[i]);
+  }
+
+  // The stack can only grow past the previous frames and maxes by what the edited blocks push.
+  const auto stack_width =
+      static_cast<uint16_t>(std::min<int32_t>(std::max(previous.max_stack(), max_frame_stack) + growth, UINT16_MAX));
+  assign_slots(max_locals, stack_width);
+  std::deque<basic_block*> worklist;
+  for (size_t i = 0; i < order.size(); i++) {
+    auto* block = order[i];
+    const auto* state = block_states[i];
+    const auto in_region = region.find(block) != region.end();
+    size_t locals_size = max_locals;
+    if (i == 0 && (in_region || state == nullptr)) {
+      locals_size = start_locals.size();
+      block->set_input(start_locals.data(), locals_size, nullptr, 0);
+      block->input_max_stack_ = 0;
+    } else if (state != nullptr && !in_region) {
+      locals_size = state->locals.size();
+      block->set_input(state->locals.data(), locals_size, state->stack.data(), state->stack.size());
+      block->input_max_stack_ = static_cast<int32_t>(state->stack.size());
+    } else if (simulate[i]) {
+      const auto* before = order[i - 1];
+      block->set_input(before->output_locals(), max_locals, before->output_stack(), before->output_height_);
+      block->input_max_stack_ = before->output_max_stack_;
+    } else {
+      continue;
+    }
+    block->max_locals_ = max_locals;
+    // A frame drops trailing tops, they have to be back for the merges to keep them.
+    if (locals_size < max_locals) {
+      std::fill(block->input_locals() + locals_size, block->input_locals() + max_locals, top_var());
+    }
+    if (in_region) {
+      block->queued_ = true;
+      worklist.emplace_back(block);
+    } else if (simulate[i]) {
+      block->compute_frames(class_name);
+      for (auto& [succ, tcb_types] : block->successors_) {
+        if (region.find(succ) == region.end()) {
+          continue;
+        }
+        if (succ->merge(tree, *block, tcb_types) || (succ->input_max_stack_ < block->output_max_stack_)) {
+          succ->max_locals_ = block->max_locals_;
+          succ->input_max_stack_ = block->output_max_stack_;
+          if (!succ->queued_) {
+            succ->queued_ = true;
+            worklist.emplace_back(succ);
           }
-          j++;
         }
-        if (same) {
-          frames.emplace_back(get_label(&block), append_frame(append_locals));
-          written = true;
+      }
+    }
+  }
+  propagate(tree, class_name, worklist);
+  if (overflowed()) {
+    return compute_frames(tree, class_name, start_locals);
+  }
+  // The blocks outside the region were not all simulated, so the previous max stack stays a lower bound.
+  const auto max_stack = region.size() == order.size() ? 0 : previous.max_stack();
+  return collect_frames(start_locals, max_locals, max_stack, known_labels);
+}
+std::optional<frame_compute_result> basic_block_graph::verify_frames(
+    const class_tree& tree, const std::string_view& class_name, const std::vector<std::optional<frame_var>>& start_locals,
+    const std::vector<std::pair<label, frame>>& frames) {
+  const auto expanded = expand_frames(start_locals, frames);
+  if (!expanded) {
+    return std::nullopt;
+  }
+  const auto& states = *expanded;
+  auto max_locals = static_cast<uint16_t>(start_locals.size());
+  for (const auto& [id, state] : states) {
+    max_locals = std::max(max_locals, static_cast<uint16_t>(state.locals.size()));
+  }
+  if (blocks_.empty()) {
+    if (!frames.empty()) {
+      return std::nullopt;
+    }
+    return frame_compute_result(max_locals, 0);
+  }
+
+  const auto find_state = [&states](const basic_block& block) -> const frame_state* {
+    for (const auto& it : block.instructions_) {
+      const auto lbl = std::get_if<label>(&*it);
+      if (lbl == nullptr) {
+        break;
+      }
+      if (const auto found = states.find(lbl->id()); found != states.end()) {
+        return &found->second;
+      }
+    }
+    return nullptr;
+  };
+  const auto assignable = [&tree](const std::optional<frame_var>& from, const frame_var& to) {
+    if (std::holds_alternative<top_var>(to)) {
+      return true;
+    }
+    if (!from) {
+      return false;
+    }
+    if (*from == to) {
+      return true;
+    }
+    const auto to_obj = std::get_if<object_var>(&to);
+    if (to_obj == nullptr) {
+      return false;
+    }
+    if (std::holds_alternative<null_var>(*from)) {
+      return true;
+    }
+    const auto from_obj = std::get_if<object_var>(&*from);
+    return from_obj != nullptr && tree.is_assignable_from(to_obj->type, from_obj->type);
+  };
+  const auto locals_assignable = [&](const std::optional<frame_var>* from, size_t from_size,
+                                     const std::vector<std::optional<frame_var>>& to) {
+    for (size_t i = 0; i < to.size(); i++) {
+      if (!assignable(i < from_size ? from[i] : std::nullopt, *to[i])) {
+        return false;
+      }
+    }
+    return true;
+  };
+  const auto stack_assignable = [&](const std::optional<frame_var>* from, size_t from_size,
+                                    const std::vector<std::optional<frame_var>>& to) {
+    if (from_size != to.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < to.size(); i++) {
+      if (!assignable(from[i], *to[i])) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  // Frames only hold the stack at jump targets, the slots have to fit whatever a block pushes on top of it.
+  auto locals_width = max_locals;
+  int32_t stack_width = 0;
+  for (const auto& [id, state] : states) {
+    stack_width = std::max(stack_width, static_cast<int32_t>(state.stack.size()));
+  }
+  int32_t growth = 1;
+  for (auto& block : blocks_) {
+    block.max_locals_ = 0;
+    block.input_max_stack_ = -1;
+    block.output_max_stack_ = 0;
+    block.max_stack_ = 0;
+    block.compute_maxes();
+    locals_width = std::max(locals_width, static_cast<uint16_t>(block.max_locals_));
+    growth = std::max(growth, block.max_stack_ + 1);
+  }
+  assign_slots(locals_width, static_cast<uint16_t>(std::min<int32_t>(stack_width + growth, UINT16_MAX)));
+
+  size_t matched = 0;
+  uint16_t max_stack = 0;
+  const basic_block* previous = nullptr;
+  std::vector<std::pair<uint16_t, std::optional<frame_var>>> stores;
+  for (auto& block : blocks_) {
+    // A block without a frame can only be entered by falling through from the block before it.
+    if (const auto state = find_state(block)) {
+      if (previous == nullptr &&
+          (!state->stack.empty() || !locals_assignable(start_locals.data(), start_locals.size(), state->locals))) {
+        return std::nullopt;
+      }
+      matched++;
+      block.set_input(state->locals.data(), state->locals.size(), state->stack.data(), state->stack.size());
+      block.max_locals_ = static_cast<int32_t>(state->locals.size());
+    } else if (previous == nullptr) {
+      block.set_input(start_locals.data(), start_locals.size(), nullptr, 0);
+      block.max_locals_ = static_cast<int32_t>(start_locals.size());
+    } else if (previous->successors_.find(&block) == previous->successors_.end()) {
+      // Labels after the last instruction or behind a jump form a block that is never entered and writes no code.
+      const auto labels_only = std::all_of(block.instructions_.begin(), block.instructions_.end(), [](const auto& it) {
+        return std::holds_alternative<label>(*it);
+      });
+      if (labels_only) {
+        continue;
+      }
+      return std::nullopt;
+    } else if (block.needs_frame_) {
+      return std::nullopt;
+    } else {
+      block.set_input(previous->output_locals(), locals_width, previous->output_stack(), previous->output_height_);
+      block.max_locals_ = previous->max_locals_;
+    }
+    block.input_max_stack_ = block.input_height_;
+    block.max_stack_ = block.input_max_stack_;
+    // The locals seen by a handler are those at any instruction of the block, that is the input locals and every value
+    // stored on the way.
+    stores.clear();
+    const auto has_handlers = std::any_of(block.successors_.begin(), block.successors_.end(), [](const auto& succ) {
+      return !succ.second.empty();
+    });
+    block.stores_ = has_handlers ? &stores : nullptr;
+    block.compute_frames(class_name);
+    block.stores_ = nullptr;
+    if (block.overflow_) {
+      return std::nullopt;
+    }
+
+    for (const auto& [succ, tcb_types] : block.successors_) {
+      const auto succ_state = find_state(*succ);
+      if (!tcb_types.empty()) {
+        if (succ_state == nullptr || succ_state->stack.size() != 1 ||
+            !locals_assignable(block.input_locals(), block.locals_width_, succ_state->locals)) {
+          return std::nullopt;
         }
-      } else if (locals.size() > block_locals.size() && locals.size() - block_locals.size() <= 3) {
-        bool same = true;
-        for (auto j = 0; j < block_locals.size(); j++) {
-          if (locals[j] != block_locals[j]) {
-            same = false;
-            break;
+        for (const auto& [index, var] : stores) {
+          if (index < succ_state->locals.size() && !assignable(var, *succ_state->locals[index])) {
+            return std::nullopt;
           }
         }
-        if (same) {
-          frames.emplace_back(get_label(&block), chop_frame(static_cast<uint8_t>(locals.size() - block_locals.size())));
-          written = true;
+        for (const auto& type : tcb_types) {
+          if (!assignable(object_var(type), *succ_state->stack.back())) {
+            return std::nullopt;
+          }
         }
-      } else if (locals == block_locals) {
-        frames.emplace_back(get_label(&block), same_frame());
-        written = true;
+      } else if (succ_state != nullptr &&
+                 (!locals_assignable(block.output_locals(), block.locals_width_, succ_state->locals) ||
+                  !stack_assignable(block.output_stack(), block.output_height_, succ_state->stack))) {
+        return std::nullopt;
       }
-    } else if (block_stack.size() == 1 && locals == block_locals) {
-      frames.emplace_back(get_label(&block), same_frame(block_stack[0]));
-      written = true;
-    }
-    if (!written) {
-      frames.emplace_back(get_label(&block), full_frame(block_locals, block_stack));
     }
-    locals = block_locals;
-    stack = block_stack;
+    max_locals = std::max(max_locals, static_cast<uint16_t>(block.max_locals_));
+    max_stack = std::max(max_stack, static_cast<uint16_t>(block.max_stack_));
+    previous = &block;
   }
-  uint16_t max_stack = 0;
-  for (const auto& b : blocks_) {
-    if (b.max_locals_ > max_locals) {
-      max_locals = b.max_locals_;
+  if (matched != states.size()) {
+    return std::nullopt;
+  }
+  return frame_compute_result({}, std::vector<std::pair<label, frame>>(frames), max_locals, max_stack);
+}
+frame basic_block_graph::encode_frame(const std::vector<frame_var>& previous_locals,
+                                     const std::optional<frame_var>* locals, size_t locals_size,
+                                     const std::optional<frame_var>* stack, size_t stack_size) {
+  // The slots are only converted to vectors for the frames that carry them.
+  size_t index = 0;
+  auto changed = previous_locals.size();
+  const auto size = for_each_frame_local(locals, locals_size, [&](const frame_var& var) {
+    if (index < changed && var != previous_locals[index]) {
+      changed = index;
     }
-    if (b.max_stack_ > max_stack) {
-      max_stack = b.max_stack_;
+    index++;
+  });
+  const frame_var* first_stack = nullptr;
+  const auto height = for_each_frame_stack(stack, stack_size, [&first_stack](const frame_var& var) {
+    if (first_stack == nullptr) {
+      first_stack = &var;
+    }
+  });
+  const auto common = std::min(previous_locals.size(), size);
+  if (changed >= common) {
+    if (size == previous_locals.size()) {
+      if (height == 0) {
+        return same_frame();
+      }
+      if (height == 1) {
+        return same_frame(*first_stack);
+      }
+    } else if (height == 0 && size > previous_locals.size() && size - previous_locals.size() <= 3) {
+      std::vector<frame_var> appended;
+      index = 0;
+      for_each_frame_local(locals, locals_size, [&](const frame_var& var) {
+        if (index >= common && index < size) {
+          appended.emplace_back(var);
+        }
+        index++;
+      });
+      return append_frame(appended);
+    } else if (height == 0 && size < previous_locals.size() && previous_locals.size() - size <= 3) {
+      return chop_frame(static_cast<uint8_t>(previous_locals.size() - size));
     }
   }
-  return {std::move(inject_labels), std::move(frames), max_locals, max_stack};
+  return full_frame(frame_locals(locals, locals_size), frame_stack(stack, stack_size));
 }
 std::pair<uint16_t, uint16_t> basic_block_graph::compute_maxes(uint16_t start_locals) {
   if (blocks_.empty()) {
@@ -1540,18 +2110,96 @@ std::pair<uint16_t, uint16_t> basic_block_graph::compute_maxes(uint16_t start_lo
   }
   return {max_locals, max_stack};
 }
-uint16_t basic_block_graph::get_start_locals(const method& method) {
-  const type type(method.desc);
-  auto start_locals = (method.access_flags & access_flag::acc_static) != 0 ? 0 : 1;
-  for (const auto& p : type.parameter_types()) {
-    start_locals += p.size();
+std::optional<std::pair<uint16_t, uint16_t>> basic_block_graph::linear_maxes(const code& code, uint16_t start_locals) {
+  // Past this many open jumps the linear search for their targets stops paying off against the graph.
+  constexpr size_t max_pending = 16;
+  if (!code.tcbs.empty()) {
+    return std::nullopt;
+  }
+  max_state state;
+  state.max_locals = start_locals;
+  // Jumps whose target has not been reached yet, with the stack height they carry. A target that is never reached lies
+  // behind the jump or is missing, either way the graph has to handle it.
+  std::vector<std::pair<label_id, int32_t>> pending;
+  bool reachable = true;
+  for (const auto& in : code) {
+    if (const auto lbl = std::get_if<label>(&in)) {
+      auto height = reachable ? state.stack : -1;
+      for (size_t i = 0; i < pending.size();) {
+        if (pending[i].first == lbl->id()) {
+          height = std::max(height, pending[i].second);
+          pending[i] = pending.back();
+          pending.pop_back();
+        } else {
+          i++;
+        }
+      }
+      // Code that is neither jumped to nor fallen into is never visited by compute_maxes() either.
+      reachable = height >= 0;
+      if (reachable) {
+        state.stack = height;
+      }
+      continue;
+    }
+    if (!reachable) {
+      continue;
+    }
+    apply_maxes(in, state);
+    if (const auto branch = std::get_if<branch_insn>(&in)) {
+      if (branch->opcode == op::jsr || branch->opcode == op::jsr_w) {
+        return std::nullopt;
+      }
+      pending.emplace_back(branch->target.id(), state.stack);
+      reachable = branch->opcode != op::goto_ && branch->opcode != op::goto_w;
+    } else if (const auto table_switch = std::get_if<table_switch_insn>(&in)) {
+      for (const auto& target : table_switch->targets) {
+        pending.emplace_back(target.id(), state.stack);
+      }
+      pending.emplace_back(table_switch->default_target.id(), state.stack);
+      reachable = false;
+    } else if (const auto lookup_switch = std::get_if<lookup_switch_insn>(&in)) {
+      for (const auto& [key, target] : lookup_switch->targets) {
+        pending.emplace_back(target.id(), state.stack);
+      }
+      pending.emplace_back(lookup_switch->default_target.id(), state.stack);
+      reachable = false;
+    } else if (const auto var = std::get_if<var_insn>(&in)) {
+      if (var->opcode == op::ret) {
+        return std::nullopt;
+      }
+    } else if (const auto ins = std::get_if<insn>(&in)) {
+      switch (ins->opcode) {
+        case op::return_:
+        case op::areturn:
+        case op::ireturn:
+        case op::freturn:
+        case op::dreturn:
+        case op::lreturn:
+        case op::athrow:
+          reachable = false;
+          break;
+        default:
+          break;
+      }
+    }
+    if (pending.size() > max_pending) {
+      return std::nullopt;
+    }
   }
-  return start_locals;
+  if (!pending.empty()) {
+    return std::nullopt;
+  }
+  return std::make_pair(static_cast<uint16_t>(state.max_locals), static_cast<uint16_t>(state.max_stack));
+}
+uint16_t basic_block_graph::get_start_locals(const method& method) {
+  const auto start_locals = (method.access_flags & access_flag::acc_static) != 0 ? 0 : 1;
+  return start_locals + descriptor::get(method.desc)->parameter_size;
 }
 std::vector<std::optional<frame_var>> basic_block_graph::get_start_locals(const std::string_view& class_name,
                                                                           const method& method) {
   std::vector<std::optional<frame_var>> locals;
-  const type type(method.desc);
+  const auto desc = descriptor::get(method.desc);
+  locals.reserve(desc->parameter_size + 1);
 
   if ((method.access_flags & access_flag::acc_static) == 0) {
     if (method.name == "<init>") {
@@ -1561,11 +2209,12 @@ std::vector<std::optional<frame_var>> basic_block_graph::get_start_locals(const
     }
   }
 
-  for (const auto& p : type.parameter_types()) {
+  for (const auto& p : desc->parameter_types) {
     switch (p.kind()) {
       case type_kind::boolean:
       case type_kind::byte:
       case type_kind::char_:
+      case type_kind::short_:
       case type_kind::int_:
         locals.emplace_back(int_var());
         break;
@@ -157,6 +157,11 @@ inner_class::inner_class(const std::string_view& name, const std::optional<std::
                          const std::optional<std::string>& inner_name, uint16_t access_flags) :
     name(name), outer_name(outer_name), inner_name(inner_name), access_flags(access_flags) {
 }
+class_header::class_header(const std::string_view& name, const std::optional<std::string>& super_name,
+                           const std::vector<std::string>& interfaces) :
+    version(class_version::v8), access_flags(access_flag::acc_public), name(name), super_name(super_name),
+    interfaces(interfaces) {
+}
 class_file::class_file(uint32_t version, uint16_t access_flags, const std::string_view& name,
                        const std::optional<std::string>& super_name) :
     version(version), access_flags(access_flags), name(name), super_name(super_name) {
@@ -14,48 +14,28 @@ result<class_file> class_reader::read(data_reader&& reader) {
   }
   return file;
 }
+result<class_header> class_reader::read_class_header(data_reader&& reader) {
+  reader_ = std::move(reader);
+  pool_.clear();
+  class_header header;
+  if (const auto res = read_class_info(header); !res) {
+    return res.err();
+  }
+  return header;
+}
 result<void> class_reader::read(data_reader&& reader, class_file& file) {
   reader_ = std::move(reader);
   pool_.clear();
   label_count_ = 0;
-  if (const auto res = read_header(); !res) {
+  class_header header;
+  if (const auto res = read_class_info(header); !res) {
     return res.err();
   }
-  file.version = class_version_;
-  const auto access_flags = reader_.read_u16();
-  if (!access_flags) {
-    return access_flags.err();
-  }
-  file.access_flags = access_flags.value();
-  const auto this_class = get_string(reader_.read_u16());
-  if (!this_class) {
-    return this_class.err();
-  }
-  file.name = this_class.value();
-  const auto super_name_index = reader_.read_u16();
-  if (!super_name_index) {
-    return super_name_index.err();
-  }
-  if (super_name_index.value() != 0) {
-    const auto super_name = get_string(super_name_index.value());
-    if (!super_name) {
-      return super_name.err();
-    }
-    file.super_name = super_name.value();
-  }
-  const auto interfaces_count_res = reader_.read_u16();
-  if (!interfaces_count_res) {
-    return interfaces_count_res.err();
-  }
-  const auto interfaces_count = interfaces_count_res.value();
-  file.interfaces.reserve(interfaces_count);
-  for (auto i = 0; i < interfaces_count; i++) {
-    const auto interface = get_string(reader_.read_u16());
-    if (!interface) {
-      return interface.err();
-    }
-    file.interfaces.emplace_back(interface.value());
-  }
+  file.version = header.version;
+  file.access_flags = header.access_flags;
+  file.name = std::move(header.name);
+  file.super_name = std::move(header.super_name);
+  file.interfaces = std::move(header.interfaces);
 
   const auto fields_count_res = reader_.read_u16();
   if (!fields_count_res) {
@@ -227,10 +207,8 @@ result<void> class_reader::read(data_reader&& reader, class_file& file) {
         if (!num_bootstrap_arguments) {
           goto fail;
         }
-        for (auto k = 0; k < num_bootstrap_arguments.value(); k++) {
-          if (!reader_.skip(2)) {
-            goto fail;
-          }
+        if (!reader_.skip(num_bootstrap_arguments.value() * 2)) {
+          goto fail;
         }
       }
     } else if (attribute_name == "Module") {
@@ -676,15 +654,11 @@ result<void> class_reader::read_code(code& code, uint32_t code_length) {
           return npairs_res.err();
         }
         const auto npairs = npairs_res.value();
+        if (npairs < 0 || !reader_.read_i32s(i32_cache_, static_cast<size_t>(npairs) * 2)) {
+          return error("Failed to read code");
+        }
         for (auto i = 0; i < npairs; i++) {
-          if (!reader_.skip(4)) {
-            return error("Failed to read code");
-          }
-          offset = reader_.read_i32();
-          if (!offset) {
-            return offset.err();
-          }
-          get_label(labels, insn_start + offset.value());
+          get_label(labels, insn_start + i32_cache_[i * 2 + 1]);
         }
         break;
       }
@@ -712,12 +686,15 @@ result<void> class_reader::read_code(code& code, uint32_t code_length) {
         if (!high) {
           return high.err();
         }
-        for (auto i = low.value(); i <= high.value(); i++) {
-          offset = reader_.read_i32();
-          if (!offset) {
-            return offset.err();
-          }
-          get_label(labels, insn_start + offset.value());
+        if (high.value() < low.value()) {
+          return error("Failed to read code");
+        }
+        const auto count = static_cast<size_t>(static_cast<int64_t>(high.value()) - low.value() + 1);
+        if (!reader_.read_i32s(i32_cache_, count)) {
+          return error("Failed to read code");
+        }
+        for (const auto target : i32_cache_) {
+          get_label(labels, insn_start + target);
         }
         break;
       }
@@ -737,30 +714,19 @@ result<void> class_reader::read_code(code& code, uint32_t code_length) {
     return exception_table_length_res.err();
   }
   const auto exception_table_length = exception_table_length_res.value();
+  if (!reader_.read_u16s(u16_cache_, exception_table_length * 4)) {
+    return error("Failed to read exception table");
+  }
   code.tcbs.reserve(exception_table_length);
   for (auto i = 0; i < exception_table_length; i++) {
-    auto offset = reader_.read_u16();
-    if (!offset) {
-      return offset.err();
-    }
-    const auto start = get_label(labels, offset.value());
-    offset = reader_.read_u16();
-    if (!offset) {
-      return offset.err();
-    }
-    const auto end = get_label(labels, offset.value());
-    offset = reader_.read_u16();
-    if (!offset) {
-      return offset.err();
-    }
-    const auto handler = get_label(labels, offset.value());
-    const auto catch_type_index = reader_.read_u16();
-    if (!catch_type_index) {
-      return catch_type_index.err();
-    }
+    const auto entry = u16_cache_.data() + i * 4;
+    const auto start = get_label(labels, entry[0]);
+    const auto end = get_label(labels, entry[1]);
+    const auto handler = get_label(labels, entry[2]);
+    const auto catch_type_index = entry[3];
     std::optional<std::string> catch_type = std::nullopt;
-    if (catch_type_index.value() != 0) {
-      auto type_res = get_string(catch_type_index.value());
+    if (catch_type_index != 0) {
+      auto type_res = get_string(catch_type_index);
       if (!type_res) {
         return type_res.err();
       }
@@ -793,18 +759,13 @@ result<void> class_reader::read_code(code& code, uint32_t code_length) {
         goto fail;
       }
       const auto line_number_table_length = line_number_table_length_res.value();
+      if (!reader_.read_u16s(u16_cache_, line_number_table_length * 2)) {
+        goto fail;
+      }
       code.line_numbers.reserve(line_number_table_length);
       for (auto j = 0; j < line_number_table_length; j++) {
-        const auto start_pc_res = reader_.read_u16();
-        if (!start_pc_res) {
-          goto fail;
-        }
-        const auto start_pc = start_pc_res.value();
-        const auto line_number_res = reader_.read_u16();
-        if (!line_number_res) {
-          goto fail;
-        }
-        const auto line_number = line_number_res.value();
+        const auto start_pc = u16_cache_[j * 2];
+        const auto line_number = u16_cache_[j * 2 + 1];
         const auto start_label = get_label(labels, start_pc);
         code.line_numbers.emplace_back(line_number, start_label);
       }
@@ -817,32 +778,24 @@ result<void> class_reader::read_code(code& code, uint32_t code_length) {
       if (!should_search_local) {
         code.locals.reserve(local_variable_table_length);
       }
+      if (!reader_.read_u16s(u16_cache_, local_variable_table_length * 5)) {
+        goto fail;
+      }
       for (auto j = 0; j < local_variable_table_length; j++) {
-        const auto start_pc_res = reader_.read_u16();
-        if (!start_pc_res) {
-          goto fail;
-        }
-        const auto start_pc = start_pc_res.value();
-        const auto length_res = reader_.read_u16();
-        if (!length_res) {
-          goto fail;
-        }
-        const auto length = length_res.value();
+        const auto entry = u16_cache_.data() + j * 5;
+        const auto start_pc = entry[0];
+        const auto length = entry[1];
         const auto start = get_label(labels, start_pc);
         const auto end = get_label(labels, start_pc + length);
-        const auto name = get_string(reader_.read_u16());
+        const auto name = get_string(entry[2]);
         if (!name) {
           goto fail;
         }
-        const auto desc = get_string(reader_.read_u16());
+        const auto desc = get_string(entry[3]);
         if (!desc) {
           goto fail;
         }
-        const auto index_res = reader_.read_u16();
-        if (!index_res) {
-          goto fail;
-        }
-        const auto index = index_res.value();
+        const auto index = entry[4];
         if (should_search_local) {
           bool found = false;
           for (auto& local : code.locals) {
@@ -868,32 +821,24 @@ result<void> class_reader::read_code(code& code, uint32_t code_length) {
       if (!should_search_local) {
         code.locals.reserve(local_variable_type_table_length);
       }
+      if (!reader_.read_u16s(u16_cache_, local_variable_type_table_length * 5)) {
+        goto fail;
+      }
       for (auto j = 0; j < local_variable_type_table_length; j++) {
-        const auto start_pc_res = reader_.read_u16();
-        if (!start_pc_res) {
-          goto fail;
-        }
-        const auto start_pc = start_pc_res.value();
-        const auto length_res = reader_.read_u16();
-        if (!length_res) {
-          goto fail;
-        }
-        const auto length = length_res.value();
+        const auto entry = u16_cache_.data() + j * 5;
+        const auto start_pc = entry[0];
+        const auto length = entry[1];
         const auto start = get_label(labels, start_pc);
         const auto end = get_label(labels, start_pc + length);
-        const auto name = get_string(reader_.read_u16());
+        const auto name = get_string(entry[2]);
         if (!name) {
           goto fail;
         }
-        const auto signature = get_string(reader_.read_u16());
+        const auto signature = get_string(entry[3]);
         if (!signature) {
           goto fail;
         }
-        const auto index_res = reader_.read_u16();
-        if (!index_res) {
-          goto fail;
-        }
-        const auto index = index_res.value();
+        const auto index = entry[4];
         if (should_search_local) {
           bool found = false;
           for (auto& local : code.locals) {
@@ -1444,13 +1389,8 @@ result<void> class_reader::read_code(code& code, uint32_t code_length) {
           }
           const auto arg_count = arg_count_res.value();
           std::vector<uint16_t> arg_indices;
-          arg_indices.reserve(arg_count);
-          for (auto i = 0; i < arg_count; i++) {
-            const auto arg = reader_.read_u16();
-            if (!arg) {
-              return arg.err();
-            }
-            arg_indices.emplace_back(arg.value());
+          if (!reader_.read_u16s(arg_indices, arg_count)) {
+            return error("Invalid invoke dynamic instruction");
           }
           if (!reader_.cursor(curr)) {
             return error("Invalid invoke dynamic instruction");
@@ -1519,18 +1459,12 @@ result<void> class_reader::read_code(code& code, uint32_t code_length) {
           return npairs_res.err();
         }
         const auto npairs = npairs_res.value();
+        if (npairs < 0 || !reader_.read_i32s(i32_cache_, static_cast<size_t>(npairs) * 2)) {
+          return error("Invalid lookup switch instruction");
+        }
         pairs.reserve(npairs);
         for (auto i = 0; i < npairs; i++) {
-          const auto match = reader_.read_i32();
-          if (!match) {
-            return match.err();
-          }
-          offset = reader_.read_i32();
-          if (!offset) {
-            return offset.err();
-          }
-          const auto target = get_label(labels, insn_start + offset.value());
-          pairs.emplace_back(match.value(), target);
+          pairs.emplace_back(i32_cache_[i * 2], get_label(labels, insn_start + i32_cache_[i * 2 + 1]));
         }
         code.add_lookup_switch_insn(default_target, pairs);
         break;
@@ -1575,14 +1509,16 @@ result<void> class_reader::read_code(code& code, uint32_t code_length) {
         }
         const auto low = low_res.value();
         const auto high = high_res.value();
+        if (high < low) {
+          return error("Invalid table switch instruction");
+        }
+        if (!reader_.read_i32s(i32_cache_, static_cast<size_t>(static_cast<int64_t>(high) - low + 1))) {
+          return error("Invalid table switch instruction");
+        }
         std::vector<label> targets;
-        targets.reserve(high - low + 1);
-        for (auto i = low; i <= high; i++) {
-          offset = reader_.read_i32();
-          if (!offset) {
-            return offset.err();
-          }
-          targets.emplace_back(get_label(labels, insn_start + offset.value()));
+        targets.reserve(i32_cache_.size());
+        for (const auto target : i32_cache_) {
+          targets.emplace_back(get_label(labels, insn_start + target));
         }
         code.add_table_switch_insn(default_target, low, high, targets);
         break;
@@ -2110,6 +2046,50 @@ result<void> class_reader::read_record(class_file& file) {
   }
   return {};
 }
+result<void> class_reader::read_class_info(class_header& header) {
+  if (const auto res = read_header(); !res) {
+    return res.err();
+  }
+  header.version = class_version_;
+  const auto access_flags = reader_.read_u16();
+  if (!access_flags) {
+    return access_flags.err();
+  }
+  header.access_flags = access_flags.value();
+  const auto this_class = get_string(reader_.read_u16());
+  if (!this_class) {
+    return this_class.err();
+  }
+  header.name = this_class.value();
+  const auto super_name_index = reader_.read_u16();
+  if (!super_name_index) {
+    return super_name_index.err();
+  }
+  if (super_name_index.value() != 0) {
+    const auto super_name = get_string(super_name_index.value());
+    if (!super_name) {
+      return super_name.err();
+    }
+    header.super_name = super_name.value();
+  }
+  const auto interfaces_count_res = reader_.read_u16();
+  if (!interfaces_count_res) {
+    return interfaces_count_res.err();
+  }
+  const auto interfaces_count = interfaces_count_res.value();
+  if (!reader_.read_u16s(u16_cache_, interfaces_count)) {
+    return error("Failed to read interfaces");
+  }
+  header.interfaces.reserve(interfaces_count);
+  for (const auto index : u16_cache_) {
+    const auto interface = get_string(index);
+    if (!interface) {
+      return interface.err();
+    }
+    header.interfaces.emplace_back(interface.value());
+  }
+  return {};
+}
 result<void> class_reader::read_header() {
   const auto magic_res = reader_.read_u32();
   if (const auto magic = magic_res.value(); magic != 0xcafebabe) {
@@ -2804,13 +2784,8 @@ result<value> class_reader::get_constant(uint16_t index) {
     }
     const auto arg_count = arg_count_res.value();
     std::vector<uint16_t> arg_indices;
-    arg_indices.reserve(arg_count);
-    for (auto i = 0; i < arg_count; i++) {
-      const auto arg = reader_.read_u16();
-      if (!arg) {
-        return arg.err();
-      }
-      arg_indices.emplace_back(arg.value());
+    if (!reader_.read_u16s(arg_indices, arg_count)) {
+      return error("Invalid bootstrap method arguments");
     }
     if (!reader_.cursor(curr)) {
       return error("Failed to reset cursor");
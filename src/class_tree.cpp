@@ -1,45 +1,391 @@
 #include "cafe/class_tree.hpp"
 
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <mutex>
+
+#include "cafe/class_reader.hpp"
+#include "cafe/class_tree_snapshot.hpp"
 #include "gen/gen_class_tree.hpp"
 
 namespace cafe {
+namespace {
+constexpr size_t concurrent_shard_count = 64;
+constexpr size_t initial_index_capacity = 16;
+}
+class_tree::published_index::published_index(size_t capacity) :
+    slots(std::make_unique<std::atomic<node*>[]>(capacity)), capacity(capacity) {
+  for (size_t i = 0; i < capacity; i++) {
+    slots[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
 class_tree::node::node(const std::string_view& name) : name(name), super_class(nullptr) {
 }
 
 class_tree::node::node(const std::string_view& name, node* super_class, const std::vector<node*>& interfaces) :
     name(name), super_class(super_class), interfaces(interfaces) {
 }
-class_tree::class_tree(load_rt_t) {
+class_tree::node::node(const node& other) :
+    name(other.name), super_class(other.super_class), interfaces(other.interfaces), subclasses(other.subclasses),
+    implementors(other.implementors), state_(other.state_.load(std::memory_order_acquire)) {
+}
+class_tree::node::node(node&& other) noexcept :
+    name(std::move(other.name)), super_class(other.super_class), interfaces(std::move(other.interfaces)),
+    subclasses(std::move(other.subclasses)), implementors(std::move(other.implementors)), state_(other.state_.load(std::memory_order_acquire)) {
+}
+class_tree::node& class_tree::node::operator=(const node& other) {
+  name = other.name;
+  super_class = other.super_class;
+  interfaces = other.interfaces;
+  subclasses = other.subclasses;
+  implementors = other.implementors;
+  state_.store(other.state_.load(std::memory_order_acquire), std::memory_order_release);
+  return *this;
+}
+class_tree::node& class_tree::node::operator=(node&& other) noexcept {
+  name = std::move(other.name);
+  super_class = other.super_class;
+  interfaces = std::move(other.interfaces);
+  subclasses = std::move(other.subclasses);
+  implementors = std::move(other.implementors);
+  state_.store(other.state_.load(std::memory_order_acquire), std::memory_order_release);
+  return *this;
+}
+bool class_tree::node::resolved() const {
+  return state_.load(std::memory_order_acquire) == published;
+}
+class_tree::subtype_iterator::subtype_iterator(const class_tree* tree, const node* root) : tree_(tree) {
+  visited_.emplace(root);
+  push_children(root);
+}
+class_tree::subtype_iterator::reference class_tree::subtype_iterator::operator*() const {
+  return stack_.back();
+}
+class_tree::subtype_iterator::pointer class_tree::subtype_iterator::operator->() const {
+  return &stack_.back();
+}
+class_tree::subtype_iterator& class_tree::subtype_iterator::operator++() {
+  const auto n = stack_.back();
+  stack_.pop_back();
+  push_children(n);
+  return *this;
+}
+class_tree::subtype_iterator class_tree::subtype_iterator::operator++(int) {
+  auto copy = *this;
+  ++*this;
+  return copy;
+}
+bool class_tree::subtype_iterator::operator==(const subtype_iterator& other) const {
+  if (stack_.empty() || other.stack_.empty()) {
+    return stack_.empty() == other.stack_.empty();
+  }
+  return stack_.size() == other.stack_.size() && stack_.back() == other.stack_.back();
+}
+bool class_tree::subtype_iterator::operator!=(const subtype_iterator& other) const {
+  return !(*this == other);
+}
+void class_tree::subtype_iterator::push_children(const node* n) {
+  std::vector<node*> children;
+  tree_->children_of(n->name, children);
+  for (auto it = children.rbegin(); it != children.rend(); ++it) {
+    if (visited_.emplace(*it).second) {
+      stack_.emplace_back(*it);
+    }
+  }
+}
+class_tree::subtype_range::subtype_range(const class_tree* tree, const node* root) : tree_(tree), root_(root) {
+}
+class_tree::subtype_iterator class_tree::subtype_range::begin() const {
+  return root_ != nullptr ? subtype_iterator(tree_, root_) : subtype_iterator();
+}
+class_tree::subtype_iterator class_tree::subtype_range::end() const {
+  return {};
+}
+class_tree::class_tree() : shards_(std::make_unique<shard[]>(1)) {
+}
+class_tree::class_tree(load_rt_t) : class_tree() {
   put_rt(*this);
 }
-class_tree::node* class_tree::get_or_create(const std::string& name) {
-  if (const auto it = tree_.find(name); it != tree_.end()) {
+class_tree::class_tree(concurrent_t) :
+    shards_(std::make_unique<shard[]>(concurrent_shard_count)), shard_count_(concurrent_shard_count),
+    concurrent_(true) {
+}
+class_tree::class_tree(load_rt_t, concurrent_t) : class_tree(concurrent_t{}) {
+  put_rt(*this);
+}
+class_tree::class_tree(std::shared_ptr<const class_tree> base) : class_tree() {
+  base_ = std::move(base);
+}
+class_tree::class_tree(std::shared_ptr<const class_tree> base, concurrent_t) : class_tree(concurrent_t{}) {
+  base_ = std::move(base);
+}
+size_t class_tree::hash_of(const std::string& name) const {
+  return std::hash<std::string>{}(name);
+}
+class_tree::shard& class_tree::shard_of(const std::string& name) const {
+  if (shard_count_ == 1) {
+    return shards_[0];
+  }
+  return shards_[hash_of(name) % shard_count_];
+}
+void class_tree::wait_published(const node* n) const {
+  if (!concurrent_ || n->state_.load(std::memory_order_acquire) != node::publishing) {
+    return;
+  }
+  auto& s = shard_of(n->name);
+  std::unique_lock lock(s.mutex);
+  s.resolved.wait(lock, [n] { return n->state_.load(std::memory_order_acquire) == node::published; });
+}
+class_tree::node* class_tree::super_of(const node* n) const {
+  wait_published(n);
+  // Overlays reach every node through get(), which already resolved it and must not publish into base nodes.
+  if (resolver_ && !base_ && !n->resolved()) {
+    resolve(n->name, const_cast<node*>(n));
+  }
+  // Only a concurrent tree may have another thread writing the edges of a node that is not published yet. Elsewhere they
+  // can also have been set directly on a node from get_or_create().
+  if ((concurrent_ && !n->resolved()) || n->super_class == nullptr) {
+    return nullptr;
+  }
+  return base_ ? get(n->super_class->name) : n->super_class;
+}
+const std::vector<class_tree::node*>* class_tree::interfaces_of(const node* n) const {
+  wait_published(n);
+  if (resolver_ && !base_ && !n->resolved()) {
+    resolve(n->name, const_cast<node*>(n));
+  }
+  return !concurrent_ || n->resolved() ? &n->interfaces : nullptr;
+}
+class_tree::node* class_tree::find(const std::string& name) const {
+  const auto& s = shard_of(name);
+  std::shared_lock lock(s.mutex, std::defer_lock);
+  if (concurrent_) {
+    lock.lock();
+  }
+  const auto it = s.map.find(name);
+  return it != s.map.end() ? it->second.get() : nullptr;
+}
+class_tree::node* class_tree::find_published(const std::string& name) const {
+  const auto index = shard_of(name).index.load(std::memory_order_acquire);
+  if (index == nullptr) {
+    return nullptr;
+  }
+  // The low bits of the hash pick the shard, so the slot comes from the rest. The table is at most half full.
+  const auto mask = index->capacity - 1;
+  for (auto i = (hash_of(name) / shard_count_) & mask;; i = (i + 1) & mask) {
+    const auto n = index->slots[i].load(std::memory_order_acquire);
+    if (n == nullptr || n->name == name) {
+      return n;
+    }
+  }
+}
+void class_tree::add_published(node* n) const {
+  auto& s = shard_of(n->name);
+  const auto place = [this](published_index& index, node* entry) {
+    const auto mask = index.capacity - 1;
+    auto i = (hash_of(entry->name) / shard_count_) & mask;
+    while (index.slots[i].load(std::memory_order_relaxed) != nullptr) {
+      i = (i + 1) & mask;
+    }
+    index.slots[i].store(entry, std::memory_order_release);
+    index.count++;
+  };
+  std::unique_lock lock(s.mutex);
+  auto index = s.index.load(std::memory_order_relaxed);
+  if (index == nullptr || (index->count + 1) * 2 > index->capacity) {
+    auto grown = std::make_unique<published_index>(index != nullptr ? index->capacity * 2 : initial_index_capacity);
+    if (index != nullptr) {
+      for (size_t i = 0; i < index->capacity; i++) {
+        if (const auto entry = index->slots[i].load(std::memory_order_relaxed)) {
+          place(*grown, entry);
+        }
+      }
+    }
+    index = s.indices.emplace_back(std::move(grown)).get();
+    s.index.store(index, std::memory_order_release);
+  }
+  place(*index, n);
+}
+class_tree::node* class_tree::insert(const std::string& name) const {
+  auto& s = shard_of(name);
+  if (concurrent_) {
+    {
+      std::shared_lock lock(s.mutex);
+      if (const auto it = s.map.find(name); it != s.map.end()) {
+        return it->second.get();
+      }
+    }
+    std::unique_lock lock(s.mutex);
+    const auto [it, inserted] = s.map.try_emplace(name, nullptr);
+    if (inserted) {
+      it->second = std::make_unique<node>(name);
+    }
     return it->second.get();
   }
-  if (const auto [it, pass] = tree_.emplace(name, std::make_unique<node>(name)); pass) {
+  if (const auto it = s.map.find(name); it != s.map.end()) {
+    return it->second.get();
+  }
+  if (const auto [it, pass] = s.map.emplace(name, std::make_unique<node>(name)); pass) {
     return it->second.get();
   }
   return nullptr;
 }
-void class_tree::put(const std::string& name, const std::optional<std::string>& super_name,
-                           const std::vector<std::string>& interfaces) {
-  const auto node = get_or_create(name);
+void class_tree::publish(node* n, const std::optional<std::string>& super_name,
+                         const std::vector<std::string>& interfaces) const {
+  if (concurrent_) {
+    auto expected = node::placeholder;
+    if (!n->state_.compare_exchange_strong(expected, node::publishing, std::memory_order_acq_rel)) {
+      // Another thread won, wait for its links so that the caller never sees a half published node.
+      wait_published(n);
+      return;
+    }
+  } else if (n->resolved()) {
+    unlink(n);
+  }
   if (super_name) {
-    node->super_class = get_or_create(*super_name);
+    n->super_class = insert(*super_name);
   } else {
-    node->super_class = nullptr;
+    n->super_class = nullptr;
   }
-  node->interfaces.clear();
+  n->interfaces.clear();
   for (const auto& interface : interfaces) {
-    node->interfaces.emplace_back(get_or_create(interface));
+    n->interfaces.emplace_back(insert(interface));
+  }
+  link(n);
+  n->state_.store(node::published, std::memory_order_release);
+  if (concurrent_) {
+    // Adding the node takes the shard lock, so a thread that saw it publishing is already waiting when notified.
+    add_published(n);
+    shard_of(n->name).resolved.notify_all();
+  }
+}
+void class_tree::link(node* n) const {
+  const auto add = [this, n](node* parent, std::vector<node*>& children) {
+    std::unique_lock lock(shard_of(parent->name).mutex, std::defer_lock);
+    if (concurrent_) {
+      lock.lock();
+    }
+    children.emplace_back(n);
+  };
+  if (n->super_class != nullptr) {
+    add(n->super_class, n->super_class->subclasses);
+  }
+  for (const auto interface : n->interfaces) {
+    add(interface, interface->implementors);
   }
 }
+void class_tree::unlink(node* n) const {
+  const auto remove = [n](std::vector<node*>& children) {
+    if (const auto it = std::find(children.begin(), children.end(), n); it != children.end()) {
+      children.erase(it);
+    }
+  };
+  if (n->super_class != nullptr) {
+    remove(n->super_class->subclasses);
+  }
+  for (const auto interface : n->interfaces) {
+    remove(interface->implementors);
+  }
+}
+class_tree::node* class_tree::resolve(const std::string& name, node* existing) const {
+  if (name.empty() || name[0] == '[') {
+    return existing;
+  }
+  auto& s = shard_of(name);
+  if (concurrent_) {
+    std::unique_lock lock(s.mutex);
+    s.resolved.wait(lock, [&s, &name] { return s.pending.find(name) == s.pending.end(); });
+    if (s.missing.find(name) != s.missing.end()) {
+      return existing;
+    }
+    if (const auto it = s.map.find(name); it != s.map.end() && it->second->resolved()) {
+      return it->second.get();
+    }
+    s.pending.emplace(name);
+  } else if (s.missing.find(name) != s.missing.end()) {
+    return existing;
+  }
+  // Waiting threads are released even if the resolver throws.
+  struct done_guard {
+    const class_tree& tree;
+    shard& s;
+    const std::string& name;
+    bool missing = false;
+    ~done_guard() {
+      {
+        std::unique_lock lock(s.mutex, std::defer_lock);
+        if (tree.concurrent_) {
+          lock.lock();
+        }
+        if (missing) {
+          s.missing.emplace(name);
+        }
+        s.pending.erase(name);
+      }
+      s.resolved.notify_all();
+    }
+  } done{*this, s, name};
+  const auto header = resolver_(name);
+  if (!header) {
+    done.missing = true;
+    return existing;
+  }
+  const auto n = existing != nullptr ? existing : insert(name);
+  publish(n, header->super_name, header->interfaces);
+  return n;
+}
+class_tree::node* class_tree::get_or_create(const std::string& name) {
+  return insert(name);
+}
+void class_tree::put(const std::string& name, const std::optional<std::string>& super_name,
+                           const std::vector<std::string>& interfaces) {
+  publish(insert(name), super_name, interfaces);
+}
 void class_tree::put(const class_file& file) {
   put(file.name, file.super_name, file.interfaces);
 }
 class_tree::node* class_tree::get(const std::string& name) const {
-  const auto it = tree_.find(name);
-  return it != tree_.end() ? it->second.get() : nullptr;
+  if (concurrent_) {
+    if (const auto n = find_published(name)) {
+      return n;
+    }
+  }
+  const auto n = find(name);
+  if (n != nullptr) {
+    wait_published(n);
+    if (n->resolved()) {
+      return n;
+    }
+  }
+  if (base_) {
+    if (const auto base_node = base_->get(name); base_node != nullptr) {
+      return base_node;
+    }
+  }
+  if (resolver_) {
+    return resolve(name, n);
+  }
+  return n;
+}
+void class_tree::children_of(const std::string& name, std::vector<node*>& children) const {
+  if (const auto n = find(name); n != nullptr) {
+    std::shared_lock lock(shard_of(name).mutex, std::defer_lock);
+    if (concurrent_) {
+      lock.lock();
+    }
+    children.insert(children.end(), n->subclasses.begin(), n->subclasses.end());
+    children.insert(children.end(), n->implementors.begin(), n->implementors.end());
+  }
+  if (base_) {
+    std::vector<node*> base_children;
+    base_->children_of(name, base_children);
+    for (const auto child : base_children) {
+      if (get(child->name) == child) {
+        children.emplace_back(child);
+      }
+    }
+  }
 }
 bool class_tree::is_assignable_from(const std::string& from, const std::string& to) const {
   if (from == to) {
@@ -74,28 +420,48 @@ bool class_tree::is_assignable_from(const std::string& from, const std::string&
   if (to_node == nullptr) {
     return false;
   }
-  auto curr = to_node->super_class;
+  auto curr = super_of(to_node);
   while (curr != nullptr) {
     if (from == curr->name) {
       return true;
     }
-    curr = curr->super_class;
+    curr = super_of(curr);
   }
 
-  curr = to_node;
-  while (curr != nullptr) {
-    for (const auto& interface : curr->interfaces) {
-      if (from == interface->name) {
-        return true;
-      }
-      if (is_assignable_from(from, interface->name)) {
-        return true;
+  const node* iface_curr = to_node;
+  while (iface_curr != nullptr) {
+    if (const auto interfaces = interfaces_of(iface_curr)) {
+      for (const auto& interface : *interfaces) {
+        if (from == interface->name) {
+          return true;
+        }
+        if (is_assignable_from(from, interface->name)) {
+          return true;
+        }
       }
     }
-    curr = curr->super_class;
+    iface_curr = super_of(iface_curr);
   }
   return false;
 }
+class_tree::subtype_range class_tree::subtypes(const std::string& name) const {
+  return subtype_range(this, get(name));
+}
+std::string class_tree::common_super_class(const std::string& first, const std::string& second) const {
+  if (is_assignable_from(first, second)) {
+    return first;
+  }
+  if (is_assignable_from(second, first)) {
+    return second;
+  }
+  const node* curr = get(first);
+  do {
+    if (curr != nullptr) {
+      curr = super_of(curr);
+    }
+  } while (curr != nullptr && !is_assignable_from(curr->name, second));
+  return curr == nullptr ? "java/lang/Object" : curr->name;
+}
 
 bool class_tree::is_primitive(const std::string_view& name) const {
   if (name.empty()) {
@@ -117,23 +483,71 @@ bool class_tree::is_primitive(const std::string_view& name) const {
   }
 }
 
+bool class_tree::concurrent() const {
+  return concurrent_;
+}
+bool class_tree::concurrent_lookups() const {
+  return (concurrent_ || !resolver_) && (!base_ || base_->concurrent_lookups());
+}
+const std::shared_ptr<const class_tree>& class_tree::base() const {
+  return base_;
+}
+void class_tree::set_resolver(resolver res) {
+  resolver_ = std::move(res);
+}
+result<class_tree> class_tree::load_release(const std::string& directory, uint32_t release) {
+  auto snapshot = class_tree_snapshot::open(directory + "/" + class_tree_snapshot::release_file_name(release));
+  if (!snapshot) {
+    return snapshot.err();
+  }
+  auto shared = std::make_shared<const class_tree_snapshot>(std::move(snapshot.value()));
+  class_tree tree(concurrent_t{});
+  tree.set_resolver(class_tree_snapshot::resolver(std::move(shared)));
+  return tree;
+}
+class_tree::resolver class_tree::directory_resolver(const std::vector<std::string>& directories) {
+  return [directories](const std::string& name) -> std::optional<class_header> {
+    for (const auto& directory : directories) {
+      std::ifstream stream(directory + "/" + name + ".class", std::ios::binary);
+      if (!stream) {
+        continue;
+      }
+      class_reader reader;
+      if (auto header = reader.read_class_header(data_reader(stream))) {
+        return std::move(header.value());
+      }
+    }
+    return std::nullopt;
+  };
+}
 size_t class_tree::size() const {
-  return tree_.size();
+  size_t size = 0;
+  for (size_t i = 0; i < shard_count_; i++) {
+    std::shared_lock lock(shards_[i].mutex, std::defer_lock);
+    if (concurrent_) {
+      lock.lock();
+    }
+    size += shards_[i].map.size();
+  }
+  return size;
 }
-class_tree::map_type::const_iterator
-class_tree::begin() const {
-  return tree_.begin();
+class_tree::const_iterator class_tree::begin() const {
+  const shard* first = shards_.get();
+  return {first, first + shard_count_, first->map.begin()};
 }
-class_tree::map_type::const_iterator class_tree::end() const {
-  return tree_.end();
+class_tree::const_iterator class_tree::end() const {
+  const shard* last = shards_.get() + shard_count_;
+  return {last, last, {}};
 }
-class_tree::map_type::iterator class_tree::begin() {
-  return tree_.begin();
+class_tree::iterator class_tree::begin() {
+  shard* first = shards_.get();
+  return {first, first + shard_count_, first->map.begin()};
 }
-class_tree::map_type::iterator class_tree::end() {
-  return tree_.end();
+class_tree::iterator class_tree::end() {
+  shard* last = shards_.get() + shard_count_;
+  return {last, last, {}};
 }
 bool class_tree::empty() const {
-  return tree_.empty();
+  return size() == 0;
+}
 }
-}
\ No newline at end of file
@@ -0,0 +1,476 @@
+#include "cafe/class_tree_snapshot.hpp"
+
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include "cafe/data_writer.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CAFE_SNAPSHOT_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cafe {
+namespace {
+constexpr uint32_t snapshot_magic = 0x43414654;
+constexpr size_t header_size = 40;
+constexpr uint32_t record_size = 24;
+constexpr uint32_t name_offset_field = 0;
+constexpr uint32_t name_length_field = 1;
+constexpr uint32_t super_field = 2;
+constexpr uint32_t interfaces_start_field = 3;
+constexpr uint32_t interfaces_count_field = 4;
+constexpr uint32_t flags_field = 5;
+constexpr uint32_t resolved_flag = 1;
+
+uint32_t hash_name(const std::string_view& name) {
+  uint32_t hash = 2166136261u;
+  for (const auto c : name) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+  }
+  return hash;
+}
+
+bool is_primitive(const std::string_view& name) {
+  if (name.empty()) {
+    return false;
+  }
+  switch (name[0]) {
+    case 'V':
+    case 'Z':
+    case 'B':
+    case 'C':
+    case 'S':
+    case 'I':
+    case 'J':
+    case 'F':
+    case 'D':
+      return true;
+    default:
+      return false;
+  }
+}
+} // namespace
+
+class_tree_snapshot::~class_tree_snapshot() {
+  release();
+}
+class_tree_snapshot::class_tree_snapshot(class_tree_snapshot&& other) noexcept :
+    data_(other.data_), size_(other.size_), mapping_(other.mapping_), buffer_(std::move(other.buffer_)),
+    class_count_(other.class_count_), bucket_count_(other.bucket_count_), strings_offset_(other.strings_offset_),
+    strings_size_(other.strings_size_), interface_total_(other.interface_total_),
+    classes_offset_(other.classes_offset_), interfaces_offset_(other.interfaces_offset_),
+    buckets_offset_(other.buckets_offset_) {
+  if (mapping_ == nullptr) {
+    data_ = reinterpret_cast<const uint8_t*>(buffer_.data());
+  }
+  other.data_ = nullptr;
+  other.size_ = 0;
+  other.mapping_ = nullptr;
+  other.class_count_ = 0;
+  other.bucket_count_ = 0;
+}
+class_tree_snapshot& class_tree_snapshot::operator=(class_tree_snapshot&& other) noexcept {
+  if (this != &other) {
+    release();
+    data_ = other.data_;
+    size_ = other.size_;
+    mapping_ = other.mapping_;
+    buffer_ = std::move(other.buffer_);
+    if (mapping_ == nullptr) {
+      data_ = reinterpret_cast<const uint8_t*>(buffer_.data());
+    }
+    class_count_ = other.class_count_;
+    bucket_count_ = other.bucket_count_;
+    strings_offset_ = other.strings_offset_;
+    strings_size_ = other.strings_size_;
+    interface_total_ = other.interface_total_;
+    classes_offset_ = other.classes_offset_;
+    interfaces_offset_ = other.interfaces_offset_;
+    buckets_offset_ = other.buckets_offset_;
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.mapping_ = nullptr;
+    other.class_count_ = 0;
+    other.bucket_count_ = 0;
+  }
+  return *this;
+}
+void class_tree_snapshot::release() {
+#ifdef CAFE_SNAPSHOT_MMAP
+  if (mapping_ != nullptr) {
+    munmap(mapping_, size_);
+  }
+#endif
+  mapping_ = nullptr;
+  data_ = nullptr;
+  size_ = 0;
+}
+
+std::vector<int8_t> class_tree_snapshot::serialize(const class_tree& tree) {
+  std::vector<const class_tree::node*> nodes;
+  std::unordered_map<const class_tree::node*, uint32_t> indices;
+  nodes.reserve(tree.size());
+  for (const auto& [name, node] : tree) {
+    indices.emplace(node.get(), static_cast<uint32_t>(nodes.size()));
+    nodes.emplace_back(node.get());
+  }
+  const auto index_of = [&indices](const class_tree::node* node) {
+    const auto it = indices.find(node);
+    return it != indices.end() ? it->second : no_class;
+  };
+
+  const auto class_count = static_cast<uint32_t>(nodes.size());
+  uint32_t bucket_count = 1;
+  while (bucket_count < class_count * 2) {
+    bucket_count <<= 1;
+  }
+  std::vector<uint32_t> buckets(bucket_count);
+  std::vector<int8_t> strings;
+  std::vector<int8_t> records;
+  std::vector<int8_t> interfaces;
+  records.reserve(class_count * record_size);
+  uint32_t interface_count = 0;
+  for (uint32_t i = 0; i < class_count; i++) {
+    const auto node = nodes[i];
+    data_writer::write_u32(records, static_cast<uint32_t>(strings.size()));
+    data_writer::write_u32(records, static_cast<uint32_t>(node->name.size()));
+    strings.insert(strings.end(), node->name.begin(), node->name.end());
+    const auto resolved = node->resolved();
+    data_writer::write_u32(records, resolved && node->super_class != nullptr ? index_of(node->super_class) : no_class);
+    data_writer::write_u32(records, interface_count);
+    uint32_t count = 0;
+    if (resolved) {
+      for (const auto interface : node->interfaces) {
+        if (const auto index = index_of(interface); index != no_class) {
+          data_writer::write_u32(interfaces, index);
+          count++;
+        }
+      }
+    }
+    interface_count += count;
+    data_writer::write_u32(records, count);
+    data_writer::write_u32(records, resolved ? resolved_flag : 0);
+
+    auto bucket = hash_name(node->name) & (bucket_count - 1);
+    while (buckets[bucket] != 0) {
+      bucket = (bucket + 1) & (bucket_count - 1);
+    }
+    buckets[bucket] = i + 1;
+  }
+
+  const auto strings_offset = static_cast<uint32_t>(header_size);
+  const auto classes_offset = strings_offset + static_cast<uint32_t>(strings.size());
+  const auto interfaces_offset = classes_offset + static_cast<uint32_t>(records.size());
+  const auto buckets_offset = interfaces_offset + static_cast<uint32_t>(interfaces.size());
+  std::vector<int8_t> data;
+  data.reserve(buckets_offset + bucket_count * 4);
+  data_writer::write_u32(data, snapshot_magic);
+  data_writer::write_u32(data, format_version);
+  data_writer::write_u32(data, class_count);
+  data_writer::write_u32(data, bucket_count);
+  data_writer::write_u32(data, strings_offset);
+  data_writer::write_u32(data, static_cast<uint32_t>(strings.size()));
+  data_writer::write_u32(data, classes_offset);
+  data_writer::write_u32(data, interfaces_offset);
+  data_writer::write_u32(data, interface_count);
+  data_writer::write_u32(data, buckets_offset);
+  data.insert(data.end(), strings.begin(), strings.end());
+  data.insert(data.end(), records.begin(), records.end());
+  data.insert(data.end(), interfaces.begin(), interfaces.end());
+  for (const auto bucket : buckets) {
+    data_writer::write_u32(data, bucket);
+  }
+  return data;
+}
+result<void> class_tree_snapshot::write(const class_tree& tree, const std::string& path) {
+  const auto data = serialize(tree);
+  std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+  if (!stream) {
+    return error("Failed to open " + path + " for writing");
+  }
+  stream.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+  if (!stream) {
+    return error("Failed to write " + path);
+  }
+  return {};
+}
+result<class_tree_snapshot> class_tree_snapshot::open(const std::string& path) {
+  class_tree_snapshot snapshot;
+#ifdef CAFE_SNAPSHOT_MMAP
+  const auto fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return error("Failed to open " + path);
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return error("Failed to read the size of " + path);
+  }
+  const auto size = static_cast<size_t>(st.st_size);
+  const auto mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return error("Failed to map " + path);
+  }
+  snapshot.mapping_ = mapping;
+  snapshot.data_ = static_cast<const uint8_t*>(mapping);
+  snapshot.size_ = size;
+#else
+  std::ifstream stream(path, std::ios::binary);
+  if (!stream) {
+    return error("Failed to open " + path);
+  }
+  snapshot.buffer_.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+  snapshot.data_ = reinterpret_cast<const uint8_t*>(snapshot.buffer_.data());
+  snapshot.size_ = snapshot.buffer_.size();
+#endif
+  if (const auto res = snapshot.load(); !res) {
+    return res.err();
+  }
+  return snapshot;
+}
+result<class_tree_snapshot> class_tree_snapshot::from_bytes(std::vector<int8_t>&& data) {
+  class_tree_snapshot snapshot;
+  snapshot.buffer_ = std::move(data);
+  snapshot.data_ = reinterpret_cast<const uint8_t*>(snapshot.buffer_.data());
+  snapshot.size_ = snapshot.buffer_.size();
+  if (const auto res = snapshot.load(); !res) {
+    return res.err();
+  }
+  return snapshot;
+}
+std::string class_tree_snapshot::release_file_name(uint32_t release) {
+  return "jdk" + std::to_string(release) + ".tree";
+}
+result<void> class_tree_snapshot::load() {
+  if (size_ < header_size) {
+    return error("Class tree snapshot is truncated");
+  }
+  if (read_u32(0) != snapshot_magic) {
+    return error("Invalid class tree snapshot magic");
+  }
+  if (const auto version = read_u32(4); version != format_version) {
+    return error("Unsupported class tree snapshot version " + std::to_string(version));
+  }
+  class_count_ = read_u32(8);
+  bucket_count_ = read_u32(12);
+  strings_offset_ = read_u32(16);
+  strings_size_ = read_u32(20);
+  classes_offset_ = read_u32(24);
+  interfaces_offset_ = read_u32(28);
+  interface_total_ = read_u32(32);
+  buckets_offset_ = read_u32(36);
+  const auto in_bounds = [this](uint64_t offset, uint64_t size) {
+    return offset >= header_size && offset + size <= size_;
+  };
+  if (bucket_count_ == 0 || (bucket_count_ & (bucket_count_ - 1)) != 0 || bucket_count_ < class_count_ ||
+      !in_bounds(strings_offset_, strings_size_) ||
+      !in_bounds(classes_offset_, static_cast<uint64_t>(class_count_) * record_size) ||
+      !in_bounds(interfaces_offset_, static_cast<uint64_t>(interface_total_) * 4) ||
+      !in_bounds(buckets_offset_, static_cast<uint64_t>(bucket_count_) * 4)) {
+    class_count_ = 0;
+    return error("Class tree snapshot sections are out of bounds");
+  }
+  // Only the header is checked here, so that opening a snapshot does not page in the whole file. Each record is checked
+  // when it is read.
+  return {};
+}
+uint32_t class_tree_snapshot::read_u32(size_t offset) const {
+  return static_cast<uint32_t>(data_[offset]) << 24 | static_cast<uint32_t>(data_[offset + 1]) << 16 |
+         static_cast<uint32_t>(data_[offset + 2]) << 8 | static_cast<uint32_t>(data_[offset + 3]);
+}
+uint32_t class_tree_snapshot::record(uint32_t index, uint32_t field) const {
+  return read_u32(classes_offset_ + static_cast<size_t>(index) * record_size + field * 4);
+}
+
+class_tree::resolver class_tree_snapshot::resolver(std::shared_ptr<const class_tree_snapshot> snapshot) {
+  return [snapshot = std::move(snapshot)](const std::string& name) -> std::optional<class_header> {
+    const auto index = snapshot->find(name);
+    // The walks in class_tree follow super classes and interfaces without a bound, so a class that leads into a cycle
+    // is never handed out.
+    if (index == no_class || !snapshot->resolved(index) || snapshot->has_cyclic_ancestors(index)) {
+      return std::nullopt;
+    }
+    std::optional<std::string> super_name;
+    if (const auto super = snapshot->super_class(index); super != no_class) {
+      super_name = std::string(snapshot->name(super));
+    }
+    std::vector<std::string> interfaces;
+    const auto count = snapshot->interface_count(index);
+    interfaces.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+      if (const auto interface = snapshot->interface(index, i); interface != no_class) {
+        interfaces.emplace_back(snapshot->name(interface));
+      }
+    }
+    return class_header(name, super_name, interfaces);
+  };
+}
+
+size_t class_tree_snapshot::size() const {
+  return class_count_;
+}
+uint32_t class_tree_snapshot::find(const std::string_view& name) const {
+  if (class_count_ == 0) {
+    return no_class;
+  }
+  const auto mask = bucket_count_ - 1;
+  for (auto bucket = hash_name(name) & mask, probes = 0u; probes < bucket_count_;
+       bucket = (bucket + 1) & mask, probes++) {
+    const auto entry = read_u32(buckets_offset_ + static_cast<size_t>(bucket) * 4);
+    if (entry == 0 || entry > class_count_) {
+      return no_class;
+    }
+    if (this->name(entry - 1) == name) {
+      return entry - 1;
+    }
+  }
+  return no_class;
+}
+std::string_view class_tree_snapshot::name(uint32_t index) const {
+  if (index >= class_count_) {
+    return {};
+  }
+  const auto offset = record(index, name_offset_field);
+  const auto length = record(index, name_length_field);
+  if (static_cast<uint64_t>(offset) + length > strings_size_) {
+    return {};
+  }
+  return {reinterpret_cast<const char*>(data_ + strings_offset_ + offset), length};
+}
+uint32_t class_tree_snapshot::super_class(uint32_t index) const {
+  if (index >= class_count_) {
+    return no_class;
+  }
+  const auto super = record(index, super_field);
+  return super < class_count_ ? super : no_class;
+}
+uint32_t class_tree_snapshot::interface_count(uint32_t index) const {
+  if (index >= class_count_) {
+    return 0;
+  }
+  const auto count = record(index, interfaces_count_field);
+  return static_cast<uint64_t>(record(index, interfaces_start_field)) + count <= interface_total_ ? count : 0;
+}
+uint32_t class_tree_snapshot::interface(uint32_t index, uint32_t i) const {
+  if (i >= interface_count(index)) {
+    return no_class;
+  }
+  const auto interface =
+      read_u32(interfaces_offset_ + (static_cast<size_t>(record(index, interfaces_start_field)) + i) * 4);
+  return interface < class_count_ ? interface : no_class;
+}
+bool class_tree_snapshot::resolved(uint32_t index) const {
+  return index < class_count_ && (record(index, flags_field) & resolved_flag) != 0;
+}
+bool class_tree_snapshot::has_cyclic_ancestors(uint32_t index) const {
+  constexpr uint8_t visiting = 1;
+  constexpr uint8_t visited = 2;
+  std::unordered_map<uint32_t, uint8_t> marks;
+  // A class and the next of its edges to follow, edge 0 being the super class and the rest the interfaces.
+  std::vector<std::pair<uint32_t, uint32_t>> stack;
+  marks.emplace(index, visiting);
+  stack.emplace_back(index, 0);
+  while (!stack.empty()) {
+    auto& [curr, edge] = stack.back();
+    if (edge > interface_count(curr)) {
+      marks[curr] = visited;
+      stack.pop_back();
+      continue;
+    }
+    const auto next = edge == 0 ? super_class(curr) : interface(curr, edge - 1);
+    edge++;
+    if (next == no_class) {
+      continue;
+    }
+    const auto [mark, inserted] = marks.emplace(next, visiting);
+    if (!inserted) {
+      if (mark->second == visiting) {
+        return true;
+      }
+      continue;
+    }
+    stack.emplace_back(next, 0);
+  }
+  return false;
+}
+
+bool class_tree_snapshot::is_assignable_from(const std::string_view& from, const std::string_view& to) const {
+  if (from == to) {
+    return true;
+  }
+  const auto to_array = !to.empty() && to[0] == '[';
+  if (to_array && (from == "java/lang/Object" || from == "java/lang/Cloneable" || from == "java/io/Serializable")) {
+    return true;
+  }
+  const auto from_array = !from.empty() && from[0] == '[';
+  if (from_array && to_array) {
+    auto from_sub = from.substr(1);
+    auto to_sub = to.substr(1);
+    if (is_primitive(from_sub) || is_primitive(to_sub)) {
+      return from_sub == to_sub;
+    }
+    if (from_sub[0] == 'L' && from_sub[from_sub.size() - 1] == ';') {
+      from_sub = from_sub.substr(1, from_sub.size() - 2);
+    }
+    if (to_sub[0] == 'L' && to_sub[to_sub.size() - 1] == ';') {
+      to_sub = to_sub.substr(1, to_sub.size() - 2);
+    }
+    return is_assignable_from(from_sub, to_sub);
+  }
+  if (from_array || to_array) {
+    return false;
+  }
+  const auto to_index = find(to);
+  const auto from_index = find(from);
+  if (to_index == no_class || from_index == no_class) {
+    return false;
+  }
+  return is_class_assignable(from_index, to_index);
+}
+bool class_tree_snapshot::is_class_assignable(uint32_t from, uint32_t to) const {
+  // Every ancestor is visited once, which also ends the walk if the records form a cycle.
+  std::unordered_set<uint32_t> seen{to};
+  std::vector<uint32_t> pending{to};
+  while (!pending.empty()) {
+    const auto curr = pending.back();
+    pending.pop_back();
+    const auto count = interface_count(curr);
+    for (uint32_t edge = 0; edge <= count; edge++) {
+      const auto next = edge == 0 ? super_class(curr) : interface(curr, edge - 1);
+      if (next == from) {
+        return true;
+      }
+      if (next != no_class && seen.emplace(next).second) {
+        pending.emplace_back(next);
+      }
+    }
+  }
+  return false;
+}
+std::string class_tree_snapshot::common_super_class(const std::string_view& first,
+                                                    const std::string_view& second) const {
+  if (is_assignable_from(first, second)) {
+    return std::string(first);
+  }
+  if (is_assignable_from(second, first)) {
+    return std::string(second);
+  }
+  auto curr = find(first);
+  // A chain longer than the number of classes is a cycle.
+  size_t steps = 0;
+  do {
+    if (curr != no_class) {
+      curr = ++steps <= class_count_ ? super_class(curr) : no_class;
+    }
+  } while (curr != no_class && !is_assignable_from(name(curr), second));
+  return curr == no_class ? "java/lang/Object" : std::string(name(curr));
+}
+
+}
@@ -1,7 +1,20 @@
 #include "cafe/class_writer.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <iostream>
 #include <limits>
+#include <unordered_map>
+#include <thread>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <sys/uio.h>
+#endif
 
 #include "cafe/constants.hpp"
 
@@ -11,14 +24,19 @@
 
 
 namespace cafe {
+namespace {
+constexpr size_t parallel_min_instructions = 4096;
+}
 class_writer::class_writer(uint8_t flags) : flags_(flags) {
 }
 class_writer::class_writer(const class_tree& tree) : flags_(compute_frames), tree_(&tree) {
 }
+class_writer::class_writer(const class_tree& tree, uint8_t flags) : flags_(flags | compute_frames), tree_(&tree) {
+}
 void class_writer::write_source_file(const std::string_view& source_file) {
   const auto attr_name = get_utf("SourceFile");
   const auto source_index = get_utf(source_file);
-  databuf buf(attributes_);
+  databuf buf(body_);
   buf.write_u16(attr_name);
   buf.write_u32(2);
   buf.write_u16(source_index);
@@ -33,7 +51,7 @@ void class_writer::write_enclosing_method(const std::string_view& owner,
     const auto [name, desc] = *method;
     nat_index = get_name_and_type(name, desc);
   }
-  databuf buf(attributes_);
+  databuf buf(body_);
   buf.write_u16(attr_name);
   buf.write_u32(4);
   buf.write_u16(class_index);
@@ -42,17 +60,16 @@ void class_writer::write_enclosing_method(const std::string_view& owner,
 }
 void class_writer::write_source_debug_extension(const std::string_view& debug_extension) {
   const auto attr_name = get_utf("SourceDebugExtension");
-  const auto& data = std::vector<int8_t>(debug_extension.begin(), debug_extension.end());
-  databuf buf(attributes_);
+  databuf buf(body_);
   buf.write_u16(attr_name);
-  buf.write_u32(static_cast<uint32_t>(data.size()));
-  buf.write_all(data);
+  buf.write_u32(static_cast<uint32_t>(debug_extension.size()));
+  buf.write_all(debug_extension);
   attributes_count_++;
 }
 void class_writer::write_signature(const std::string_view& signature) {
   const auto attr_name = get_utf("Signature");
   const auto sig_index = get_utf(signature);
-  databuf buf(attributes_);
+  databuf buf(body_);
   buf.write_u16(attr_name);
   buf.write_u32(2);
   buf.write_u16(sig_index);
@@ -60,7 +77,7 @@ void class_writer::write_signature(const std::string_view& signature) {
 }
 void class_writer::write_inner_classes(const std::vector<inner_class>& inner_classes) {
   const auto attr_name = get_utf("InnerClasses");
-  databuf buf(attributes_);
+  databuf buf(body_);
   buf.write_u16(attr_name);
   buf.write_u32(static_cast<uint32_t>((inner_classes.size() * 8) + 2));
   buf.write_u16(static_cast<uint16_t>(inner_classes.size()));
@@ -73,7 +90,10 @@ void class_writer::write_inner_classes(const std::vector<inner_class>& inner_cla
   attributes_count_++;
 }
 void class_writer::write_module(const module& module) {
-  data_writer buf;
+  databuf buf(body_);
+  // The attribute name is looked up after the contents to keep the pool order of the entries it refers to.
+  const auto attr_name = buf.reserve_u16();
+  const auto length = buf.reserve_u32();
   buf.write_u16(get_module(module.name));
   buf.write_u16(module.access_flags);
   buf.write_u16(module.version ? get_utf(*module.version) : 0);
@@ -113,19 +133,15 @@ void class_writer::write_module(const module& module) {
       buf.write_u16(get_class(provider));
     }
   }
-  const auto attr_name = get_utf("Module");
-  const auto module_data = buf.data();
-  databuf data(attributes_);
-  data.write_u16(attr_name);
-  data.write_u32(static_cast<uint32_t>(module_data.size()));
-  data.write_all(module_data);
+  buf.patch_u16(attr_name, get_utf("Module"));
+  buf.patch_length(length);
   attributes_count_++;
 }
 void class_writer::write_module_packages(const std::vector<std::string>& module_packages) {
   const auto attr_name = get_utf("ModulePackages");
-  databuf buf(attributes_);
+  databuf buf(body_);
   buf.write_u16(attr_name);
-  buf.write_u32(static_cast<uint32_t>(module_packages.size() + 2));
+  buf.write_u32(static_cast<uint32_t>((module_packages.size() * 2) + 2));
   buf.write_u16(static_cast<uint16_t>(module_packages.size()));
   for (const auto& name : module_packages) {
     buf.write_u16(get_package(name));
@@ -135,7 +151,7 @@ void class_writer::write_module_packages(const std::vector<std::string>& module_
 void class_writer::write_module_main_class(const std::string_view& main_class) {
   const auto attr_name = get_utf("ModuleMainClass");
   const auto module_class = get_class(main_class);
-  databuf buf(attributes_);
+  databuf buf(body_);
   buf.write_u16(attr_name);
   buf.write_u32(2);
   buf.write_u16(module_class);
@@ -144,7 +160,7 @@ void class_writer::write_module_main_class(const std::string_view& main_class) {
 void class_writer::write_nest_host(const std::string_view& host) {
   const auto attr_name = get_utf("NestHost");
   const auto nest_host = get_class(host);
-  databuf buf(attributes_);
+  databuf buf(body_);
   buf.write_u16(attr_name);
   buf.write_u32(2);
   buf.write_u16(nest_host);
@@ -152,7 +168,7 @@ void class_writer::write_nest_host(const std::string_view& host) {
 }
 void class_writer::write_nest_members(const std::vector<std::string>& members) {
   const auto attr_name = get_utf("NestMembers");
-  databuf buf(attributes_);
+  databuf buf(body_);
   buf.write_u16(attr_name);
   buf.write_u32(static_cast<uint32_t>((members.size() * 2) + 2));
   buf.write_u16(static_cast<uint16_t>(members.size()));
@@ -162,80 +178,37 @@ void class_writer::write_nest_members(const std::vector<std::string>& members) {
   attributes_count_++;
 }
 void class_writer::write_record(const std::vector<record_component>& components) {
-  data_writer buf;
+  databuf buf(body_);
+  const auto attr_name = buf.reserve_u16();
+  const auto length = buf.reserve_u32();
   buf.write_u16(static_cast<uint16_t>(components.size()));
-  std::vector<std::pair<size_t, label>> dummy_labels;
   for (const auto& comp : components) {
     buf.write_u16(get_utf(comp.name));
     buf.write_u16(get_utf(comp.desc));
 
-    data_writer attr_buf;
+    const auto attr_count_offset = buf.reserve_u16();
     uint16_t attr_count = 0;
     if (comp.signature) {
-      const auto attr_name = get_utf("Signature");
+      const auto sig_name = get_utf("Signature");
       const auto sig = get_utf(*comp.signature);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(2);
-      attr_buf.write_u16(sig);
+      buf.write_u16(sig_name);
+      buf.write_u32(2);
+      buf.write_u16(sig);
       attr_count++;
     }
-    if (!comp.visible_annotations.empty()) {
-      const auto attr_name = get_utf("RuntimeVisibleAnnotations");
-      const auto& data = get_annotations(comp.visible_annotations);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-      attr_buf.write_u16(static_cast<uint16_t>(comp.visible_annotations.size()));
-      attr_buf.write_all(data);
-      attr_count++;
-    }
-    if (!comp.invisible_annotations.empty()) {
-      const auto attr_name = get_utf("RuntimeInvisibleAnnotations");
-      const auto& data = get_annotations(comp.invisible_annotations);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-      attr_buf.write_u16(static_cast<uint16_t>(comp.invisible_annotations.size()));
-      attr_buf.write_all(data);
-      attr_count++;
-    }
-    if (!comp.visible_type_annotations.empty()) {
-      const auto attr_name = get_utf("RuntimeVisibleTypeAnnotations");
-      const auto& data = get_type_annotations(comp.visible_type_annotations, dummy_labels);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-      attr_buf.write_u16(static_cast<uint16_t>(comp.visible_type_annotations.size()));
-      attr_buf.write_all(data);
-      attr_count++;
-    }
-    if (!comp.invisible_type_annotations.empty()) {
-      const auto attr_name = get_utf("RuntimeInvisibleTypeAnnotations");
-      const auto& data = get_type_annotations(comp.invisible_type_annotations, dummy_labels);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-      attr_buf.write_u16(static_cast<uint16_t>(comp.invisible_type_annotations.size()));
-      attr_buf.write_all(data);
-      attr_count++;
-    }
-    for (const auto& attr : comp.attributes) {
-      const auto attr_name = get_utf(attr.name);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(attr.data.size()));
-      attr_buf.write_all(attr.data);
-      attr_count++;
-    }
-    buf.write_u16(attr_count);
-    buf.write_all(attr_buf.data());
+    attr_count += write_annotation_attributes(buf, comp.visible_annotations, comp.invisible_annotations);
+    attr_count += write_type_annotation_attributes(buf, comp.visible_type_annotations,
+                                                   comp.invisible_type_annotations, {});
+    attr_count += write_attributes(buf, comp.attributes);
+    buf.patch_u16(attr_count_offset, attr_count);
   }
-  const auto attr_name = get_utf("Record");
-  const auto& data = buf.data();
-  databuf data_buf(attributes_);
-  data_buf.write_u16(attr_name);
-  data_buf.write_u32(static_cast<uint32_t>(data.size()));
-  data_buf.write_all(data);
+  buf.patch_u16(attr_name, get_utf("Record"));
+  buf.patch_length(length);
   attributes_count_++;
 }
 void class_writer::write_permitted_subclasses(const std::vector<std::string>& subclasses) {
   const auto attr_name = get_utf("PermittedSubclasses");
-  databuf buf(attributes_);
+  databuf buf(body_);
   buf.write_u16(attr_name);
   buf.write_u32(static_cast<uint32_t>((subclasses.size() * 2) + 2));
   buf.write_u16(static_cast<uint16_t>(subclasses.size()));
@@ -244,30 +217,52 @@ void class_writer::write_permitted_subclasses(const std::vector<std::string>& su
   }
   attributes_count_++;
 }
-void class_writer::write_annotations(const std::vector<annotation>& annotations, bool visible) {
-  const auto attr_name = get_utf(visible ? "RuntimeVisibleAnnotations" : "RuntimeInvisibleAnnotations");
-  const auto& data = get_annotations(annotations);
-  databuf buf(attributes_);
-  buf.write_u16(attr_name);
-  buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-  buf.write_u16(static_cast<uint16_t>(annotations.size()));
-  buf.write_all(data);
-  attributes_count_++;
+uint16_t class_writer::write_annotation_attributes(databuf& buf, const std::vector<annotation>& visible,
+                                                   const std::vector<annotation>& invisible) {
+  uint16_t count = 0;
+  for (const auto& [annos, attr_name] : {std::make_pair(&visible, "RuntimeVisibleAnnotations"),
+                                         std::make_pair(&invisible, "RuntimeInvisibleAnnotations")}) {
+    if (annos->empty()) {
+      continue;
+    }
+    buf.write_u16(get_utf(attr_name));
+    const auto length = buf.reserve_u32();
+    buf.write_u16(static_cast<uint16_t>(annos->size()));
+    get_annotations(buf, *annos);
+    buf.patch_length(length);
+    count++;
+  }
+  return count;
 }
-void class_writer::write_type_annotations(const std::vector<type_annotation>& annotations, bool visible) {
-  const auto attr_name = get_utf(visible ? "RuntimeVisibleTypeAnnotations" : "RuntimeInvisibleTypeAnnotations");
-  std::vector<std::pair<size_t, label>> dummy_labels;
-  const auto& data = get_type_annotations(annotations, dummy_labels);
-  databuf buf(attributes_);
-  buf.write_u16(attr_name);
-  buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-  buf.write_u16(static_cast<uint16_t>(annotations.size()));
-  buf.write_all(data);
-  attributes_count_++;
+uint16_t class_writer::write_type_annotation_attributes(databuf& buf, const std::vector<type_annotation>& visible,
+                                                        const std::vector<type_annotation>& invisible,
+                                                        const std::vector<std::pair<size_t, label>>& labels) {
+  uint16_t count = 0;
+  for (const auto& [annos, attr_name] : {std::make_pair(&visible, "RuntimeVisibleTypeAnnotations"),
+                                         std::make_pair(&invisible, "RuntimeInvisibleTypeAnnotations")}) {
+    if (annos->empty()) {
+      continue;
+    }
+    buf.write_u16(get_utf(attr_name));
+    const auto length = buf.reserve_u32();
+    buf.write_u16(static_cast<uint16_t>(annos->size()));
+    get_type_annotations(buf, *annos, labels);
+    buf.patch_length(length);
+    count++;
+  }
+  return count;
+}
+uint16_t class_writer::write_attributes(databuf& buf, const std::vector<attribute>& attributes) {
+  for (const auto& attr : attributes) {
+    buf.write_u16(get_utf(attr.name));
+    buf.write_u32(static_cast<uint32_t>(attr.data.size()));
+    buf.write_all(attr.data);
+  }
+  return static_cast<uint16_t>(attributes.size());
 }
 void class_writer::write_fields(const std::vector<field>& fields) {
-  databuf buf(fields_);
-  std::vector<std::pair<size_t, label>> dummy_labels;
+  databuf buf(body_);
+  buf.write_u16(static_cast<uint16_t>(fields.size()));
   for (const auto& field : fields) {
     const auto name = get_utf(field.name);
     const auto desc = get_utf(field.desc);
@@ -275,246 +270,237 @@ void class_writer::write_fields(const std::vector<field>& fields) {
     buf.write_u16(name);
     buf.write_u16(desc);
 
+    const auto attr_count_offset = buf.reserve_u16();
     uint16_t attr_count = 0;
-    data_writer attr_buf;
     if (field.signature) {
       const auto attr_name = get_utf("Signature");
       const auto sig = get_utf(*field.signature);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(2);
-      attr_buf.write_u16(sig);
+      buf.write_u16(attr_name);
+      buf.write_u32(2);
+      buf.write_u16(sig);
       attr_count++;
     }
     if (field.synthetic) {
-      attr_buf.write_u16(get_utf("Synthetic"));
-      attr_buf.write_u32(0);
+      buf.write_u16(get_utf("Synthetic"));
+      buf.write_u32(0);
       attr_count++;
     }
     if (field.deprecated) {
-      attr_buf.write_u16(get_utf("Deprecated"));
-      attr_buf.write_u32(0);
-      attr_count++;
-    }
-    if (!field.visible_annotations.empty()) {
-      const auto attr_name = get_utf("RuntimeVisibleAnnotations");
-      const auto& data = get_annotations(field.visible_annotations);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-      attr_buf.write_u16(static_cast<uint16_t>(field.visible_annotations.size()));
-      attr_buf.write_all(data);
-      attr_count++;
-    }
-    if (!field.invisible_annotations.empty()) {
-      const auto attr_name = get_utf("RuntimeInvisibleAnnotations");
-      const auto& data = get_annotations(field.invisible_annotations);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-      attr_buf.write_u16(static_cast<uint16_t>(field.invisible_annotations.size()));
-      attr_buf.write_all(data);
-      attr_count++;
-    }
-    if (!field.visible_type_annotations.empty()) {
-      const auto attr_name = get_utf("RuntimeVisibleTypeAnnotations");
-      const auto& data = get_type_annotations(field.visible_type_annotations, dummy_labels);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-      attr_buf.write_u16(static_cast<uint16_t>(field.visible_type_annotations.size()));
-      attr_buf.write_all(data);
-      attr_count++;
-    }
-    if (!field.invisible_type_annotations.empty()) {
-      const auto attr_name = get_utf("RuntimeInvisibleTypeAnnotations");
-      const auto& data = get_type_annotations(field.invisible_type_annotations, dummy_labels);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-      attr_buf.write_u16(static_cast<uint16_t>(field.invisible_type_annotations.size()));
-      attr_buf.write_all(data);
-      attr_count++;
-    }
-    for (const auto& attr : field.attributes) {
-      const auto attr_name = get_utf(attr.name);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(attr.data.size()));
-      attr_buf.write_all(attr.data);
+      buf.write_u16(get_utf("Deprecated"));
+      buf.write_u32(0);
       attr_count++;
     }
-    buf.write_u16(attr_count);
-    buf.write_all(attr_buf.data());
+    attr_count += write_annotation_attributes(buf, field.visible_annotations, field.invisible_annotations);
+    attr_count += write_type_annotation_attributes(buf, field.visible_type_annotations,
+                                                   field.invisible_type_annotations, {});
+    attr_count += write_attributes(buf, field.attributes);
+    buf.patch_u16(attr_count_offset, attr_count);
   }
 }
 void class_writer::write_methods(const class_file& file, const std::vector<method>& methods, bool oak) {
-  databuf buf(methods_);
-  std::vector<std::pair<size_t, label>> dummy_labels;
-  for (const auto& method : methods) {
+  databuf buf(body_);
+  buf.write_u16(static_cast<uint16_t>(methods.size()));
+  // The code analyses do not depend on the constant pool, so the first optimize_pool pass keeps them for the second.
+  const auto first_pool_pass = (flags_ & optimize_pool) != 0 && pool_seed_.empty();
+  if (analyses_.empty()) {
+    // Lookups in a tree that is not concurrent but resolves classes on demand would race on filling it.
+    if ((flags_ & parallel_methods) != 0 && methods.size() > 1 && (tree_ == nullptr || tree_->concurrent_lookups())) {
+      analyses_ = analyze_methods(file, methods);
+    } else if (first_pool_pass) {
+      analyses_.resize(methods.size());
+      for (size_t i = 0; i < methods.size(); i++) {
+        if (has_code(methods[i])) {
+          analyses_[i] = analyze_code(file, methods[i], methods[i].body);
+        }
+      }
+    }
+  }
+  for (size_t method_index = 0; method_index < methods.size(); method_index++) {
+    const auto& method = methods[method_index];
     const auto name = get_utf(method.name);
     const auto desc = get_utf(method.desc);
     buf.write_u16(method.access_flags);
     buf.write_u16(name);
     buf.write_u16(desc);
 
+    const auto attr_count_offset = buf.reserve_u16();
     uint16_t attr_count = 0;
-    data_writer attr_buf;
     if (!method.exceptions.empty()) {
       const auto attr_name = get_utf("Exceptions");
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>((method.exceptions.size() * 2) + 2));
-      attr_buf.write_u16(static_cast<uint16_t>(method.exceptions.size()));
+      buf.write_u16(attr_name);
+      buf.write_u32(static_cast<uint32_t>((method.exceptions.size() * 2) + 2));
+      buf.write_u16(static_cast<uint16_t>(method.exceptions.size()));
       for (const auto& exc : method.exceptions) {
-        attr_buf.write_u16(get_class(exc));
+        buf.write_u16(get_class(exc));
       }
       attr_count++;
     }
-    if (!method.visible_parameter_annotations.empty()) {
-      const auto attr_name = get_utf("RuntimeVisibleParameterAnnotations");
-      data_writer anno_writer;
-      for (const auto& annos : method.visible_parameter_annotations) {
-        const auto anno = get_annotations(annos);
-        anno_writer.write_u16(static_cast<uint16_t>(annos.size()));
-        anno_writer.write_all(anno);
+    for (const auto& [params, attr_name] :
+         {std::make_pair(&method.visible_parameter_annotations, "RuntimeVisibleParameterAnnotations"),
+          std::make_pair(&method.invisible_parameter_annotations, "RuntimeInvisibleParameterAnnotations")}) {
+      if (params->empty()) {
+        continue;
       }
-      const auto& data = anno_writer.data();
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(data.size() + 1));
-      attr_buf.write_u8(static_cast<uint8_t>(method.visible_parameter_annotations.size()));
-      attr_buf.write_all(data);
-      attr_count++;
-    }
-    if (!method.invisible_parameter_annotations.empty()) {
-      const auto attr_name = get_utf("RuntimeInvisibleParameterAnnotations");
-      data_writer anno_writer;
-      for (const auto& annos : method.invisible_parameter_annotations) {
-        const auto anno = get_annotations(annos);
-        anno_writer.write_u16(static_cast<uint16_t>(annos.size()));
-        anno_writer.write_all(anno);
+      buf.write_u16(get_utf(attr_name));
+      const auto length = buf.reserve_u32();
+      buf.write_u8(static_cast<uint8_t>(params->size()));
+      for (const auto& annos : *params) {
+        buf.write_u16(static_cast<uint16_t>(annos.size()));
+        get_annotations(buf, annos);
       }
-      const auto& data = anno_writer.data();
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(data.size() + 1));
-      attr_buf.write_u8(static_cast<uint8_t>(method.invisible_parameter_annotations.size()));
-      attr_buf.write_all(data);
+      buf.patch_length(length);
       attr_count++;
     }
     if (method.annotation_default) {
-      const auto attr_name = get_utf("AnnotationDefault");
-      data_writer anno_writer;
-      get_element_value(anno_writer, *method.annotation_default);
-      const auto& data = anno_writer.data();
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(data.size()));
-      attr_buf.write_all(data);
+      buf.write_u16(get_utf("AnnotationDefault"));
+      const auto length = buf.reserve_u32();
+      get_element_value(buf, *method.annotation_default);
+      buf.patch_length(length);
       attr_count++;
     }
     if (!method.parameters.empty()) {
       const auto attr_name = get_utf("MethodParameters");
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>((method.parameters.size() * 4) + 1));
-      attr_buf.write_u8(static_cast<uint8_t>(method.parameters.size()));
+      buf.write_u16(attr_name);
+      buf.write_u32(static_cast<uint32_t>((method.parameters.size() * 4) + 1));
+      buf.write_u8(static_cast<uint8_t>(method.parameters.size()));
       for (const auto& [access, name] : method.parameters) {
-        attr_buf.write_u16(name ? get_utf(*name) : 0);
-        attr_buf.write_u16(access);
+        buf.write_u16(name ? get_utf(*name) : 0);
+        buf.write_u16(access);
       }
       attr_count++;
     }
     if (method.synthetic) {
-      attr_buf.write_u16(get_utf("Synthetic"));
-      attr_buf.write_u32(0);
+      buf.write_u16(get_utf("Synthetic"));
+      buf.write_u32(0);
       attr_count++;
     }
     if (method.deprecated) {
-      attr_buf.write_u16(get_utf("Deprecated"));
-      attr_buf.write_u32(0);
+      buf.write_u16(get_utf("Deprecated"));
+      buf.write_u32(0);
       attr_count++;
     }
     if (method.signature) {
       const auto attr_name = get_utf("Signature");
       const auto sig = get_utf(*method.signature);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(2);
-      attr_buf.write_u16(sig);
-      attr_count++;
-    }
-    if (!method.visible_annotations.empty()) {
-      const auto attr_name = get_utf("RuntimeVisibleAnnotations");
-      const auto& data = get_annotations(method.visible_annotations);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-      attr_buf.write_u16(static_cast<uint16_t>(method.visible_annotations.size()));
-      attr_buf.write_all(data);
+      buf.write_u16(attr_name);
+      buf.write_u32(2);
+      buf.write_u16(sig);
       attr_count++;
     }
-    if (!method.invisible_annotations.empty()) {
-      const auto attr_name = get_utf("RuntimeInvisibleAnnotations");
-      const auto& data = get_annotations(method.invisible_annotations);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-      attr_buf.write_u16(static_cast<uint16_t>(method.invisible_annotations.size()));
-      attr_buf.write_all(data);
+    attr_count += write_annotation_attributes(buf, method.visible_annotations, method.invisible_annotations);
+    attr_count += write_type_annotation_attributes(buf, method.visible_type_annotations,
+                                                   method.invisible_type_annotations, {});
+    if (has_code(method)) {
+      buf.write_u16(get_utf("Code"));
+      const auto length = buf.reserve_u32();
+      if (analyses_.empty()) {
+        write_code(buf, method.body, oak, analyze_code(file, method, method.body));
+      } else {
+        write_code(buf, method.body, oak, analyses_[method_index]);
+      }
+      buf.patch_length(length);
       attr_count++;
     }
-    if (!method.visible_type_annotations.empty()) {
-      const auto attr_name = get_utf("RuntimeVisibleTypeAnnotations");
-      const auto& data = get_type_annotations(method.visible_type_annotations, dummy_labels);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-      attr_buf.write_u16(static_cast<uint16_t>(method.visible_type_annotations.size()));
-      attr_buf.write_all(data);
-      attr_count++;
+    attr_count += write_attributes(buf, method.attributes);
+    buf.patch_u16(attr_count_offset, attr_count);
+  }
+  if (!first_pool_pass) {
+    analyses_.clear();
+  }
+}
+class_writer::code_analysis class_writer::analyze_code(const class_file& file, const method& method,
+                                                       const code& c) const {
+  code_analysis analysis{c.max_stack, c.max_locals, c.frames, {}};
+  if ((flags_ & compute_maxes) != 0 || ((flags_ & compute_frames) != 0 && tree_ == nullptr)) {
+    // Most methods are simple enough for a single scan, the graph is only built for the rest.
+    const auto start_locals = basic_block_graph::get_start_locals(method);
+    auto maxes = basic_block_graph::linear_maxes(c, start_locals);
+    if (!maxes) {
+      basic_block_graph graph(c);
+      maxes = graph.compute_maxes(start_locals);
+    }
+    analysis.max_locals = maxes->first;
+    analysis.max_stack = maxes->second;
+  } else if ((flags_ & compute_frames) != 0) {
+    basic_block_graph graph(c);
+    const auto start_locals = basic_block_graph::get_start_locals(file.name, method);
+    std::optional<frame_compute_result> result;
+    if ((flags_ & reuse_frames) != 0) {
+      result = graph.verify_frames(*tree_, file.name, start_locals, c.frames);
     }
-    if (!method.invisible_type_annotations.empty()) {
-      const auto attr_name = get_utf("RuntimeInvisibleTypeAnnotations");
-      const auto& data = get_type_annotations(method.invisible_type_annotations, dummy_labels);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-      attr_buf.write_u16(static_cast<uint16_t>(method.invisible_type_annotations.size()));
-      attr_buf.write_all(data);
-      attr_count++;
+    if (!result) {
+      result = graph.compute_frames(*tree_, file.name, start_locals);
     }
-    if (!method.body.empty() || !method.body.visible_type_annotations.empty() ||
-        !method.body.invisible_type_annotations.empty() || !method.body.attributes.empty()) {
-      const auto attr_name = get_utf("Code");
-      const auto& data = write_code(file, method, method.body, oak);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(data.size()));
-      attr_buf.write_all(data);
-      attr_count++;
+    analysis.max_stack = result->max_stack();
+    analysis.max_locals = result->max_locals();
+    analysis.frames = result->frames();
+    analysis.labels = result->labels();
+  }
+  return analysis;
+}
+std::vector<class_writer::code_analysis> class_writer::analyze_methods(const class_file& file,
+                                                                       const std::vector<method>& methods) const {
+  std::vector<code_analysis> analyses(methods.size());
+  // Starting a thread costs about as much as analyzing a few thousand instructions, so small classes stay serial.
+  size_t instructions = 0;
+  for (const auto& method : methods) {
+    instructions += method.body.size();
+  }
+  const auto thread_count = std::min<size_t>({std::max(1u, std::thread::hardware_concurrency()), methods.size(),
+                                              std::max<size_t>(1, instructions / parallel_min_instructions)});
+  std::atomic_size_t next{0};
+  std::vector<std::exception_ptr> errors(thread_count);
+  const auto worker = [&](size_t thread_index) {
+    try {
+      for (auto i = next++; i < methods.size(); i = next++) {
+        if (has_code(methods[i])) {
+          analyses[i] = analyze_code(file, methods[i], methods[i].body);
+        }
+      }
+    } catch (...) {
+      errors[thread_index] = std::current_exception();
+      next = methods.size();
     }
-    for (const auto& attr : method.attributes) {
-      const auto attr_name = get_utf(attr.name);
-      attr_buf.write_u16(attr_name);
-      attr_buf.write_u32(static_cast<uint32_t>(attr.data.size()));
-      attr_buf.write_all(attr.data);
-      attr_count++;
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < thread_count; i++) {
+    threads.emplace_back(worker, i);
+  }
+  worker(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  // A failed analysis throws on the calling thread, as it would when analyzing serially.
+  for (const auto& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
     }
-    buf.write_u16(attr_count);
-    buf.write_all(attr_buf.data());
   }
+  return analyses;
 }
-std::vector<int8_t> class_writer::write_code(const class_file& file, const method& method, const code& c, bool oak) {
-  auto max_stack = c.max_stack;
-  auto max_locals = c.max_locals;
-  std::vector<std::pair<label, frame>> frames = c.frames;
-  std::vector<std::pair<code::const_iterator, label>> inject_labels;
-
-  if ((flags_ & compute_maxes) != 0) {
-    basic_block_graph graph(c);
-    const auto [locals, stack] = graph.compute_maxes(basic_block_graph::get_start_locals(method));
-    max_stack = stack;
-    max_locals = locals;
-  } else if ((flags_ & compute_frames) != 0) {
-    basic_block_graph graph(c);
-    if (tree_ == nullptr) {
-      const auto [locals, stack] = graph.compute_maxes(basic_block_graph::get_start_locals(method));
-      max_stack = stack;
-      max_locals = locals;
-    } else {
-      const auto result =
-          graph.compute_frames(*tree_, file.name, basic_block_graph::get_start_locals(file.name, method));
-      max_stack = result.max_stack();
-      max_locals = result.max_locals();
-      frames = result.frames();
-      inject_labels = result.labels();
-    }
+size_t class_writer::estimate_body_size(const class_file& file) {
+  // Roughly what javac output needs. Overshooting a little is cheaper than growing the buffer a second time.
+  size_t size = 64 + file.attributes.size() * 8;
+  for (const auto& attr : file.attributes) {
+    size += attr.data.size();
+  }
+  size += file.fields.size() * 16;
+  for (const auto& method : file.methods) {
+    const auto& body = method.body;
+    size += 32 + body.size() * 3 + body.tcbs.size() * 8 + body.line_numbers.size() * 4 + body.locals.size() * 20 +
+            body.frames.size() * 8;
   }
+  return size;
+}
+bool class_writer::has_code(const method& method) {
+  return !method.body.empty() || !method.body.visible_type_annotations.empty() ||
+         !method.body.invisible_type_annotations.empty() || !method.body.attributes.empty();
+}
+void class_writer::write_code(databuf& buf, const code& c, bool oak, const code_analysis& analysis) {
+  const auto max_stack = analysis.max_stack;
+  const auto max_locals = analysis.max_locals;
+  const auto& frames = analysis.frames;
+  const auto& inject_labels = analysis.labels;
 
   std::vector<uint8_t> code;
   std::vector<std::pair<size_t, label>> labels;
@@ -561,7 +547,7 @@ std::vector<int8_t> class_writer::write_code(const class_file& file, const metho
     last_label = pos;
     return delta;
   };
-  const auto write_frame_var = [&](data_writer& buf, const frame_var& var) {
+  const auto write_frame_var = [&](const frame_var& var) {
     std::visit(
         [&](const auto& arg) {
           using T = std::decay_t<decltype(arg)>;
@@ -723,17 +709,20 @@ std::vector<int8_t> class_writer::write_code(const class_file& file, const metho
               code.emplace_back(opcode);
             } else {
               const auto index = get_value(val);
+              if ((flags_ & optimize_pool) != 0) {
+                ldc_counts_[index]++;
+              }
               if (std::holds_alternative<int64_t>(val) || std::holds_alternative<double>(val)) {
                 code.emplace_back(op::ldc2_w);
                 code.emplace_back(static_cast<uint8_t>((index >> 8) & 0xff));
                 code.emplace_back(static_cast<uint8_t>(index & 0xff));
-              } else if (index > std::numeric_limits<int8_t>::max()) {
+              } else if (index > std::numeric_limits<uint8_t>::max()) {
                 code.emplace_back(op::ldc_w);
                 code.emplace_back(static_cast<uint8_t>((index >> 8) & 0xff));
                 code.emplace_back(static_cast<uint8_t>(index & 0xff));
               } else {
                 code.emplace_back(op::ldc);
-                code.emplace_back(static_cast<int8_t>(index));
+                code.emplace_back(static_cast<uint8_t>(index));
               }
             }
           }
@@ -857,7 +846,8 @@ std::vector<int8_t> class_writer::write_code(const class_file& file, const metho
           }
           wide = true;
           code.insert(code.begin() + pos, 2, 0);
-          shift(pos, 2);
+          // The operand grows in place, only what comes after it moves.
+          shift(pos + 1, 2);
           changed = true;
         }
       }
@@ -903,7 +893,6 @@ std::vector<int8_t> class_writer::write_code(const class_file& file, const metho
     }
   }
 
-  data_writer buf;
   if (oak) {
     buf.write_u8(static_cast<uint8_t>(max_stack));
     buf.write_u8(static_cast<uint8_t>(max_locals));
@@ -920,78 +909,69 @@ std::vector<int8_t> class_writer::write_code(const class_file& file, const metho
     const auto end_pc = get_label(tcb.end);
     const auto handler_pc = get_label(tcb.handler);
     const auto catch_type = tcb.type ? get_class(*tcb.type) : 0;
-    buf.write_u16(static_cast<uint16_t>(start_pc));
-    buf.write_u16(static_cast<uint16_t>(end_pc));
-    buf.write_u16(static_cast<uint16_t>(handler_pc));
-    buf.write_u16(catch_type);
+    const uint16_t entry[] = {static_cast<uint16_t>(start_pc), static_cast<uint16_t>(end_pc),
+                              static_cast<uint16_t>(handler_pc), static_cast<uint16_t>(catch_type)};
+    buf.write_u16s(entry, 4);
   }
 
+  const auto attr_count_offset = buf.reserve_u16();
   uint16_t attr_count = 0;
-  data_writer attr_buf;
   if (!c.line_numbers.empty()) {
     const auto attr_name = get_utf("LineNumberTable");
-    attr_buf.write_u16(attr_name);
-    attr_buf.write_u32(static_cast<uint32_t>(c.line_numbers.size() * 4 + 2));
-    attr_buf.write_u16(static_cast<uint16_t>(c.line_numbers.size()));
+    buf.write_u16(attr_name);
+    buf.write_u32(static_cast<uint32_t>(c.line_numbers.size() * 4 + 2));
+    buf.write_u16(static_cast<uint16_t>(c.line_numbers.size()));
     for (const auto& [line, start] : c.line_numbers) {
       const auto start_pc = get_label(start);
-      attr_buf.write_u16(static_cast<uint16_t>(start_pc));
-      attr_buf.write_u16(line);
+      buf.write_u16(static_cast<uint16_t>(start_pc));
+      buf.write_u16(line);
     }
     attr_count++;
   }
 
-  data_writer local_buf;
-  data_writer local_type_buf;
   uint16_t local_count = 0;
   uint16_t local_type_count = 0;
   for (const auto& local : c.locals) {
-    const auto start_pc = get_label(local.start);
-    const auto length = get_label(local.end) - start_pc;
-    const auto name_index = get_utf(local.name);
-    const auto desc_index = local.desc.empty() ? 0 : get_utf(local.desc);
-    const auto signature_index = local.signature.empty() ? 0 : get_utf(local.signature);
-    if (desc_index != 0) {
-      local_count++;
-      local_buf.write_u16(static_cast<uint16_t>(start_pc));
-      local_buf.write_u16(static_cast<uint16_t>(length));
-      local_buf.write_u16(name_index);
-      local_buf.write_u16(desc_index);
-      local_buf.write_u16(local.index);
-    }
-
-    if (signature_index != 0) {
-      local_type_count++;
-      local_type_buf.write_u16(static_cast<uint16_t>(start_pc));
-      local_type_buf.write_u16(static_cast<uint16_t>(length));
-      local_type_buf.write_u16(name_index);
-      local_type_buf.write_u16(signature_index);
-      local_type_buf.write_u16(local.index);
+    local_count += !local.desc.empty();
+    local_type_count += !local.signature.empty();
+  }
+  // Each table is written with its own pass over the locals. The attribute names are patched in afterwards so that they
+  // follow the names of the locals in the pool.
+  const auto write_locals = [&](bool types) {
+    for (const auto& local : c.locals) {
+      const auto start_pc = get_label(local.start);
+      const auto length = get_label(local.end) - start_pc;
+      const auto name_index = get_utf(local.name);
+      const auto desc_index = local.desc.empty() ? 0 : get_utf(local.desc);
+      const auto signature_index = local.signature.empty() ? 0 : get_utf(local.signature);
+      const auto index = types ? signature_index : desc_index;
+      if (index != 0) {
+        const uint16_t entry[] = {static_cast<uint16_t>(start_pc), static_cast<uint16_t>(length), name_index,
+                                  static_cast<uint16_t>(index), local.index};
+        buf.write_u16s(entry, 5);
+      }
     }
-  }
+  };
   if (local_count != 0) {
-    const auto attr_name = get_utf("LocalVariableTable");
-    const auto& data = local_buf.data();
-    attr_buf.write_u16(attr_name);
-    attr_buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-    attr_buf.write_u16(local_count);
-    attr_buf.write_all(data);
+    const auto attr_name = buf.reserve_u16();
+    buf.write_u32(static_cast<uint32_t>(local_count * 10 + 2));
+    buf.write_u16(local_count);
+    write_locals(false);
+    buf.patch_u16(attr_name, get_utf("LocalVariableTable"));
     attr_count++;
   }
   if (local_type_count != 0) {
-    const auto attr_name = get_utf("LocalVariableTypeTable");
-    const auto& data = local_type_buf.data();
-    attr_buf.write_u16(attr_name);
-    attr_buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-    attr_buf.write_u16(local_type_count);
-    attr_buf.write_all(data);
+    const auto attr_name = buf.reserve_u16();
+    buf.write_u32(static_cast<uint32_t>(local_type_count * 10 + 2));
+    buf.write_u16(local_type_count);
+    write_locals(true);
+    buf.patch_u16(attr_name, get_utf("LocalVariableTypeTable"));
     attr_count++;
   }
   if (!frames.empty()) {
-    const auto attr_name = get_utf("StackMapTable");
-    data_writer frame_buf;
-    attr_buf.write_u16(attr_name);
-    frame_buf.write_u16(static_cast<uint16_t>(frames.size()));
+    buf.write_u16(get_utf("StackMapTable"));
+    const auto length = buf.reserve_u32();
+    buf.write_u16(static_cast<uint16_t>(frames.size()));
     for (const auto& [target, frame] : frames) {
       const auto delta = next_delta(target);
       std::visit(
@@ -1000,77 +980,50 @@ std::vector<int8_t> class_writer::write_code(const class_file& file, const metho
             if constexpr (std::is_same_v<T, same_frame>) {
               if (const auto stack_opt = arg.stack) {
                 if (delta <= 63) {
-                  frame_buf.write_u8(static_cast<uint8_t>(delta + 64));
+                  buf.write_u8(static_cast<uint8_t>(delta + 64));
                 } else {
-                  frame_buf.write_u8(247);
-                  frame_buf.write_u16(delta);
+                  buf.write_u8(247);
+                  buf.write_u16(delta);
                 }
-                write_frame_var(frame_buf, *stack_opt);
+                write_frame_var(*stack_opt);
               } else {
                 if (delta <= 63) {
-                  frame_buf.write_u8(static_cast<uint8_t>(delta));
+                  buf.write_u8(static_cast<uint8_t>(delta));
                 } else {
-                  frame_buf.write_u8(251);
-                  frame_buf.write_u16(delta);
+                  buf.write_u8(251);
+                  buf.write_u16(delta);
                 }
               }
             } else if constexpr (std::is_same_v<T, full_frame>) {
-              frame_buf.write_u8(255);
-              frame_buf.write_u16(delta);
-              frame_buf.write_u16(static_cast<uint16_t>(arg.locals.size()));
+              buf.write_u8(255);
+              buf.write_u16(delta);
+              buf.write_u16(static_cast<uint16_t>(arg.locals.size()));
               for (const auto& local : arg.locals) {
-                write_frame_var(frame_buf, local);
+                write_frame_var(local);
               }
-              frame_buf.write_u16(static_cast<uint16_t>(arg.stack.size()));
+              buf.write_u16(static_cast<uint16_t>(arg.stack.size()));
               for (const auto& stack : arg.stack) {
-                write_frame_var(frame_buf, stack);
+                write_frame_var(stack);
               }
             } else if constexpr (std::is_same_v<T, chop_frame>) {
-              frame_buf.write_u8(static_cast<uint8_t>(251 - arg.size));
-              frame_buf.write_u16(delta);
+              buf.write_u8(static_cast<uint8_t>(251 - arg.size));
+              buf.write_u16(delta);
             } else if constexpr (std::is_same_v<T, append_frame>) {
-              frame_buf.write_u8(static_cast<uint8_t>(arg.locals.size() + 251));
-              frame_buf.write_u16(delta);
+              buf.write_u8(static_cast<uint8_t>(arg.locals.size() + 251));
+              buf.write_u16(delta);
               for (const auto& local : arg.locals) {
-                write_frame_var(frame_buf, local);
+                write_frame_var(local);
               }
             }
           },
           frame);
     }
-    const auto data = frame_buf.data();
-    attr_buf.write_u32(static_cast<uint32_t>(data.size()));
-    attr_buf.write_all(data);
-    attr_count++;
-  }
-  if (!c.visible_type_annotations.empty()) {
-    const auto attr_name = get_utf("RuntimeVisibleTypeAnnotations");
-    const auto& data = get_type_annotations(c.visible_type_annotations, labels);
-    attr_buf.write_u16(attr_name);
-    attr_buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-    attr_buf.write_u16(static_cast<uint16_t>(c.visible_type_annotations.size()));
-    attr_buf.write_all(data);
-    attr_count++;
-  }
-  if (!c.invisible_type_annotations.empty()) {
-    const auto attr_name = get_utf("RuntimeInvisibleTypeAnnotations");
-    const auto& data = get_type_annotations(c.invisible_type_annotations, labels);
-    attr_buf.write_u16(attr_name);
-    attr_buf.write_u32(static_cast<uint32_t>(data.size() + 2));
-    attr_buf.write_u16(static_cast<uint16_t>(c.invisible_type_annotations.size()));
-    attr_buf.write_all(data);
-    attr_count++;
-  }
-  for (const auto& attr : c.attributes) {
-    const auto attr_name = get_utf(attr.name);
-    attr_buf.write_u16(attr_name);
-    attr_buf.write_u32(static_cast<uint32_t>(attr.data.size()));
-    attr_buf.write_all(attr.data);
+    buf.patch_length(length);
     attr_count++;
   }
-  buf.write_u16(attr_count);
-  buf.write_all(attr_buf.data());
-  return buf.data();
+  attr_count += write_type_annotation_attributes(buf, c.visible_type_annotations, c.invisible_type_annotations, labels);
+  attr_count += write_attributes(buf, c.attributes);
+  buf.patch_u16(attr_count_offset, attr_count);
 }
 uint16_t class_writer::get_class(const std::string_view& name) {
   const auto utf_index = get_utf(name);
@@ -1356,8 +1309,7 @@ uint16_t class_writer::get_bsm(const method_handle& handle, const std::vector<va
   bsm_buffer_.emplace_back(handle_index, arg_indices);
   return static_cast<uint16_t>(index);
 }
-std::vector<int8_t> class_writer::get_annotations(const std::vector<annotation>& annos) {
-  data_writer buf;
+void class_writer::get_annotations(databuf& buf, const std::vector<annotation>& annos) {
   for (const auto& anno : annos) {
     const auto type_index = get_utf(anno.desc);
     buf.write_u16(type_index);
@@ -1368,9 +1320,8 @@ std::vector<int8_t> class_writer::get_annotations(const std::vector<annotation>&
       get_element_value(buf, value);
     }
   }
-  return buf.data();
 }
-void class_writer::get_element_value(data_writer& buf, const element_value& value) {
+void class_writer::get_element_value(databuf& buf, const element_value& value) {
   std::visit(
       [this, &buf](auto&& arg) {
         using T = std::decay_t<decltype(arg)>;
@@ -1410,7 +1361,7 @@ void class_writer::get_element_value(data_writer& buf, const element_value& valu
           buf.write_u16(get_utf(arg.get()));
         } else if constexpr (std::is_same_v<T, annotation>) {
           buf.write_u8('@');
-          buf.write_all(get_annotations({arg}));
+          get_annotations(buf, {arg});
         } else if constexpr (std::is_same_v<T, std::vector<element_value>>) {
           buf.write_u8('[');
           buf.write_u16(static_cast<uint16_t>(arg.size()));
@@ -1421,8 +1372,8 @@ void class_writer::get_element_value(data_writer& buf, const element_value& valu
       },
       value.value);
 }
-std::vector<int8_t> class_writer::get_type_annotations(const std::vector<type_annotation>& annos,
-                                                       const std::vector<std::pair<size_t, label>>& labels) {
+void class_writer::get_type_annotations(databuf& buf, const std::vector<type_annotation>& annos,
+                                        const std::vector<std::pair<size_t, label>>& labels) {
   const auto get_label = [&labels](const label& lbl) -> size_t {
     for (const auto& [idx, label] : labels) {
       if (lbl == label) {
@@ -1431,7 +1382,6 @@ std::vector<int8_t> class_writer::get_type_annotations(const std::vector<type_an
     }
     return 0;
   };
-  data_writer buf;
   for (const auto& anno : annos) {
     buf.write_u8(anno.target_type);
     std::visit(
@@ -1486,16 +1436,150 @@ std::vector<int8_t> class_writer::get_type_annotations(const std::vector<type_an
       get_element_value(buf, value);
     }
   }
-  return buf.data();
 }
 std::vector<int8_t> class_writer::write(const class_file& file) {
+  std::vector<int8_t> data;
+  write(file, data);
+  return data;
+}
+void class_writer::write(const class_file& file, std::vector<int8_t>& out) {
+  prepare(file);
+  out.clear();
+  out.reserve(head_.size() + body_.size());
+  out.insert(out.end(), head_.begin(), head_.end());
+  out.insert(out.end(), body_.begin(), body_.end());
+}
+result<void> class_writer::write(const class_file& file, std::ostream& out) {
+  prepare(file);
+  for (const auto segment : {&head_, &body_}) {
+    out.write(reinterpret_cast<const char*>(segment->data()), static_cast<std::streamsize>(segment->size()));
+  }
+  if (!out) {
+    return error("Failed to write class " + file.name);
+  }
+  return {};
+}
+result<void> class_writer::write(const class_file& file, int fd) {
+  prepare(file);
+#ifdef _WIN32
+  for (const auto segment : {&head_, &body_}) {
+    size_t written = 0;
+    while (written < segment->size()) {
+      const auto res = _write(fd, segment->data() + written, static_cast<unsigned int>(segment->size() - written));
+      if (res < 0) {
+        return error("Failed to write class " + file.name);
+      }
+      written += static_cast<size_t>(res);
+    }
+  }
+#else
+  iovec iov[2];
+  auto count = 0;
+  for (const auto segment : {&head_, &body_}) {
+    if (!segment->empty()) {
+      iov[count].iov_base = segment->data();
+      iov[count].iov_len = segment->size();
+      count++;
+    }
+  }
+  auto first = 0;
+  while (first < count) {
+    const auto res = writev(fd, iov + first, count - first);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return error("Failed to write class " + file.name + ": " + std::strerror(errno));
+    }
+    auto written = static_cast<size_t>(res);
+    while (first < count && written >= iov[first].iov_len) {
+      written -= iov[first].iov_len;
+      first++;
+    }
+    if (first < count) {
+      iov[first].iov_base = static_cast<int8_t*>(iov[first].iov_base) + written;
+      iov[first].iov_len -= written;
+    }
+  }
+#endif
+  return {};
+}
+void class_writer::prepare(const class_file& file) {
+  // Left behind by a write that threw.
+  pool_seed_.clear();
+  analyses_.clear();
+  if ((flags_ & optimize_pool) == 0) {
+    write_class(file);
+    return;
+  }
+  ldc_counts_.clear();
+  write_class(file);
+  layout_pool();
+  write_class(file);
+  pool_seed_.clear();
+}
+void class_writer::layout_pool() {
+  std::vector<uint16_t> hot;
+  for (const auto& [index, count] : ldc_counts_) {
+    const auto& info = pool_[index];
+    if (std::holds_alternative<cp::string_info>(info) || std::holds_alternative<cp::class_info>(info) ||
+        std::holds_alternative<cp::integer_info>(info) || std::holds_alternative<cp::float_info>(info)) {
+      hot.emplace_back(index);
+    }
+  }
+  std::sort(hot.begin(), hot.end(), [this](uint16_t a, uint16_t b) {
+    const auto count_a = ldc_counts_[a];
+    const auto count_b = ldc_counts_[b];
+    return count_a != count_b ? count_a > count_b : a < b;
+  });
+  if (hot.size() > std::numeric_limits<uint8_t>::max()) {
+    hot.resize(std::numeric_limits<uint8_t>::max());
+  }
+
+  std::vector<const std::string*> utf;
+  for (const auto& info : pool_) {
+    if (const auto str = std::get_if<cp::utf8_info>(&info)) {
+      utf.emplace_back(&str->value);
+    }
+  }
+  std::sort(utf.begin(), utf.end(), [](const std::string* a, const std::string* b) {
+    return *a < *b;
+  });
+
+  pool_seed_.clear();
+  pool_seed_.reserve(1 + hot.size() + utf.size());
+  pool_seed_.emplace_back(cp::pad_info{});
+  pool_seed_.resize(1 + hot.size());
+  std::unordered_map<std::string_view, uint16_t> utf_indices;
+  for (const auto str : utf) {
+    utf_indices.emplace(*str, static_cast<uint16_t>(pool_seed_.size()));
+    pool_seed_.emplace_back(cp::utf8_info{*str});
+  }
+  const auto utf_of = [this, &utf_indices](uint16_t old_index) {
+    return utf_indices.at(std::get<cp::utf8_info>(pool_[old_index]).value);
+  };
+  for (size_t i = 0; i < hot.size(); i++) {
+    const auto& info = pool_[hot[i]];
+    if (const auto str = std::get_if<cp::string_info>(&info)) {
+      pool_seed_[i + 1] = cp::string_info{utf_of(str->string_index)};
+    } else if (const auto cls = std::get_if<cp::class_info>(&info)) {
+      pool_seed_[i + 1] = cp::class_info{utf_of(cls->name_index)};
+    } else {
+      pool_seed_[i + 1] = info;
+    }
+  }
+}
+void class_writer::write_class(const class_file& file) {
   pool_.clear();
   bsm_buffer_.clear();
-  attributes_.clear();
+  body_.clear();
+  body_.reserve(estimate_body_size(file));
   attributes_count_ = 0;
-  fields_.clear();
-  methods_.clear();
-  pool_.emplace_back(cp::pad_info{});
+  if (pool_seed_.empty()) {
+    pool_.emplace_back(cp::pad_info{});
+  } else {
+    pool_ = pool_seed_;
+  }
   uint16_t this_class = get_class(file.name);
   uint16_t super_class = file.super_name ? get_class(*file.super_name) : 0;
   std::vector<uint16_t> interfaces;
@@ -1503,6 +1587,9 @@ std::vector<int8_t> class_writer::write(const class_file& file) {
   for (const auto& i : file.interfaces) {
     interfaces.emplace_back(get_class(i));
   }
+  write_fields(file.fields);
+  write_methods(file, file.methods, file.version < class_version::v1_1);
+  const auto attributes_count = data_writer::reserve_u16(body_);
   if (file.source_file) {
     write_source_file(*file.source_file);
   }
@@ -1540,64 +1627,43 @@ std::vector<int8_t> class_writer::write(const class_file& file) {
   if (!file.permitted_subclasses.empty()) {
     write_permitted_subclasses(file.permitted_subclasses);
   }
+  databuf buf(body_);
   if (file.synthetic) {
-    databuf buf(attributes_);
     buf.write_u16(get_utf("Synthetic"));
     buf.write_u32(0);
     attributes_count_++;
   }
   if (file.deprecated) {
-    databuf buf(attributes_);
     buf.write_u16(get_utf("Deprecated"));
     buf.write_u32(0);
     attributes_count_++;
   }
-  if (!file.visible_annotations.empty()) {
-    write_annotations(file.visible_annotations, true);
-  }
-  if (!file.invisible_annotations.empty()) {
-    write_annotations(file.invisible_annotations, false);
-  }
-  if (!file.visible_type_annotations.empty()) {
-    write_type_annotations(file.visible_type_annotations, true);
-  }
-  if (!file.invisible_type_annotations.empty()) {
-    write_type_annotations(file.invisible_type_annotations, false);
-  }
-  for (const auto& attr : file.attributes) {
-    const auto attr_name = get_utf(attr.name);
-    databuf buf(attributes_);
-    buf.write_u16(attr_name);
-    buf.write_u16(static_cast<uint16_t>(attr.data.size()));
-    buf.write_all(attr.data);
-    attributes_count_++;
-  }
-  write_fields(file.fields);
-  write_methods(file, file.methods, file.version < class_version::v1_1);
-
+  attributes_count_ += write_annotation_attributes(buf, file.visible_annotations, file.invisible_annotations);
+  attributes_count_ +=
+      write_type_annotation_attributes(buf, file.visible_type_annotations, file.invisible_type_annotations, {});
+  attributes_count_ += write_attributes(buf, file.attributes);
   if (!bsm_buffer_.empty()) {
-    const auto attr_name = get_utf("BootstrapMethods");
-    data_writer attrbuf;
-    attrbuf.write_u16(static_cast<uint16_t>(bsm_buffer_.size()));
+    buf.write_u16(get_utf("BootstrapMethods"));
+    const auto length = buf.reserve_u32();
+    buf.write_u16(static_cast<uint16_t>(bsm_buffer_.size()));
     for (const auto& [ref, args] : bsm_buffer_) {
-      attrbuf.write_u16(ref);
-      attrbuf.write_u16(static_cast<uint16_t>(args.size()));
-      for (const auto& i : args) {
-        attrbuf.write_u16(i);
-      }
+      buf.write_u16(ref);
+      buf.write_u16(static_cast<uint16_t>(args.size()));
+      buf.write_u16s(args.data(), args.size());
     }
-    const auto attr = attrbuf.data();
-    databuf buf(attributes_);
-    buf.write_u16(attr_name);
-    buf.write_u32(static_cast<uint32_t>(attr.size()));
-    buf.write_all(attr);
+    buf.patch_length(length);
     attributes_count_++;
   }
+  buf.patch_u16(attributes_count, attributes_count_);
 
-  data_writer buf;
-  buf.write_u32(0xcafebabe);
-  buf.write_u16(static_cast<uint16_t>(file.version & 0xffff));
-  buf.write_u16(static_cast<uint16_t>(file.version >> 16));
+  // The pool is only complete once everything else has been written, so it goes into its own segment in front of the
+  // body.
+  data_writer head;
+  head.data().swap(head_);
+  head.data().clear();
+  head.write_u32(0xcafebabe);
+  head.write_u16(static_cast<uint16_t>(file.version & 0xffff));
+  head.write_u16(static_cast<uint16_t>(file.version >> 16));
   uint16_t pool_count = 1;
   for (const auto& info : pool_) {
     if (std::holds_alternative<cp::pad_info>(info)) {
@@ -1608,23 +1674,15 @@ std::vector<int8_t> class_writer::write(const class_file& file) {
       pool_count++;
     }
   }
-  buf.write_u16(pool_count);
+  head.write_u16(pool_count);
   for (const auto& info : pool_) {
-    std::visit(constant_pool_visitor(buf), info);
-  }
-  buf.write_u16(file.access_flags);
-  buf.write_u16(this_class);
-  buf.write_u16(super_class);
-  buf.write_u16(static_cast<uint16_t>(interfaces.size()));
-  for (const auto& i : interfaces) {
-    buf.write_u16(i);
-  }
-  buf.write_u16(static_cast<uint16_t>(file.fields.size()));
-  buf.write_all(fields_);
-  buf.write_u16(static_cast<uint16_t>(file.methods.size()));
-  buf.write_all(methods_);
-  buf.write_u16(attributes_count_);
-  buf.write_all(attributes_);
-  return buf.data();
+    std::visit(constant_pool_visitor(head), info);
+  }
+  head.write_u16(file.access_flags);
+  head.write_u16(this_class);
+  head.write_u16(super_class);
+  head.write_u16(static_cast<uint16_t>(interfaces.size()));
+  head.write_u16s(interfaces.data(), interfaces.size());
+  head.data().swap(head_);
 }
 } // namespace cafe
@@ -160,6 +160,33 @@ std::vector<int8_t>& data_reader::data() {
 size_t data_reader::cursor() const {
   return cursor_;
 }
+bool data_reader::read_u16s(std::vector<uint16_t>& out, size_t count) {
+  if (cursor_ > buffer_.size() || count > (buffer_.size() - cursor_) / 2) {
+    return false;
+  }
+  out.resize(count);
+  const auto in = reinterpret_cast<const uint8_t*>(buffer_.data() + cursor_);
+  const auto values = out.data();
+  for (size_t i = 0; i < count; i++) {
+    values[i] = static_cast<uint16_t>(in[i * 2] << 8 | in[i * 2 + 1]);
+  }
+  cursor_ += count * 2;
+  return true;
+}
+bool data_reader::read_i32s(std::vector<int32_t>& out, size_t count) {
+  if (cursor_ > buffer_.size() || count > (buffer_.size() - cursor_) / 4) {
+    return false;
+  }
+  out.resize(count);
+  const auto in = reinterpret_cast<const uint8_t*>(buffer_.data() + cursor_);
+  const auto values = out.data();
+  for (size_t i = 0; i < count; i++) {
+    values[i] = static_cast<int32_t>(static_cast<uint32_t>(in[i * 4]) << 24 | static_cast<uint32_t>(in[i * 4 + 1]) << 16 |
+                                     static_cast<uint32_t>(in[i * 4 + 2]) << 8 | in[i * 4 + 3]);
+  }
+  cursor_ += count * 4;
+  return true;
+}
 bool data_reader::cursor(size_t cursor) {
   if (cursor > buffer_.size()) {
     return false;
@@ -4,6 +4,21 @@
 #include <cstring>
 
 namespace cafe {
+namespace {
+// Grows the buffer once for a run of values and returns where they go.
+int8_t* grow(std::vector<int8_t>& buffer, size_t size) {
+  const auto offset = buffer.size();
+  buffer.resize(offset + size);
+  return buffer.data() + offset;
+}
+// Compilers turn this into a single byte swapped store.
+template<typename T>
+void store_be(int8_t* out, T value) {
+  for (size_t i = 0; i < sizeof(T); i++) {
+    out[i] = static_cast<int8_t>(value >> ((sizeof(T) - 1 - i) * 8));
+  }
+}
+} // namespace
 inline size_t to_utf8m_len(const std::string_view& input) {
   size_t new_length = 0;
   const auto length = input.length();
@@ -85,6 +100,12 @@ void data_writer::write_u64(std::vector<int8_t>& buffer, uint64_t value) {
   write_i8(buffer, b7);
   write_i8(buffer, b8);
 }
+void data_writer::write_u16s(std::vector<int8_t>& buffer, const uint16_t* values, size_t count) {
+  auto out = grow(buffer, count * 2);
+  for (size_t i = 0; i < count; i++, out += 2) {
+    store_be(out, values[i]);
+  }
+}
 void data_writer::write_f32(std::vector<int8_t>& buffer, float value) {
   if (std::isnan(value)) {
     write_i32(buffer, 0x7fc00000);
@@ -139,6 +160,25 @@ void data_writer::write_utf(std::vector<int8_t>& buffer, const std::string_view&
     }
   }
 }
+size_t data_writer::reserve_u16(std::vector<int8_t>& buffer) {
+  const auto offset = buffer.size();
+  grow(buffer, 2);
+  return offset;
+}
+size_t data_writer::reserve_u32(std::vector<int8_t>& buffer) {
+  const auto offset = buffer.size();
+  grow(buffer, 4);
+  return offset;
+}
+void data_writer::patch_u16(std::vector<int8_t>& buffer, size_t offset, uint16_t value) {
+  store_be(buffer.data() + offset, value);
+}
+void data_writer::patch_u32(std::vector<int8_t>& buffer, size_t offset, uint32_t value) {
+  store_be(buffer.data() + offset, value);
+}
+void data_writer::patch_length(std::vector<int8_t>& buffer, size_t offset) {
+  patch_u32(buffer, offset, static_cast<uint32_t>(buffer.size() - offset - 4));
+}
 
 void data_writer::write_i8(int8_t value) {
   return write_u8(buffer_, value);
@@ -173,6 +213,30 @@ void data_writer::write_f64(double value) {
 void data_writer::write_utf(const std::string_view& value) {
   return write_utf(buffer_, value);
 }
+void data_writer::write_u16s(const uint16_t* values, size_t count) {
+  write_u16s(buffer_, values, count);
+}
+void data_writer::reserve(size_t capacity) {
+  buffer_.reserve(capacity);
+}
+size_t data_writer::reserve_u16() {
+  return reserve_u16(buffer_);
+}
+size_t data_writer::reserve_u32() {
+  return reserve_u32(buffer_);
+}
+void data_writer::patch_u16(size_t offset, uint16_t value) {
+  patch_u16(buffer_, offset, value);
+}
+void data_writer::patch_u32(size_t offset, uint32_t value) {
+  patch_u32(buffer_, offset, value);
+}
+void data_writer::patch_length(size_t offset) {
+  patch_length(buffer_, offset);
+}
+size_t data_writer::size() const {
+  return buffer_.size();
+}
 const std::vector<int8_t>& data_writer::data() const {
   return buffer_;
 }
@@ -214,4 +278,28 @@ void databuf::write_f64(double value) {
 void databuf::write_utf(const std::string_view& value) {
   return data_writer::write_utf(buffer_, value);
 }
+void databuf::write_u16s(const uint16_t* values, size_t count) {
+  data_writer::write_u16s(buffer_, values, count);
+}
+void databuf::reserve(size_t capacity) {
+  buffer_.reserve(capacity);
+}
+size_t databuf::reserve_u16() {
+  return data_writer::reserve_u16(buffer_);
+}
+size_t databuf::reserve_u32() {
+  return data_writer::reserve_u32(buffer_);
+}
+void databuf::patch_u16(size_t offset, uint16_t value) {
+  data_writer::patch_u16(buffer_, offset, value);
+}
+void databuf::patch_u32(size_t offset, uint32_t value) {
+  data_writer::patch_u32(buffer_, offset, value);
+}
+void databuf::patch_length(size_t offset) {
+  data_writer::patch_length(buffer_, offset);
+}
+size_t databuf::size() const {
+  return buffer_.size();
+}
 } // namespace cafe
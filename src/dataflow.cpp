@@ -0,0 +1,303 @@
+#include "cafe/dataflow.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+namespace cafe {
+namespace {
+// The load or store an instruction is, short forms such as iload_0 included, or nullopt for anything else.
+std::optional<var_insn> var_access(const instruction& in) {
+  if (const auto var = std::get_if<var_insn>(&in)) {
+    return *var;
+  }
+  if (const auto plain = std::get_if<insn>(&in)) {
+    return expand_var_insn(plain->opcode);
+  }
+  return std::nullopt;
+}
+} // namespace
+
+bit_vector::bit_vector(size_t size) : size_(size), words_((size + 63) / 64) {
+}
+size_t bit_vector::size() const {
+  return size_;
+}
+bool bit_vector::test(size_t index) const {
+  return (words_[index / 64] >> (index % 64) & 1) != 0;
+}
+void bit_vector::set(size_t index) {
+  words_[index / 64] |= uint64_t(1) << (index % 64);
+}
+void bit_vector::reset(size_t index) {
+  words_[index / 64] &= ~(uint64_t(1) << (index % 64));
+}
+void bit_vector::set_all() {
+  std::fill(words_.begin(), words_.end(), ~uint64_t(0));
+  // The bits past the size stay clear, so that comparing and counting can work on whole words.
+  if (size_ % 64 != 0) {
+    words_.back() = (uint64_t(1) << (size_ % 64)) - 1;
+  }
+}
+void bit_vector::reset_all() {
+  std::fill(words_.begin(), words_.end(), 0);
+}
+bool bit_vector::any() const {
+  return std::any_of(words_.begin(), words_.end(), [](uint64_t word) {
+    return word != 0;
+  });
+}
+size_t bit_vector::count() const {
+  size_t count = 0;
+  for (auto word : words_) {
+    for (; word != 0; word &= word - 1) {
+      count++;
+    }
+  }
+  return count;
+}
+bool bit_vector::union_with(const bit_vector& other) {
+  uint64_t changed = 0;
+  for (size_t i = 0; i < words_.size(); i++) {
+    const auto word = words_[i] | other.words_[i];
+    changed |= word ^ words_[i];
+    words_[i] = word;
+  }
+  return changed != 0;
+}
+bool bit_vector::intersect_with(const bit_vector& other) {
+  uint64_t changed = 0;
+  for (size_t i = 0; i < words_.size(); i++) {
+    const auto word = words_[i] & other.words_[i];
+    changed |= word ^ words_[i];
+    words_[i] = word;
+  }
+  return changed != 0;
+}
+void bit_vector::subtract(const bit_vector& other) {
+  for (size_t i = 0; i < words_.size(); i++) {
+    words_[i] &= ~other.words_[i];
+  }
+}
+bool bit_vector::intersects(const bit_vector& other) const {
+  for (size_t i = 0; i < words_.size(); i++) {
+    if ((words_[i] & other.words_[i]) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+bool bit_vector::operator==(const bit_vector& other) const {
+  return size_ == other.size_ && words_ == other.words_;
+}
+bool bit_vector::operator!=(const bit_vector& other) const {
+  return !(*this == other);
+}
+std::string bit_vector::to_string() const {
+  std::ostringstream oss;
+  oss << "bit_vector(";
+  auto first = true;
+  for_each([&](size_t index) {
+    if (!first) {
+      oss << ", ";
+    }
+    first = false;
+    oss << index;
+  });
+  oss << ")";
+  return oss.str();
+}
+
+block_order::block_order(const basic_block_graph& graph) {
+  const auto& blocks = graph.blocks();
+  if (blocks.empty()) {
+    return;
+  }
+  std::unordered_map<const basic_block*, size_t> positions;
+  std::vector<const basic_block*> by_position;
+  for (const auto& block : blocks) {
+    positions.emplace(&block, by_position.size());
+    by_position.emplace_back(&block);
+  }
+  // Successors are visited in graph order so that the numbering does not depend on where the blocks were allocated.
+  std::vector<std::vector<edge>> edges(by_position.size());
+  for (size_t i = 0; i < by_position.size(); i++) {
+    for (const auto& [succ, tcb_types] : by_position[i]->successors()) {
+      edges[i].push_back(edge{positions.at(succ), !tcb_types.empty()});
+    }
+    std::sort(edges[i].begin(), edges[i].end(), [](const edge& first, const edge& second) {
+      return first.block < second.block;
+    });
+  }
+
+  std::vector<size_t> postorder;
+  std::vector<bool> visited(by_position.size());
+  std::vector<std::pair<size_t, size_t>> stack;
+  stack.emplace_back(0, 0);
+  visited[0] = true;
+  while (!stack.empty()) {
+    auto& [block, next] = stack.back();
+    if (next < edges[block].size()) {
+      const auto succ = edges[block][next++].block;
+      if (!visited[succ]) {
+        visited[succ] = true;
+        stack.emplace_back(succ, 0);
+      }
+      continue;
+    }
+    postorder.emplace_back(block);
+    stack.pop_back();
+  }
+  reachable_ = postorder.size();
+
+  std::vector<size_t> ids(by_position.size());
+  blocks_.reserve(by_position.size());
+  for (auto it = postorder.rbegin(); it != postorder.rend(); ++it) {
+    ids[*it] = blocks_.size();
+    blocks_.emplace_back(by_position[*it]);
+  }
+  for (size_t i = 0; i < by_position.size(); i++) {
+    if (!visited[i]) {
+      ids[i] = blocks_.size();
+      blocks_.emplace_back(by_position[i]);
+    }
+  }
+  ids_.reserve(blocks_.size());
+  successors_.resize(blocks_.size());
+  predecessors_.resize(blocks_.size());
+  for (size_t i = 0; i < by_position.size(); i++) {
+    const auto id = ids[i];
+    ids_.emplace(by_position[i], id);
+    for (const auto& succ : edges[i]) {
+      successors_[id].push_back(edge{ids[succ.block], succ.handler});
+      predecessors_[ids[succ.block]].push_back(edge{id, succ.handler});
+    }
+  }
+}
+size_t block_order::size() const {
+  return blocks_.size();
+}
+size_t block_order::reachable() const {
+  return reachable_;
+}
+size_t block_order::id(const basic_block& block) const {
+  return ids_.at(&block);
+}
+const basic_block& block_order::block(size_t id) const {
+  return *blocks_[id];
+}
+const std::vector<block_order::edge>& block_order::successors(size_t id) const {
+  return successors_[id];
+}
+const std::vector<block_order::edge>& block_order::predecessors(size_t id) const {
+  return predecessors_[id];
+}
+
+dataflow_result::dataflow_result(std::vector<bit_vector>&& in, std::vector<bit_vector>&& out)
+    : in_(std::move(in)), out_(std::move(out)) {
+}
+const bit_vector& dataflow_result::in(size_t block) const {
+  return in_[block];
+}
+const bit_vector& dataflow_result::out(size_t block) const {
+  return out_[block];
+}
+
+liveness::liveness(uint16_t max_locals) : max_locals_(max_locals) {
+}
+size_t liveness::size() const {
+  return max_locals_;
+}
+void liveness::boundary(bit_vector& facts) const {
+  facts.reset_all();
+}
+void liveness::effect(const basic_block& block, block_effect& effect) const {
+  const auto use = [&](uint16_t index, uint16_t size) {
+    for (size_t i = index; i < static_cast<size_t>(index) + size && i < max_locals_; i++) {
+      effect.gen.set(i);
+    }
+  };
+  const auto def = [&](uint16_t index, uint16_t size) {
+    for (size_t i = index; i < static_cast<size_t>(index) + size && i < max_locals_; i++) {
+      effect.gen.reset(i);
+      effect.kill.set(i);
+    }
+  };
+  const auto& instructions = block.instructions();
+  for (auto it = instructions.rbegin(); it != instructions.rend(); ++it) {
+    if (const auto var = var_access(**it)) {
+      const uint16_t size = var->is_wide() ? 2 : 1;
+      if (var->is_store()) {
+        def(var->index, size);
+      } else {
+        use(var->index, size);
+      }
+    } else if (const auto iinc = std::get_if<iinc_insn>(&**it)) {
+      use(iinc->index, 1);
+    }
+  }
+}
+
+reaching_definitions::reaching_definitions(const code& code, uint16_t start_locals) : start_locals_(start_locals) {
+  for (uint16_t i = 0; i < start_locals; i++) {
+    definitions_.push_back(definition{code.end(), i, 1});
+  }
+  uint16_t max_locals = start_locals;
+  for (auto it = code.begin(); it != code.end(); ++it) {
+    if (const auto var = var_access(*it); var && var->is_store()) {
+      const uint16_t size = var->is_wide() ? 2 : 1;
+      by_insn_.emplace(&*it, definitions_.size());
+      definitions_.push_back(definition{it, var->index, size});
+      max_locals = std::max(max_locals, static_cast<uint16_t>(var->index + size));
+    } else if (const auto iinc = std::get_if<iinc_insn>(&*it)) {
+      by_insn_.emplace(&*it, definitions_.size());
+      definitions_.push_back(definition{it, iinc->index, 1});
+      max_locals = std::max(max_locals, static_cast<uint16_t>(iinc->index + 1));
+    }
+  }
+  none_ = bit_vector(definitions_.size());
+  by_slot_.assign(max_locals, none_);
+  for (size_t i = 0; i < definitions_.size(); i++) {
+    const auto& def = definitions_[i];
+    for (uint16_t slot = def.index; slot < def.index + def.size; slot++) {
+      by_slot_[slot].set(i);
+    }
+  }
+}
+size_t reaching_definitions::size() const {
+  return definitions_.size();
+}
+void reaching_definitions::boundary(bit_vector& facts) const {
+  facts.reset_all();
+  for (uint16_t i = 0; i < start_locals_; i++) {
+    facts.set(i);
+  }
+}
+void reaching_definitions::effect(const basic_block& block, block_effect& effect) const {
+  for (const auto& it : block.instructions()) {
+    const auto found = by_insn_.find(&*it);
+    if (found == by_insn_.end()) {
+      continue;
+    }
+    const auto& def = definitions_[found->second];
+    // A write to either slot of a long or double ends it, so every definition that overlaps is killed.
+    for (uint16_t slot = def.index; slot < def.index + def.size; slot++) {
+      effect.gen.subtract(by_slot_[slot]);
+      effect.kill.union_with(by_slot_[slot]);
+    }
+    effect.gen.set(found->second);
+    effect.thrown.set(found->second);
+  }
+}
+const std::vector<reaching_definitions::definition>& reaching_definitions::definitions() const {
+  return definitions_;
+}
+std::optional<size_t> reaching_definitions::definition_of(const instruction& insn) const {
+  if (const auto found = by_insn_.find(&insn); found != by_insn_.end()) {
+    return found->second;
+  }
+  return std::nullopt;
+}
+const bit_vector& reaching_definitions::definitions_of(uint16_t index) const {
+  return index < by_slot_.size() ? by_slot_[index] : none_;
+}
+} // namespace cafe
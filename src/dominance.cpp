@@ -0,0 +1,157 @@
+#include "cafe/dominance.hpp"
+
+#include <algorithm>
+
+namespace cafe {
+dominator_tree::dominator_tree(const block_order& order)
+    : idoms_(order.size(), none), children_(order.size()), frontiers_(order.size()), enter_(order.size(), none),
+      exit_(order.size(), none) {
+  const auto count = order.reachable();
+  if (count == 0) {
+    return;
+  }
+  // The ids are in reverse postorder, so walking up from the higher id meets the common dominator.
+  const auto intersect = [this](size_t first, size_t second) {
+    while (first != second) {
+      while (first > second) {
+        first = idoms_[first];
+      }
+      while (second > first) {
+        second = idoms_[second];
+      }
+    }
+    return first;
+  };
+  idoms_[0] = 0;
+  for (auto changed = true; changed;) {
+    changed = false;
+    for (size_t block = 1; block < count; block++) {
+      auto idom = none;
+      for (const auto& pred : order.predecessors(block)) {
+        if (pred.block >= count || idoms_[pred.block] == none) {
+          continue;
+        }
+        idom = idom == none ? pred.block : intersect(pred.block, idom);
+      }
+      if (idoms_[block] != idom) {
+        idoms_[block] = idom;
+        changed = true;
+      }
+    }
+  }
+  idoms_[0] = none;
+  for (size_t block = 1; block < count; block++) {
+    children_[idoms_[block]].emplace_back(block);
+  }
+
+  size_t time = 0;
+  std::vector<std::pair<size_t, size_t>> stack;
+  stack.emplace_back(0, 0);
+  enter_[0] = time++;
+  while (!stack.empty()) {
+    auto& [block, next] = stack.back();
+    if (next < children_[block].size()) {
+      const auto child = children_[block][next++];
+      enter_[child] = time++;
+      stack.emplace_back(child, 0);
+      continue;
+    }
+    exit_[block] = time++;
+    stack.pop_back();
+  }
+
+  for (size_t block = 0; block < count; block++) {
+    const auto& preds = order.predecessors(block);
+    // Control also enters the entry block from outside the method.
+    if (preds.size() + (block == 0 ? 1 : 0) < 2) {
+      continue;
+    }
+    for (const auto& pred : preds) {
+      if (pred.block >= count) {
+        continue;
+      }
+      for (auto runner = pred.block; runner != idoms_[block]; runner = idoms_[runner]) {
+        auto& frontier = frontiers_[runner];
+        if (frontier.empty() || frontier.back() != block) {
+          frontier.emplace_back(block);
+        }
+        if (runner == 0) {
+          break;
+        }
+      }
+    }
+  }
+}
+size_t dominator_tree::idom(size_t block) const {
+  return idoms_[block];
+}
+const std::vector<size_t>& dominator_tree::children(size_t block) const {
+  return children_[block];
+}
+bool dominator_tree::dominates(size_t first, size_t second) const {
+  if (enter_[first] == none || enter_[second] == none) {
+    return false;
+  }
+  return enter_[first] <= enter_[second] && exit_[second] <= exit_[first];
+}
+const std::vector<size_t>& dominator_tree::frontier(size_t block) const {
+  return frontiers_[block];
+}
+
+loop_forest::loop_forest(const block_order& order, const dominator_tree& dominators)
+    : block_loops_(order.size(), none) {
+  const auto count = order.reachable();
+  // Headers are visited in reverse postorder, so every loop is found before the loops nested in it.
+  std::vector<bool> in_loop(count);
+  std::vector<size_t> worklist;
+  for (size_t header = 0; header < count; header++) {
+    std::vector<size_t> latches;
+    for (const auto& pred : order.predecessors(header)) {
+      if (pred.block < count && dominators.dominates(header, pred.block)) {
+        latches.emplace_back(pred.block);
+      }
+    }
+    if (latches.empty()) {
+      continue;
+    }
+    loop current{header, none, 1, {header}, latches};
+    std::fill(in_loop.begin(), in_loop.end(), false);
+    in_loop[header] = true;
+    worklist = latches;
+    while (!worklist.empty()) {
+      const auto block = worklist.back();
+      worklist.pop_back();
+      if (in_loop[block]) {
+        continue;
+      }
+      in_loop[block] = true;
+      current.blocks.emplace_back(block);
+      for (const auto& pred : order.predecessors(block)) {
+        if (pred.block < count && !in_loop[pred.block]) {
+          worklist.emplace_back(pred.block);
+        }
+      }
+    }
+    std::sort(current.blocks.begin(), current.blocks.end());
+    if (const auto parent = block_loops_[header]; parent != none) {
+      current.parent = parent;
+      current.depth = loops_[parent].depth + 1;
+    }
+    const auto id = loops_.size();
+    for (const auto block : current.blocks) {
+      block_loops_[block] = id;
+    }
+    loops_.emplace_back(std::move(current));
+  }
+}
+const std::vector<loop_forest::loop>& loop_forest::loops() const {
+  return loops_;
+}
+size_t loop_forest::loop_of(size_t block) const {
+  return block_loops_[block];
+}
+size_t loop_forest::depth(size_t block) const {
+  const auto id = block_loops_[block];
+  return id == none ? 0 : loops_[id].depth;
+}
+} // namespace cafe
@@ -345,6 +345,17 @@ std::string to_string(const instruction& insn) {
 std::string to_string(instruction&& insn) {
   return std::visit([](auto&& i) -> std::string { return i.to_string(); }, insn);
 }
+std::optional<var_insn> expand_var_insn(uint8_t opcode) {
+  if (opcode >= op::iload_0 && opcode <= op::aload_3) {
+    const auto offset = opcode - op::iload_0;
+    return var_insn(static_cast<uint8_t>(op::iload + offset / 4), static_cast<uint16_t>(offset % 4));
+  }
+  if (opcode >= op::istore_0 && opcode <= op::astore_3) {
+    const auto offset = opcode - op::istore_0;
+    return var_insn(static_cast<uint8_t>(op::istore + offset / 4), static_cast<uint16_t>(offset % 4));
+  }
+  return std::nullopt;
+}
 tcb::tcb(label start, label end, label handler, const std::optional<std::string>& type) :
     start(std::move(start)), end(std::move(end)), handler(std::move(handler)), type(type) {
 }
@@ -0,0 +1,1453 @@
+#include "cafe/ssa.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "cafe/analysis.hpp"
+#include "cafe/constants.hpp"
+#include "cafe/transform.hpp"
+
+namespace cafe {
+namespace {
+// The second stack slot of a long or double, and a local or stack entry that is not set.
+constexpr ssa_value top = ssa_insn::none - 1;
+constexpr ssa_value undefined = ssa_insn::none - 2;
+
+bool is_wide(ssa_type type) {
+  return type == ssa_type::long_ || type == ssa_type::double_;
+}
+ssa_type type_of(const type& type) {
+  switch (type.kind()) {
+    case type_kind::long_:
+      return ssa_type::long_;
+    case type_kind::float_:
+      return ssa_type::float_;
+    case type_kind::double_:
+      return ssa_type::double_;
+    case type_kind::object:
+    case type_kind::array:
+      return ssa_type::reference;
+    default:
+      return ssa_type::int_;
+  }
+}
+ssa_type type_of(char type) {
+  switch (type) {
+    case 'j':
+      return ssa_type::long_;
+    case 'f':
+      return ssa_type::float_;
+    case 'd':
+      return ssa_type::double_;
+    case 'a':
+      return ssa_type::reference;
+    default:
+      return ssa_type::int_;
+  }
+}
+ssa_type type_of(const value& value) {
+  return std::visit(
+      [](const auto& arg) {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, int32_t>) {
+          return ssa_type::int_;
+        } else if constexpr (std::is_same_v<T, float>) {
+          return ssa_type::float_;
+        } else if constexpr (std::is_same_v<T, int64_t>) {
+          return ssa_type::long_;
+        } else if constexpr (std::is_same_v<T, double>) {
+          return ssa_type::double_;
+        } else if constexpr (std::is_same_v<T, dynamic>) {
+          return type_of(descriptor::get(arg.desc)->return_type);
+        } else {
+          return ssa_type::reference;
+        }
+      },
+      value);
+}
+char type_char(ssa_type type) {
+  switch (type) {
+    case ssa_type::int_:
+      return 'i';
+    case ssa_type::long_:
+      return 'j';
+    case ssa_type::float_:
+      return 'f';
+    case ssa_type::double_:
+      return 'd';
+    default:
+      return 'a';
+  }
+}
+
+// The stack effect of a plain instruction: the types it pops, in push order, then '>' and the type it pushes, if any.
+// Returns nullptr for the instructions that only move values around.
+const char* effect_of(uint8_t opcode) {
+  switch (opcode) {
+    case op::nop:
+    case op::return_:
+      return ">";
+    case op::aconst_null:
+      return ">a";
+    case op::iconst_m1:
+    case op::iconst_0:
+    case op::iconst_1:
+    case op::iconst_2:
+    case op::iconst_3:
+    case op::iconst_4:
+    case op::iconst_5:
+      return ">i";
+    case op::lconst_0:
+    case op::lconst_1:
+      return ">j";
+    case op::fconst_0:
+    case op::fconst_1:
+    case op::fconst_2:
+      return ">f";
+    case op::dconst_0:
+    case op::dconst_1:
+      return ">d";
+    case op::iaload:
+    case op::baload:
+    case op::caload:
+    case op::saload:
+      return "ai>i";
+    case op::laload:
+      return "ai>j";
+    case op::faload:
+      return "ai>f";
+    case op::daload:
+      return "ai>d";
+    case op::aaload:
+      return "ai>a";
+    case op::iastore:
+    case op::bastore:
+    case op::castore:
+    case op::sastore:
+      return "aii>";
+    case op::lastore:
+      return "aij>";
+    case op::fastore:
+      return "aif>";
+    case op::dastore:
+      return "aid>";
+    case op::aastore:
+      return "aia>";
+    case op::iadd:
+    case op::isub:
+    case op::imul:
+    case op::idiv:
+    case op::irem:
+    case op::iand:
+    case op::ior:
+    case op::ixor:
+    case op::ishl:
+    case op::ishr:
+    case op::iushr:
+      return "ii>i";
+    case op::ladd:
+    case op::lsub:
+    case op::lmul:
+    case op::ldiv:
+    case op::lrem:
+    case op::land:
+    case op::lor:
+    case op::lxor:
+      return "jj>j";
+    case op::lshl:
+    case op::lshr:
+    case op::lushr:
+      return "ji>j";
+    case op::fadd:
+    case op::fsub:
+    case op::fmul:
+    case op::fdiv:
+    case op::frem:
+      return "ff>f";
+    case op::dadd:
+    case op::dsub:
+    case op::dmul:
+    case op::ddiv:
+    case op::drem:
+      return "dd>d";
+    case op::ineg:
+    case op::i2b:
+    case op::i2c:
+    case op::i2s:
+      return "i>i";
+    case op::lneg:
+      return "j>j";
+    case op::fneg:
+      return "f>f";
+    case op::dneg:
+      return "d>d";
+    case op::i2l:
+      return "i>j";
+    case op::i2f:
+      return "i>f";
+    case op::i2d:
+      return "i>d";
+    case op::l2i:
+      return "j>i";
+    case op::l2f:
+      return "j>f";
+    case op::l2d:
+      return "j>d";
+    case op::f2i:
+      return "f>i";
+    case op::f2l:
+      return "f>j";
+    case op::f2d:
+      return "f>d";
+    case op::d2i:
+      return "d>i";
+    case op::d2l:
+      return "d>j";
+    case op::d2f:
+      return "d>f";
+    case op::lcmp:
+      return "jj>i";
+    case op::fcmpl:
+    case op::fcmpg:
+      return "ff>i";
+    case op::dcmpl:
+    case op::dcmpg:
+      return "dd>i";
+    case op::ireturn:
+      return "i>";
+    case op::lreturn:
+      return "j>";
+    case op::freturn:
+      return "f>";
+    case op::dreturn:
+      return "d>";
+    case op::areturn:
+    case op::athrow:
+    case op::monitorenter:
+    case op::monitorexit:
+      return "a>";
+    case op::arraylength:
+      return "a>i";
+    default:
+      return nullptr;
+  }
+}
+
+ssa_type var_type(uint8_t opcode) {
+  switch (opcode) {
+    case op::lload:
+    case op::lstore:
+      return ssa_type::long_;
+    case op::fload:
+    case op::fstore:
+      return ssa_type::float_;
+    case op::dload:
+    case op::dstore:
+      return ssa_type::double_;
+    case op::aload:
+    case op::astore:
+      return ssa_type::reference;
+    default:
+      return ssa_type::int_;
+  }
+}
+bool is_return(uint8_t opcode) {
+  return (opcode >= op::ireturn && opcode <= op::return_) || opcode == op::athrow;
+}
+bool is_goto(const branch_insn& branch) {
+  return branch.opcode == op::goto_ || branch.opcode == op::goto_w;
+}
+
+// A run of the code that becomes one block, before the unreachable ones are dropped.
+struct code_block {
+  std::vector<code::const_iterator> insns;
+  std::vector<uint16_t> lines;
+  // Indices into the try-catch blocks of the code that cover this block.
+  std::vector<size_t> tcbs;
+  std::vector<size_t> successors;
+  bool falls = true;
+  bool handler = false;
+};
+
+class ssa_lifter {
+public:
+  ssa_lifter(const method& method) : method_(method), code_(method.body) {
+  }
+
+  result<ssa_code> lift() {
+    if (code_.empty()) {
+      return error("Method has no code");
+    }
+    if (auto res = split(); !res) {
+      return res.err();
+    }
+    if (auto res = link(); !res) {
+      return res.err();
+    }
+    order();
+    if (auto res = build(); !res) {
+      return res.err();
+    }
+    return finish();
+  }
+private:
+  const method& method_;
+  const code& code_;
+  std::vector<code_block> blocks_;
+  std::unordered_map<label_id, size_t> label_blocks_;
+  // The reachable code blocks, in code order, which are the ids of the SSA blocks, and the order to lift them in.
+  std::vector<size_t> ids_;
+  std::vector<size_t> ssa_ids_;
+  std::vector<size_t> rpo_;
+  ssa_code ssa_;
+  uint32_t locals_{};
+
+  // Where each local and stack entry is set at the start and the end of every block. Stack entries come after the
+  // locals, numbered from the bottom of the stack.
+  std::vector<std::unordered_map<uint32_t, ssa_value>> entry_defs_;
+  std::vector<std::unordered_map<uint32_t, ssa_value>> exit_defs_;
+  std::vector<std::vector<ssa_value>> exit_stacks_;
+  std::vector<bool> processed_;
+  std::vector<bool> sealed_;
+  std::vector<size_t> pending_;
+  std::vector<std::vector<std::pair<uint32_t, size_t>>> incomplete_;
+
+  result<void> split() {
+    std::unordered_set<label_id> leaders;
+    std::unordered_map<label_id, std::vector<std::pair<size_t, bool>>> bounds;
+    for (size_t i = 0; i < code_.tcbs.size(); i++) {
+      const auto& tcb = code_.tcbs[i];
+      leaders.emplace(tcb.start.id());
+      leaders.emplace(tcb.end.id());
+      leaders.emplace(tcb.handler.id());
+      bounds[tcb.start.id()].emplace_back(i, true);
+      bounds[tcb.end.id()].emplace_back(i, false);
+    }
+    std::unordered_map<label_id, uint16_t> lines;
+    for (const auto& [line, lbl] : code_.line_numbers) {
+      lines[lbl.id()] = line;
+    }
+    uint16_t locals = basic_block_graph::get_start_locals(method_);
+    for (const auto& in : code_) {
+      if (const auto branch = std::get_if<branch_insn>(&in)) {
+        if (branch->opcode == op::jsr || branch->opcode == op::jsr_w) {
+          return error("Subroutines are not supported");
+        }
+        leaders.emplace(branch->target.id());
+      } else if (const auto lookup = std::get_if<lookup_switch_insn>(&in)) {
+        leaders.emplace(lookup->default_target.id());
+        for (const auto& [key, target] : lookup->targets) {
+          leaders.emplace(target.id());
+        }
+      } else if (const auto table = std::get_if<table_switch_insn>(&in)) {
+        leaders.emplace(table->default_target.id());
+        for (const auto& target : table->targets) {
+          leaders.emplace(target.id());
+        }
+      } else if (const auto var = std::get_if<var_insn>(&in)) {
+        if (var->opcode == op::ret) {
+          return error("Subroutines are not supported");
+        }
+        locals = std::max(locals, static_cast<uint16_t>(var->index + (var->is_wide() ? 2 : 1)));
+      } else if (const auto iinc = std::get_if<iinc_insn>(&in)) {
+        locals = std::max(locals, static_cast<uint16_t>(iinc->index + 1));
+      } else if (const auto plain = std::get_if<insn>(&in)) {
+        if (const auto var = expand_var_insn(plain->opcode)) {
+          locals = std::max(locals, static_cast<uint16_t>(var->index + (var->is_wide() ? 2 : 1)));
+        }
+      }
+    }
+    locals_ = locals;
+
+    // Block 0 is the entry block, the code starts in block 1.
+    blocks_.resize(2);
+    std::vector<bool> active(code_.tcbs.size());
+    uint16_t line = 0;
+    auto open = false;
+    auto ended = false;
+    const auto next_block = [&]() {
+      blocks_.emplace_back();
+      open = false;
+      ended = false;
+    };
+    for (auto it = code_.begin(); it != code_.end(); ++it) {
+      if (const auto lbl = std::get_if<label>(&*it)) {
+        if (open && leaders.find(lbl->id()) != leaders.end()) {
+          next_block();
+        }
+        label_blocks_[lbl->id()] = blocks_.size() - 1;
+        if (const auto found = lines.find(lbl->id()); found != lines.end()) {
+          line = found->second;
+        }
+        if (const auto found = bounds.find(lbl->id()); found != bounds.end()) {
+          for (const auto& [index, start] : found->second) {
+            active[index] = start;
+          }
+        }
+        continue;
+      }
+      if (ended) {
+        next_block();
+      }
+      auto& block = blocks_.back();
+      if (!open) {
+        for (size_t i = 0; i < active.size(); i++) {
+          if (active[i]) {
+            block.tcbs.emplace_back(i);
+          }
+        }
+        open = true;
+      }
+      block.insns.emplace_back(it);
+      block.lines.emplace_back(line);
+      std::visit(
+          [&](const auto& arg) {
+            using T = std::decay_t<decltype(arg)>;
+            if constexpr (std::is_same_v<T, branch_insn>) {
+              ended = true;
+              block.falls = !is_goto(arg);
+            } else if constexpr (std::is_same_v<T, lookup_switch_insn> || std::is_same_v<T, table_switch_insn>) {
+              ended = true;
+              block.falls = false;
+            } else if constexpr (std::is_same_v<T, insn>) {
+              if (is_return(arg.opcode)) {
+                ended = true;
+                block.falls = false;
+              } else if (const auto var = expand_var_insn(arg.opcode); var && var->is_store()) {
+                ended = !block.tcbs.empty();
+              }
+            } else if constexpr (std::is_same_v<T, var_insn> || std::is_same_v<T, iinc_insn>) {
+              // A protected block ends after a store, so that its handlers see the same locals at every
+              // instruction of it.
+              if constexpr (std::is_same_v<T, var_insn>) {
+                ended = arg.is_store() && !block.tcbs.empty();
+              } else {
+                ended = !block.tcbs.empty();
+              }
+            }
+          },
+          *it);
+    }
+    if (blocks_.back().insns.empty()) {
+      blocks_.pop_back();
+    }
+    if (blocks_.size() < 2) {
+      return error("Method has no code");
+    }
+    return {};
+  }
+
+  result<void> link() {
+    blocks_[0].successors.emplace_back(1);
+    const auto block_of = [this](const label& lbl) -> std::optional<size_t> {
+      const auto found = label_blocks_.find(lbl.id());
+      if (found == label_blocks_.end() || found->second >= blocks_.size()) {
+        return std::nullopt;
+      }
+      return found->second;
+    };
+    for (size_t id = 1; id < blocks_.size(); id++) {
+      auto& block = blocks_[id];
+      std::vector<const label*> targets;
+      const auto& last = *block.insns.back();
+      if (const auto branch = std::get_if<branch_insn>(&last)) {
+        targets.emplace_back(&branch->target);
+      } else if (const auto lookup = std::get_if<lookup_switch_insn>(&last)) {
+        targets.emplace_back(&lookup->default_target);
+        for (const auto& [key, target] : lookup->targets) {
+          targets.emplace_back(&target);
+        }
+      } else if (const auto table = std::get_if<table_switch_insn>(&last)) {
+        targets.emplace_back(&table->default_target);
+        for (const auto& target : table->targets) {
+          targets.emplace_back(&target);
+        }
+      }
+      for (const auto* target : targets) {
+        const auto succ = block_of(*target);
+        if (!succ) {
+          return error("Jump to a label that is not in the code");
+        }
+        block.successors.emplace_back(*succ);
+      }
+      if (block.falls) {
+        if (id + 1 == blocks_.size()) {
+          return error("Code falls off the end");
+        }
+        block.successors.emplace_back(id + 1);
+      }
+      for (const auto index : block.tcbs) {
+        const auto handler = block_of(code_.tcbs[index].handler);
+        if (!handler) {
+          return error("Handler label is not in the code");
+        }
+        blocks_[*handler].handler = true;
+      }
+    }
+    return {};
+  }
+
+  // Numbers the reachable blocks in code order and finds a reverse postorder to lift them in.
+  void order() {
+    std::vector<bool> seen(blocks_.size());
+    std::vector<size_t> postorder;
+    std::vector<std::pair<size_t, size_t>> stack;
+    seen[0] = true;
+    stack.emplace_back(0, 0);
+    while (!stack.empty()) {
+      auto& [id, next] = stack.back();
+      const auto& block = blocks_[id];
+      const auto edges = block.successors.size() + block.tcbs.size();
+      if (next < edges) {
+        const auto succ = next < block.successors.size()
+                              ? block.successors[next]
+                              : label_blocks_.at(code_.tcbs[block.tcbs[next - block.successors.size()]].handler.id());
+        next++;
+        if (!seen[succ]) {
+          seen[succ] = true;
+          stack.emplace_back(succ, 0);
+        }
+        continue;
+      }
+      postorder.emplace_back(id);
+      stack.pop_back();
+    }
+    ssa_ids_.assign(blocks_.size(), SIZE_MAX);
+    for (size_t id = 0; id < blocks_.size(); id++) {
+      if (seen[id]) {
+        ssa_ids_[id] = ids_.size();
+        ids_.emplace_back(id);
+      }
+    }
+    for (auto it = postorder.rbegin(); it != postorder.rend(); ++it) {
+      rpo_.emplace_back(ssa_ids_[*it]);
+    }
+  }
+
+  result<void> build() {
+    const auto count = ids_.size();
+    ssa_.blocks.resize(count);
+    std::vector<std::vector<size_t>> out_edges(count);
+    const auto add_edge = [&](size_t from, size_t to, bool handler) {
+      auto& preds = ssa_.blocks[to].predecessors;
+      for (const auto& edge : preds) {
+        if (edge.block == from && edge.handler == handler) {
+          return;
+        }
+      }
+      preds.push_back(ssa_edge{from, handler});
+      out_edges[from].emplace_back(to);
+    };
+    for (size_t id = 0; id < count; id++) {
+      const auto& block = blocks_[ids_[id]];
+      auto& ssa_block = ssa_.blocks[id];
+      for (const auto succ : block.successors) {
+        if (blocks_[succ].handler) {
+          return error("Handler block is also jumped to");
+        }
+        ssa_block.successors.emplace_back(ssa_ids_[succ]);
+        add_edge(id, ssa_ids_[succ], false);
+      }
+      for (const auto index : block.tcbs) {
+        const auto& tcb = code_.tcbs[index];
+        const auto handler = ssa_ids_[label_blocks_.at(tcb.handler.id())];
+        ssa_block.handlers.push_back(ssa_handler{handler, tcb.type});
+        add_edge(id, handler, true);
+      }
+    }
+
+    entry_defs_.resize(count);
+    exit_defs_.resize(count);
+    exit_stacks_.resize(count);
+    processed_.resize(count);
+    sealed_.resize(count);
+    incomplete_.resize(count);
+    pending_.resize(count);
+    for (size_t id = 0; id < count; id++) {
+      pending_[id] = ssa_.blocks[id].predecessors.size();
+    }
+
+    uint32_t slot = 0;
+    const auto add_parameter = [&](ssa_type type) {
+      const auto value = ssa_.add_value(type);
+      ssa_.parameters.emplace_back(value);
+      exit_defs_[0][slot++] = value;
+      if (is_wide(type)) {
+        exit_defs_[0][slot++] = undefined;
+      }
+    };
+    if ((method_.access_flags & access_flag::acc_static) == 0) {
+      add_parameter(ssa_type::reference);
+    }
+    const auto desc = descriptor::get(method_.desc);
+    for (const auto& param : desc->parameter_types) {
+      add_parameter(type_of(param));
+    }
+
+    for (const auto id : rpo_) {
+      if (pending_[id] == 0 && !sealed_[id]) {
+        seal(id);
+      }
+      if (id != 0) {
+        if (auto res = lift_block(id); !res) {
+          return res;
+        }
+      }
+      processed_[id] = true;
+      for (const auto succ : out_edges[id]) {
+        if (--pending_[succ] == 0) {
+          seal(succ);
+        }
+      }
+    }
+    return {};
+  }
+
+  ssa_value add_phi(size_t block, ssa_type type) {
+    const auto value = ssa_.add_value(type);
+    ssa_.blocks[block].phis.push_back(ssa_phi{value, {}});
+    return value;
+  }
+
+  void fill_phi(size_t block, size_t index, uint32_t var) {
+    const auto phi = ssa_.blocks[block].phis[index].result;
+    const auto type = ssa_.types[phi];
+    std::vector<ssa_value> operands;
+    const auto preds = ssa_.blocks[block].predecessors;
+    for (const auto& edge : preds) {
+      auto value = edge.handler ? read_entry(edge.block, var, type) : read(edge.block, var, type);
+      if (value < ssa_.types.size() && ssa_.types[value] != type) {
+        value = undefined;
+      }
+      operands.emplace_back(value == top ? undefined : value);
+    }
+    ssa_.blocks[block].phis[index].operands = std::move(operands);
+  }
+
+  void seal(size_t block) {
+    sealed_[block] = true;
+    const auto incomplete = std::move(incomplete_[block]);
+    for (const auto& [var, index] : incomplete) {
+      fill_phi(block, index, var);
+    }
+  }
+
+  ssa_value read(size_t block, uint32_t var, ssa_type type) {
+    if (const auto found = exit_defs_[block].find(var); found != exit_defs_[block].end()) {
+      return found->second;
+    }
+    return read_entry(block, var, type);
+  }
+
+  // The value of a local or stack entry at the start of a block. Chains of blocks with a single predecessor are
+  // walked without recursing, a block with several gets a phi, which is left incomplete until the block is sealed.
+  ssa_value read_entry(size_t block, uint32_t var, ssa_type type) {
+    std::vector<size_t> chain;
+    ssa_value value;
+    while (true) {
+      if (const auto found = entry_defs_[block].find(var); found != entry_defs_[block].end()) {
+        value = found->second;
+        break;
+      }
+      if (block == 0) {
+        value = undefined;
+        break;
+      }
+      const auto& preds = ssa_.blocks[block].predecessors;
+      if (!sealed_[block]) {
+        value = add_phi(block, type);
+        incomplete_[block].emplace_back(var, ssa_.blocks[block].phis.size() - 1);
+        entry_defs_[block][var] = value;
+        break;
+      }
+      if (preds.size() != 1) {
+        value = add_phi(block, type);
+        entry_defs_[block][var] = value;
+        fill_phi(block, ssa_.blocks[block].phis.size() - 1, var);
+        break;
+      }
+      chain.emplace_back(block);
+      const auto edge = preds.front();
+      if (!edge.handler) {
+        if (const auto found = exit_defs_[edge.block].find(var); found != exit_defs_[edge.block].end()) {
+          value = found->second;
+          break;
+        }
+      }
+      block = edge.block;
+    }
+    for (const auto id : chain) {
+      entry_defs_[id][var] = value;
+    }
+    return value;
+  }
+
+  result<void> lift_block(size_t id) {
+    auto& defs = exit_defs_[id];
+    std::vector<ssa_value> stack;
+    if (blocks_[ids_[id]].handler) {
+      const auto exception = ssa_.add_value(ssa_type::reference);
+      ssa_.blocks[id].exception = exception;
+      stack.emplace_back(exception);
+    } else {
+      for (const auto& edge : ssa_.blocks[id].predecessors) {
+        if (!edge.handler && processed_[edge.block]) {
+          const auto layout = exit_stacks_[edge.block];
+          for (size_t i = 0; i < layout.size(); i++) {
+            stack.emplace_back(layout[i] == top ? top
+                                                : read_entry(id, locals_ + static_cast<uint32_t>(i),
+                                                             layout[i] < ssa_.types.size() ? ssa_.types[layout[i]]
+                                                                                           : ssa_type::int_));
+          }
+          break;
+        }
+      }
+    }
+
+    auto underflow = false;
+    const auto pop_slot = [&]() -> ssa_value {
+      if (stack.empty()) {
+        underflow = true;
+        return undefined;
+      }
+      const auto value = stack.back();
+      stack.pop_back();
+      return value;
+    };
+    const auto pop = [&]() -> ssa_value {
+      auto value = pop_slot();
+      if (value == top) {
+        value = pop_slot();
+      }
+      return value;
+    };
+    const auto push = [&](ssa_value value) {
+      stack.emplace_back(value);
+      if (value < ssa_.types.size() && is_wide(ssa_.types[value])) {
+        stack.emplace_back(top);
+      }
+    };
+    const auto pop_operands = [&](size_t count) {
+      std::vector<ssa_value> operands(count);
+      for (size_t i = count; i-- > 0;) {
+        operands[i] = pop();
+      }
+      return operands;
+    };
+    const auto write = [&](uint16_t index, ssa_value value, ssa_type type) {
+      defs[index] = value;
+      if (is_wide(type)) {
+        defs[index + 1] = undefined;
+      }
+    };
+    const auto shuffle = [&](size_t count, const std::vector<size_t>& order) {
+      std::vector<ssa_value> taken(count);
+      for (size_t i = count; i-- > 0;) {
+        taken[i] = pop_slot();
+      }
+      for (const auto index : order) {
+        stack.emplace_back(taken[index]);
+      }
+    };
+
+    const auto& block = blocks_[ids_[id]];
+    auto& insns = ssa_.blocks[id].insns;
+    for (size_t i = 0; i < block.insns.size(); i++) {
+      const auto& in = *block.insns[i];
+      const auto line = block.lines[i];
+      const auto emit = [&](std::vector<ssa_value> operands, std::optional<ssa_type> type) {
+        const auto result = type ? ssa_.add_value(*type) : ssa_insn::none;
+        ssa_.blocks[id].insns.emplace_back(in, std::move(operands), result, line);
+        if (type) {
+          push(result);
+        }
+      };
+      const auto emit_effect = [&](const char* effect) {
+        const auto arrow = std::string_view(effect).find('>');
+        auto operands = pop_operands(arrow);
+        emit(std::move(operands),
+             effect[arrow + 1] != '\0' ? std::optional<ssa_type>(type_of(effect[arrow + 1])) : std::nullopt);
+      };
+      const auto access = [&](const var_insn& var) {
+        const auto type = var_type(var.opcode);
+        if (var.is_load()) {
+          auto value = read(id, var.index, type);
+          if (value < ssa_.types.size() && ssa_.types[value] != type) {
+            value = undefined;
+          }
+          stack.emplace_back(value);
+          if (is_wide(type)) {
+            stack.emplace_back(top);
+          }
+        } else {
+          write(var.index, pop(), type);
+        }
+      };
+      std::visit(
+          [&](const auto& arg) {
+            using T = std::decay_t<decltype(arg)>;
+            if constexpr (std::is_same_v<T, insn>) {
+              if (const auto var = expand_var_insn(arg.opcode)) {
+                access(*var);
+                return;
+              }
+              switch (arg.opcode) {
+                case op::pop:
+                  shuffle(1, {});
+                  return;
+                case op::pop2:
+                  shuffle(2, {});
+                  return;
+                case op::dup:
+                  shuffle(1, {0, 0});
+                  return;
+                case op::dup_x1:
+                  shuffle(2, {1, 0, 1});
+                  return;
+                case op::dup_x2:
+                  shuffle(3, {2, 0, 1, 2});
+                  return;
+                case op::dup2:
+                  shuffle(2, {0, 1, 0, 1});
+                  return;
+                case op::dup2_x1:
+                  shuffle(3, {1, 2, 0, 1, 2});
+                  return;
+                case op::dup2_x2:
+                  shuffle(4, {2, 3, 0, 1, 2, 3});
+                  return;
+                case op::swap:
+                  shuffle(2, {1, 0});
+                  return;
+                default:
+                  break;
+              }
+              if (const auto effect = effect_of(arg.opcode)) {
+                emit_effect(effect);
+              }
+            } else if constexpr (std::is_same_v<T, var_insn>) {
+              access(arg);
+            } else if constexpr (std::is_same_v<T, iinc_insn>) {
+              const auto value = read(id, arg.index, ssa_type::int_);
+              const auto increment = ssa_.add_value(ssa_type::int_);
+              insns.emplace_back(push_insn(int32_t(arg.value)), std::vector<ssa_value>(), increment, line);
+              const auto sum = ssa_.add_value(ssa_type::int_);
+              insns.emplace_back(insn(op::iadd), std::vector<ssa_value>{value, increment}, sum, line);
+              write(arg.index, sum, ssa_type::int_);
+            } else if constexpr (std::is_same_v<T, push_insn>) {
+              emit({}, type_of(arg.operand));
+            } else if constexpr (std::is_same_v<T, type_insn>) {
+              switch (arg.opcode) {
+                case op::new_:
+                  emit_effect(">a");
+                  break;
+                case op::anewarray:
+                  emit_effect("i>a");
+                  break;
+                case op::checkcast:
+                  emit_effect("a>a");
+                  break;
+                case op::instanceof:
+                  emit_effect("a>i");
+                  break;
+                default:
+                  break;
+              }
+            } else if constexpr (std::is_same_v<T, field_insn>) {
+              const auto type = type_of(descriptor::get(arg.desc)->return_type);
+              switch (arg.opcode) {
+                case op::getstatic:
+                  emit({}, type);
+                  break;
+                case op::getfield:
+                  emit(pop_operands(1), type);
+                  break;
+                case op::putstatic:
+                  emit(pop_operands(1), std::nullopt);
+                  break;
+                case op::putfield:
+                  emit(pop_operands(2), std::nullopt);
+                  break;
+                default:
+                  break;
+              }
+            } else if constexpr (std::is_same_v<T, method_insn> || std::is_same_v<T, invoke_dynamic_insn>) {
+              const auto desc = descriptor::get(arg.desc);
+              auto count = desc->parameter_types.size();
+              const auto& return_type = desc->return_type;
+              std::optional<ssa_type> result;
+              if (return_type.kind() != type_kind::void_) {
+                result = type_of(return_type);
+              }
+              if constexpr (std::is_same_v<T, method_insn>) {
+                if (arg.opcode != op::invokestatic) {
+                  count++;
+                }
+              }
+              emit(pop_operands(count), result);
+            } else if constexpr (std::is_same_v<T, branch_insn>) {
+              switch (arg.opcode) {
+                case op::goto_:
+                case op::goto_w:
+                  break;
+                case op::ifeq:
+                case op::ifne:
+                case op::iflt:
+                case op::ifge:
+                case op::ifgt:
+                case op::ifle:
+                case op::ifnull:
+                case op::ifnonnull:
+                  emit(pop_operands(1), std::nullopt);
+                  break;
+                default:
+                  emit(pop_operands(2), std::nullopt);
+                  break;
+              }
+            } else if constexpr (std::is_same_v<T, lookup_switch_insn> || std::is_same_v<T, table_switch_insn>) {
+              emit(pop_operands(1), std::nullopt);
+            } else if constexpr (std::is_same_v<T, multi_array_insn>) {
+              emit(pop_operands(arg.dims), ssa_type::reference);
+            } else if constexpr (std::is_same_v<T, array_insn>) {
+              emit_effect("i>a");
+            }
+          },
+          in);
+      if (underflow) {
+        return error("Stack underflow");
+      }
+    }
+    for (size_t i = 0; i < stack.size(); i++) {
+      defs[locals_ + static_cast<uint32_t>(i)] = stack[i];
+    }
+    exit_stacks_[id] = std::move(stack);
+    return {};
+  }
+
+  // Removes the phis whose operands are all the same value or the phi itself and those no instruction depends on,
+  // then numbers the values in the order they are defined.
+  result<ssa_code> finish() {
+    std::vector<ssa_value> forward(ssa_.types.size());
+    for (ssa_value value = 0; value < forward.size(); value++) {
+      forward[value] = value;
+    }
+    const auto find = [&forward](ssa_value value) {
+      while (value < forward.size() && forward[value] != value) {
+        value = forward[value] = forward[forward[value]];
+      }
+      return value;
+    };
+    for (auto changed = true; changed;) {
+      changed = false;
+      for (auto& block : ssa_.blocks) {
+        for (auto& phi : block.phis) {
+          if (forward[phi.result] != phi.result) {
+            continue;
+          }
+          auto same = ssa_insn::none;
+          auto trivial = true;
+          for (auto& operand : phi.operands) {
+            operand = find(operand);
+            if (operand == phi.result || operand == same) {
+              continue;
+            }
+            if (same != ssa_insn::none) {
+              trivial = false;
+              break;
+            }
+            same = operand;
+          }
+          if (trivial) {
+            forward[phi.result] = same == ssa_insn::none ? undefined : same;
+            changed = true;
+          }
+        }
+      }
+    }
+
+    std::unordered_map<ssa_value, const ssa_phi*> phis;
+    for (const auto& block : ssa_.blocks) {
+      for (const auto& phi : block.phis) {
+        if (forward[phi.result] == phi.result) {
+          phis.emplace(phi.result, &phi);
+        }
+      }
+    }
+    std::vector<bool> live(ssa_.types.size());
+    std::vector<ssa_value> worklist;
+    const auto mark = [&](ssa_value value) -> bool {
+      value = find(value);
+      if (value >= live.size()) {
+        return false;
+      }
+      if (!live[value]) {
+        live[value] = true;
+        if (phis.find(value) != phis.end()) {
+          worklist.emplace_back(value);
+        }
+      }
+      return true;
+    };
+    for (const auto& block : ssa_.blocks) {
+      for (const auto& in : block.insns) {
+        for (const auto operand : in.operands) {
+          if (!mark(operand)) {
+            return error("Value read before it is set on every path to it");
+          }
+        }
+      }
+    }
+    while (!worklist.empty()) {
+      const auto* phi = phis.at(worklist.back());
+      worklist.pop_back();
+      for (const auto operand : phi->operands) {
+        if (!mark(operand)) {
+          return error("Value read before it is set on every path to it");
+        }
+      }
+    }
+
+    std::vector<ssa_value> numbers(ssa_.types.size(), ssa_insn::none);
+    std::vector<ssa_type> types;
+    const auto number = [&](ssa_value value) {
+      numbers[value] = static_cast<ssa_value>(types.size());
+      types.emplace_back(ssa_.types[value]);
+    };
+    for (const auto param : ssa_.parameters) {
+      number(param);
+    }
+    for (auto& block : ssa_.blocks) {
+      if (block.exception != ssa_insn::none) {
+        number(block.exception);
+      }
+      std::vector<ssa_phi> kept;
+      for (auto& phi : block.phis) {
+        if (forward[phi.result] == phi.result && live[phi.result]) {
+          number(phi.result);
+          kept.emplace_back(std::move(phi));
+        }
+      }
+      block.phis = std::move(kept);
+      for (const auto& in : block.insns) {
+        if (in.result != ssa_insn::none) {
+          number(in.result);
+        }
+      }
+    }
+    const auto renumber = [&](ssa_value& value) {
+      value = numbers[find(value)];
+    };
+    for (auto& param : ssa_.parameters) {
+      renumber(param);
+    }
+    for (auto& block : ssa_.blocks) {
+      if (block.exception != ssa_insn::none) {
+        renumber(block.exception);
+      }
+      for (auto& phi : block.phis) {
+        renumber(phi.result);
+        for (auto& operand : phi.operands) {
+          renumber(operand);
+        }
+      }
+      for (auto& in : block.insns) {
+        if (in.result != ssa_insn::none) {
+          renumber(in.result);
+        }
+        for (auto& operand : in.operands) {
+          renumber(operand);
+        }
+      }
+    }
+    ssa_.types = std::move(types);
+    return std::move(ssa_);
+  }
+};
+
+class ssa_emitter {
+public:
+  ssa_emitter(const ssa_code& ssa, code& code) : ssa_(ssa), code_(code) {
+  }
+
+  void emit(uint16_t start_locals) {
+    const auto count = ssa_.blocks.size();
+    uses_.assign(ssa_.types.size(), 0);
+    for (const auto& block : ssa_.blocks) {
+      for (const auto& phi : block.phis) {
+        for (const auto operand : phi.operands) {
+          uses_[operand]++;
+        }
+      }
+      for (const auto& in : block.insns) {
+        for (const auto operand : in.operands) {
+          uses_[operand]++;
+        }
+      }
+    }
+    locals_.assign(ssa_.types.size(), unassigned);
+    handler_inputs_.assign(ssa_.types.size(), unassigned);
+    next_local_ = 0;
+    for (const auto param : ssa_.parameters) {
+      locals_[param] = next_local_;
+      next_local_ += is_wide(ssa_.types[param]) ? 2 : 1;
+    }
+    next_local_ = std::max(next_local_, start_locals);
+
+    labels_.resize(count);
+    range_starts_.resize(count);
+    sets_inputs_.resize(count);
+    for (size_t id = 0; id < count; id++) {
+      emit_block(id);
+    }
+    const label end;
+    code_.add_label(end);
+    for (const auto& [lbl, from, to] : stubs_) {
+      code_.add_label(lbl);
+      copy_phis(from, to);
+      code_.add_branch_insn(op::goto_, labels_[to]);
+    }
+
+    // A protected range starts after the block has set the inputs of its handlers, which cannot throw, so that the
+    // locals it sets are not live into the block. Consecutive blocks with the same handlers and nothing to set share
+    // their try-catch blocks, and a range without any instruction gets none.
+    std::unordered_map<label_id, size_t> positions;
+    size_t position = 0;
+    for (const auto& in : code_) {
+      if (const auto lbl = std::get_if<label>(&in)) {
+        positions.emplace(lbl->id(), position);
+      } else {
+        position++;
+      }
+    }
+    for (size_t id = 0; id < count;) {
+      const auto& handlers = ssa_.blocks[id].handlers;
+      auto next = id + 1;
+      while (next < count && !sets_inputs_[next] && same_handlers(ssa_.blocks[next].handlers, handlers)) {
+        next++;
+      }
+      const auto& range_start = range_starts_[id];
+      const auto& range_end = next < count ? labels_[next] : end;
+      if (positions.at(range_start.id()) < positions.at(range_end.id())) {
+        for (const auto& handler : handlers) {
+          code_.tcbs.emplace_back(range_start, range_end, labels_[handler.block], handler.type);
+        }
+      }
+      id = next;
+    }
+    code_.max_locals = next_local_;
+  }
+private:
+  static constexpr uint16_t unassigned = UINT16_MAX;
+
+  const ssa_code& ssa_;
+  code& code_;
+  std::vector<size_t> uses_;
+  std::vector<uint16_t> locals_;
+  // The locals the protected blocks set for the phis of their handlers, see emit_ssa().
+  std::vector<uint16_t> handler_inputs_;
+  uint16_t next_local_{};
+  std::vector<label> labels_;
+  std::vector<label> range_starts_;
+  std::vector<bool> sets_inputs_;
+  std::vector<std::tuple<label, size_t, size_t>> stubs_;
+  uint16_t line_{};
+  // For every instruction of the block being emitted, where its tree starts and how many of its operands are loaded.
+  std::vector<size_t> tree_starts_;
+  std::vector<size_t> loaded_;
+
+  static bool same_handlers(const std::vector<ssa_handler>& first, const std::vector<ssa_handler>& second) {
+    if (first.size() != second.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < first.size(); i++) {
+      if (first[i].block != second[i].block || first[i].type != second[i].type) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  uint16_t new_local(ssa_value value) {
+    const auto local = next_local_;
+    next_local_ += is_wide(ssa_.types[value]) ? 2 : 1;
+    return local;
+  }
+  uint16_t local_of(ssa_value value) {
+    if (locals_[value] == unassigned) {
+      locals_[value] = new_local(value);
+    }
+    return locals_[value];
+  }
+  uint16_t handler_input_of(ssa_value phi) {
+    if (handler_inputs_[phi] == unassigned) {
+      handler_inputs_[phi] = new_local(phi);
+    }
+    return handler_inputs_[phi];
+  }
+  static uint8_t load_opcode(ssa_type type) {
+    return static_cast<uint8_t>(op::iload + static_cast<uint8_t>(type));
+  }
+  static uint8_t store_opcode(ssa_type type) {
+    return static_cast<uint8_t>(op::istore + static_cast<uint8_t>(type));
+  }
+  void load(ssa_value value) {
+    code_.add_var_insn(load_opcode(ssa_.types[value]), local_of(value));
+  }
+  void store(ssa_value value) {
+    code_.add_var_insn(store_opcode(ssa_.types[value]), local_of(value));
+  }
+
+  bool needs_copies(size_t block) const {
+    const auto& target = ssa_.blocks[block];
+    return !target.phis.empty() && target.exception == ssa_insn::none;
+  }
+  static size_t edge_index(const ssa_block& block, size_t from, bool handler) {
+    for (size_t i = 0; i < block.predecessors.size(); i++) {
+      if (block.predecessors[i].block == from && block.predecessors[i].handler == handler) {
+        return i;
+      }
+    }
+    return SIZE_MAX;
+  }
+  // Sets the phis of a block for the edge from another, as a parallel copy: every operand is loaded before any phi is
+  // stored, so a phi that is the operand of another one is read before it changes.
+  void copy_phis(size_t from, size_t to) {
+    const auto& target = ssa_.blocks[to];
+    const auto index = edge_index(target, from, false);
+    std::vector<std::pair<ssa_value, ssa_value>> copies;
+    for (const auto& phi : target.phis) {
+      if (phi.operands[index] != phi.result) {
+        copies.emplace_back(phi.result, phi.operands[index]);
+      }
+    }
+    for (const auto& [phi, operand] : copies) {
+      load(operand);
+    }
+    for (auto it = copies.rbegin(); it != copies.rend(); ++it) {
+      store(it->first);
+    }
+  }
+  label target_of(size_t from, size_t to) {
+    if (!needs_copies(to)) {
+      return labels_[to];
+    }
+    const label stub;
+    stubs_.emplace_back(stub, from, to);
+    return stub;
+  }
+
+  void emit_block(size_t id) {
+    const auto& block = ssa_.blocks[id];
+    code_.add_label(labels_[id]);
+    if (block.exception != ssa_insn::none) {
+      if (uses_[block.exception] == 0) {
+        code_.add_insn(op::pop);
+      } else {
+        store(block.exception);
+      }
+      for (const auto& phi : block.phis) {
+        code_.add_var_insn(load_opcode(ssa_.types[phi.result]), handler_input_of(phi.result));
+        store(phi.result);
+      }
+    }
+    std::vector<size_t> seen;
+    for (const auto& handler : block.handlers) {
+      if (std::find(seen.begin(), seen.end(), handler.block) != seen.end()) {
+        continue;
+      }
+      seen.emplace_back(handler.block);
+      const auto& target = ssa_.blocks[handler.block];
+      const auto index = edge_index(target, id, true);
+      for (const auto& phi : target.phis) {
+        load(phi.operands[index]);
+        code_.add_var_insn(store_opcode(ssa_.types[phi.result]), handler_input_of(phi.result));
+        sets_inputs_[id] = true;
+      }
+    }
+    if (sets_inputs_[id]) {
+      code_.add_label(range_starts_[id]);
+    } else {
+      range_starts_[id] = labels_[id];
+    }
+
+    // The instructions form trees: the last operands of an instruction that are used only there and computed right
+    // before it, in order, stay on the stack. Its other operands are loaded before the first of those is computed.
+    const auto& insns = block.insns;
+    tree_starts_.assign(insns.size(), 0);
+    loaded_.assign(insns.size(), 0);
+    std::vector<size_t> roots;
+    for (auto end = insns.size(); end > 0;) {
+      const auto root = end - 1;
+      end = build_tree(insns, root);
+      roots.emplace_back(root);
+    }
+    for (auto it = roots.rbegin(); it != roots.rend(); ++it) {
+      emit_tree(id, insns, *it);
+      if (const auto result = insns[*it].result; result != ssa_insn::none) {
+        if (uses_[result] == 0) {
+          code_.add_insn(is_wide(ssa_.types[result]) ? op::pop2 : op::pop);
+        } else {
+          store(result);
+        }
+      }
+    }
+
+    const auto falls_to = [&](size_t to) {
+      if (needs_copies(to)) {
+        copy_phis(id, to);
+      }
+      if (to != id + 1) {
+        code_.add_branch_insn(op::goto_, labels_[to]);
+      }
+    };
+    if (insns.empty() || !ends_block(insns.back().operation)) {
+      if (!block.successors.empty()) {
+        falls_to(block.successors.front());
+      }
+    } else if (std::holds_alternative<branch_insn>(insns.back().operation)) {
+      falls_to(block.successors[1]);
+    }
+  }
+
+  // Returns the index of the first instruction of the tree of an instruction.
+  size_t build_tree(const std::vector<ssa_insn>& insns, size_t root) {
+    const auto& operands = insns[root].operands;
+    auto start = root;
+    auto loaded = operands.size();
+    while (loaded > 0 && start > 0) {
+      const auto result = insns[start - 1].result;
+      if (result != operands[loaded - 1] || uses_[result] != 1) {
+        break;
+      }
+      start = build_tree(insns, start - 1);
+      loaded--;
+    }
+    tree_starts_[root] = start;
+    loaded_[root] = loaded;
+    return start;
+  }
+  void emit_tree(size_t id, const std::vector<ssa_insn>& insns, size_t root) {
+    const auto& in = insns[root];
+    for (size_t i = 0; i < loaded_[root]; i++) {
+      load(in.operands[i]);
+    }
+    std::vector<size_t> children;
+    for (auto end = root; end > tree_starts_[root]; end = tree_starts_[end - 1]) {
+      children.emplace_back(end - 1);
+    }
+    for (auto it = children.rbegin(); it != children.rend(); ++it) {
+      emit_tree(id, insns, *it);
+    }
+    emit_operation(id, in);
+  }
+
+  static bool ends_block(const instruction& operation) {
+    if (const auto plain = std::get_if<insn>(&operation)) {
+      return is_return(plain->opcode);
+    }
+    return std::holds_alternative<branch_insn>(operation) || std::holds_alternative<lookup_switch_insn>(operation) ||
+           std::holds_alternative<table_switch_insn>(operation);
+  }
+
+  void emit_operation(size_t id, const ssa_insn& in) {
+    if (in.line != 0 && in.line != line_) {
+      const label lbl;
+      code_.add_label(lbl);
+      code_.line_numbers.emplace_back(in.line, lbl);
+      line_ = in.line;
+    }
+    const auto& successors = ssa_.blocks[id].successors;
+    if (const auto branch = std::get_if<branch_insn>(&in.operation)) {
+      code_.add_branch_insn(branch->opcode, target_of(id, successors[0]));
+    } else if (const auto lookup = std::get_if<lookup_switch_insn>(&in.operation)) {
+      std::vector<std::pair<int32_t, label>> targets;
+      for (size_t i = 0; i < lookup->targets.size(); i++) {
+        targets.emplace_back(lookup->targets[i].first, target_of(id, successors[i + 1]));
+      }
+      code_.add_lookup_switch_insn(target_of(id, successors[0]), targets);
+    } else if (const auto table = std::get_if<table_switch_insn>(&in.operation)) {
+      std::vector<label> targets;
+      for (size_t i = 0; i < table->targets.size(); i++) {
+        targets.emplace_back(target_of(id, successors[i + 1]));
+      }
+      code_.add_table_switch_insn(target_of(id, successors[0]), table->low, table->high, targets);
+    } else {
+      code_.emplace_back(in.operation);
+    }
+  }
+};
+} // namespace
+
+ssa_insn::ssa_insn(instruction operation, std::vector<ssa_value> operands, ssa_value result, uint16_t line)
+    : operation(std::move(operation)), operands(std::move(operands)), result(result), line(line) {
+}
+std::string ssa_insn::to_string() const {
+  std::ostringstream oss;
+  if (result != none) {
+    oss << "v" << result << " = ";
+  }
+  oss << cafe::to_string(operation);
+  for (size_t i = 0; i < operands.size(); i++) {
+    oss << (i == 0 ? " " : ", ") << "v" << operands[i];
+  }
+  return oss.str();
+}
+
+ssa_value ssa_code::add_value(ssa_type type) {
+  types.emplace_back(type);
+  return static_cast<ssa_value>(types.size() - 1);
+}
+std::string ssa_code::to_string() const {
+  std::ostringstream oss;
+  oss << "params";
+  for (const auto param : parameters) {
+    oss << " v" << param << ":" << type_char(types[param]);
+  }
+  oss << "\n";
+  for (size_t id = 0; id < blocks.size(); id++) {
+    const auto& block = blocks[id];
+    oss << "block " << id << " <-";
+    for (const auto& edge : block.predecessors) {
+      oss << " " << (edge.handler ? "!" : "") << edge.block;
+    }
+    oss << "\n";
+    if (block.exception != ssa_insn::none) {
+      oss << "  v" << block.exception << " = catch\n";
+    }
+    for (const auto& phi : block.phis) {
+      oss << "  v" << phi.result << ":" << type_char(types[phi.result]) << " = phi";
+      for (size_t i = 0; i < phi.operands.size(); i++) {
+        oss << (i == 0 ? " " : ", ") << "v" << phi.operands[i];
+      }
+      oss << "\n";
+    }
+    for (const auto& in : block.insns) {
+      oss << "  " << in.to_string() << "\n";
+    }
+    oss << "  ->";
+    for (const auto succ : block.successors) {
+      oss << " " << succ;
+    }
+    for (const auto& handler : block.handlers) {
+      oss << " !" << handler.block;
+    }
+    oss << "\n";
+  }
+  return oss.str();
+}
+
+result<ssa_code> lift_ssa(const method& method) {
+  return ssa_lifter(method).lift();
+}
+
+void emit_ssa(const ssa_code& ssa, method& method) {
+  code body;
+  ssa_emitter(ssa, body).emit(basic_block_graph::get_start_locals(method));
+  method.body = std::move(body);
+  compact_locals(method);
+  basic_block_graph graph(method.body);
+  graph.compute_maxes(method);
+}
+} // namespace cafe
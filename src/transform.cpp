@@ -0,0 +1,1612 @@
+#include "cafe/transform.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <list>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "cafe/analysis.hpp"
+#include "cafe/constants.hpp"
+#include "cafe/dataflow.hpp"
+
+namespace cafe {
+namespace {
+// The load or store an instruction is, short forms such as iload_0 included, or nullopt for anything else.
+std::optional<var_insn> var_access(const instruction& in) {
+  if (const auto var = std::get_if<var_insn>(&in)) {
+    return *var;
+  }
+  if (const auto plain = std::get_if<insn>(&in)) {
+    return expand_var_insn(plain->opcode);
+  }
+  return std::nullopt;
+}
+// A slot reference that has to follow the local when it moves.
+struct slot_ref {
+  uint16_t* index;
+  uint16_t size;
+  size_t position;
+};
+// A LocalVariableTable or type annotation entry, the local must keep its slot over the whole range.
+struct debug_range {
+  uint16_t* index;
+  uint16_t size;
+  label_id start;
+  label_id end;
+};
+
+// The number of stack slots a constant, load or dup pushes without any other effect, or 0 for other instructions.
+uint8_t pure_push_size(const instruction& in) {
+  if (const auto plain = std::get_if<insn>(&in)) {
+    switch (plain->opcode) {
+      case op::aconst_null:
+      case op::iconst_m1:
+      case op::iconst_0:
+      case op::iconst_1:
+      case op::iconst_2:
+      case op::iconst_3:
+      case op::iconst_4:
+      case op::iconst_5:
+      case op::fconst_0:
+      case op::fconst_1:
+      case op::fconst_2:
+      case op::dup:
+        return 1;
+      case op::lconst_0:
+      case op::lconst_1:
+      case op::dconst_0:
+      case op::dconst_1:
+      case op::dup2:
+        return 2;
+      default:
+        return 0;
+    }
+  }
+  if (const auto var = std::get_if<var_insn>(&in)) {
+    return var->is_load() ? (var->is_wide() ? 2 : 1) : 0;
+  }
+  if (const auto push = std::get_if<push_insn>(&in)) {
+    // Loading a class, method handle, method type or dynamic constant can fail.
+    const auto& operand = push->operand;
+    if (std::holds_alternative<int32_t>(operand) || std::holds_alternative<float>(operand) ||
+        std::holds_alternative<std::string>(operand)) {
+      return 1;
+    }
+    if (std::holds_alternative<int64_t>(operand) || std::holds_alternative<double>(operand)) {
+      return 2;
+    }
+  }
+  return 0;
+}
+std::optional<int32_t> int_constant(const instruction& in) {
+  if (const auto plain = std::get_if<insn>(&in); plain != nullptr && plain->opcode >= op::iconst_m1 &&
+                                                 plain->opcode <= op::iconst_5) {
+    return plain->opcode - op::iconst_0;
+  }
+  if (const auto push = std::get_if<push_insn>(&in)) {
+    if (const auto value = std::get_if<int32_t>(&push->operand)) {
+      return *value;
+    }
+  }
+  return std::nullopt;
+}
+bool is_insn(const instruction& in, uint8_t opcode) {
+  const auto plain = std::get_if<insn>(&in);
+  return plain != nullptr && plain->opcode == opcode;
+}
+// Whether control never falls through to the next instruction.
+bool ends_flow(const instruction& in) {
+  if (const auto plain = std::get_if<insn>(&in)) {
+    return (plain->opcode >= op::ireturn && plain->opcode <= op::return_) || plain->opcode == op::athrow;
+  }
+  if (const auto branch = std::get_if<branch_insn>(&in)) {
+    return branch->opcode == op::goto_ || branch->opcode == op::goto_w;
+  }
+  return std::holds_alternative<lookup_switch_insn>(in) || std::holds_alternative<table_switch_insn>(in);
+}
+// Whether a comparison of the ifeq to ifle or if_icmpeq to if_icmple family holds, the opcode given relative to ifeq
+// or if_icmpeq.
+bool compare(int32_t first, int32_t second, int condition) {
+  switch (condition) {
+    case 0:
+      return first == second;
+    case 1:
+      return first != second;
+    case 2:
+      return first < second;
+    case 3:
+      return first >= second;
+    case 4:
+      return first > second;
+    default:
+      return first <= second;
+  }
+}
+
+// An upper bound on the number of bytes an instruction takes in the class file, with switches at their worst padding. A
+// goto counts as the goto_w the class writer widens it to when its target is out of reach.
+uint32_t max_size(const instruction& in) {
+  return std::visit(
+      [](const auto& arg) -> uint32_t {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, label>) {
+          return 0;
+        } else if constexpr (std::is_same_v<T, insn>) {
+          return 1;
+        } else if constexpr (std::is_same_v<T, var_insn>) {
+          return arg.index <= 3 && arg.opcode != op::ret ? 1 : arg.index <= UINT8_MAX ? 2 : 4;
+        } else if constexpr (std::is_same_v<T, iinc_insn>) {
+          return arg.index <= UINT8_MAX && arg.value >= INT8_MIN && arg.value <= INT8_MAX ? 3 : 6;
+        } else if constexpr (std::is_same_v<T, push_insn>) {
+          if (const auto value = std::get_if<int32_t>(&arg.operand)) {
+            return *value >= -1 && *value <= 5 ? 1 : *value >= INT8_MIN && *value <= INT8_MAX ? 2 : 3;
+          }
+          return 3;
+        } else if constexpr (std::is_same_v<T, method_insn>) {
+          return arg.opcode == op::invokeinterface ? 5 : 3;
+        } else if constexpr (std::is_same_v<T, invoke_dynamic_insn>) {
+          return 5;
+        } else if constexpr (std::is_same_v<T, branch_insn>) {
+          return arg.opcode == op::goto_ || arg.opcode == op::goto_w || arg.opcode == op::jsr_w ? 5 : 3;
+        } else if constexpr (std::is_same_v<T, lookup_switch_insn>) {
+          return static_cast<uint32_t>(12 + arg.targets.size() * 8);
+        } else if constexpr (std::is_same_v<T, table_switch_insn>) {
+          return static_cast<uint32_t>(16 + arg.targets.size() * 4);
+        } else if constexpr (std::is_same_v<T, multi_array_insn>) {
+          return 4;
+        } else if constexpr (std::is_same_v<T, array_insn>) {
+          return std::holds_alternative<uint8_t>(arg.type) ? 2 : 3;
+        } else {
+          return 3;
+        }
+      },
+      in);
+}
+bool is_goto(const instruction& in) {
+  const auto branch = std::get_if<branch_insn>(&in);
+  return branch != nullptr && (branch->opcode == op::goto_ || branch->opcode == op::goto_w);
+}
+bool is_conditional(uint8_t opcode) {
+  return (opcode >= op::ifeq && opcode <= op::if_acmpne) || opcode == op::ifnull || opcode == op::ifnonnull;
+}
+// Whether a jump over the given number of bytes fits in the 16 bit offset of goto or a conditional branch.
+bool short_jump(int64_t distance) {
+  return distance >= INT16_MIN && distance <= INT16_MAX;
+}
+
+// The number of instructions before each label.
+std::unordered_map<label_id, size_t> label_positions(const code& code) {
+  std::unordered_map<label_id, size_t> positions;
+  size_t position = 0;
+  for (const auto& in : code) {
+    if (const auto lbl = std::get_if<label>(&in)) {
+      positions.emplace(lbl->id(), position);
+    } else {
+      position++;
+    }
+  }
+  return positions;
+}
+// Whether a range has no instructions left. A range with a label that is not in the code is left alone.
+bool empty_range(const std::unordered_map<label_id, size_t>& positions, const label& start, const label& end) {
+  const auto first = positions.find(start.id());
+  const auto last = positions.find(end.id());
+  return first != positions.end() && last != positions.end() && first->second >= last->second;
+}
+
+// A try-catch block whose range lost all its instructions is not valid in a class file.
+void remove_empty_tcbs(code& code) {
+  const auto positions = label_positions(code);
+  constexpr auto removed = SIZE_MAX;
+  std::vector<size_t> indices(code.tcbs.size());
+  std::vector<tcb> kept;
+  for (size_t i = 0; i < code.tcbs.size(); i++) {
+    auto& tcb = code.tcbs[i];
+    if (empty_range(positions, tcb.start, tcb.end)) {
+      indices[i] = removed;
+      continue;
+    }
+    indices[i] = kept.size();
+    kept.emplace_back(std::move(tcb));
+  }
+  const auto any_removed = kept.size() != code.tcbs.size();
+  code.tcbs = std::move(kept);
+  if (!any_removed) {
+    return;
+  }
+  const auto dropped = [&indices](type_annotation& annotation) {
+    const auto target = std::get_if<target::catch_target>(&annotation.target_info);
+    if (target == nullptr) {
+      return false;
+    }
+    if (target->index >= indices.size()) {
+      return false;
+    }
+    if (indices[target->index] == removed) {
+      return true;
+    }
+    target->index = static_cast<uint16_t>(indices[target->index]);
+    return false;
+  };
+  for (auto* annotations : {&code.visible_type_annotations, &code.invisible_type_annotations}) {
+    annotations->erase(std::remove_if(annotations->begin(), annotations->end(), dropped), annotations->end());
+  }
+}
+
+class peephole_optimizer {
+public:
+  peephole_optimizer(method& method, uint8_t rules) : code_(method.body), rules_(rules) {
+  }
+
+  bool run() {
+    if (code_.empty()) {
+      return false;
+    }
+    for (const auto& in : code_) {
+      if (const auto var = std::get_if<var_insn>(&in); var != nullptr && var->opcode == op::ret) {
+        rules_ &= ~peephole_locals;
+      } else if (const auto branch = std::get_if<branch_insn>(&in);
+                 branch != nullptr && (branch->opcode == op::jsr || branch->opcode == op::jsr_w)) {
+        rules_ &= ~peephole_locals;
+      }
+    }
+    for (auto* annotations : {&code_.visible_type_annotations, &code_.invisible_type_annotations}) {
+      for (const auto& annotation : *annotations) {
+        if (const auto offset = std::get_if<target::offset_target>(&annotation.target_info)) {
+          pinned_.emplace(offset->offset.id());
+        } else if (const auto argument = std::get_if<target::type_argument>(&annotation.target_info)) {
+          pinned_.emplace(argument->offset.id());
+        }
+      }
+    }
+
+    auto changed = false;
+    // Folding a branch can take the last jump to a label, which lets patterns span it, and dropping a read can make
+    // more stores dead, so the rules are applied until a whole sweep changes nothing.
+    for (auto again = true; again;) {
+      find_barriers();
+      if ((rules_ & peephole_locals) != 0) {
+        find_dead_accesses();
+      }
+      again = sweep();
+      changed = changed || again;
+    }
+    if (changed) {
+      remove_empty_tcbs(code_);
+      code_.frames.clear();
+    }
+    return changed;
+  }
+private:
+  static constexpr size_t max_window = 4;
+  using window = std::array<code::iterator, max_window>;
+
+  code& code_;
+  uint8_t rules_;
+  // Jump targets, handlers and try-catch boundaries, which no pattern may span.
+  std::unordered_set<label_id> barriers_;
+  // The labels of instructions with type annotations.
+  std::unordered_set<label_id> pinned_;
+  // The loads, stores and iinc instructions after which the local they access is not read again.
+  std::unordered_set<const instruction*> dead_;
+
+  void find_barriers() {
+    barriers_.clear();
+    for (const auto& in : code_) {
+      if (const auto branch = std::get_if<branch_insn>(&in)) {
+        barriers_.emplace(branch->target.id());
+      } else if (const auto lookup = std::get_if<lookup_switch_insn>(&in)) {
+        barriers_.emplace(lookup->default_target.id());
+        for (const auto& [key, target] : lookup->targets) {
+          barriers_.emplace(target.id());
+        }
+      } else if (const auto table = std::get_if<table_switch_insn>(&in)) {
+        barriers_.emplace(table->default_target.id());
+        for (const auto& target : table->targets) {
+          barriers_.emplace(target.id());
+        }
+      }
+    }
+    for (const auto& tcb : code_.tcbs) {
+      barriers_.emplace(tcb.start.id());
+      barriers_.emplace(tcb.end.id());
+      barriers_.emplace(tcb.handler.id());
+    }
+  }
+
+  void find_dead_accesses() {
+    dead_.clear();
+    size_t slot_count = code_.max_locals;
+    for (const auto& in : code_) {
+      if (const auto var = var_access(in)) {
+        slot_count = std::max<size_t>(slot_count, var->index + (var->is_wide() ? 2 : 1));
+      } else if (const auto iinc = std::get_if<iinc_insn>(&in)) {
+        slot_count = std::max<size_t>(slot_count, iinc->index + 1);
+      }
+    }
+    slot_count = std::min<size_t>(slot_count, UINT16_MAX);
+    std::vector<bool> debug(slot_count);
+    const auto mark_debug = [&](uint16_t index, uint16_t size) {
+      for (size_t slot = index; slot < std::min<size_t>(index + size, slot_count); slot++) {
+        debug[slot] = true;
+      }
+    };
+    for (const auto& local : code_.locals) {
+      mark_debug(local.index, local.desc == "J" || local.desc == "D" ? 2 : 1);
+    }
+    for (const auto* annotations : {&code_.visible_type_annotations, &code_.invisible_type_annotations}) {
+      for (const auto& annotation : *annotations) {
+        if (const auto target = std::get_if<target::localvar>(&annotation.target_info)) {
+          for (const auto& local : target->table) {
+            mark_debug(local.index, 1);
+          }
+        }
+      }
+    }
+
+    basic_block_graph graph(code_);
+    const block_order order(graph);
+    const auto live = solve_dataflow(order, liveness(static_cast<uint16_t>(slot_count)));
+    bit_vector facts(slot_count);
+    bit_vector thrown(slot_count);
+    for (size_t id = 0; id < order.reachable(); id++) {
+      thrown.reset_all();
+      for (const auto& succ : order.successors(id)) {
+        if (succ.handler) {
+          thrown.union_with(live.in(succ.block));
+        }
+      }
+      facts = live.out(id);
+      facts.union_with(thrown);
+      const auto& instructions = order.block(id).instructions();
+      for (auto it = instructions.rbegin(); it != instructions.rend(); ++it) {
+        const auto access = [&](uint16_t index, uint16_t size, bool write) {
+          auto read_later = false;
+          for (size_t slot = index; slot < static_cast<size_t>(index) + size; slot++) {
+            read_later = read_later || facts.test(slot) || debug[slot];
+          }
+          if (!read_later) {
+            dead_.emplace(&**it);
+          }
+          for (size_t slot = index; slot < static_cast<size_t>(index) + size; slot++) {
+            if (write) {
+              facts.reset(slot);
+            } else {
+              facts.set(slot);
+            }
+          }
+        };
+        if (const auto var = var_access(**it)) {
+          access(var->index, var->is_wide() ? 2 : 1, var->is_store());
+        } else if (const auto iinc = std::get_if<iinc_insn>(&**it)) {
+          access(iinc->index, 1, false);
+        }
+        facts.union_with(thrown);
+      }
+    }
+  }
+
+  bool sweep() {
+    auto changed = false;
+    for (auto it = code_.begin(); it != code_.end();) {
+      if (std::holds_alternative<label>(*it)) {
+        ++it;
+        continue;
+      }
+      const auto before = it == code_.begin() ? code_.end() : std::prev(it);
+      window w;
+      const auto size = fill_window(it, w);
+      if (!rewrite(w, size)) {
+        ++it;
+        continue;
+      }
+      changed = true;
+      // The rewrite can complete a pattern that starts a few instructions earlier.
+      it = before == code_.end() ? code_.begin() : before;
+      for (size_t steps = 0; steps < max_window && it != code_.begin();) {
+        --it;
+        if (!std::holds_alternative<label>(*it)) {
+          steps++;
+        }
+      }
+    }
+    return changed;
+  }
+  // Collects the instructions from the given one on that no barrier separates.
+  size_t fill_window(code::iterator it, window& w) const {
+    size_t size = 0;
+    w[size++] = it;
+    for (++it; it != code_.end() && size < max_window; ++it) {
+      if (const auto lbl = std::get_if<label>(&*it)) {
+        if (barriers_.find(lbl->id()) != barriers_.end()) {
+          break;
+        }
+        continue;
+      }
+      w[size++] = it;
+    }
+    return size;
+  }
+  bool pinned(code::iterator it) const {
+    if (pinned_.empty()) {
+      return false;
+    }
+    while (it != code_.begin()) {
+      const auto lbl = std::get_if<label>(&*--it);
+      if (lbl == nullptr) {
+        return false;
+      }
+      if (pinned_.find(lbl->id()) != pinned_.end()) {
+        return true;
+      }
+    }
+    return false;
+  }
+  bool unpinned(const window& w, size_t count) const {
+    for (size_t i = 0; i < count; i++) {
+      if (pinned(w[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+  bool dead(code::iterator it) const {
+    return dead_.find(&*it) != dead_.end();
+  }
+  void erase(code::iterator it) {
+    dead_.erase(&*it);
+    code_.erase(it);
+  }
+  void replace(code::iterator it, instruction&& in) {
+    dead_.erase(&*it);
+    *it = std::move(in);
+  }
+
+  bool rewrite(const window& w, size_t size) {
+    return ((rules_ & peephole_stack) != 0 && rewrite_stack(w, size)) ||
+           ((rules_ & peephole_locals) != 0 && rewrite_locals(w, size)) ||
+           ((rules_ & peephole_jumps) != 0 && rewrite_jumps(w)) ||
+           ((rules_ & peephole_branches) != 0 && rewrite_branches(w, size)) ||
+           ((rules_ & peephole_casts) != 0 && rewrite_casts(w, size));
+  }
+
+  bool rewrite_stack(const window& w, size_t size) {
+    if (is_insn(*w[0], op::nop) && unpinned(w, 1)) {
+      erase(w[0]);
+      return true;
+    }
+    if (size < 2) {
+      return false;
+    }
+    const auto pushed = pure_push_size(*w[0]);
+    if ((pushed == 1 && is_insn(*w[1], op::pop)) || (pushed == 2 && is_insn(*w[1], op::pop2)) ||
+        (is_insn(*w[0], op::swap) && is_insn(*w[1], op::swap))) {
+      if (!unpinned(w, 2)) {
+        return false;
+      }
+      erase(w[0]);
+      erase(w[1]);
+      return true;
+    }
+    if (size >= 3 && pushed == 1 && pure_push_size(*w[1]) == 1 && is_insn(*w[2], op::pop2) && unpinned(w, 3)) {
+      erase(w[0]);
+      erase(w[1]);
+      erase(w[2]);
+      return true;
+    }
+    return false;
+  }
+
+  bool rewrite_locals(const window& w, size_t size) {
+    if (const auto iinc = std::get_if<iinc_insn>(&*w[0])) {
+      if ((iinc->value == 0 || dead(w[0])) && unpinned(w, 1)) {
+        erase(w[0]);
+        return true;
+      }
+      return false;
+    }
+    const auto var = var_access(*w[0]);
+    if (!var) {
+      return false;
+    }
+    if (var->is_store() && dead(w[0]) && unpinned(w, 1)) {
+      replace(w[0], insn(var->is_wide() ? op::pop2 : op::pop));
+      return true;
+    }
+    if (size < 2) {
+      return false;
+    }
+    if (const auto next = var_access(*w[1]); next && next->index == var->index) {
+      // The opcodes of a load and a store of the same type are the same distance apart.
+      const auto& load = var->is_load() ? *var : *next;
+      const auto& store = var->is_load() ? *next : *var;
+      auto removable = load.is_load() && store.is_store() && store.opcode - load.opcode == op::istore - op::iload;
+      if (var->is_store()) {
+        removable = removable && dead(w[1]);
+      }
+      if (removable && unpinned(w, 2)) {
+        erase(w[0]);
+        erase(w[1]);
+        return true;
+      }
+      return false;
+    }
+    if (size < 4 || var->opcode != op::iload) {
+      return false;
+    }
+    const auto constant = int_constant(*w[1]);
+    const auto store = var_access(*w[3]);
+    if (!constant || !store || store->opcode != op::istore || store->index != var->index) {
+      return false;
+    }
+    int64_t delta = *constant;
+    if (is_insn(*w[2], op::isub)) {
+      delta = -delta;
+    } else if (!is_insn(*w[2], op::iadd)) {
+      return false;
+    }
+    if (delta < INT16_MIN || delta > INT16_MAX || !unpinned(w, 4)) {
+      return false;
+    }
+    const auto dead_after = dead(w[3]);
+    erase(w[1]);
+    erase(w[2]);
+    erase(w[3]);
+    replace(w[0], iinc_insn(var->index, static_cast<int16_t>(delta)));
+    if (dead_after) {
+      dead_.emplace(&*w[0]);
+    }
+    return true;
+  }
+
+  bool rewrite_jumps(const window& w) {
+    const auto& first = *w[0];
+    if (const auto branch = std::get_if<branch_insn>(&first);
+        branch != nullptr && branch->opcode != op::jsr && branch->opcode != op::jsr_w) {
+      for (auto it = std::next(w[0]); it != code_.end(); ++it) {
+        const auto lbl = std::get_if<label>(&*it);
+        if (lbl == nullptr) {
+          break;
+        }
+        if (*lbl != branch->target) {
+          continue;
+        }
+        if (!unpinned(w, 1)) {
+          return false;
+        }
+        // The operands of a conditional branch still have to go.
+        if (branch->opcode == op::goto_ || branch->opcode == op::goto_w) {
+          erase(w[0]);
+        } else if (branch->opcode >= op::if_icmpeq && branch->opcode <= op::if_acmpne) {
+          replace(w[0], insn(op::pop2));
+        } else {
+          replace(w[0], insn(op::pop));
+        }
+        return true;
+      }
+    }
+    if (!ends_flow(first)) {
+      return false;
+    }
+    // Only a jump target or handler makes the instructions after it reachable again.
+    auto erased = false;
+    for (auto it = std::next(w[0]); it != code_.end();) {
+      if (const auto lbl = std::get_if<label>(&*it)) {
+        if (barriers_.find(lbl->id()) != barriers_.end()) {
+          break;
+        }
+        ++it;
+        continue;
+      }
+      if (pinned(it)) {
+        break;
+      }
+      const auto next = std::next(it);
+      erase(it);
+      it = next;
+      erased = true;
+    }
+    return erased;
+  }
+
+  bool rewrite_branches(const window& w, size_t size) {
+    if (size < 2) {
+      return false;
+    }
+    const auto first = int_constant(*w[0]);
+    const auto second = int_constant(*w[1]);
+    const branch_insn* branch = nullptr;
+    size_t length = 0;
+    auto taken = false;
+    if (first) {
+      if (const auto next = std::get_if<branch_insn>(&*w[1]);
+          next != nullptr && next->opcode >= op::ifeq && next->opcode <= op::ifle) {
+        branch = next;
+        length = 2;
+        taken = compare(*first, 0, next->opcode - op::ifeq);
+      } else if (second && size >= 3) {
+        if (const auto last = std::get_if<branch_insn>(&*w[2]);
+            last != nullptr && last->opcode >= op::if_icmpeq && last->opcode <= op::if_icmple) {
+          branch = last;
+          length = 3;
+          taken = compare(*first, *second, last->opcode - op::if_icmpeq);
+        }
+      }
+    } else if (is_insn(*w[0], op::aconst_null)) {
+      if (const auto next = std::get_if<branch_insn>(&*w[1]);
+          next != nullptr && (next->opcode == op::ifnull || next->opcode == op::ifnonnull)) {
+        branch = next;
+        length = 2;
+        taken = next->opcode == op::ifnull;
+      }
+    }
+    if (branch == nullptr || !unpinned(w, length)) {
+      return false;
+    }
+    const auto target = branch->target;
+    for (size_t i = 1; i < length; i++) {
+      erase(w[i]);
+    }
+    if (taken) {
+      replace(w[0], branch_insn(op::goto_, target));
+    } else {
+      erase(w[0]);
+    }
+    return true;
+  }
+
+  bool rewrite_casts(const window& w, size_t size) {
+    const auto cast = std::get_if<type_insn>(&*w[0]);
+    if (cast != nullptr && cast->opcode == op::checkcast && cast->type == "java/lang/Object" && unpinned(w, 1)) {
+      erase(w[0]);
+      return true;
+    }
+    if (size < 2) {
+      return false;
+    }
+    const auto next = std::get_if<type_insn>(&*w[1]);
+    if (next == nullptr || next->opcode != op::checkcast || !unpinned(w, 2)) {
+      return false;
+    }
+    if ((cast != nullptr && cast->opcode == op::checkcast && cast->type == next->type) ||
+        is_insn(*w[0], op::aconst_null)) {
+      erase(w[1]);
+      return true;
+    }
+    return false;
+  }
+};
+
+class branch_optimizer {
+public:
+  explicit branch_optimizer(method& method) : code_(method.body) {
+  }
+
+  bool run() {
+    if (code_.empty()) {
+      return false;
+    }
+    for (const auto& in : code_) {
+      if (const auto var = std::get_if<var_insn>(&in); var != nullptr && var->opcode == op::ret) {
+        return false;
+      }
+      if (const auto branch = std::get_if<branch_insn>(&in);
+          branch != nullptr && (branch->opcode == op::jsr || branch->opcode == op::jsr_w)) {
+        return false;
+      }
+    }
+    for (auto* annotations : {&code_.visible_type_annotations, &code_.invisible_type_annotations}) {
+      for (const auto& annotation : *annotations) {
+        if (const auto offset = std::get_if<target::offset_target>(&annotation.target_info)) {
+          pinned_.emplace(offset->offset.id());
+        } else if (const auto argument = std::get_if<target::type_argument>(&annotation.target_info)) {
+          pinned_.emplace(argument->offset.id());
+        }
+      }
+    }
+    record_lines();
+    estimate_offsets();
+
+    auto changed = thread_jumps();
+    changed = invert_branches() || changed;
+    changed = reorder_chains() || changed;
+    if (changed) {
+      fix_lines();
+      remove_empty_tcbs(code_);
+      code_.frames.clear();
+    }
+    return changed;
+  }
+private:
+  // A run of instructions that control only enters at the top, ending with a goto, return, athrow or switch.
+  struct chain {
+    code::iterator first;
+    code::iterator last;
+    size_t first_index;
+    size_t end_index;
+  };
+
+  code& code_;
+  // The labels of instructions with type annotations.
+  std::unordered_set<label_id> pinned_;
+  // The line number each instruction had and the instruction before it, before anything changed.
+  std::unordered_map<const instruction*, uint16_t> lines_;
+  std::unordered_map<const instruction*, const instruction*> previous_;
+  // The byte offsets the labels and instructions end up at at most.
+  std::unordered_map<label_id, int64_t> label_offsets_;
+  std::unordered_map<const instruction*, int64_t> offsets_;
+  // The gotos that reach their target in 16 bits even with every other goto not in here widened.
+  std::unordered_set<const instruction*> short_gotos_;
+
+  void record_lines() {
+    std::unordered_map<label_id, size_t> entries;
+    for (size_t i = code_.line_numbers.size(); i-- > 0;) {
+      entries[code_.line_numbers[i].second.id()] = i;
+    }
+    // Of several entries for the same instruction, the first in the table counts.
+    std::optional<uint16_t> current;
+    auto first_entry = SIZE_MAX;
+    const instruction* before = nullptr;
+    for (const auto& in : code_) {
+      if (const auto lbl = std::get_if<label>(&in)) {
+        if (const auto it = entries.find(lbl->id()); it != entries.end()) {
+          first_entry = std::min(first_entry, it->second);
+        }
+        continue;
+      }
+      if (first_entry != SIZE_MAX) {
+        current = code_.line_numbers[first_entry].first;
+        first_entry = SIZE_MAX;
+      }
+      if (current) {
+        lines_.emplace(&in, *current);
+      }
+      previous_.emplace(&in, before);
+      before = &in;
+    }
+  }
+
+  // Starts with every goto widened and shrinks those that fit. The code only gets shorter from one round to the next,
+  // so a goto that fits once keeps fitting, and stopping after any round leaves upper bounds.
+  void estimate_offsets() {
+    constexpr size_t max_rounds = 8;
+    for (size_t round = 0;; round++) {
+      label_offsets_.clear();
+      offsets_.clear();
+      int64_t offset = 0;
+      for (const auto& in : code_) {
+        if (const auto lbl = std::get_if<label>(&in)) {
+          label_offsets_.emplace(lbl->id(), offset);
+        } else {
+          offsets_.emplace(&in, offset);
+          offset += short_gotos_.find(&in) != short_gotos_.end() ? 3 : max_size(in);
+        }
+      }
+      if (round == max_rounds) {
+        return;
+      }
+      auto shrunk = false;
+      for (const auto& in : code_) {
+        const auto branch = std::get_if<branch_insn>(&in);
+        if (branch != nullptr && branch->opcode == op::goto_ && short_gotos_.find(&in) == short_gotos_.end() &&
+            short_jump_to(in, branch->target)) {
+          short_gotos_.emplace(&in);
+          shrunk = true;
+        }
+      }
+      if (!shrunk) {
+        return;
+      }
+    }
+  }
+  // Whether a jump from the instruction to the label fits in 16 bits. Labels that are not in the code never do.
+  bool short_jump_to(const instruction& from, const label& target) const {
+    const auto to = label_offsets_.find(target.id());
+    return to != label_offsets_.end() && short_jump(to->second - offsets_.at(&from));
+  }
+
+  std::unordered_set<label_id> jump_targets() const {
+    std::unordered_set<label_id> targets;
+    for (const auto& in : code_) {
+      if (const auto branch = std::get_if<branch_insn>(&in)) {
+        targets.emplace(branch->target.id());
+      } else if (const auto lookup = std::get_if<lookup_switch_insn>(&in)) {
+        targets.emplace(lookup->default_target.id());
+        for (const auto& [key, target] : lookup->targets) {
+          targets.emplace(target.id());
+        }
+      } else if (const auto table = std::get_if<table_switch_insn>(&in)) {
+        targets.emplace(table->default_target.id());
+        for (const auto& target : table->targets) {
+          targets.emplace(target.id());
+        }
+      }
+    }
+    for (const auto& tcb : code_.tcbs) {
+      targets.emplace(tcb.handler.id());
+    }
+    return targets;
+  }
+  // Whether the labels right before an instruction are all free to move away from it.
+  bool free_labels(code::iterator it, const std::unordered_set<label_id>& targets) const {
+    while (it != code_.begin()) {
+      const auto lbl = std::get_if<label>(&*--it);
+      if (lbl == nullptr) {
+        return true;
+      }
+      if (targets.find(lbl->id()) != targets.end() || pinned_.find(lbl->id()) != pinned_.end()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Points every jump through a chain of gotos at the end of the chain.
+  bool thread_jumps() {
+    std::unordered_map<label_id, const instruction*> next;
+    const instruction* after = nullptr;
+    for (auto it = code_.rbegin(); it != code_.rend(); ++it) {
+      if (const auto lbl = std::get_if<label>(&*it)) {
+        next.emplace(lbl->id(), after);
+      } else {
+        after = &*it;
+      }
+    }
+    const auto resolve = [&next](const label& target) {
+      auto current = target;
+      std::unordered_set<label_id> seen{current.id()};
+      for (;;) {
+        const auto it = next.find(current.id());
+        if (it == next.end() || it->second == nullptr || !is_goto(*it->second)) {
+          return current;
+        }
+        const auto& jump = std::get<branch_insn>(*it->second).target;
+        if (!seen.emplace(jump.id()).second) {
+          return current;
+        }
+        current = jump;
+      }
+    };
+    auto changed = false;
+    for (auto& in : code_) {
+      if (auto branch = std::get_if<branch_insn>(&in)) {
+        const auto target = resolve(branch->target);
+        // A conditional branch can't be widened, and a goto is only widened if it already was.
+        const auto fits = short_jump_to(in, target) ||
+                          (!is_conditional(branch->opcode) && !short_jump_to(in, branch->target));
+        if (target != branch->target && fits) {
+          branch->target = target;
+          changed = true;
+        }
+        if (branch->opcode == op::goto_w && short_jump_to(in, branch->target)) {
+          branch->opcode = op::goto_;
+          changed = true;
+        }
+      } else if (auto lookup = std::get_if<lookup_switch_insn>(&in)) {
+        const auto thread = [&](label& target) {
+          const auto resolved = resolve(target);
+          changed = changed || resolved != target;
+          target = resolved;
+        };
+        thread(lookup->default_target);
+        for (auto& [key, target] : lookup->targets) {
+          thread(target);
+        }
+      } else if (auto table = std::get_if<table_switch_insn>(&in)) {
+        const auto thread = [&](label& target) {
+          const auto resolved = resolve(target);
+          changed = changed || resolved != target;
+          target = resolved;
+        };
+        thread(table->default_target);
+        for (auto& target : table->targets) {
+          thread(target);
+        }
+      }
+    }
+    return changed;
+  }
+
+  // Turns a conditional branch over a goto into the opposite branch to the target of the goto.
+  bool invert_branches() {
+    const auto targets = jump_targets();
+    auto changed = false;
+    for (auto it = code_.begin(); it != code_.end(); ++it) {
+      const auto branch = std::get_if<branch_insn>(&*it);
+      if (branch == nullptr || !is_conditional(branch->opcode)) {
+        continue;
+      }
+      auto jump = std::next(it);
+      while (jump != code_.end() && std::holds_alternative<label>(*jump)) {
+        ++jump;
+      }
+      if (jump == code_.end() || !is_goto(*jump) || !free_labels(jump, targets)) {
+        continue;
+      }
+      const auto& target = std::get<branch_insn>(*jump).target;
+      auto skipped = false;
+      for (auto next = std::next(jump); next != code_.end(); ++next) {
+        const auto lbl = std::get_if<label>(&*next);
+        if (lbl == nullptr) {
+          break;
+        }
+        skipped = skipped || *lbl == branch->target;
+      }
+      if (!skipped || !short_jump_to(*it, target)) {
+        continue;
+      }
+      // The conditions come in pairs of opposites, ifnull and ifnonnull included.
+      branch->opcode = branch->opcode >= op::ifnull ? branch->opcode ^ 1 : ((branch->opcode - op::ifeq) ^ 1) + op::ifeq;
+      branch->target = target;
+      code_.erase(jump);
+      changed = true;
+    }
+    return changed;
+  }
+
+  // Moves the target of a goto right after it where nothing else falls into it, so that the goto can go. The new
+  // layout is only kept if no try-catch block has to be split and no branch ends up needing a wider offset.
+  bool reorder_chains() {
+    std::vector<code::iterator> insns;
+    std::vector<chain> chains;
+    auto first = code_.begin();
+    for (auto it = code_.begin(); it != code_.end(); ++it) {
+      if (std::holds_alternative<label>(*it)) {
+        continue;
+      }
+      insns.emplace_back(it);
+      if (ends_flow(*it)) {
+        const auto first_index = chains.empty() ? 0 : chains.back().end_index;
+        chains.push_back({first, it, first_index, insns.size()});
+        first = std::next(it);
+      }
+    }
+    // Code that runs off its end can't be reordered safely.
+    if (chains.size() < 2 || chains.back().end_index != insns.size()) {
+      return false;
+    }
+    std::unordered_map<label_id, size_t> entries;
+    for (size_t c = 0; c < chains.size(); c++) {
+      for (auto it = chains[c].first; std::holds_alternative<label>(*it); ++it) {
+        entries.emplace(std::get<label>(*it).id(), c);
+      }
+    }
+
+    const auto targets = jump_targets();
+    std::vector<size_t> order;
+    std::vector<bool> placed(chains.size());
+    std::unordered_set<size_t> erased;
+    for (size_t c = 0; c < chains.size(); c++) {
+      for (auto current = c; !placed[current];) {
+        placed[current] = true;
+        order.emplace_back(current);
+        const auto last = chains[current].last;
+        if (!is_goto(*last)) {
+          break;
+        }
+        const auto entry = entries.find(std::get<branch_insn>(*last).target.id());
+        if (entry == entries.end() || entry->second == 0 || placed[entry->second] || !free_labels(last, {})) {
+          break;
+        }
+        erased.emplace(chains[current].end_index - 1);
+        current = entry->second;
+      }
+    }
+    if (erased.empty()) {
+      return false;
+    }
+
+    constexpr auto removed = SIZE_MAX;
+    std::vector<size_t> positions(insns.size(), removed);
+    size_t count = 0;
+    for (const auto c : order) {
+      for (auto index = chains[c].first_index; index < chains[c].end_index; index++) {
+        if (erased.find(index) == erased.end()) {
+          positions[index] = count++;
+        }
+      }
+    }
+    const auto label_indices = label_positions(code_);
+    const auto runs = [&](const label& start, const label& end) {
+      std::vector<std::pair<size_t, size_t>> result;
+      const auto first_index = label_indices.find(start.id());
+      const auto end_index = label_indices.find(end.id());
+      if (first_index == label_indices.end() || end_index == label_indices.end()) {
+        return result;
+      }
+      std::vector<size_t> covered;
+      for (auto index = first_index->second; index < end_index->second; index++) {
+        if (positions[index] != removed) {
+          covered.emplace_back(positions[index]);
+        }
+      }
+      std::sort(covered.begin(), covered.end());
+      for (const auto position : covered) {
+        if (!result.empty() && result.back().second == position) {
+          result.back().second++;
+        } else {
+          result.emplace_back(position, position + 1);
+        }
+      }
+      return result;
+    };
+    for (const auto& tcb : code_.tcbs) {
+      if (runs(tcb.start, tcb.end).size() > 1) {
+        return false;
+      }
+    }
+    if (!keeps_jumps_short(insns, order, chains, erased)) {
+      return false;
+    }
+
+    // Every range is rebuilt from the instructions it covered, so the ranges have to be known before anything moves.
+    std::vector<std::vector<std::pair<size_t, size_t>>> tcb_runs;
+    for (const auto& tcb : code_.tcbs) {
+      tcb_runs.emplace_back(runs(tcb.start, tcb.end));
+    }
+    std::vector<std::vector<std::pair<size_t, size_t>>> local_runs;
+    for (const auto& local : code_.locals) {
+      local_runs.emplace_back(runs(local.start, local.end));
+    }
+    std::vector<std::vector<std::vector<std::pair<size_t, size_t>>>> annotation_runs;
+    for (auto* annotations : {&code_.visible_type_annotations, &code_.invisible_type_annotations}) {
+      for (const auto& annotation : *annotations) {
+        annotation_runs.emplace_back();
+        if (const auto localvar = std::get_if<target::localvar>(&annotation.target_info)) {
+          for (const auto& local : localvar->table) {
+            annotation_runs.back().emplace_back(runs(local.start, local.end));
+          }
+        }
+      }
+    }
+
+    std::list<instruction> layout;
+    for (const auto c : order) {
+      layout.splice(layout.end(), code_, chains[c].first, std::next(chains[c].last));
+    }
+    code_.splice(code_.begin(), layout);
+    for (const auto index : erased) {
+      code_.erase(insns[index]);
+    }
+
+    std::vector<code::iterator> moved(count);
+    for (size_t index = 0; index < insns.size(); index++) {
+      if (positions[index] != removed) {
+        moved[positions[index]] = insns[index];
+      }
+    }
+    // A range starts at the last label before its first instruction and ends at the first label after its last one, so
+    // that the labels other code jumps to stay outside of it.
+    const auto label_at = [&](size_t position, bool end) {
+      auto it = position == count ? code_.end() : moved[position];
+      if (it != code_.begin() && std::holds_alternative<label>(*std::prev(it))) {
+        while (end && std::prev(it) != code_.begin() && std::holds_alternative<label>(*std::prev(it, 2))) {
+          --it;
+        }
+        return std::get<label>(*std::prev(it));
+      }
+      label lbl;
+      code_.insert(it, lbl);
+      return lbl;
+    };
+    for (size_t i = 0; i < code_.tcbs.size(); i++) {
+      auto& tcb = code_.tcbs[i];
+      if (tcb_runs[i].empty()) {
+        tcb.end = tcb.start;
+      } else {
+        tcb.start = label_at(tcb_runs[i].front().first, false);
+        tcb.end = label_at(tcb_runs[i].front().second, true);
+      }
+    }
+    std::vector<local_var> locals;
+    for (size_t i = 0; i < code_.locals.size(); i++) {
+      for (const auto& [start, end] : local_runs[i]) {
+        auto& local = locals.emplace_back(code_.locals[i]);
+        local.start = label_at(start, false);
+        local.end = label_at(end, true);
+      }
+    }
+    code_.locals = std::move(locals);
+    size_t annotation_index = 0;
+    for (auto* annotations : {&code_.visible_type_annotations, &code_.invisible_type_annotations}) {
+      std::vector<type_annotation> kept;
+      for (auto& annotation : *annotations) {
+        const auto& ranges = annotation_runs[annotation_index++];
+        if (const auto localvar = std::get_if<target::localvar>(&annotation.target_info)) {
+          std::vector<target::local> table;
+          for (size_t i = 0; i < localvar->table.size(); i++) {
+            for (const auto& [start, end] : ranges[i]) {
+              table.emplace_back(label_at(start, false), label_at(end, true), localvar->table[i].index);
+            }
+          }
+          if (table.empty()) {
+            continue;
+          }
+          localvar->table = std::move(table);
+        }
+        kept.emplace_back(std::move(annotation));
+      }
+      *annotations = std::move(kept);
+    }
+    return true;
+  }
+  // Whether a layout needs no more goto_w than the current one and keeps every conditional branch that reaches its
+  // target now in reach.
+  bool keeps_jumps_short(const std::vector<code::iterator>& insns, const std::vector<size_t>& order,
+                         const std::vector<chain>& chains, const std::unordered_set<size_t>& erased) const {
+    std::unordered_map<const instruction*, int64_t> offsets;
+    int64_t offset = 0;
+    for (const auto c : order) {
+      for (auto index = chains[c].first_index; index < chains[c].end_index; index++) {
+        offsets.emplace(&*insns[index], offset);
+        if (erased.find(index) == erased.end()) {
+          offset += max_size(*insns[index]);
+        }
+      }
+    }
+    // A label stays in front of the instruction after it, or at the end.
+    std::unordered_map<label_id, int64_t> label_offsets;
+    auto next = offset;
+    for (auto it = code_.rbegin(); it != code_.rend(); ++it) {
+      if (const auto lbl = std::get_if<label>(&*it)) {
+        label_offsets.emplace(lbl->id(), next);
+      } else {
+        next = offsets.at(&*it);
+      }
+    }
+    size_t wide_before = 0;
+    size_t wide_after = 0;
+    for (const auto& it : insns) {
+      const auto branch = std::get_if<branch_insn>(&*it);
+      if (branch == nullptr || erased.find(&it - insns.data()) != erased.end()) {
+        continue;
+      }
+      const auto target = label_offsets.find(branch->target.id());
+      if (target == label_offsets.end()) {
+        continue;
+      }
+      const auto before = short_jump_to(*it, branch->target);
+      const auto after = short_jump(target->second - offsets.at(&*it));
+      if (is_conditional(branch->opcode)) {
+        if (before && !after) {
+          return false;
+        }
+      } else {
+        wide_before += before ? 0 : 1;
+        wide_after += after ? 0 : 1;
+      }
+    }
+    return wide_after <= wide_before;
+  }
+
+  // Gives every instruction that ended up after a different one the line number it had before.
+  void fix_lines() {
+    if (code_.line_numbers.empty()) {
+      return;
+    }
+    std::unordered_map<label_id, std::vector<size_t>> entries;
+    for (size_t i = 0; i < code_.line_numbers.size(); i++) {
+      entries[code_.line_numbers[i].second.id()].emplace_back(i);
+    }
+    std::vector<bool> dropped(code_.line_numbers.size());
+    std::vector<std::pair<uint16_t, label>> added;
+    std::vector<size_t> run;
+    std::optional<uint16_t> current;
+    const instruction* before = nullptr;
+    for (auto it = code_.begin(); it != code_.end(); ++it) {
+      if (const auto lbl = std::get_if<label>(&*it)) {
+        if (const auto entry = entries.find(lbl->id()); entry != entries.end()) {
+          run.insert(run.end(), entry->second.begin(), entry->second.end());
+        }
+        continue;
+      }
+      std::sort(run.begin(), run.end());
+      const auto line = lines_.find(&*it);
+      const auto previous = previous_.find(&*it);
+      if (line != lines_.end() && previous != previous_.end() && previous->second != before) {
+        // Of the entries now in front of the instruction only one with its own line stays.
+        auto kept = false;
+        for (const auto i : run) {
+          if (!kept && code_.line_numbers[i].first == line->second) {
+            kept = true;
+          } else {
+            dropped[i] = true;
+          }
+        }
+        if (!kept && !run.empty()) {
+          added.emplace_back(line->second, code_.line_numbers[run.front()].second);
+        } else if (!kept && current != line->second) {
+          label lbl;
+          code_.insert(it, lbl);
+          added.emplace_back(line->second, lbl);
+        }
+        current = line->second;
+      } else if (!run.empty()) {
+        current = code_.line_numbers[run.front()].first;
+      }
+      run.clear();
+      before = &*it;
+    }
+    std::vector<std::pair<uint16_t, label>> line_numbers;
+    for (size_t i = 0; i < code_.line_numbers.size(); i++) {
+      if (!dropped[i]) {
+        line_numbers.emplace_back(code_.line_numbers[i]);
+      }
+    }
+    line_numbers.insert(line_numbers.end(), added.begin(), added.end());
+    code_.line_numbers = std::move(line_numbers);
+  }
+};
+} // namespace
+
+bool compact_locals(method& method) {
+  auto& code = method.body;
+  if (code.empty()) {
+    return false;
+  }
+  const auto start_locals = basic_block_graph::get_start_locals(method);
+
+  std::vector<slot_ref> refs;
+  std::vector<debug_range> ranges;
+  // Short forms such as istore_1 are renumbered as their long forms, which replace them once the new slots are known.
+  std::vector<std::pair<instruction*, var_insn>> short_forms;
+  std::unordered_map<label_id, size_t> label_positions;
+  std::unordered_map<const instruction*, size_t> positions;
+  size_t position = 0;
+  for (auto& in : code) {
+    positions.emplace(&in, position);
+    if (const auto lbl = std::get_if<label>(&in)) {
+      label_positions.emplace(lbl->id(), position);
+    } else if (const auto var = std::get_if<var_insn>(&in)) {
+      if (var->opcode == op::ret) {
+        return false;
+      }
+      refs.push_back(slot_ref{&var->index, static_cast<uint16_t>(var->is_wide() ? 2 : 1), position});
+    } else if (const auto iinc = std::get_if<iinc_insn>(&in)) {
+      refs.push_back(slot_ref{&iinc->index, 1, position});
+    } else if (const auto branch = std::get_if<branch_insn>(&in)) {
+      if (branch->opcode == op::jsr || branch->opcode == op::jsr_w) {
+        return false;
+      }
+    } else if (const auto plain = std::get_if<insn>(&in)) {
+      if (const auto expanded = expand_var_insn(plain->opcode)) {
+        short_forms.emplace_back(&in, *expanded);
+      }
+    }
+    position++;
+  }
+  for (auto& [in, var] : short_forms) {
+    refs.push_back(slot_ref{&var.index, static_cast<uint16_t>(var.is_wide() ? 2 : 1), positions.at(in)});
+  }
+  for (auto& local : code.locals) {
+    const uint16_t size = local.desc == "J" || local.desc == "D" ? 2 : 1;
+    ranges.push_back(debug_range{&local.index, size, local.start.id(), local.end.id()});
+  }
+  for (auto* annotations : {&code.visible_type_annotations, &code.invisible_type_annotations}) {
+    for (auto& annotation : *annotations) {
+      if (auto target = std::get_if<target::localvar>(&annotation.target_info)) {
+        for (auto& local : target->table) {
+          ranges.push_back(debug_range{&local.index, 1, local.start.id(), local.end.id()});
+        }
+      }
+    }
+  }
+
+  // The slots of a long or double are joined into one local, and so are locals that overlap because a slot is used
+  // both on its own and as the second half of a wide value. Every local is a run of consecutive slots.
+  size_t slot_count = start_locals;
+  for (const auto& ref : refs) {
+    slot_count = std::max(slot_count, static_cast<size_t>(*ref.index) + ref.size);
+  }
+  for (const auto& range : ranges) {
+    slot_count = std::max(slot_count, static_cast<size_t>(*range.index) + range.size);
+  }
+  std::vector<size_t> parent(slot_count);
+  std::iota(parent.begin(), parent.end(), 0);
+  const auto find = [&parent](size_t slot) {
+    while (parent[slot] != slot) {
+      slot = parent[slot] = parent[parent[slot]];
+    }
+    return slot;
+  };
+  std::vector<bool> used(slot_count);
+  const auto join = [&](uint16_t index, uint16_t size) {
+    for (size_t slot = index; slot < static_cast<size_t>(index) + size; slot++) {
+      used[slot] = true;
+      if (slot != index) {
+        parent[find(slot)] = find(index);
+      }
+    }
+  };
+  for (const auto& ref : refs) {
+    join(*ref.index, ref.size);
+  }
+  for (const auto& range : ranges) {
+    join(*range.index, range.size);
+  }
+  size_t param_slot = (method.access_flags & access_flag::acc_static) != 0 ? 0 : 1;
+  join(0, static_cast<uint16_t>(param_slot));
+  const auto desc = descriptor::get(method.desc);
+  for (const auto& param : desc->parameter_types) {
+    join(static_cast<uint16_t>(param_slot), param.size());
+    param_slot += param.size();
+  }
+
+  std::vector<size_t> slot_local(slot_count);
+  std::vector<size_t> local_start;
+  std::vector<size_t> local_size;
+  std::unordered_map<size_t, size_t> root_local;
+  for (size_t slot = 0; slot < slot_count; slot++) {
+    if (!used[slot]) {
+      continue;
+    }
+    const auto [it, inserted] = root_local.emplace(find(slot), local_start.size());
+    if (inserted) {
+      local_start.emplace_back(slot);
+      local_size.emplace_back(0);
+    }
+    slot_local[slot] = it->second;
+    local_size[it->second] = slot - local_start[it->second] + 1;
+  }
+  const auto local_count = local_start.size();
+
+  // A local occupies the positions where it is live after the instruction or written by it, and the ranges of its
+  // debug entries. Locals that share a position must not share a slot.
+  basic_block_graph graph(code);
+  const block_order order(graph);
+  const auto live = solve_dataflow(order, liveness(static_cast<uint16_t>(slot_count)));
+  auto read_first = false;
+  live.in(0).for_each([&](size_t slot) {
+    read_first = read_first || slot >= start_locals;
+  });
+  if (read_first) {
+    return false;
+  }
+  std::vector<bit_vector> occupied(local_count, bit_vector(position));
+  bit_vector reachable(position);
+  bit_vector facts(slot_count);
+  bit_vector thrown(slot_count);
+  for (size_t id = 0; id < order.reachable(); id++) {
+    const auto& block = order.block(id);
+    thrown.reset_all();
+    for (const auto& succ : order.successors(id)) {
+      if (succ.handler) {
+        thrown.union_with(live.in(succ.block));
+      }
+    }
+    facts = live.out(id);
+    facts.union_with(thrown);
+    const auto& instructions = block.instructions();
+    auto pos = positions.at(&*instructions.front()) + instructions.size();
+    for (auto it = instructions.rbegin(); it != instructions.rend(); ++it) {
+      pos--;
+      reachable.set(pos);
+      facts.for_each([&](size_t slot) {
+        occupied[slot_local[slot]].set(pos);
+      });
+      const auto access = [&](uint16_t index, uint16_t size, bool write) {
+        for (size_t slot = index; slot < static_cast<size_t>(index) + size; slot++) {
+          if (write) {
+            occupied[slot_local[slot]].set(pos);
+            facts.reset(slot);
+          } else {
+            facts.set(slot);
+          }
+        }
+      };
+      if (const auto var = std::get_if<var_insn>(&**it)) {
+        access(var->index, var->is_wide() ? 2 : 1, var->is_store());
+      } else if (const auto iinc = std::get_if<iinc_insn>(&**it)) {
+        access(iinc->index, 1, true);
+        access(iinc->index, 1, false);
+      } else if (const auto plain = std::get_if<insn>(&**it)) {
+        if (const auto expanded = expand_var_insn(plain->opcode)) {
+          access(expanded->index, expanded->is_wide() ? 2 : 1, expanded->is_store());
+        }
+      }
+      facts.union_with(thrown);
+    }
+  }
+  for (const auto& range : ranges) {
+    const auto start = label_positions.find(range.start);
+    const auto end = label_positions.find(range.end);
+    if (start == label_positions.end() || end == label_positions.end()) {
+      continue;
+    }
+    for (auto pos = start->second; pos < end->second; pos++) {
+      occupied[slot_local[*range.index]].set(pos);
+    }
+  }
+
+  // Code that cannot be reached was left out above, so its accesses keep their slots and nothing is moved onto them.
+  std::vector<bool> reserved(slot_count);
+  for (const auto& ref : refs) {
+    if (!reachable.test(ref.position)) {
+      std::fill_n(reserved.begin() + *ref.index, ref.size, true);
+    }
+  }
+
+  // Parameters stay where the caller puts them, the other locals take the lowest slots that are free for them.
+  constexpr auto unplaced = SIZE_MAX;
+  std::vector<size_t> offsets(local_count, unplaced);
+  std::vector<size_t> placed;
+  for (size_t local = 0; local < local_count; local++) {
+    if (local_start[local] < start_locals) {
+      offsets[local] = local_start[local];
+      placed.emplace_back(local);
+    }
+  }
+  for (size_t local = 0; local < local_count; local++) {
+    if (offsets[local] != unplaced) {
+      continue;
+    }
+    size_t offset = 0;
+    for (auto moved = true; moved;) {
+      moved = false;
+      for (const auto other : placed) {
+        if (offset < offsets[other] + local_size[other] && offsets[other] < offset + local_size[local] &&
+            occupied[local].intersects(occupied[other])) {
+          offset = offsets[other] + local_size[other];
+          moved = true;
+        }
+      }
+      for (auto slot = offset; slot < std::min(offset + local_size[local], slot_count); slot++) {
+        if (reserved[slot]) {
+          offset = slot + 1;
+          moved = true;
+        }
+      }
+    }
+    offsets[local] = offset;
+    placed.emplace_back(local);
+  }
+
+  size_t max_locals = start_locals;
+  for (size_t local = 0; local < local_count; local++) {
+    max_locals = std::max(max_locals, offsets[local] + local_size[local]);
+  }
+  for (size_t slot = 0; slot < slot_count; slot++) {
+    if (reserved[slot]) {
+      max_locals = std::max(max_locals, slot + 1);
+    }
+  }
+  const auto remap = [&](uint16_t& index) {
+    const auto local = slot_local[index];
+    index = static_cast<uint16_t>(offsets[local] + index - local_start[local]);
+  };
+  for (const auto& ref : refs) {
+    if (reachable.test(ref.position)) {
+      remap(*ref.index);
+    }
+  }
+  for (const auto& range : ranges) {
+    remap(*range.index);
+  }
+  for (auto& [in, var] : short_forms) {
+    *in = std::move(var);
+  }
+  code.max_locals = static_cast<uint16_t>(max_locals);
+  code.frames.clear();
+  return true;
+}
+
+bool peephole(method& method, uint8_t rules) {
+  return peephole_optimizer(method, rules).run();
+}
+
+bool remove_unreachable(method& method) {
+  auto& code = method.body;
+  for (const auto& in : code) {
+    if (const auto var = std::get_if<var_insn>(&in); var != nullptr && var->opcode == op::ret) {
+      return false;
+    }
+    if (const auto branch = std::get_if<branch_insn>(&in);
+        branch != nullptr && (branch->opcode == op::jsr || branch->opcode == op::jsr_w)) {
+      return false;
+    }
+  }
+  std::unordered_set<const instruction*> dead;
+  {
+    basic_block_graph graph(code);
+    const block_order order(graph);
+    for (auto id = order.reachable(); id < order.size(); id++) {
+      for (const auto& it : order.block(id).instructions()) {
+        if (!std::holds_alternative<label>(*it)) {
+          dead.emplace(&*it);
+        }
+      }
+    }
+  }
+  if (dead.empty()) {
+    return false;
+  }
+
+  // A label in front of removed instructions ends up in front of the next instruction that stays.
+  std::unordered_set<label_id> moved;
+  std::unordered_map<label_id, size_t> label_order;
+  auto next_dead = false;
+  for (auto it = code.rbegin(); it != code.rend(); ++it) {
+    if (const auto lbl = std::get_if<label>(&*it)) {
+      if (next_dead) {
+        moved.emplace(lbl->id());
+      }
+      label_order.emplace(lbl->id(), label_order.size());
+    } else {
+      next_dead = dead.find(&*it) != dead.end();
+    }
+  }
+  size_t remaining = 0;
+  for (auto it = code.begin(); it != code.end();) {
+    if (dead.find(&*it) != dead.end()) {
+      it = code.erase(it);
+    } else {
+      remaining += std::holds_alternative<label>(*it) ? 0 : 1;
+      ++it;
+    }
+  }
+  const auto positions = label_positions(code);
+  const auto is_moved = [&moved](const label& lbl) {
+    return moved.find(lbl.id()) != moved.end();
+  };
+
+  // A moved line number still holds for the instruction it now precedes, unless another one comes after it there. The
+  // labels were numbered from the end, so the last one in code order has the lowest number.
+  std::unordered_map<size_t, size_t> last_lines;
+  for (const auto& [line, lbl] : code.line_numbers) {
+    if (const auto pos = positions.find(lbl.id()); pos != positions.end()) {
+      const auto [it, inserted] = last_lines.emplace(pos->second, label_order.at(lbl.id()));
+      it->second = std::min(it->second, label_order.at(lbl.id()));
+    }
+  }
+  code.line_numbers.erase(std::remove_if(code.line_numbers.begin(), code.line_numbers.end(),
+                                         [&](const std::pair<uint16_t, label>& entry) {
+                                           const auto pos = positions.find(entry.second.id());
+                                           if (!is_moved(entry.second) || pos == positions.end()) {
+                                             return false;
+                                           }
+                                           return pos->second == remaining ||
+                                                  last_lines.at(pos->second) != label_order.at(entry.second.id());
+                                         }),
+                          code.line_numbers.end());
+  code.frames.erase(std::remove_if(code.frames.begin(), code.frames.end(),
+                                   [&](const std::pair<label, frame>& entry) {
+                                     return is_moved(entry.first);
+                                   }),
+                    code.frames.end());
+  code.locals.erase(std::remove_if(code.locals.begin(), code.locals.end(),
+                                   [&](const local_var& local) {
+                                     return empty_range(positions, local.start, local.end);
+                                   }),
+                    code.locals.end());
+  const auto dropped = [&](type_annotation& annotation) {
+    if (const auto offset = std::get_if<target::offset_target>(&annotation.target_info)) {
+      return is_moved(offset->offset);
+    }
+    if (const auto argument = std::get_if<target::type_argument>(&annotation.target_info)) {
+      return is_moved(argument->offset);
+    }
+    if (const auto localvar = std::get_if<target::localvar>(&annotation.target_info)) {
+      auto& table = localvar->table;
+      table.erase(std::remove_if(table.begin(), table.end(),
+                                 [&](const target::local& local) {
+                                   return empty_range(positions, local.start, local.end);
+                                 }),
+                  table.end());
+      return table.empty();
+    }
+    return false;
+  };
+  for (auto* annotations : {&code.visible_type_annotations, &code.invisible_type_annotations}) {
+    annotations->erase(std::remove_if(annotations->begin(), annotations->end(), dropped), annotations->end());
+  }
+  remove_empty_tcbs(code);
+  return true;
+}
+
+bool optimize_branches(method& method) {
+  return branch_optimizer(method).run();
+}
+} // namespace cafe
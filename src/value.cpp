@@ -2,6 +2,8 @@
 
 #include <algorithm>
 #include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 
 #include "cafe/constants.hpp"
@@ -58,6 +60,33 @@ std::string to_string(const value& v) {
       v);
 }
 
+descriptor::descriptor(const std::string_view& desc) : return_type(desc) {
+  const type parsed(desc);
+  if (parsed.kind() != type_kind::method) {
+    return;
+  }
+  parameter_types = parsed.parameter_types();
+  return_type = parsed.return_type();
+  for (const auto& p : parameter_types) {
+    parameter_size += p.size();
+  }
+}
+std::shared_ptr<const descriptor> descriptor::get(const std::string_view& desc) {
+  // Bounds the memory a long running thread spends on descriptors it will not see again.
+  constexpr size_t max_cached = 4096;
+  thread_local std::unordered_set<std::string> names;
+  thread_local std::unordered_map<std::string_view, std::shared_ptr<const descriptor>> cache;
+  if (const auto it = cache.find(desc); it != cache.end()) {
+    return it->second;
+  }
+  if (cache.size() >= max_cached) {
+    cache.clear();
+    names.clear();
+  }
+  const auto& name = *names.emplace(desc).first;
+  return cache.emplace(name, std::make_shared<const descriptor>(name)).first->second;
+}
+
 type::type(const std::string_view& value) : value_(value), kind_(get_kind(value)) {
 }
 
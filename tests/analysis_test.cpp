@@ -48,6 +48,41 @@ TEST(block_graph, compute_maxes) {
 }
 
 
+TEST(block_graph, linear_maxes) {
+  std::ifstream stream("data/SwitchTest.class", std::ios::binary);
+  cafe::class_reader reader;
+  const auto file_res = reader.read(stream);
+  ASSERT_TRUE(file_res) << file_res.err().message();
+  for (const auto& method : file_res.value().methods) {
+    const auto start_locals = cafe::basic_block_graph::get_start_locals(method);
+    if (const auto linear = cafe::basic_block_graph::linear_maxes(method.body, start_locals)) {
+      cafe::basic_block_graph graph(method.body);
+      EXPECT_EQ(*linear, graph.compute_maxes(start_locals)) << method.name_desc();
+    }
+  }
+
+  cafe::code forward;
+  cafe::label skip;
+  forward.add_var_insn(cafe::op::iload, 0);
+  forward.add_branch_insn(cafe::op::ifeq, skip);
+  forward.add_insn(cafe::op::lconst_1);
+  forward.add_var_insn(cafe::op::lstore, 1);
+  forward.add_label(skip);
+  forward.add_insn(cafe::op::return_);
+  const auto maxes = cafe::basic_block_graph::linear_maxes(forward, 1);
+  ASSERT_TRUE(maxes);
+  EXPECT_EQ(maxes->first, 3);
+  EXPECT_EQ(maxes->second, 2);
+
+  cafe::code loop;
+  cafe::label head;
+  loop.add_label(head);
+  loop.add_var_insn(cafe::op::iload, 0);
+  loop.add_branch_insn(cafe::op::ifne, head);
+  loop.add_insn(cafe::op::return_);
+  EXPECT_FALSE(cafe::basic_block_graph::linear_maxes(loop, 1));
+}
+
 TEST(block_graph, compute_frames) {
   std::string test_name = "SwitchTest";
   std::ifstream stream(std::string("data/") + test_name + ".class", std::ios::binary);
@@ -79,6 +114,266 @@ TEST(block_graph, compute_frames) {
   }
 }
 
+TEST(block_graph, stack_width_overflow) {
+  // The stack carried into a block plus what it pushes is more than any single block pushes.
+  cafe::code deep;
+  cafe::label next;
+  for (int32_t i = 0; i < 3; i++) {
+    deep.add_push_insn(cafe::value{i});
+  }
+  deep.add_branch_insn(cafe::op::goto_, next);
+  deep.add_label(next);
+  for (int32_t i = 0; i < 3; i++) {
+    deep.add_push_insn(cafe::value{i});
+  }
+  for (int32_t i = 0; i < 3; i++) {
+    deep.add_insn(cafe::op::pop2);
+  }
+  deep.add_insn(cafe::op::return_);
+  cafe::class_tree tree(cafe::load_rt);
+  cafe::basic_block_graph graph(deep);
+  const auto result = graph.compute_frames(tree, "A", {});
+  EXPECT_EQ(result.max_stack(), 6);
+  ASSERT_EQ(result.frames().size(), 1);
+  const auto& frame = result.frames().front().second;
+  ASSERT_TRUE(std::holds_alternative<cafe::full_frame>(frame));
+  EXPECT_EQ(std::get<cafe::full_frame>(frame).stack, std::vector<cafe::frame_var>(3, cafe::int_var()));
+}
+
+TEST(block_graph, verify_frames) {
+  std::ifstream stream("data/FinallyTest.class", std::ios::binary);
+  cafe::class_reader reader;
+  const auto file_res = reader.read(stream);
+  ASSERT_TRUE(file_res) << file_res.err().message();
+  const auto& file = file_res.value();
+  cafe::class_tree tree(cafe::load_rt);
+
+  auto checked = 0;
+  for (const auto& method : file.methods) {
+    if (method.body.frames.empty()) {
+      continue;
+    }
+    const auto start_locals = cafe::basic_block_graph::get_start_locals(file.name, method);
+    cafe::basic_block_graph graph(method.body);
+    const auto verified = graph.verify_frames(tree, file.name, start_locals, method.body.frames);
+    ASSERT_TRUE(verified) << method.name_desc();
+    cafe::basic_block_graph computed_graph(method.body);
+    const auto computed = computed_graph.compute_frames(tree, file.name, start_locals);
+    EXPECT_EQ(verified->max_stack(), computed.max_stack()) << method.name_desc();
+    EXPECT_EQ(verified->frames().size(), method.body.frames.size()) << method.name_desc();
+
+    cafe::basic_block_graph missing_graph(method.body);
+    EXPECT_FALSE(missing_graph.verify_frames(tree, file.name, start_locals, {})) << method.name_desc();
+    checked++;
+  }
+  EXPECT_GT(checked, 0);
+}
+
+TEST(block_graph, verify_frames_mismatch) {
+  // static void f(int), with local 1 stored before a branch and read at its target.
+  cafe::label target;
+  const auto build = [&target](uint8_t store_const, uint8_t store, size_t pushes) {
+    cafe::code body;
+    for (size_t i = 0; i < pushes; i++) {
+      body.add_insn(cafe::op::iconst_0);
+    }
+    body.add_insn(store_const);
+    body.add_var_insn(store, 1);
+    body.add_var_insn(cafe::op::iload, 0);
+    body.add_branch_insn(cafe::op::ifeq, target);
+    body.add_insn(cafe::op::nop);
+    body.add_label(target);
+    body.add_insn(cafe::op::return_);
+    return body;
+  };
+  cafe::class_tree tree(cafe::load_rt);
+  const std::vector<std::optional<cafe::frame_var>> start_locals{cafe::int_var()};
+  auto body = build(cafe::op::iconst_0, cafe::op::istore, 0);
+  cafe::basic_block_graph graph(body);
+  const auto original = graph.compute_frames(tree, "A", start_locals);
+  ASSERT_EQ(original.frames().size(), 1);
+  cafe::basic_block_graph original_graph(body);
+  EXPECT_TRUE(original_graph.verify_frames(tree, "A", start_locals, original.frames()));
+
+  // Local 1 is a float at the target now, the old frame says int.
+  auto retyped = build(cafe::op::fconst_0, cafe::op::fstore, 0);
+  cafe::basic_block_graph retyped_graph(retyped);
+  EXPECT_FALSE(retyped_graph.verify_frames(tree, "A", start_locals, original.frames()));
+  cafe::basic_block_graph retyped_compute_graph(retyped);
+  const auto retyped_frames = retyped_compute_graph.compute_frames(tree, "A", start_locals);
+  ASSERT_EQ(retyped_frames.frames().size(), 1);
+  EXPECT_NE(cafe::to_string(retyped_frames.frames()[0].second), cafe::to_string(original.frames()[0].second));
+
+  // An int is left on the stack at the target, the old frame has an empty stack.
+  auto pushed = build(cafe::op::iconst_0, cafe::op::istore, 1);
+  cafe::basic_block_graph pushed_graph(pushed);
+  EXPECT_FALSE(pushed_graph.verify_frames(tree, "A", start_locals, original.frames()));
+  cafe::basic_block_graph pushed_compute_graph(pushed);
+  const auto pushed_frames = pushed_compute_graph.compute_frames(tree, "A", start_locals);
+  ASSERT_EQ(pushed_frames.frames().size(), 1);
+  const auto& frame = pushed_frames.frames()[0].second;
+  ASSERT_TRUE(std::holds_alternative<cafe::full_frame>(frame));
+  EXPECT_EQ(std::get<cafe::full_frame>(frame).stack, std::vector<cafe::frame_var>{cafe::int_var()});
+  EXPECT_EQ(pushed_frames.max_stack(), 2);
+}
+
+TEST(block_graph, recompute_frames) {
+  std::ifstream stream("data/TableSwitchTest.class", std::ios::binary);
+  cafe::class_reader reader;
+  auto file_res = reader.read(stream);
+  ASSERT_TRUE(file_res) << file_res.err().message();
+  auto& file = file_res.value();
+  cafe::class_tree tree(cafe::load_rt);
+
+  const auto frames_of = [](const cafe::frame_compute_result& result) {
+    std::vector<std::string> frames;
+    for (const auto& [lbl, f] : result.frames()) {
+      frames.emplace_back(cafe::to_string(f));
+    }
+    return frames;
+  };
+  for (auto& method : file.methods) {
+    if (method.body.size() < 8) {
+      continue;
+    }
+    auto& body = method.body;
+    const auto start_locals = cafe::basic_block_graph::get_start_locals(file.name, method);
+    cafe::basic_block_graph graph(body);
+    const auto previous = graph.compute_frames(tree, file.name, start_locals);
+
+    auto pos = std::next(body.begin(), static_cast<std::ptrdiff_t>(body.size() / 2));
+    const auto first = body.insert(pos, cafe::insn(cafe::op::aconst_null));
+    body.insert(pos, cafe::var_insn(cafe::op::astore, previous.max_locals()));
+    body.insert(pos, cafe::push_insn(cafe::value{int32_t(1)}));
+    body.insert(pos, cafe::insn(cafe::op::pop));
+
+    cafe::basic_block_graph full_graph(body);
+    const auto full = full_graph.compute_frames(tree, file.name, start_locals);
+    cafe::basic_block_graph edited_graph(body);
+    const auto edited = edited_graph.recompute_frames(tree, file.name, start_locals, previous, first, pos);
+    EXPECT_EQ(frames_of(edited), frames_of(full)) << method.name_desc();
+    EXPECT_EQ(edited.max_locals(), full.max_locals()) << method.name_desc();
+    EXPECT_GE(edited.max_stack(), full.max_stack()) << method.name_desc();
+  }
+}
+
+TEST(block_graph, recompute_frames_replaced_label) {
+  cafe::code body;
+  cafe::label start;
+  cafe::label end;
+  cafe::label handler;
+  body.add_type_insn(cafe::op::new_, "java/lang/Object");
+  body.add_insn(cafe::op::dup);
+  body.add_label(start);
+  body.add_insn(cafe::op::nop);
+  body.add_label(end);
+  body.add_method_insn(cafe::op::invokespecial, "java/lang/Object", "<init>", "()V");
+  body.add_insn(cafe::op::pop);
+  body.add_insn(cafe::op::return_);
+  body.add_label(handler);
+  body.add_insn(cafe::op::pop);
+  body.add_insn(cafe::op::return_);
+  body.tcbs.emplace_back(start, end, handler, std::nullopt);
+  cafe::class_tree tree(cafe::load_rt);
+  cafe::basic_block_graph graph(body);
+  const auto previous = graph.compute_frames(tree, "A", {});
+  // The block split at the start of the try-catch block carries the uninitialized object, which gets a label injected
+  // at the new.
+  ASSERT_FALSE(previous.labels().empty());
+  for (const auto& [it, lbl] : previous.labels()) {
+    ASSERT_EQ(it, body.begin());
+  }
+
+  // The instruction carrying the label is removed, so the previous labels point at an erased instruction, and another
+  // one takes its place.
+  body.erase(body.begin());
+  const auto first = body.insert(body.begin(), cafe::type_insn(cafe::op::new_, "java/lang/Object"));
+  cafe::basic_block_graph full_graph(body);
+  const auto full = full_graph.compute_frames(tree, "A", {});
+  cafe::basic_block_graph edited_graph(body);
+  const auto edited = edited_graph.recompute_frames(tree, "A", {}, previous, first, std::next(first));
+  ASSERT_EQ(edited.labels().size(), full.labels().size());
+  for (const auto& [it, lbl] : edited.labels()) {
+    EXPECT_EQ(it, body.begin());
+  }
+  ASSERT_EQ(edited.frames().size(), full.frames().size());
+  for (size_t i = 0; i < full.frames().size(); i++) {
+    EXPECT_EQ(cafe::to_string(edited.frames()[i].second), cafe::to_string(full.frames()[i].second));
+  }
+  EXPECT_EQ(edited.max_locals(), full.max_locals());
+  EXPECT_GE(edited.max_stack(), full.max_stack());
+}
+
+TEST(block_graph, encode_frame) {
+  using cafe::basic_block_graph;
+  using slots = std::vector<std::optional<cafe::frame_var>>;
+  const std::vector<cafe::frame_var> base{cafe::object_var("A"), cafe::int_var()};
+  const slots base_slots{cafe::object_var("A"), cafe::int_var()};
+  const slots none;
+  const slots one_stack{cafe::long_var(), cafe::top_var()};
+  const slots appended{cafe::object_var("A"), cafe::int_var(), std::nullopt, cafe::long_var(), cafe::top_var()};
+  const slots chopped{cafe::object_var("A"), std::nullopt};
+  const slots changed{cafe::object_var("B"), cafe::int_var()};
+  const auto encode = [&base](const slots& locals, const slots& stack) {
+    return basic_block_graph::encode_frame(base, locals.data(), locals.size(), stack.data(), stack.size());
+  };
+
+  EXPECT_TRUE(std::holds_alternative<cafe::same_frame>(encode(base_slots, none)));
+  const auto same_stack = encode(base_slots, one_stack);
+  ASSERT_TRUE(std::holds_alternative<cafe::same_frame>(same_stack));
+  EXPECT_EQ(std::get<cafe::same_frame>(same_stack).stack, cafe::frame_var(cafe::long_var()));
+  const auto append = encode(appended, none);
+  ASSERT_TRUE(std::holds_alternative<cafe::append_frame>(append));
+  EXPECT_EQ(std::get<cafe::append_frame>(append).locals,
+            (std::vector<cafe::frame_var>{cafe::top_var(), cafe::long_var()}));
+  const auto chop = encode(chopped, none);
+  ASSERT_TRUE(std::holds_alternative<cafe::chop_frame>(chop));
+  EXPECT_EQ(std::get<cafe::chop_frame>(chop).size, 1);
+  EXPECT_TRUE(std::holds_alternative<cafe::full_frame>(encode(changed, none)));
+  const auto full = encode(appended, one_stack);
+  ASSERT_TRUE(std::holds_alternative<cafe::full_frame>(full));
+  EXPECT_EQ(std::get<cafe::full_frame>(full).locals,
+            (std::vector<cafe::frame_var>{cafe::object_var("A"), cafe::int_var(), cafe::top_var(), cafe::long_var()}));
+  EXPECT_EQ(std::get<cafe::full_frame>(full).stack, std::vector<cafe::frame_var>{cafe::long_var()});
+}
+
+TEST(block_graph, constructor_receiver_in_local) {
+  cafe::code code;
+  cafe::label next;
+  code.add_type_insn(cafe::op::new_, "java/lang/Object");
+  code.add_var_insn(cafe::op::astore, 0);
+  code.add_var_insn(cafe::op::aload, 0);
+  code.add_method_insn(cafe::op::invokespecial, "java/lang/Object", "<init>", "()V");
+  code.add_branch_insn(cafe::op::goto_, next);
+  code.add_label(next);
+  code.add_var_insn(cafe::op::aload, 0);
+  code.add_insn(cafe::op::areturn);
+  cafe::class_tree tree(cafe::load_rt);
+  cafe::basic_block_graph graph(code);
+  const auto result = graph.compute_frames(tree, "A", {});
+  ASSERT_EQ(result.frames().size(), 1);
+  // The copy in the local is initialized along with the one the constructor was called on.
+  const auto& frame = result.frames().front().second;
+  ASSERT_TRUE(std::holds_alternative<cafe::append_frame>(frame));
+  const std::vector<cafe::frame_var> locals{cafe::object_var("java/lang/Object")};
+  EXPECT_EQ(std::get<cafe::append_frame>(frame).locals, locals);
+}
+
+TEST(block_graph, swap_in_loop) {
+  cafe::code code;
+  cafe::label head;
+  code.add_push_insn(cafe::value{int32_t(1)});
+  code.add_push_insn(cafe::value{int32_t(2)});
+  code.add_label(head);
+  code.add_insn(cafe::op::swap);
+  code.add_branch_insn(cafe::op::goto_, head);
+  cafe::class_tree tree(cafe::load_rt);
+  cafe::basic_block_graph graph(code);
+  const auto result = graph.compute_frames(tree, "A", {});
+  EXPECT_EQ(result.max_stack(), 2);
+  ASSERT_EQ(result.frames().size(), 1);
+}
+
 using namespace cafe;
 
 TEST(exaple, test) {
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <fstream>
+#include <initializer_list>
+#include <map>
+#include <set>
+#include <string>
+
+#include <gtest/gtest.h>
+#include <hippo/cafe.hpp>
+
+// The id of the block that starts with the given label.
+inline size_t block_at(const cafe::block_order& order, const cafe::label& lbl) {
+  for (size_t id = 0; id < order.size(); id++) {
+    const auto& first = *order.block(id).instructions().front();
+    if (const auto found = std::get_if<cafe::label>(&first); found != nullptr && *found == lbl) {
+      return id;
+    }
+  }
+  return order.size();
+}
+
+// Reads data/<name>.class.
+inline cafe::result<cafe::class_file> read_class(const std::string& name) {
+  std::ifstream stream("data/" + name + ".class", std::ios::binary);
+  cafe::class_reader reader;
+  return reader.read(stream);
+}
+
+// Calls f(name, file, method) for every method with code in the named classes.
+template <typename F>
+void for_each_method(std::initializer_list<const char*> names, F&& f) {
+  for (const auto* name : names) {
+    auto file_res = read_class(name);
+    ASSERT_TRUE(file_res) << name << " " << file_res.err().message();
+    auto& file = file_res.value();
+    for (auto& method : file.methods) {
+      if (!method.body.empty()) {
+        f(name, file, method);
+      }
+    }
+  }
+}
+
+// The writes that reach each read of a local in reachable code. Parameters are written by nullptr.
+inline std::map<const cafe::instruction*, std::set<const cafe::instruction*>> reads_of(const cafe::method& method) {
+  const cafe::basic_block_graph graph(method.body);
+  const cafe::block_order order(graph);
+  const cafe::reaching_definitions defs(method.body, cafe::basic_block_graph::get_start_locals(method));
+  const auto reaching = cafe::solve_dataflow(order, defs);
+  std::map<const cafe::instruction*, std::set<const cafe::instruction*>> reads;
+  for (size_t id = 0; id < order.reachable(); id++) {
+    auto facts = reaching.in(id);
+    for (const auto& it : order.block(id).instructions()) {
+      const auto read = [&](uint16_t index) {
+        auto seen = defs.definitions_of(index);
+        seen.intersect_with(facts);
+        auto& writes = reads[&*it];
+        seen.for_each([&](size_t def) {
+          const auto insn = defs.definitions()[def].insn;
+          writes.emplace(insn == method.body.end() ? nullptr : &*insn);
+        });
+      };
+      if (const auto var = std::get_if<cafe::var_insn>(&*it); var != nullptr && var->is_load()) {
+        read(var->index);
+      } else if (const auto iinc = std::get_if<cafe::iinc_insn>(&*it)) {
+        read(iinc->index);
+      }
+      if (const auto def = defs.definition_of(*it)) {
+        const auto& written = defs.definitions()[*def];
+        for (uint16_t slot = written.index; slot < written.index + written.size; slot++) {
+          facts.subtract(defs.definitions_of(slot));
+        }
+        facts.set(*def);
+      }
+    }
+  }
+  return reads;
+}
+
+// Whether every read of a local in reachable code sees a write of it.
+inline bool reads_defined(const cafe::method& method) {
+  for (const auto& [read, writes] : reads_of(method)) {
+    if (writes.empty()) {
+      return false;
+    }
+  }
+  return true;
+}
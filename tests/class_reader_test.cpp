@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -25,4 +26,48 @@ TEST(class_reader, test) {
       std::cout << "  " << cafe::to_string(in) << std::endl;
     }
   }
-}
\ No newline at end of file
+}
+TEST(class_reader, switch_tables) {
+  cafe::class_file file("test/Switch", "java/lang/Object");
+  cafe::code body;
+  cafe::label dflt;
+  std::vector<cafe::label> targets(1000);
+  std::vector<std::pair<int32_t, cafe::label>> pairs;
+  for (auto i = 0; i < 100; i++) {
+    pairs.emplace_back(i * 1000, targets[i]);
+  }
+  body.add_var_insn(cafe::op::iload, 0);
+  body.add_table_switch_insn(dflt, -500, 499, targets);
+  body.add_var_insn(cafe::op::iload, 0);
+  body.add_lookup_switch_insn(dflt, pairs);
+  for (const auto& target : targets) {
+    body.add_label(target);
+  }
+  body.add_label(dflt);
+  body.add_insn(cafe::op::return_);
+  file.methods.emplace_back(cafe::access_flag::acc_static, "run", "(I)V", std::move(body));
+
+  cafe::class_writer writer(cafe::compute_maxes);
+  auto data = writer.write(file);
+  cafe::class_reader reader;
+  const auto res = reader.read(data);
+  ASSERT_TRUE(res) << res.err().message();
+  const auto& code = res.value().methods[0].body;
+  const auto table = std::find_if(code.begin(), code.end(), [](const cafe::instruction& insn) {
+    return std::holds_alternative<cafe::table_switch_insn>(insn);
+  });
+  ASSERT_NE(table, code.end());
+  EXPECT_EQ(std::get<cafe::table_switch_insn>(*table).low, -500);
+  EXPECT_EQ(std::get<cafe::table_switch_insn>(*table).targets.size(), 1000);
+  const auto lookup = std::find_if(code.begin(), code.end(), [](const cafe::instruction& insn) {
+    return std::holds_alternative<cafe::lookup_switch_insn>(insn);
+  });
+  ASSERT_NE(lookup, code.end());
+  EXPECT_EQ(std::get<cafe::lookup_switch_insn>(*lookup).targets.size(), 100);
+  EXPECT_EQ(std::get<cafe::lookup_switch_insn>(*lookup).targets[99].first, 99000);
+
+  // Truncated input fails cleanly instead of reading past the end.
+  data.resize(data.size() / 2);
+  cafe::class_reader truncated;
+  EXPECT_FALSE(truncated.read(data));
+}
@@ -0,0 +1,125 @@
+#include <hippo/cafe.hpp>
+#include <gtest/gtest.h>
+
+TEST(class_tree_snapshot_test, round_trip) {
+  cafe::class_tree tree(cafe::load_rt);
+  tree.put("test/MyList", "java/util/AbstractList", {"test/Marker"});
+
+  const auto path = std::string("class_tree_snapshot_test.bin");
+  ASSERT_TRUE(cafe::class_tree_snapshot::write(tree, path));
+  auto snapshot_res = cafe::class_tree_snapshot::open(path);
+  ASSERT_TRUE(snapshot_res) << snapshot_res.err().message();
+  const auto snapshot = std::make_shared<const cafe::class_tree_snapshot>(std::move(snapshot_res.value()));
+  std::cout << snapshot->size() << " classes" << std::endl;
+
+  EXPECT_EQ(snapshot->size(), tree.size());
+  for (const auto& [name, node] : tree) {
+    const auto index = snapshot->find(name);
+    ASSERT_NE(index, cafe::class_tree_snapshot::no_class) << name;
+    EXPECT_EQ(snapshot->name(index), name);
+    EXPECT_EQ(snapshot->resolved(index), node->resolved());
+  }
+  EXPECT_EQ(snapshot->find("test/Missing"), cafe::class_tree_snapshot::no_class);
+  EXPECT_TRUE(snapshot->is_assignable_from("java/util/List", "test/MyList"));
+  EXPECT_TRUE(snapshot->is_assignable_from("test/Marker", "test/MyList"));
+  EXPECT_TRUE(snapshot->is_assignable_from("java/lang/Object", "[Ljava/util/List;"));
+  EXPECT_TRUE(snapshot->is_assignable_from("[Ljava/util/Collection;", "[Ljava/util/ArrayList;"));
+  EXPECT_FALSE(snapshot->is_assignable_from("java/util/ArrayList", "java/util/List"));
+  EXPECT_EQ(snapshot->common_super_class("java/util/ArrayList", "java/util/LinkedList"), "java/util/AbstractList");
+
+  cafe::class_tree lazy;
+  lazy.set_resolver(cafe::class_tree_snapshot::resolver(snapshot));
+  EXPECT_TRUE(lazy.is_assignable_from("java/util/List", "test/MyList"));
+  EXPECT_EQ(lazy.common_super_class("test/MyList", "java/util/LinkedList"), "java/util/AbstractList");
+  EXPECT_LT(lazy.size(), 20);
+
+  auto bytes = cafe::class_tree_snapshot::serialize(tree);
+  bytes.resize(bytes.size() / 2);
+  EXPECT_FALSE(cafe::class_tree_snapshot::from_bytes(std::move(bytes)));
+  std::remove(path.c_str());
+}
+
+TEST(class_tree_snapshot_test, cyclic_hierarchy) {
+  // Cycles are only found when a walk reaches them. Queries still end, and the resolver keeps the classes that lead into
+  // a cycle from a class_tree, whose walks are not bounded.
+  cafe::class_tree supers;
+  supers.put("test/A", "test/B", {});
+  supers.put("test/B", "test/A", {});
+  supers.put("test/C", "test/A", {});
+  supers.put("test/D", "java/lang/Object", {});
+  auto supers_res = cafe::class_tree_snapshot::from_bytes(cafe::class_tree_snapshot::serialize(supers));
+  ASSERT_TRUE(supers_res) << supers_res.err().message();
+  const auto supers_snapshot = std::make_shared<const cafe::class_tree_snapshot>(std::move(supers_res.value()));
+  EXPECT_TRUE(supers_snapshot->has_cyclic_ancestors(supers_snapshot->find("test/C")));
+  EXPECT_FALSE(supers_snapshot->has_cyclic_ancestors(supers_snapshot->find("test/D")));
+  EXPECT_FALSE(supers_snapshot->is_assignable_from("test/D", "test/C"));
+  EXPECT_EQ(supers_snapshot->common_super_class("test/C", "test/D"), "java/lang/Object");
+  cafe::class_tree lazy;
+  lazy.set_resolver(cafe::class_tree_snapshot::resolver(supers_snapshot));
+  EXPECT_EQ(lazy.get("test/C"), nullptr);
+  ASSERT_NE(lazy.get("test/D"), nullptr);
+  EXPECT_TRUE(lazy.get("test/D")->resolved());
+  EXPECT_FALSE(lazy.is_assignable_from("test/D", "test/C"));
+
+  cafe::class_tree interfaces;
+  interfaces.put("test/C", "java/lang/Object", {"test/I"});
+  interfaces.put("test/I", "java/lang/Object", {"test/J"});
+  interfaces.put("test/J", "java/lang/Object", {"test/I"});
+  const auto interfaces_snapshot =
+      cafe::class_tree_snapshot::from_bytes(cafe::class_tree_snapshot::serialize(interfaces));
+  ASSERT_TRUE(interfaces_snapshot) << interfaces_snapshot.err().message();
+  EXPECT_TRUE(interfaces_snapshot.value().has_cyclic_ancestors(interfaces_snapshot.value().find("test/C")));
+  EXPECT_FALSE(interfaces_snapshot.value().is_assignable_from("test/K", "test/C"));
+  EXPECT_TRUE(interfaces_snapshot.value().is_assignable_from("test/J", "test/C"));
+
+  // Diamonds are fine.
+  cafe::class_tree diamond;
+  diamond.put("test/C", "java/lang/Object", {"test/I", "test/J"});
+  diamond.put("test/I", "java/lang/Object", {"test/K"});
+  diamond.put("test/J", "java/lang/Object", {"test/K"});
+  const auto snapshot = cafe::class_tree_snapshot::from_bytes(cafe::class_tree_snapshot::serialize(diamond));
+  ASSERT_TRUE(snapshot) << snapshot.err().message();
+  EXPECT_FALSE(snapshot.value().has_cyclic_ancestors(snapshot.value().find("test/C")));
+  EXPECT_TRUE(snapshot.value().is_assignable_from("test/K", "test/C"));
+}
+
+TEST(class_tree_snapshot_test, damaged_records) {
+  cafe::class_tree tree;
+  tree.put("test/A", "java/lang/Object", {"test/I"});
+  auto bytes = cafe::class_tree_snapshot::serialize(tree);
+  // Every field of every record is pointed far out of range. Opening only checks the header, the reads find nothing.
+  const auto read_u32 = [&bytes](size_t offset) {
+    return static_cast<uint32_t>(static_cast<uint8_t>(bytes[offset])) << 24 |
+           static_cast<uint32_t>(static_cast<uint8_t>(bytes[offset + 1])) << 16 |
+           static_cast<uint32_t>(static_cast<uint8_t>(bytes[offset + 2])) << 8 |
+           static_cast<uint32_t>(static_cast<uint8_t>(bytes[offset + 3]));
+  };
+  const auto classes_offset = read_u32(24);
+  const auto class_count = read_u32(8);
+  for (auto i = classes_offset; i < classes_offset + class_count * 24; i++) {
+    bytes[i] = 0x7f;
+  }
+  auto res = cafe::class_tree_snapshot::from_bytes(std::move(bytes));
+  ASSERT_TRUE(res) << res.err().message();
+  const auto& snapshot = res.value();
+  EXPECT_EQ(snapshot.size(), class_count);
+  EXPECT_TRUE(snapshot.name(0).empty());
+  EXPECT_EQ(snapshot.super_class(0), cafe::class_tree_snapshot::no_class);
+  EXPECT_EQ(snapshot.interface_count(0), 0);
+  EXPECT_EQ(snapshot.find("test/A"), cafe::class_tree_snapshot::no_class);
+  EXPECT_FALSE(snapshot.is_assignable_from("java/lang/Object", "test/A"));
+}
+
+TEST(class_tree_snapshot_test, load_release) {
+  cafe::class_tree tree(cafe::load_rt);
+  const auto path = cafe::class_tree_snapshot::release_file_name(21);
+  ASSERT_TRUE(cafe::class_tree_snapshot::write(tree, path));
+
+  auto release = cafe::class_tree::load_release(".", 21);
+  ASSERT_TRUE(release) << release.err().message();
+  EXPECT_TRUE(release.value().concurrent());
+  EXPECT_TRUE(release.value().is_assignable_from("java/util/Collection", "java/util/ArrayList"));
+  EXPECT_LT(release.value().size(), 20);
+  EXPECT_FALSE(cafe::class_tree::load_release(".", 7));
+  std::remove(path.c_str());
+}
@@ -1,3 +1,10 @@
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
 #include <hippo/cafe.hpp>
 #include <gtest/gtest.h>
 
@@ -5,4 +12,211 @@ TEST(class_tree_test, assignable_from) {
   cafe::class_tree tree(cafe::load_rt);
 
   std::cout << tree.is_assignable_from("java/lang/Object", "[I") << std::endl;
-}
\ No newline at end of file
+}
+
+TEST(class_tree_test, subtypes) {
+  cafe::class_tree tree(cafe::load_rt);
+
+  std::set<std::string> expected;
+  for (const auto& [name, node] : tree) {
+    if (name != "java/util/Collection" && tree.is_assignable_from("java/util/Collection", name)) {
+      expected.emplace(name);
+    }
+  }
+  std::set<std::string> found;
+  for (const auto node : tree.subtypes("java/util/Collection")) {
+    EXPECT_TRUE(found.emplace(node->name).second) << node->name;
+  }
+  EXPECT_EQ(found, expected);
+  std::cout << found.size() << " subtypes of java/util/Collection" << std::endl;
+
+  const auto& list_subclasses = tree.get("java/util/AbstractList")->subclasses;
+  EXPECT_NE(std::find(list_subclasses.begin(), list_subclasses.end(), tree.get("java/util/ArrayList")),
+            list_subclasses.end());
+  tree.put("java/util/ArrayList", "java/lang/Object", {});
+  EXPECT_EQ(std::find(list_subclasses.begin(), list_subclasses.end(), tree.get("java/util/ArrayList")),
+            list_subclasses.end());
+  const auto& object_subclasses = tree.get("java/lang/Object")->subclasses;
+  EXPECT_NE(std::find(object_subclasses.begin(), object_subclasses.end(), tree.get("java/util/ArrayList")),
+            object_subclasses.end());
+  EXPECT_EQ(tree.subtypes("test/Missing").begin(), tree.subtypes("test/Missing").end());
+}
+
+TEST(class_tree_test, direct_edits) {
+  cafe::class_tree tree(cafe::load_rt);
+  const auto node = tree.get_or_create("test/Direct");
+  node->super_class = tree.get("java/util/AbstractList");
+  node->interfaces.emplace_back(tree.get_or_create("test/Marker"));
+  EXPECT_TRUE(tree.is_assignable_from("java/util/List", "test/Direct"));
+  EXPECT_TRUE(tree.is_assignable_from("test/Marker", "test/Direct"));
+  EXPECT_EQ(tree.common_super_class("test/Direct", "java/util/ArrayList"), "java/util/AbstractList");
+}
+
+TEST(class_tree_test, overlay) {
+  const auto base = std::make_shared<const cafe::class_tree>(cafe::load_rt);
+  const auto base_size = base->size();
+  cafe::class_tree first(base);
+  cafe::class_tree second(base);
+
+  first.put("test/MyList", "java/util/AbstractList", {"test/Marker"});
+  first.put("java/util/ArrayList", "java/lang/Object", {});
+  EXPECT_TRUE(first.is_assignable_from("java/util/List", "test/MyList"));
+  EXPECT_TRUE(first.is_assignable_from("test/Marker", "test/MyList"));
+  EXPECT_EQ(first.common_super_class("test/MyList", "java/util/LinkedList"), "java/util/AbstractList");
+  EXPECT_FALSE(first.is_assignable_from("java/util/List", "java/util/ArrayList"));
+  EXPECT_EQ(second.get("test/MyList"), nullptr);
+  EXPECT_TRUE(second.is_assignable_from("java/util/List", "java/util/ArrayList"));
+  EXPECT_EQ(second.get("java/util/ArrayList"), base->get("java/util/ArrayList"));
+  EXPECT_EQ(base->size(), base_size);
+
+  std::set<std::string> subtypes;
+  for (const auto node : first.subtypes("java/util/AbstractList")) {
+    subtypes.emplace(node->name);
+  }
+  EXPECT_EQ(subtypes.count("test/MyList"), 1);
+  EXPECT_EQ(subtypes.count("java/util/ArrayList"), 0);
+  EXPECT_EQ(subtypes.count("java/util/LinkedList"), 1);
+  for (const auto node : base->subtypes("java/util/AbstractList")) {
+    EXPECT_NE(node->name, "test/MyList");
+  }
+}
+
+TEST(class_tree_test, concurrent_put) {
+  cafe::class_tree tree(cafe::load_rt, cafe::concurrent);
+  const auto rt_size = tree.size();
+
+  constexpr auto thread_count = 4;
+  constexpr auto class_count = 2000;
+  std::vector<std::thread> threads;
+  for (auto t = 0; t < thread_count; t++) {
+    threads.emplace_back([&tree, t]() {
+      for (auto i = t; i < class_count; i += thread_count) {
+        const auto super_name = i == 0 ? std::string("java/util/AbstractList") : "test/C" + std::to_string(i - 1);
+        const auto name = "test/C" + std::to_string(i);
+        tree.put(name, super_name, {"test/I" + std::to_string(i % 7)});
+        EXPECT_TRUE(tree.get(name)->resolved());
+        EXPECT_TRUE(tree.is_assignable_from("test/I" + std::to_string(i % 7), name));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(tree.size(), rt_size + class_count + 7);
+  EXPECT_TRUE(tree.is_assignable_from("java/util/List", "test/C1999"));
+  EXPECT_TRUE(tree.is_assignable_from("test/C10", "test/C1999"));
+  EXPECT_TRUE(tree.is_assignable_from("test/I3", "test/C1999"));
+  EXPECT_FALSE(tree.is_assignable_from("test/C1999", "test/C10"));
+  EXPECT_EQ(tree.common_super_class("test/C10", "test/C1999"), "test/C10");
+
+  tree.put("test/C10", "java/lang/Object", {});
+  EXPECT_TRUE(tree.is_assignable_from("java/util/List", "test/C10"));
+
+  size_t count = 0;
+  for (const auto& [name, node] : tree) {
+    EXPECT_EQ(name, node->name);
+    count++;
+  }
+  EXPECT_EQ(count, tree.size());
+}
+
+TEST(class_tree_test, concurrent_lookup_during_put) {
+  cafe::class_tree tree(cafe::concurrent);
+  constexpr auto class_count = 500;
+  std::vector<std::string> interfaces;
+  for (auto i = 0; i < 64; i++) {
+    interfaces.emplace_back("test/I" + std::to_string(i));
+  }
+  for (auto i = 0; i < class_count; i++) {
+    tree.put("test/D" + std::to_string(i), "test/C" + std::to_string(i), {});
+  }
+
+  std::thread writer([&tree, &interfaces]() {
+    for (auto i = 0; i < class_count; i++) {
+      tree.put("test/C" + std::to_string(i), "test/S" + std::to_string(i), interfaces);
+    }
+  });
+  std::thread reader([&tree]() {
+    for (auto i = 0; i < class_count; i++) {
+      const auto super_name = "test/S" + std::to_string(i);
+      while (tree.get(super_name) == nullptr) {
+        std::this_thread::yield();
+      }
+      // The super class only exists once the put of C has started, so lookups that meet C have to wait for it.
+      EXPECT_TRUE(tree.get("test/C" + std::to_string(i))->resolved());
+      EXPECT_TRUE(tree.is_assignable_from(super_name, "test/D" + std::to_string(i)));
+      EXPECT_TRUE(tree.is_assignable_from("test/I63", "test/C" + std::to_string(i)));
+    }
+  });
+  writer.join();
+  reader.join();
+}
+
+TEST(class_tree_test, concurrent_resolver) {
+  cafe::class_tree tree(cafe::concurrent);
+  std::mutex mutex;
+  std::map<std::string, size_t> requested;
+  tree.set_resolver([&mutex, &requested](const std::string& name) -> std::optional<cafe::class_header> {
+    {
+      std::lock_guard lock(mutex);
+      requested[name]++;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+    if (name.rfind("test/R", 0) != 0) {
+      return std::nullopt;
+    }
+    const auto index = std::stoi(name.substr(6));
+    return cafe::class_header(name, index == 0 ? "java/lang/Object" : "test/R" + std::to_string(index - 1), {});
+  });
+
+  constexpr auto thread_count = 8;
+  std::vector<std::thread> threads;
+  for (auto t = 0; t < thread_count; t++) {
+    threads.emplace_back([&tree]() {
+      // Every thread has to see the whole chain, whichever thread resolved each link.
+      EXPECT_TRUE(tree.is_assignable_from("test/R0", "test/R99"));
+      EXPECT_EQ(tree.common_super_class("test/R50", "test/R99"), "test/R50");
+      EXPECT_EQ(tree.get("test/Missing"), nullptr);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (const auto& [name, count] : requested) {
+    EXPECT_EQ(count, 1) << name;
+  }
+  EXPECT_EQ(requested.count("test/R1"), 1);
+  EXPECT_EQ(requested.count("test/Missing"), 1);
+}
+
+TEST(class_tree_test, resolver) {
+  cafe::class_tree tree;
+  std::vector<std::string> requested;
+  const auto directory = cafe::class_tree::directory_resolver({"data"});
+  tree.set_resolver([&requested, &directory](const std::string& name) -> std::optional<cafe::class_header> {
+    requested.emplace_back(name);
+    if (name == "test/A") {
+      return cafe::class_header("test/A", "test/B", {"test/I"});
+    }
+    if (name == "test/B") {
+      return cafe::class_header("test/B", "java/lang/Object", {});
+    }
+    return directory(name);
+  });
+
+  EXPECT_TRUE(tree.is_assignable_from("test/B", "test/A"));
+  EXPECT_TRUE(tree.is_assignable_from("test/I", "test/A"));
+  EXPECT_FALSE(tree.is_assignable_from("test/A", "test/B"));
+  EXPECT_EQ(tree.common_super_class("test/A", "test/B"), "test/B");
+  ASSERT_NE(tree.get("HelloWorld"), nullptr);
+  EXPECT_TRUE(tree.get("HelloWorld")->resolved());
+  EXPECT_EQ(tree.get("HelloWorld")->super_class->name, "java/lang/Object");
+  EXPECT_EQ(tree.get("test/Missing"), nullptr);
+  EXPECT_EQ(tree.get("test/Missing"), nullptr);
+
+  for (const auto& name : {"test/A", "test/B", "HelloWorld", "test/Missing"}) {
+    EXPECT_EQ(std::count(requested.begin(), requested.end(), name), 1) << name;
+  }
+}
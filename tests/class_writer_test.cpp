@@ -1,5 +1,9 @@
+#include <algorithm>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
 
 #include <gtest/gtest.h>
 
@@ -62,3 +66,269 @@ TEST(class_writer, test) {
     }
   }
 }
+
+TEST(class_writer, parallel_methods) {
+  const cafe::class_tree tree(cafe::load_rt);
+  for (const auto& test_name : {"ForLoopTest", "BranchTest", "FinallyTest", "CalculationTest", "InnerClass"}) {
+    std::ifstream stream(std::string("data/") + test_name + ".class", std::ios::binary);
+    cafe::class_reader reader;
+    const auto file_res = reader.read(stream);
+    ASSERT_TRUE(file_res) << file_res.err().message();
+    const auto& file = file_res.value();
+
+    cafe::class_writer serial(tree);
+    cafe::class_writer parallel(tree, cafe::parallel_methods);
+    EXPECT_EQ(serial.write(file), parallel.write(file)) << test_name;
+
+    // A tree that is filled by its lookups and not concurrent is only used from one thread.
+    cafe::class_tree lazy;
+    lazy.set_resolver(cafe::class_tree::directory_resolver({"data"}));
+    ASSERT_FALSE(lazy.concurrent_lookups());
+    cafe::class_writer fallback(lazy, cafe::parallel_methods);
+    cafe::class_tree lazy_serial;
+    lazy_serial.set_resolver(cafe::class_tree::directory_resolver({"data"}));
+    cafe::class_writer serial_fallback(lazy_serial);
+    EXPECT_EQ(serial_fallback.write(file), fallback.write(file)) << test_name;
+  }
+}
+
+TEST(class_writer, parallel_methods_throw) {
+  cafe::class_file file("test/Throwing", "java/lang/Object");
+  for (auto i = 0; i < 8; i++) {
+    cafe::code code;
+    cafe::label other;
+    cafe::label join;
+    for (auto j = 0; j < 3000; j++) {
+      code.add_insn(cafe::op::nop);
+    }
+    code.add_var_insn(cafe::op::iload, 0);
+    code.add_branch_insn(cafe::op::ifeq, other);
+    code.add_var_insn(cafe::op::aload, 1);
+    code.add_branch_insn(cafe::op::goto_, join);
+    code.add_label(other);
+    code.add_var_insn(cafe::op::aload, 2);
+    code.add_label(join);
+    code.add_insn(cafe::op::areturn);
+    file.methods.emplace_back(cafe::access_flag::acc_static, "f" + std::to_string(i),
+                              "(ZLtest/A;Ltest/B;)Ljava/lang/Object;", std::move(code));
+  }
+
+  // Merging the two branches looks up both classes, and the resolver fails on them.
+  cafe::class_tree tree(cafe::concurrent);
+  tree.set_resolver([](const std::string& name) -> std::optional<cafe::class_header> {
+    throw std::runtime_error("cannot resolve " + name);
+  });
+  cafe::class_writer writer(tree, cafe::parallel_methods);
+  EXPECT_THROW(writer.write(file), std::runtime_error);
+}
+
+TEST(class_writer, optimize_pool) {
+  cafe::class_file file("test/Pool", "java/lang/Object");
+  cafe::code cold;
+  for (auto i = 0; i < 300; i++) {
+    cold.add_push_insn(cafe::value{"cold" + std::to_string(i)});
+    cold.add_insn(cafe::op::pop);
+  }
+  cold.add_insn(cafe::op::return_);
+  cafe::code hot;
+  for (auto i = 0; i < 50; i++) {
+    hot.add_push_insn(cafe::value{std::string("hot")});
+    hot.add_insn(cafe::op::pop);
+  }
+  hot.add_insn(cafe::op::return_);
+  file.methods.emplace_back(cafe::access_flag::acc_static, "cold", "()V", std::move(cold));
+  file.methods.emplace_back(cafe::access_flag::acc_static, "hot", "()V", std::move(hot));
+
+  cafe::class_writer plain_writer(cafe::compute_maxes);
+  cafe::class_writer optimized_writer(cafe::compute_maxes | cafe::optimize_pool);
+  const auto plain = plain_writer.write(file);
+  const auto optimized = optimized_writer.write(file);
+  std::cout << "plain: " << plain.size() << " optimized: " << optimized.size() << std::endl;
+  EXPECT_LT(optimized.size(), plain.size());
+
+  cafe::class_reader reader;
+  const auto res = reader.read(optimized);
+  ASSERT_TRUE(res) << res.err().message();
+  const auto& methods = res.value().methods;
+  ASSERT_EQ(methods.size(), 2);
+  EXPECT_EQ(std::get<cafe::push_insn>(methods[0].body.front()).operand, cafe::value{std::string("cold0")});
+  EXPECT_EQ(std::get<cafe::push_insn>(methods[1].body.front()).operand, cafe::value{std::string("hot")});
+  EXPECT_EQ(methods[0].body.size(), file.methods[0].body.size());
+  EXPECT_EQ(methods[1].body.size(), file.methods[1].body.size());
+}
+
+TEST(class_writer, optimize_pool_frames) {
+  const cafe::class_tree tree(cafe::load_rt);
+  for (const auto& test_name : {"ForLoopTest", "BranchTest", "FinallyTest"}) {
+    std::ifstream stream(std::string("data/") + test_name + ".class", std::ios::binary);
+    cafe::class_reader reader;
+    const auto file_res = reader.read(stream);
+    ASSERT_TRUE(file_res) << file_res.err().message();
+    const auto& file = file_res.value();
+
+    // The frames computed in the first pass are written in the second, with the constant pool laid out anew.
+    cafe::class_writer plain_writer(tree);
+    cafe::class_writer optimized_writer(tree, cafe::optimize_pool);
+    const auto plain = reader.read(plain_writer.write(file));
+    const auto optimized = reader.read(optimized_writer.write(file));
+    ASSERT_TRUE(plain) << plain.err().message();
+    ASSERT_TRUE(optimized) << optimized.err().message();
+    ASSERT_EQ(plain.value().methods.size(), optimized.value().methods.size());
+    for (size_t i = 0; i < plain.value().methods.size(); i++) {
+      const auto& expected = plain.value().methods[i].body;
+      const auto& actual = optimized.value().methods[i].body;
+      EXPECT_EQ(actual.max_stack, expected.max_stack) << test_name;
+      EXPECT_EQ(actual.max_locals, expected.max_locals) << test_name;
+      EXPECT_EQ(actual.frames.size(), expected.frames.size()) << test_name;
+    }
+  }
+}
+
+TEST(class_writer, reuse_frames) {
+  const cafe::class_tree tree(cafe::load_rt);
+  std::ifstream stream("data/ParameterFrameTest.class", std::ios::binary);
+  cafe::class_reader reader;
+  auto file_res = reader.read(stream);
+  ASSERT_TRUE(file_res) << file_res.err().message();
+  auto& file = file_res.value();
+  const auto frames_of = [](const cafe::code& body) {
+    std::vector<std::string> frames;
+    for (const auto& [lbl, f] : body.frames) {
+      frames.emplace_back(cafe::to_string(f));
+    }
+    return frames;
+  };
+  std::vector<std::vector<std::string>> original;
+  for (const auto& method : file.methods) {
+    original.emplace_back(frames_of(method.body));
+  }
+
+  // An int pushed at the start of a method without try-catch blocks stays on the stack at every frame, so its frames no
+  // longer hold.
+  const auto edited = std::find_if(file.methods.begin(), file.methods.end(), [](const cafe::method& method) {
+    return !method.body.frames.empty() && method.body.tcbs.empty();
+  });
+  ASSERT_NE(edited, file.methods.end());
+  const auto edited_index = static_cast<size_t>(std::distance(file.methods.begin(), edited));
+  edited->body.insert(edited->body.begin(), cafe::insn(cafe::op::iconst_0));
+
+  cafe::class_writer computing_writer(tree);
+  cafe::class_writer reusing_writer(tree, cafe::compute_frames | cafe::reuse_frames);
+  const auto computed = reader.read(computing_writer.write(file));
+  const auto reused = reader.read(reusing_writer.write(file));
+  ASSERT_TRUE(computed) << computed.err().message();
+  ASSERT_TRUE(reused) << reused.err().message();
+  ASSERT_EQ(reused.value().methods.size(), file.methods.size());
+  auto untouched = 0;
+  for (size_t i = 0; i < file.methods.size(); i++) {
+    const auto& method = reused.value().methods[i];
+    if (i == edited_index) {
+      const auto frames = frames_of(method.body);
+      EXPECT_NE(frames, original[i]) << method.name_desc();
+      EXPECT_EQ(frames, frames_of(computed.value().methods[i].body)) << method.name_desc();
+      EXPECT_EQ(method.body.max_stack, computed.value().methods[i].body.max_stack) << method.name_desc();
+    } else {
+      EXPECT_EQ(frames_of(method.body), original[i]) << method.name_desc();
+      untouched += original[i].empty() ? 0 : 1;
+    }
+  }
+  EXPECT_GT(untouched, 0);
+}
+
+TEST(class_writer, sinks) {
+  std::ifstream stream("data/HelloWorld.class", std::ios::binary);
+  cafe::class_reader reader;
+  const auto file_res = reader.read(stream);
+  ASSERT_TRUE(file_res) << file_res.err().message();
+  const auto& file = file_res.value();
+
+  cafe::class_writer writer(cafe::compute_maxes);
+  const auto expected = writer.write(file);
+
+  std::vector<int8_t> buffer(4096, 1);
+  writer.write(file, buffer);
+  EXPECT_EQ(buffer, expected);
+  writer.write(file, buffer);
+  EXPECT_EQ(buffer, expected);
+
+  std::ostringstream os;
+  ASSERT_TRUE(writer.write(file, os));
+  const auto str = os.str();
+  EXPECT_EQ(std::vector<int8_t>(str.begin(), str.end()), expected);
+
+#ifndef _WIN32
+  const auto tmp = std::tmpfile();
+  ASSERT_NE(tmp, nullptr);
+  ASSERT_TRUE(writer.write(file, fileno(tmp)));
+  std::rewind(tmp);
+  std::vector<int8_t> read_back(expected.size() + 1);
+  EXPECT_EQ(std::fread(read_back.data(), 1, read_back.size(), tmp), expected.size());
+  read_back.resize(expected.size());
+  EXPECT_EQ(read_back, expected);
+  std::fclose(tmp);
+#endif
+}
+
+TEST(class_writer, attribute_lengths) {
+  cafe::class_file file("test/Attributes", "java/lang/Object");
+  file.module_packages = {"test/a", "test/b", "test/c"};
+  cafe::annotation anno("Ltest/Anno;");
+  anno.values.emplace_back("value", cafe::element_value{std::string("text")});
+  file.visible_annotations.emplace_back(anno);
+  file.attributes.emplace_back("Custom", std::vector<int8_t>(70000, 7));
+  cafe::code body;
+  body.add_insn(cafe::op::return_);
+  file.methods.emplace_back(cafe::access_flag::acc_static, "run", "()V", std::move(body));
+  file.methods.back().visible_annotations.emplace_back(anno);
+
+  cafe::class_writer writer(cafe::compute_maxes);
+  const auto data = writer.write(file);
+  cafe::class_reader reader;
+  const auto res = reader.read(data);
+  ASSERT_TRUE(res) << res.err().message();
+  const auto& read = res.value();
+  EXPECT_EQ(read.module_packages, file.module_packages);
+  ASSERT_EQ(read.visible_annotations.size(), 1);
+  EXPECT_EQ(read.visible_annotations[0].to_string(), anno.to_string());
+  ASSERT_EQ(read.attributes.size(), 1);
+  EXPECT_EQ(read.attributes[0].data, file.attributes[0].data);
+  ASSERT_EQ(read.methods.size(), 1);
+  EXPECT_EQ(read.methods[0].visible_annotations.size(), 1);
+  EXPECT_EQ(read.methods[0].body.size(), 1);
+}
+
+TEST(class_writer, widened_goto) {
+  cafe::code code;
+  cafe::label far;
+  code.add_branch_insn(cafe::op::goto_, far);
+  code.add_push_insn(cafe::value{int32_t(0)});
+  code.add_insn(cafe::op::ireturn);
+  for (auto i = 0; i < 40000; i++) {
+    code.add_insn(cafe::op::nop);
+  }
+  code.add_label(far);
+  code.add_push_insn(cafe::value{int32_t(1)});
+  code.add_insn(cafe::op::ireturn);
+  cafe::class_file file("test/Widened", "java/lang/Object");
+  file.methods.emplace_back(cafe::access_flag::acc_static, "f", "()I", std::move(code));
+
+  cafe::class_writer writer(cafe::compute_maxes);
+  const auto data = writer.write(file);
+  cafe::class_reader reader;
+  const auto res = reader.read(data);
+  ASSERT_TRUE(res) << res.err().message();
+  const auto& body = res.value().methods[0].body;
+  auto it = body.begin();
+  ASSERT_TRUE(std::holds_alternative<cafe::branch_insn>(*it));
+  const auto& jump = std::get<cafe::branch_insn>(*it);
+  EXPECT_EQ(jump.opcode, cafe::op::goto_w);
+  // The instruction after the goto is left intact by the wider offset.
+  ++it;
+  ASSERT_TRUE(std::holds_alternative<cafe::push_insn>(*it));
+  EXPECT_EQ(std::get<cafe::push_insn>(*it).operand, cafe::value{int32_t(0)});
+  auto target = std::find(body.begin(), body.end(), cafe::instruction(jump.target));
+  ASSERT_NE(target, body.end());
+  ++target;
+  ASSERT_TRUE(std::holds_alternative<cafe::push_insn>(*target));
+  EXPECT_EQ(std::get<cafe::push_insn>(*target).operand, cafe::value{int32_t(1)});
+}
@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+
+#include <cafe/data_writer.hpp>
+
+TEST(data_writer, write_u16s) {
+  cafe::data_writer writer;
+  writer.write_u8(0xAA);
+  const uint16_t values[] = {0x0102, 0xFFFE, 0x0000, 0x8000};
+  writer.write_u16s(values, 4);
+  writer.write_u16s(values, 0);
+  const std::vector<int8_t> expected{static_cast<int8_t>(0xAA), 0x01, 0x02, static_cast<int8_t>(0xFF),
+                                     static_cast<int8_t>(0xFE), 0x00, 0x00, static_cast<int8_t>(0x80), 0x00};
+  EXPECT_EQ(writer.data(), expected);
+}
+
+TEST(data_writer, patch) {
+  cafe::data_writer writer;
+  writer.write_u8(1);
+  const auto count = writer.reserve_u16();
+  const auto value = writer.reserve_u32();
+  EXPECT_EQ(count, 1);
+  EXPECT_EQ(value, 3);
+  EXPECT_EQ(writer.size(), 7);
+  writer.patch_u16(count, 0xBEEF);
+  writer.patch_u32(value, 0x12345678);
+  const std::vector<int8_t> expected{1, static_cast<int8_t>(0xBE), static_cast<int8_t>(0xEF), 0x12, 0x34, 0x56, 0x78};
+  EXPECT_EQ(writer.data(), expected);
+}
+
+TEST(data_writer, patch_length) {
+  std::vector<int8_t> buffer;
+  cafe::databuf buf(buffer);
+  const auto outer = buf.reserve_u32();
+  buf.write_u16(7);
+  const auto inner = buf.reserve_u32();
+  EXPECT_EQ(inner, 6);
+  for (auto i = 0; i < 300; i++) {
+    buf.write_u8(static_cast<uint8_t>(i));
+  }
+  buf.patch_length(inner);
+  buf.patch_length(outer);
+  ASSERT_EQ(buffer.size(), 310);
+  // The outer length covers the u16, the inner slot and the 300 bytes after it.
+  const std::vector<int8_t> outer_bytes{0x00, 0x00, 0x01, 0x32};
+  const std::vector<int8_t> inner_bytes{0x00, 0x00, 0x01, 0x2C};
+  EXPECT_EQ(std::vector<int8_t>(buffer.begin(), buffer.begin() + 4), outer_bytes);
+  EXPECT_EQ(std::vector<int8_t>(buffer.begin() + 6, buffer.begin() + 10), inner_bytes);
+}
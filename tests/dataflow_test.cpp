@@ -0,0 +1,199 @@
+#include <gtest/gtest.h>
+#include <hippo/cafe.hpp>
+
+#include "block_util.hpp"
+
+static cafe::bit_vector bits(size_t size, const std::vector<size_t>& set) {
+  cafe::bit_vector result(size);
+  for (const auto index : set) {
+    result.set(index);
+  }
+  return result;
+}
+
+TEST(dataflow, bit_vector) {
+  cafe::bit_vector first(70);
+  first.set(3);
+  first.set(69);
+  EXPECT_TRUE(first.test(69));
+  EXPECT_FALSE(first.test(4));
+  EXPECT_EQ(first.count(), 2);
+
+  auto second = bits(70, {3, 64});
+  EXPECT_TRUE(second.union_with(first));
+  EXPECT_FALSE(second.union_with(first));
+  EXPECT_EQ(second, bits(70, {3, 64, 69}));
+  EXPECT_TRUE(second.intersect_with(bits(70, {64, 69})));
+  second.subtract(bits(70, {69}));
+  EXPECT_EQ(second.to_string(), "bit_vector(64)");
+
+  cafe::bit_vector all(70);
+  all.set_all();
+  EXPECT_EQ(all.count(), 70);
+  std::vector<size_t> seen;
+  first.for_each([&](size_t index) {
+    seen.emplace_back(index);
+  });
+  EXPECT_EQ(seen, (std::vector<size_t>{3, 69}));
+}
+
+TEST(dataflow, branches) {
+  cafe::code code;
+  cafe::label other;
+  cafe::label join;
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_branch_insn(cafe::op::ifeq, other);
+  code.add_push_insn(cafe::value{int32_t(1)});
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_push_insn(cafe::value{int32_t(2)});
+  code.add_var_insn(cafe::op::istore, 2);
+  code.add_branch_insn(cafe::op::goto_, join);
+  code.add_label(other);
+  code.add_push_insn(cafe::value{int32_t(3)});
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_label(join);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_insn(cafe::op::ireturn);
+
+  cafe::basic_block_graph graph(code);
+  const cafe::block_order order(graph);
+  ASSERT_EQ(order.size(), 4);
+  ASSERT_EQ(order.reachable(), 4);
+  const auto other_id = block_at(order, other);
+  const auto join_id = block_at(order, join);
+  ASSERT_LT(other_id, order.size());
+  ASSERT_LT(join_id, order.size());
+  // Reverse postorder puts the join after both of its predecessors.
+  EXPECT_EQ(join_id, 3);
+
+  const auto live = cafe::solve_dataflow(order, cafe::liveness(3));
+  EXPECT_EQ(live.in(0), bits(3, {0}));
+  EXPECT_EQ(live.out(0), bits(3, {}));
+  EXPECT_EQ(live.in(join_id), bits(3, {1}));
+  EXPECT_EQ(live.in(other_id), bits(3, {}));
+
+  const cafe::reaching_definitions defs(code, 1);
+  ASSERT_EQ(defs.size(), 4);
+  const auto reaching = cafe::solve_dataflow(order, defs);
+  EXPECT_EQ(reaching.in(0), bits(4, {0}));
+  EXPECT_EQ(reaching.in(join_id), bits(4, {0, 1, 2, 3}));
+  EXPECT_EQ(reaching.out(other_id), bits(4, {0, 3}));
+  EXPECT_EQ(defs.definitions_of(1), bits(4, {1, 3}));
+}
+
+TEST(dataflow, loop) {
+  cafe::code code;
+  cafe::label head;
+  cafe::label exit;
+  code.add_push_insn(cafe::value{int32_t(0)});
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_label(head);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_branch_insn(cafe::op::if_icmpge, exit);
+  code.add_iinc_insn(1, 1);
+  code.add_branch_insn(cafe::op::goto_, head);
+  code.add_label(exit);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_insn(cafe::op::ireturn);
+
+  cafe::basic_block_graph graph(code);
+  const cafe::block_order order(graph);
+  const auto head_id = block_at(order, head);
+  const auto exit_id = block_at(order, exit);
+
+  const auto live = cafe::solve_dataflow(order, cafe::liveness(2));
+  EXPECT_EQ(live.in(0), bits(2, {0}));
+  EXPECT_EQ(live.in(head_id), bits(2, {0, 1}));
+  EXPECT_EQ(live.in(exit_id), bits(2, {1}));
+
+  const cafe::reaching_definitions defs(code, 1);
+  const auto reaching = cafe::solve_dataflow(order, defs);
+  const auto iinc = defs.definition_of(*std::next(code.begin(), 6));
+  ASSERT_TRUE(iinc);
+  EXPECT_EQ(reaching.in(head_id), bits(3, {0, 1, *iinc}));
+  EXPECT_EQ(reaching.in(exit_id), bits(3, {0, 1, *iinc}));
+}
+
+TEST(dataflow, short_forms) {
+  cafe::code code;
+  code.add_push_insn(cafe::value{int32_t(1)});
+  code.add_insn(cafe::op::istore_1);
+  code.add_insn(cafe::op::iload_1);
+  code.add_insn(cafe::op::iload_0);
+  code.add_insn(cafe::op::iadd);
+  code.add_insn(cafe::op::i2l);
+  code.add_insn(cafe::op::lstore_2);
+  code.add_var_insn(cafe::op::lload, 2);
+  code.add_insn(cafe::op::lreturn);
+
+  cafe::basic_block_graph graph(code);
+  const cafe::block_order order(graph);
+  const auto live = cafe::solve_dataflow(order, cafe::liveness(4));
+  EXPECT_EQ(live.in(0), bits(4, {0}));
+
+  const cafe::reaching_definitions defs(code, 1);
+  ASSERT_EQ(defs.size(), 3);
+  EXPECT_EQ(defs.definition_of(*std::next(code.begin(), 1)), 1);
+  EXPECT_EQ(defs.definition_of(*std::next(code.begin(), 6)), 2);
+  EXPECT_EQ(defs.definitions_of(3), bits(3, {2}));
+}
+
+TEST(dataflow, handlers) {
+  cafe::code code;
+  cafe::label start;
+  cafe::label end;
+  cafe::label handler;
+  cafe::label after;
+  code.add_push_insn(cafe::value{int32_t(0)});
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_label(start);
+  code.add_push_insn(cafe::value{int32_t(1)});
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_push_insn(cafe::value{int32_t(2)});
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_label(end);
+  code.add_branch_insn(cafe::op::goto_, after);
+  code.add_label(handler);
+  code.add_var_insn(cafe::op::astore, 2);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_insn(cafe::op::ireturn);
+  code.add_label(after);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_insn(cafe::op::ireturn);
+  code.tcbs.emplace_back(start, end, handler, "java/lang/Exception");
+
+  cafe::basic_block_graph graph(code);
+  const cafe::block_order order(graph);
+  const auto start_id = block_at(order, start);
+  const auto handler_id = block_at(order, handler);
+  const auto after_id = block_at(order, after);
+  ASSERT_LT(handler_id, order.reachable());
+
+  // The handler can be entered before the protected block writes local 1, so the first value stays live.
+  const auto live = cafe::solve_dataflow(order, cafe::liveness(3));
+  EXPECT_EQ(live.in(handler_id), bits(3, {1}));
+  EXPECT_EQ(live.in(start_id), bits(3, {1}));
+  EXPECT_EQ(live.out(0), bits(3, {1}));
+
+  const cafe::reaching_definitions defs(code, 0);
+  const auto reaching = cafe::solve_dataflow(order, defs);
+  EXPECT_EQ(reaching.in(handler_id), bits(4, {0, 1, 2}));
+  EXPECT_EQ(reaching.in(after_id), bits(4, {2}));
+}
+
+TEST(dataflow, class_files) {
+  const auto names = {"ForLoopTest", "FinallyTest", "SwitchTest", "CalculationTest"};
+  for_each_method(names, [](const char* name, const cafe::class_file&, const cafe::method& method) {
+    const auto start_locals = cafe::basic_block_graph::get_start_locals(method);
+    cafe::basic_block_graph graph(method.body);
+    const cafe::block_order order(graph);
+    // Only parameters can be read before they are written.
+    const auto live = cafe::solve_dataflow(order, cafe::liveness(method.body.max_locals));
+    live.in(0).for_each([&](size_t index) {
+      EXPECT_LT(index, start_locals) << name << " " << method.name_desc();
+    });
+    // Every read of a local in reachable code sees a definition of it.
+    EXPECT_TRUE(reads_defined(method)) << name << " " << method.name_desc();
+  });
+}
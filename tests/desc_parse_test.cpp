@@ -29,3 +29,27 @@ TEST(desc, parse) {
   cafe::class_tree tree;
   tree.put("my/ThisClass", "my/SuperClass", {"my/Interface1", "my/Interface2"});
 }
+
+TEST(desc, descriptor) {
+  const auto method = cafe::descriptor::get("(Ljava/lang/String;IJS[[D)Ljava/lang/Object;");
+  ASSERT_EQ(method->parameter_types.size(), 5);
+  EXPECT_EQ(method->parameter_types[0].internal(), "java/lang/String");
+  EXPECT_EQ(method->parameter_types[2].kind(), cafe::type_kind::long_);
+  EXPECT_EQ(method->parameter_types[3].kind(), cafe::type_kind::short_);
+  EXPECT_EQ(method->parameter_types[4].get(), "[[D");
+  EXPECT_EQ(method->parameter_size, 6);
+  EXPECT_EQ(method->return_type.internal(), "java/lang/Object");
+  EXPECT_EQ(cafe::descriptor::get("(Ljava/lang/String;IJS[[D)Ljava/lang/Object;"), method);
+
+  const auto field = cafe::descriptor::get("D");
+  EXPECT_TRUE(field->parameter_types.empty());
+  EXPECT_EQ(field->parameter_size, 0);
+  EXPECT_EQ(field->return_type.size(), 2);
+
+  // A descriptor that is held outlives the cache clearing itself.
+  for (auto i = 0; i < 5000; i++) {
+    cafe::descriptor::get("(I)L" + std::to_string(i) + ";");
+  }
+  EXPECT_EQ(method->parameter_size, 6);
+  EXPECT_EQ(method->return_type.internal(), "java/lang/Object");
+}
@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+#include <hippo/cafe.hpp>
+
+#include "block_util.hpp"
+
+TEST(dominance, diamond) {
+  cafe::code code;
+  cafe::label other;
+  cafe::label join;
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_branch_insn(cafe::op::ifeq, other);
+  code.add_push_insn(cafe::value{int32_t(1)});
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_branch_insn(cafe::op::goto_, join);
+  code.add_label(other);
+  code.add_push_insn(cafe::value{int32_t(2)});
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_label(join);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_insn(cafe::op::ireturn);
+
+  cafe::basic_block_graph graph(code);
+  const cafe::block_order order(graph);
+  ASSERT_EQ(order.reachable(), 4);
+  const auto other_id = block_at(order, other);
+  const auto join_id = block_at(order, join);
+  // The ids are 0 to 3, so the remaining one is the fall through arm.
+  const auto then_id = 6 - other_id - join_id;
+  ASSERT_LT(then_id, order.size());
+
+  const cafe::dominator_tree dominators(order);
+  EXPECT_EQ(dominators.idom(0), cafe::dominator_tree::none);
+  EXPECT_EQ(dominators.idom(then_id), 0);
+  EXPECT_EQ(dominators.idom(other_id), 0);
+  EXPECT_EQ(dominators.idom(join_id), 0);
+  EXPECT_EQ(dominators.children(0).size(), 3);
+  EXPECT_TRUE(dominators.dominates(0, join_id));
+  EXPECT_TRUE(dominators.dominates(join_id, join_id));
+  EXPECT_FALSE(dominators.dominates(then_id, join_id));
+  EXPECT_FALSE(dominators.dominates(join_id, 0));
+  // Both arms write local 1, and the join is where their values meet.
+  EXPECT_EQ(dominators.frontier(then_id), std::vector<size_t>{join_id});
+  EXPECT_EQ(dominators.frontier(other_id), std::vector<size_t>{join_id});
+  EXPECT_TRUE(dominators.frontier(0).empty());
+  EXPECT_TRUE(dominators.frontier(join_id).empty());
+
+  const cafe::loop_forest loops(order, dominators);
+  EXPECT_TRUE(loops.loops().empty());
+  EXPECT_EQ(loops.depth(join_id), 0);
+}
+
+TEST(dominance, nested_loops) {
+  cafe::code code;
+  cafe::label outer;
+  cafe::label inner;
+  cafe::label inner_exit;
+  cafe::label exit;
+  cafe::label dead;
+  code.add_push_insn(cafe::value{int32_t(0)});
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_label(outer);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_branch_insn(cafe::op::ifge, exit);
+  code.add_label(inner);
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_branch_insn(cafe::op::ifeq, inner_exit);
+  code.add_iinc_insn(0, -1);
+  code.add_branch_insn(cafe::op::goto_, inner);
+  code.add_label(inner_exit);
+  code.add_iinc_insn(1, 1);
+  code.add_branch_insn(cafe::op::goto_, outer);
+  code.add_label(dead);
+  code.add_branch_insn(cafe::op::goto_, inner);
+  code.add_label(exit);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_insn(cafe::op::ireturn);
+
+  cafe::basic_block_graph graph(code);
+  const cafe::block_order order(graph);
+  const auto outer_id = block_at(order, outer);
+  const auto inner_id = block_at(order, inner);
+  const auto inner_exit_id = block_at(order, inner_exit);
+  const auto exit_id = block_at(order, exit);
+  const auto dead_id = block_at(order, dead);
+  ASSERT_GE(dead_id, order.reachable());
+  ASSERT_LT(dead_id, order.size());
+
+  const cafe::dominator_tree dominators(order);
+  EXPECT_EQ(dominators.idom(outer_id), 0);
+  EXPECT_EQ(dominators.idom(inner_id), outer_id);
+  EXPECT_EQ(dominators.idom(inner_exit_id), inner_id);
+  EXPECT_EQ(dominators.idom(exit_id), outer_id);
+  EXPECT_EQ(dominators.idom(dead_id), cafe::dominator_tree::none);
+  EXPECT_FALSE(dominators.dominates(0, dead_id));
+  EXPECT_FALSE(dominators.dominates(dead_id, dead_id));
+  // A loop header is in the frontier of the blocks of its loop.
+  EXPECT_EQ(dominators.frontier(outer_id), std::vector<size_t>{outer_id});
+  EXPECT_EQ(dominators.frontier(inner_exit_id), std::vector<size_t>{outer_id});
+
+  const cafe::loop_forest loops(order, dominators);
+  ASSERT_EQ(loops.loops().size(), 2);
+  const auto& outer_loop = loops.loops()[0];
+  const auto& inner_loop = loops.loops()[1];
+  EXPECT_EQ(outer_loop.header, outer_id);
+  EXPECT_EQ(outer_loop.parent, cafe::loop_forest::none);
+  EXPECT_EQ(outer_loop.depth, 1);
+  EXPECT_EQ(outer_loop.blocks.size(), 4);
+  EXPECT_EQ(outer_loop.latches, std::vector<size_t>{inner_exit_id});
+  EXPECT_EQ(inner_loop.header, inner_id);
+  EXPECT_EQ(inner_loop.parent, 0);
+  EXPECT_EQ(inner_loop.depth, 2);
+  EXPECT_EQ(inner_loop.blocks.size(), 2);
+  EXPECT_EQ(loops.loop_of(inner_exit_id), 0);
+  EXPECT_EQ(loops.loop_of(inner_id), 1);
+  EXPECT_EQ(loops.depth(inner_id), 2);
+  EXPECT_EQ(loops.depth(exit_id), 0);
+  EXPECT_EQ(loops.loop_of(dead_id), cafe::loop_forest::none);
+}
+
+TEST(dominance, entry_loop) {
+  cafe::code code;
+  cafe::label head;
+  code.add_label(head);
+  code.add_iinc_insn(0, 1);
+  code.add_branch_insn(cafe::op::goto_, head);
+
+  cafe::basic_block_graph graph(code);
+  const cafe::block_order order(graph);
+  ASSERT_EQ(order.reachable(), 1);
+
+  // The back edge meets the edge into the method at the entry block.
+  const cafe::dominator_tree dominators(order);
+  EXPECT_EQ(dominators.frontier(0), std::vector<size_t>{0});
+
+  const cafe::loop_forest loops(order, dominators);
+  ASSERT_EQ(loops.loops().size(), 1);
+  EXPECT_EQ(loops.loops()[0].header, 0);
+  EXPECT_EQ(loops.loops()[0].latches, std::vector<size_t>{0});
+}
+
+TEST(dominance, class_files) {
+  const auto names = {"ForLoopTest", "ForLoopTestLong", "FinallyTest", "SwitchTest", "CalculationTest"};
+  for_each_method(names, [](const char* name, const cafe::class_file&, const cafe::method& method) {
+    cafe::basic_block_graph graph(method.body);
+    const cafe::block_order order(graph);
+    const cafe::dominator_tree dominators(order);
+    const cafe::loop_forest loops(order, dominators);
+    for (size_t id = 1; id < order.reachable(); id++) {
+      // Every predecessor of a block is dominated by its immediate dominator.
+      const auto idom = dominators.idom(id);
+      ASSERT_LT(idom, id) << name << " " << method.name_desc();
+      EXPECT_TRUE(dominators.dominates(idom, id));
+      for (const auto& pred : order.predecessors(id)) {
+        if (pred.block < order.reachable()) {
+          EXPECT_TRUE(dominators.dominates(idom, pred.block)) << name << " " << method.name_desc();
+        }
+      }
+    }
+    for (const auto& loop : loops.loops()) {
+      for (const auto block : loop.blocks) {
+        EXPECT_TRUE(dominators.dominates(loop.header, block)) << name << " " << method.name_desc();
+      }
+    }
+  });
+}
@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+#include <hippo/cafe.hpp>
+
+#include "block_util.hpp"
+
+static size_t count_insns(const cafe::code& code) {
+  size_t count = 0;
+  for (const auto& in : code) {
+    if (!std::holds_alternative<cafe::label>(in)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+TEST(ssa, straight_line) {
+  cafe::code code;
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_var_insn(cafe::op::istore, 2);
+  code.add_var_insn(cafe::op::iload, 2);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_insn(cafe::op::iadd);
+  code.add_insn(cafe::op::ireturn);
+  code.max_locals = 3;
+  cafe::method method(cafe::access_flag::acc_static, "f", "(II)I", std::move(code));
+
+  const auto ssa_res = cafe::lift_ssa(method);
+  ASSERT_TRUE(ssa_res) << ssa_res.err().message();
+  const auto& ssa = ssa_res.value();
+  ASSERT_EQ(ssa.parameters.size(), 2);
+  ASSERT_EQ(ssa.blocks.size(), 2);
+  // The copy through local 2 is gone, the add reads the parameters directly.
+  const auto& insns = ssa.blocks[1].insns;
+  ASSERT_EQ(insns.size(), 2);
+  EXPECT_EQ(insns[0].operands, (std::vector<cafe::ssa_value>{ssa.parameters[0], ssa.parameters[1]}));
+  EXPECT_EQ(insns[1].operands, std::vector<cafe::ssa_value>{insns[0].result});
+  EXPECT_EQ(ssa.types[insns[0].result], cafe::ssa_type::int_);
+
+  cafe::emit_ssa(ssa, method);
+  EXPECT_EQ(count_insns(method.body), 4);
+  EXPECT_EQ(method.body.max_locals, 2);
+  EXPECT_EQ(method.body.max_stack, 2);
+}
+
+TEST(ssa, loop) {
+  cafe::code code;
+  cafe::label head;
+  cafe::label exit;
+  code.add_push_insn(cafe::value{int32_t(0)});
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_label(head);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_branch_insn(cafe::op::if_icmpge, exit);
+  code.add_iinc_insn(1, 2);
+  code.add_branch_insn(cafe::op::goto_, head);
+  code.add_label(exit);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_insn(cafe::op::ireturn);
+  code.max_locals = 2;
+  cafe::method method(cafe::access_flag::acc_static, "f", "(I)I", std::move(code));
+
+  for (auto round = 0; round < 2; round++) {
+    const auto ssa_res = cafe::lift_ssa(method);
+    ASSERT_TRUE(ssa_res) << ssa_res.err().message();
+    const auto& ssa = ssa_res.value();
+    // Only the counter meets another value of itself, at the loop head.
+    size_t phis = 0;
+    const cafe::ssa_block* header = nullptr;
+    for (const auto& block : ssa.blocks) {
+      phis += block.phis.size();
+      if (!block.phis.empty()) {
+        header = &block;
+      }
+    }
+    ASSERT_EQ(phis, 1);
+    ASSERT_EQ(header->predecessors.size(), 2);
+    const auto counter = header->phis.front().result;
+    bool incremented = false;
+    for (const auto& block : ssa.blocks) {
+      for (const auto& in : block.insns) {
+        const auto plain = std::get_if<cafe::insn>(&in.operation);
+        if (plain != nullptr && plain->opcode == cafe::op::iadd) {
+          EXPECT_EQ(in.operands.front(), counter);
+          EXPECT_NE(std::find(header->phis.front().operands.begin(), header->phis.front().operands.end(), in.result),
+                    header->phis.front().operands.end());
+          incremented = true;
+        }
+      }
+    }
+    EXPECT_TRUE(incremented);
+    cafe::emit_ssa(ssa, method);
+  }
+  EXPECT_EQ(method.body.max_locals, 2);
+}
+
+TEST(ssa, handler) {
+  cafe::code code;
+  cafe::label start;
+  cafe::label end;
+  cafe::label handler;
+  code.add_push_insn(cafe::value{int32_t(1)});
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_label(start);
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_method_insn(cafe::op::invokestatic, "A", "g", "(I)V");
+  code.add_label(end);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_insn(cafe::op::ireturn);
+  code.add_label(handler);
+  code.add_insn(cafe::op::pop);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_insn(cafe::op::ireturn);
+  code.tcbs.emplace_back(start, end, handler, std::nullopt);
+  code.max_locals = 2;
+  cafe::method method(cafe::access_flag::acc_static, "f", "(I)I", std::move(code));
+
+  const auto ssa_res = cafe::lift_ssa(method);
+  ASSERT_TRUE(ssa_res) << ssa_res.err().message();
+  const auto& ssa = ssa_res.value();
+  const cafe::ssa_block* catcher = nullptr;
+  for (const auto& block : ssa.blocks) {
+    if (block.exception != cafe::ssa_insn::none) {
+      catcher = &block;
+    }
+  }
+  ASSERT_NE(catcher, nullptr);
+  // The store ends the first protected block, so the handler sees local 1 either before or after it.
+  ASSERT_EQ(catcher->predecessors.size(), 2);
+  for (const auto& edge : catcher->predecessors) {
+    EXPECT_TRUE(edge.handler);
+    EXPECT_EQ(ssa.blocks[edge.block].handlers.size(), 1);
+  }
+  ASSERT_EQ(catcher->phis.size(), 1);
+  const auto& operands = catcher->phis.front().operands;
+  EXPECT_NE(operands[0], operands[1]);
+  EXPECT_NE(std::find(operands.begin(), operands.end(), ssa.parameters[0]), operands.end());
+
+  cafe::emit_ssa(ssa, method);
+  EXPECT_FALSE(method.body.tcbs.empty());
+  const auto again = cafe::lift_ssa(method);
+  ASSERT_TRUE(again) << again.err().message();
+}
+
+TEST(ssa, class_files) {
+  cafe::class_tree tree(cafe::load_rt);
+  const auto names = {"ForLoopTest", "ForLoopTestLong", "FinallyTest", "FinallyTest2", "SwitchTest",
+                      "CalculationTest", "BranchTest", "TcbTest", "TernaryTest", "JumpInit"};
+  for_each_method(names, [&tree](const char* name, const cafe::class_file& file, cafe::method& method) {
+    const auto ssa_res = cafe::lift_ssa(method);
+    ASSERT_TRUE(ssa_res) << name << " " << method.name_desc() << " " << ssa_res.err().message();
+    cafe::emit_ssa(ssa_res.value(), method);
+    // The locals are renumbered, but every read still has a write to see.
+    EXPECT_TRUE(reads_defined(method)) << name << " " << method.name_desc();
+    const auto again = cafe::lift_ssa(method);
+    ASSERT_TRUE(again) << name << " " << method.name_desc() << " " << again.err().message();
+    EXPECT_GE(again.value().blocks.size(), ssa_res.value().blocks.size()) << name << " " << method.name_desc();
+
+    // A second round trip has nothing left to change.
+    const auto emitted = count_insns(method.body);
+    cafe::emit_ssa(again.value(), method);
+    EXPECT_EQ(count_insns(method.body), emitted) << name << " " << method.name_desc();
+
+    cafe::basic_block_graph graph(method.body);
+    const auto frames =
+        graph.compute_frames(tree, file.name, cafe::basic_block_graph::get_start_locals(file.name, method));
+    EXPECT_EQ(frames.max_stack(), method.body.max_stack) << name << " " << method.name_desc();
+  });
+}
@@ -0,0 +1,556 @@
+#include <algorithm>
+#include <set>
+#include <optional>
+
+#include <gtest/gtest.h>
+#include <hippo/cafe.hpp>
+
+#include "block_util.hpp"
+
+TEST(transform, compact_locals) {
+  cafe::code code;
+  code.add_push_insn(cafe::value{int32_t(1)});
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_insn(cafe::op::pop);
+  code.add_push_insn(cafe::value{int64_t(2)});
+  code.add_var_insn(cafe::op::lstore, 2);
+  code.add_var_insn(cafe::op::lload, 2);
+  code.add_insn(cafe::op::pop2);
+  code.add_push_insn(cafe::value{int32_t(3)});
+  code.add_var_insn(cafe::op::istore, 4);
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_var_insn(cafe::op::iload, 4);
+  code.add_insn(cafe::op::iadd);
+  code.add_insn(cafe::op::ireturn);
+  code.max_locals = 5;
+  cafe::method method(cafe::access_flag::acc_static, "f", "(I)I", std::move(code));
+
+  ASSERT_TRUE(cafe::compact_locals(method));
+  // Every local after the parameter is dead before the next one is written, so they all share slot 1.
+  EXPECT_EQ(method.body.max_locals, 3);
+  for (const auto& in : method.body) {
+    if (const auto var = std::get_if<cafe::var_insn>(&in); var != nullptr && var->opcode != cafe::op::iload) {
+      EXPECT_EQ(var->index, 1) << var->to_string();
+    }
+  }
+  EXPECT_EQ(std::get<cafe::var_insn>(*std::next(method.body.begin(), 10)).index, 0);
+  EXPECT_EQ(std::get<cafe::var_insn>(*std::next(method.body.begin(), 11)).index, 1);
+}
+
+TEST(transform, compact_locals_short_forms) {
+  cafe::code code;
+  code.add_push_insn(cafe::value{int32_t(1)});
+  code.add_var_insn(cafe::op::istore, 2);
+  code.add_push_insn(cafe::value{int32_t(2)});
+  code.add_insn(cafe::op::istore_1);
+  code.add_var_insn(cafe::op::iload, 2);
+  code.add_insn(cafe::op::iload_1);
+  code.add_insn(cafe::op::iadd);
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_insn(cafe::op::iadd);
+  code.add_insn(cafe::op::ireturn);
+  code.max_locals = 3;
+  cafe::method method(cafe::access_flag::acc_static, "f", "(I)I", std::move(code));
+
+  // Both locals are live at the same time, so the short form store keeps them apart.
+  ASSERT_TRUE(cafe::compact_locals(method));
+  EXPECT_EQ(method.body.max_locals, 3);
+  const auto& first = std::get<cafe::var_insn>(*std::next(method.body.begin(), 1));
+  const auto& second = std::get<cafe::var_insn>(*std::next(method.body.begin(), 3));
+  EXPECT_EQ(second.opcode, cafe::op::istore);
+  EXPECT_NE(first.index, second.index);
+  EXPECT_EQ(std::get<cafe::var_insn>(*std::next(method.body.begin(), 4)).index, first.index);
+  EXPECT_EQ(std::get<cafe::var_insn>(*std::next(method.body.begin(), 5)).index, second.index);
+}
+
+TEST(transform, compact_locals_debug_ranges) {
+  cafe::code code;
+  cafe::label start;
+  cafe::label end;
+  code.add_label(start);
+  code.add_push_insn(cafe::value{int32_t(1)});
+  code.add_var_insn(cafe::op::istore, 0);
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_insn(cafe::op::pop);
+  code.add_push_insn(cafe::value{int32_t(2)});
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_insn(cafe::op::ireturn);
+  code.add_label(end);
+  code.locals.emplace_back("a", "I", "", start, end, 0);
+  code.locals.emplace_back("b", "I", "", start, end, 1);
+  cafe::method method(cafe::access_flag::acc_static, "f", "()I", std::move(code));
+
+  // Both variables are in scope over the whole method, so they keep apart even though their values never overlap.
+  ASSERT_TRUE(cafe::compact_locals(method));
+  EXPECT_EQ(method.body.max_locals, 2);
+  EXPECT_EQ(method.body.locals[0].index, 0);
+  EXPECT_EQ(method.body.locals[1].index, 1);
+
+  method.body.locals.clear();
+  ASSERT_TRUE(cafe::compact_locals(method));
+  EXPECT_EQ(method.body.max_locals, 1);
+}
+
+TEST(transform, compact_locals_unreachable) {
+  cafe::code code;
+  cafe::label dead;
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_var_insn(cafe::op::istore, 2);
+  code.add_var_insn(cafe::op::iload, 2);
+  code.add_insn(cafe::op::ireturn);
+  code.add_label(dead);
+  code.add_push_insn(cafe::value{std::string("dead")});
+  code.add_var_insn(cafe::op::astore, 1);
+  code.add_var_insn(cafe::op::aload, 1);
+  code.add_insn(cafe::op::areturn);
+  code.max_locals = 3;
+  cafe::method method(cafe::access_flag::acc_static, "f", "(I)I", std::move(code));
+
+  // The dead code keeps slot 1 to itself, and the live local still moves down onto the parameter.
+  ASSERT_TRUE(cafe::compact_locals(method));
+  std::vector<uint16_t> indices;
+  for (const auto& in : method.body) {
+    if (const auto var = std::get_if<cafe::var_insn>(&in)) {
+      indices.emplace_back(var->index);
+    }
+  }
+  EXPECT_EQ(indices, (std::vector<uint16_t>{0, 0, 0, 1, 1}));
+  EXPECT_EQ(method.body.max_locals, 2);
+}
+
+TEST(transform, compact_locals_class_files) {
+  size_t before = 0;
+  size_t after = 0;
+  const auto names = {"ForLoopTest", "ForLoopTestLong", "FinallyTest", "FinallyTest2", "SwitchTest",
+                      "CalculationTest", "BranchTest"};
+  for_each_method(names, [&](const char* name, const cafe::class_file&, cafe::method& method) {
+    const auto original = reads_of(method);
+    const auto max_locals = method.body.max_locals;
+    if (!cafe::compact_locals(method)) {
+      return;
+    }
+    // The same writes still reach every read.
+    EXPECT_EQ(reads_of(method), original) << name << " " << method.name_desc();
+    EXPECT_LE(method.body.max_locals, max_locals) << name << " " << method.name_desc();
+    before += max_locals;
+    after += method.body.max_locals;
+  });
+  EXPECT_LT(after, before);
+}
+
+TEST(transform, peephole) {
+  cafe::code code;
+  cafe::label skip;
+  cafe::label next;
+  cafe::label end;
+  // The counter is bumped through the stack, then read once right after it is stored.
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_push_insn(cafe::value{int32_t(3)});
+  code.add_insn(cafe::op::iadd);
+  code.add_var_insn(cafe::op::istore, 0);
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_type_insn(cafe::op::checkcast, "java/lang/Object");
+  code.add_insn(cafe::op::pop);
+  code.add_push_insn(cafe::value{int32_t(0)});
+  code.add_branch_insn(cafe::op::ifne, skip);
+  code.add_push_insn(cafe::value{std::string("x")});
+  code.add_type_insn(cafe::op::checkcast, "java/lang/String");
+  code.add_type_insn(cafe::op::checkcast, "java/lang/String");
+  code.add_var_insn(cafe::op::astore, 2);
+  code.add_label(skip);
+  code.add_branch_insn(cafe::op::goto_, next);
+  code.add_push_insn(cafe::value{int32_t(4)});
+  code.add_label(next);
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_insn(cafe::op::ireturn);
+  code.add_label(end);
+  code.max_locals = 3;
+  cafe::method method(cafe::access_flag::acc_static, "f", "(I)I", std::move(code));
+
+  ASSERT_TRUE(cafe::peephole(method));
+  // The cast of the constant can still fail, so only its repetition goes and the dead store becomes a pop.
+  std::vector<cafe::instruction> expected{cafe::iinc_insn(0, 3),
+                                          cafe::push_insn(cafe::value{std::string("x")}),
+                                          cafe::type_insn(cafe::op::checkcast, "java/lang/String"),
+                                          cafe::insn(cafe::op::pop),
+                                          cafe::var_insn(cafe::op::iload, 0),
+                                          cafe::insn(cafe::op::ireturn)};
+  std::vector<cafe::instruction> actual;
+  for (const auto& in : method.body) {
+    if (!std::holds_alternative<cafe::label>(in)) {
+      actual.emplace_back(in);
+    }
+  }
+  EXPECT_EQ(actual, expected) << method.body.to_string();
+  EXPECT_FALSE(cafe::peephole(method));
+
+  // Only some of the rules.
+  cafe::code casts;
+  casts.add_insn(cafe::op::aconst_null);
+  casts.add_type_insn(cafe::op::checkcast, "A");
+  casts.add_insn(cafe::op::pop);
+  casts.add_insn(cafe::op::return_);
+  cafe::method cast_method(cafe::access_flag::acc_static, "g", "()V", std::move(casts));
+  ASSERT_TRUE(cafe::peephole(cast_method, cafe::peephole_casts));
+  EXPECT_EQ(cast_method.body.size(), 3);
+  ASSERT_TRUE(cafe::peephole(cast_method, cafe::peephole_stack));
+  EXPECT_EQ(cast_method.body.size(), 1);
+}
+
+TEST(transform, peephole_protected) {
+  cafe::code code;
+  cafe::label start;
+  cafe::label end;
+  cafe::label handler;
+  cafe::label line;
+  code.add_push_insn(cafe::value{int32_t(1)});
+  code.add_var_insn(cafe::op::istore, 0);
+  code.add_label(start);
+  code.add_push_insn(cafe::value{int32_t(2)});
+  code.add_label(line);
+  code.add_insn(cafe::op::pop);
+  code.add_push_insn(cafe::value{int32_t(2)});
+  code.add_var_insn(cafe::op::istore, 0);
+  code.add_label(end);
+  code.add_insn(cafe::op::return_);
+  code.add_label(handler);
+  code.add_insn(cafe::op::pop);
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_insn(cafe::op::ireturn);
+  code.tcbs.emplace_back(start, end, handler, std::nullopt);
+  code.line_numbers.emplace_back(7, line);
+  code.max_locals = 1;
+  cafe::method method(cafe::access_flag::acc_static, "f", "()I", std::move(code));
+
+  // The handler reads local 0, so both stores stay, but the pair across the line number goes. The range keeps an
+  // instruction and the try-catch block with it.
+  ASSERT_TRUE(cafe::peephole(method));
+  EXPECT_EQ(method.body.size(), 12);
+  ASSERT_EQ(method.body.tcbs.size(), 1);
+
+  // Without the handler reading it, the second store is dead and the range ends up empty.
+  auto& handler_read = *std::prev(method.body.end(), 2);
+  handler_read = cafe::push_insn(cafe::value{int32_t(0)});
+  ASSERT_TRUE(cafe::peephole(method));
+  EXPECT_TRUE(method.body.tcbs.empty());
+  EXPECT_EQ(method.body.line_numbers.size(), 1);
+}
+
+TEST(transform, peephole_short_forms) {
+  cafe::code code;
+  code.add_insn(cafe::op::iload_0);
+  code.add_push_insn(cafe::value{int32_t(3)});
+  code.add_insn(cafe::op::iadd);
+  code.add_insn(cafe::op::istore_0);
+  code.add_insn(cafe::op::iload_0);
+  code.add_insn(cafe::op::istore_1);
+  code.add_insn(cafe::op::iload_1);
+  code.add_push_insn(cafe::value{int32_t(7)});
+  code.add_insn(cafe::op::istore_2);
+  code.add_insn(cafe::op::ireturn);
+  code.max_locals = 3;
+  code.max_stack = 2;
+  cafe::method method(cafe::access_flag::acc_static, "f", "(I)I", std::move(code));
+
+  // The short forms are matched like their long forms by the locals rules.
+  ASSERT_TRUE(cafe::peephole(method));
+  const std::vector<cafe::instruction> expected{cafe::iinc_insn(0, 3), cafe::insn(cafe::op::iload_0),
+                                                cafe::insn(cafe::op::ireturn)};
+  EXPECT_EQ(std::vector<cafe::instruction>(method.body.begin(), method.body.end()), expected);
+}
+
+TEST(transform, peephole_class_files) {
+  cafe::class_tree tree(cafe::load_rt);
+  size_t before = 0;
+  size_t after = 0;
+  const auto names = {"ForLoopTest", "ForLoopTestLong", "FinallyTest", "FinallyTest2", "SwitchTest",
+                      "CalculationTest", "BranchTest", "TcbTest", "TernaryTest"};
+  for_each_method(names, [&](const char* name, const cafe::class_file& file, cafe::method& method) {
+    // Round trips through the SSA form leave plenty to clean up.
+    const auto ssa_res = cafe::lift_ssa(method);
+    ASSERT_TRUE(ssa_res) << ssa_res.err().message();
+    cafe::emit_ssa(ssa_res.value(), method);
+    const auto max_stack = method.body.max_stack;
+    before += method.body.size();
+    cafe::peephole(method);
+    after += method.body.size();
+    EXPECT_FALSE(cafe::peephole(method)) << name << " " << method.name_desc();
+    EXPECT_TRUE(reads_defined(method)) << name << " " << method.name_desc();
+
+    cafe::basic_block_graph graph(method.body);
+    const auto frames =
+        graph.compute_frames(tree, file.name, cafe::basic_block_graph::get_start_locals(file.name, method));
+    EXPECT_LE(frames.max_stack(), max_stack) << name << " " << method.name_desc();
+    EXPECT_TRUE(cafe::lift_ssa(method)) << name << " " << method.name_desc();
+  });
+  EXPECT_LT(after, before);
+}
+
+TEST(transform, remove_unreachable) {
+  cafe::code code;
+  cafe::label dead;
+  cafe::label end;
+  cafe::label live;
+  cafe::label handler;
+  code.add_push_insn(cafe::value{int32_t(1)});
+  code.add_var_insn(cafe::op::istore, 0);
+  code.add_branch_insn(cafe::op::goto_, live);
+  code.add_label(dead);
+  code.add_push_insn(cafe::value{int32_t(2)});
+  code.add_var_insn(cafe::op::istore, 0);
+  code.add_label(end);
+  code.add_label(live);
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_insn(cafe::op::ireturn);
+  code.add_label(handler);
+  code.add_insn(cafe::op::pop);
+  code.add_push_insn(cafe::value{int32_t(0)});
+  code.add_insn(cafe::op::ireturn);
+  code.tcbs.emplace_back(dead, end, handler, std::nullopt);
+  code.locals.emplace_back("x", "I", "", dead, end, 0);
+  code.line_numbers.emplace_back(5, dead);
+  code.line_numbers.emplace_back(6, live);
+  code.max_locals = 1;
+  cafe::method method(cafe::access_flag::acc_static, "f", "()I", std::move(code));
+
+  // Only the handler protects the dead stores, so it goes with them.
+  ASSERT_TRUE(cafe::remove_unreachable(method));
+  EXPECT_EQ(method.body.size(), 9);
+  EXPECT_TRUE(method.body.tcbs.empty());
+  EXPECT_TRUE(method.body.locals.empty());
+  ASSERT_EQ(method.body.line_numbers.size(), 1);
+  EXPECT_EQ(method.body.line_numbers.front().first, 6);
+  EXPECT_FALSE(cafe::remove_unreachable(method));
+}
+
+TEST(transform, remove_unreachable_class_files) {
+  cafe::class_tree tree(cafe::load_rt);
+  size_t before = 0;
+  size_t after = 0;
+  const auto names = {"GraxCrackMe", "FinallyTest", "FinallyTest2", "SwitchTest", "TcbTest", "BranchTest"};
+  for_each_method(names, [&](const char* name, const cafe::class_file& file, cafe::method& method) {
+    const auto original = reads_of(method);
+    before += method.body.size();
+    cafe::remove_unreachable(method);
+    after += method.body.size();
+    EXPECT_FALSE(cafe::remove_unreachable(method)) << name << " " << method.name_desc();
+    // Only code that never runs is removed, so the reads that are left see the same writes.
+    EXPECT_EQ(reads_of(method), original) << name << " " << method.name_desc();
+
+    cafe::basic_block_graph graph(method.body);
+    const auto frames =
+        graph.compute_frames(tree, file.name, cafe::basic_block_graph::get_start_locals(file.name, method));
+    EXPECT_LE(frames.max_stack(), method.body.max_stack) << name << " " << method.name_desc();
+    EXPECT_TRUE(cafe::lift_ssa(method)) << name << " " << method.name_desc();
+  });
+  // The obfuscated crack me is full of code that cannot run.
+  EXPECT_LT(after, before);
+}
+
+TEST(transform, optimize_branches) {
+  cafe::code code;
+  cafe::label skip;
+  cafe::label hop;
+  cafe::label other;
+  cafe::label target;
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_branch_insn(cafe::op::ifeq, skip);
+  code.add_branch_insn(cafe::op::goto_w, hop);
+  code.add_label(skip);
+  code.add_push_insn(cafe::value{int32_t(1)});
+  code.add_insn(cafe::op::ireturn);
+  code.add_label(hop);
+  code.add_branch_insn(cafe::op::goto_, target);
+  code.add_label(other);
+  code.add_push_insn(cafe::value{int32_t(2)});
+  code.add_insn(cafe::op::ireturn);
+  code.add_label(target);
+  code.add_push_insn(cafe::value{int32_t(0)});
+  code.add_insn(cafe::op::ireturn);
+  code.line_numbers.emplace_back(5, hop);
+  code.line_numbers.emplace_back(6, other);
+  code.line_numbers.emplace_back(7, target);
+  code.max_locals = 1;
+  code.max_stack = 1;
+  cafe::method method(cafe::access_flag::acc_static, "f", "(I)I", std::move(code));
+
+  // The conditional branch over the goto becomes ifne straight to the target, which moves in place of the other goto.
+  ASSERT_TRUE(cafe::optimize_branches(method));
+  std::vector<cafe::instruction> insns;
+  for (const auto& in : method.body) {
+    if (!std::holds_alternative<cafe::label>(in)) {
+      insns.emplace_back(in);
+    }
+  }
+  ASSERT_EQ(insns.size(), 8);
+  ASSERT_TRUE(std::holds_alternative<cafe::branch_insn>(insns[1]));
+  EXPECT_EQ(std::get<cafe::branch_insn>(insns[1]).opcode, cafe::op::ifne);
+  EXPECT_EQ(std::get<cafe::branch_insn>(insns[1]).target, target);
+  EXPECT_EQ(insns[4], cafe::instruction(cafe::push_insn(int32_t(0))));
+  EXPECT_EQ(insns[5], cafe::instruction(cafe::insn(cafe::op::ireturn)));
+  std::set<uint16_t> lines;
+  for (const auto& [line, lbl] : method.body.line_numbers) {
+    lines.emplace(line);
+  }
+  EXPECT_EQ(lines, (std::set<uint16_t>{6, 7}));
+  EXPECT_FALSE(cafe::optimize_branches(method));
+}
+
+TEST(transform, optimize_branches_tcb_labels) {
+  cafe::code code;
+  cafe::label other;
+  cafe::label body;
+  cafe::label start;
+  cafe::label end;
+  cafe::label join;
+  cafe::label handler;
+  code.add_branch_insn(cafe::op::goto_, body);
+  code.add_label(other);
+  code.add_push_insn(cafe::value{int32_t(2)});
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_branch_insn(cafe::op::goto_, join);
+  code.add_label(body);
+  code.add_label(start);
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_var_insn(cafe::op::istore, 1);
+  code.add_label(end);
+  code.add_label(join);
+  code.add_var_insn(cafe::op::iload, 1);
+  code.add_insn(cafe::op::ireturn);
+  code.add_label(handler);
+  code.add_insn(cafe::op::pop);
+  code.add_push_insn(cafe::value{int32_t(0)});
+  code.add_insn(cafe::op::ireturn);
+  code.tcbs.emplace_back(start, end, handler, std::nullopt);
+  code.max_locals = 2;
+  code.max_stack = 1;
+  cafe::method method(cafe::access_flag::acc_static, "f", "(I)I", std::move(code));
+
+  // The body moves up in place of the goto. The range keeps ending before the join, which the other block jumps to.
+  ASSERT_TRUE(cafe::optimize_branches(method));
+  ASSERT_EQ(method.body.tcbs.size(), 1);
+  EXPECT_EQ(method.body.tcbs.front().start, start);
+  EXPECT_EQ(method.body.tcbs.front().end, end);
+}
+
+// The value pushed where control ends up from the instruction, following gotos and skipping labels and nops.
+static std::optional<cafe::value> pushed_from(const cafe::code& code, cafe::code::const_iterator it) {
+  for (size_t steps = 0; it != code.end() && steps < code.size(); steps++) {
+    if (const auto push = std::get_if<cafe::push_insn>(&*it)) {
+      return push->operand;
+    }
+    if (const auto branch = std::get_if<cafe::branch_insn>(&*it);
+        branch != nullptr && (branch->opcode == cafe::op::goto_ || branch->opcode == cafe::op::goto_w)) {
+      it = std::find(code.begin(), code.end(), cafe::instruction(branch->target));
+      continue;
+    }
+    if (!std::holds_alternative<cafe::label>(*it) && *it != cafe::instruction(cafe::insn(cafe::op::nop))) {
+      return std::nullopt;
+    }
+    ++it;
+  }
+  return std::nullopt;
+}
+
+TEST(transform, optimize_branches_large) {
+  cafe::code code;
+  cafe::label hop;
+  cafe::label skip;
+  cafe::label target;
+  cafe::label far;
+  code.add_var_insn(cafe::op::iload, 0);
+  code.add_branch_insn(cafe::op::ifeq, hop);
+  code.add_branch_insn(cafe::op::goto_, skip);
+  code.add_label(hop);
+  code.add_branch_insn(cafe::op::goto_, target);
+  code.add_label(skip);
+  // These gotos are out of reach and get widened by the class writer, which puts the target 4000 bytes further away
+  // than it seems from their short form, beyond what the conditional branch can reach.
+  for (auto i = 0; i < 2000; i++) {
+    code.add_branch_insn(cafe::op::goto_, far);
+  }
+  for (auto i = 0; i < 26000; i++) {
+    code.add_insn(cafe::op::nop);
+  }
+  code.add_label(target);
+  code.add_push_insn(cafe::value{int32_t(0)});
+  code.add_insn(cafe::op::ireturn);
+  for (auto i = 0; i < 10000; i++) {
+    code.add_insn(cafe::op::nop);
+  }
+  code.add_label(far);
+  code.add_push_insn(cafe::value{int32_t(1)});
+  code.add_insn(cafe::op::ireturn);
+  code.max_locals = 1;
+  code.max_stack = 1;
+  cafe::class_file file("test/Large", "java/lang/Object");
+  file.methods.emplace_back(cafe::access_flag::acc_static, "f", "(I)I", std::move(code));
+
+  cafe::optimize_branches(file.methods[0]);
+  cafe::class_writer writer(cafe::compute_maxes);
+  const auto data = writer.write(file);
+  cafe::class_reader reader;
+  const auto res = reader.read(data);
+  ASSERT_TRUE(res) << res.err().message();
+  const auto& body = res.value().methods[0].body;
+  const auto branch = std::find_if(body.begin(), body.end(), [](const cafe::instruction& in) {
+    return std::holds_alternative<cafe::branch_insn>(in);
+  });
+  ASSERT_NE(branch, body.end());
+  const auto& condition = std::get<cafe::branch_insn>(*branch);
+  ASSERT_TRUE(condition.opcode == cafe::op::ifeq || condition.opcode == cafe::op::ifne);
+  const auto taken = pushed_from(body, std::find(body.begin(), body.end(), cafe::instruction(condition.target)));
+  const auto fall_through = pushed_from(body, std::next(branch));
+  const auto zero = condition.opcode == cafe::op::ifeq ? taken : fall_through;
+  const auto one = condition.opcode == cafe::op::ifeq ? fall_through : taken;
+  EXPECT_EQ(zero, cafe::value{int32_t(0)});
+  EXPECT_EQ(one, cafe::value{int32_t(1)});
+}
+
+TEST(transform, optimize_branches_class_files) {
+  cafe::class_tree tree(cafe::load_rt);
+  size_t before = 0;
+  size_t after = 0;
+  for (const auto* name : {"ForLoopTest", "ForLoopTestLong", "NestedForLoopTest", "FinallyTest", "FinallyTest2",
+                           "SwitchTest", "TcbTest", "BranchTest", "TernaryTest", "GraxCrackMe"}) {
+    auto file_res = read_class(name);
+    ASSERT_TRUE(file_res) << file_res.err().message();
+    auto& file = file_res.value();
+    for (auto& method : file.methods) {
+      if (method.body.empty()) {
+        continue;
+      }
+      // Round trips through the SSA form leave plenty of jumps to gotos behind.
+      const auto ssa_res = cafe::lift_ssa(method);
+      ASSERT_TRUE(ssa_res) << ssa_res.err().message();
+      cafe::emit_ssa(ssa_res.value(), method);
+      const auto count = [&method] {
+        return std::count_if(method.body.begin(), method.body.end(), [](const cafe::instruction& in) {
+          return std::holds_alternative<cafe::branch_insn>(in);
+        });
+      };
+      // Branches are only retargeted, so every read keeps the writes it saw.
+      const auto original = reads_of(method);
+      before += count();
+      cafe::optimize_branches(method);
+      cafe::remove_unreachable(method);
+      after += count();
+      EXPECT_EQ(reads_of(method), original) << name << " " << method.name_desc();
+
+      cafe::basic_block_graph graph(method.body);
+      const auto frames =
+          graph.compute_frames(tree, file.name, cafe::basic_block_graph::get_start_locals(file.name, method));
+      EXPECT_LE(frames.max_stack(), method.body.max_stack) << name << " " << method.name_desc();
+      EXPECT_TRUE(cafe::lift_ssa(method)) << name << " " << method.name_desc();
+    }
+    cafe::class_writer writer(tree);
+    const auto data = writer.write(file);
+    cafe::class_reader rereader;
+    EXPECT_TRUE(rereader.read(data)) << name;
+  }
+  EXPECT_LT(after, before);
+}